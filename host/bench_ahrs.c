@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "imu_ahrs.h"
+
+/*
+ * Updates per second of imu_ahrs on the host CPU, measured on the wall clock since the simulator
+ * does not charge for computation. make builds it for the float and the fixed-point filter; the
+ * ratio of the two rows is what carries over to a target, the absolute numbers do not.
+ * Fused: every gyroscope update corrects with the accelerometer and the magnetometer.
+ * Gyro only: integration without a reference, as before the first acc sample.
+ *   bench_ahrs
+ */
+
+#define BENCH_UPDATES      2000000u
+#define BENCH_DT_US        1316            // 760 Hz
+#define BENCH_DPS_LSB      0.00875f
+
+#ifdef IMU_AHRS_FIXED
+#define BENCH_NAME         "fixed"
+#else
+#define BENCH_NAME         "float"
+#endif
+
+/* private functions */
+static uint64_t bench_now_ns(void);
+static void bench_run(const char *name, bool fused);
+
+int main(void) {
+    printf("imu_ahrs, %s\n", BENCH_NAME);
+    printf("%-24s %10s %10s %10s\n", "", "updates/s", "ns/update", "w");
+
+    bench_run("fused", true);
+    bench_run("gyro only", false);
+
+    return 0;
+}
+
+/* private functions */
+static uint64_t bench_now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/* a slow turn on all axes, the printed w keeps the result alive */
+static void bench_run(const char *name, bool fused) {
+    const lsm303dlhc_data_raw_t acc = { 120, -80, 990 };
+    const lsm303dlhc_data_raw_t mag = { 240, 15, -410 };
+    l3gd20_data_t gyro;
+    imu_ahrs_t ahrs;
+    imu_ahrs_quat_t q;
+    uint64_t start, ns;
+    uint32_t i;
+
+    imu_ahrs_init(&ahrs, BENCH_DPS_LSB, 1100.0f / 980.0f);
+
+    if (fused) {
+        imu_ahrs_update_acc(&ahrs, &acc);
+        imu_ahrs_update_mag(&ahrs, &mag);
+    }
+
+    start = bench_now_ns();
+
+    for (i = 0; i < BENCH_UPDATES; i++) {
+        gyro.x = (int16_t) ((i & 0x3FF) - 0x200);
+        gyro.y = 300;
+        gyro.z = (int16_t) (-(int32_t) (i & 0x1FF));
+        imu_ahrs_update_gyro(&ahrs, &gyro, BENCH_DT_US);
+    }
+
+    ns = bench_now_ns() - start;
+    imu_ahrs_get_quat(&ahrs, &q);
+
+    printf("%-24s %10.0f %10.1f %10.4f\n", name, BENCH_UPDATES * 1e9 / (double) ns, (double) ns / BENCH_UPDATES, q.w);
+}
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "board.h"
+#include "stm32f3xx_l3gd20.h"
+
+/*
+ * Cost of one gyroscope sample on the SPI bus of the simulator: l3gd20_read_raw fetches
+ * STATUS_REG and OUT_X_L..OUT_Z_H in one auto-increment burst, the single-byte variant reads
+ * the same seven registers in a transaction each, as the driver did before. One read per sample
+ * at 760 Hz; both have to return the same samples.
+ *   bench_burst [spi_hz]
+ */
+
+#define BENCH_SAMPLES      200
+
+typedef enum {
+    BENCH_BURST, BENCH_SINGLE
+} bench_mode_t;
+
+/* private variables */
+static const char *const bench_names[] = { "burst", "single-byte" };
+
+/* private functions */
+static bool bench_read_reg(uint8_t reg, uint8_t *value);
+static bool bench_read_single(l3gd20_data_t *data);
+static bool bench_read(bench_mode_t mode, l3gd20_data_t *data);
+static void bench_run(bench_mode_t mode, uint32_t spi_hz, l3gd20_data_t samples[BENCH_SAMPLES]);
+
+int main(int argc, char **argv) {
+    static l3gd20_data_t burst[BENCH_SAMPLES], single[BENCH_SAMPLES];
+    uint32_t spi_hz = (argc > 1) ? (uint32_t) strtoul(argv[1], NULL, 0) : BOARD_SPI_HZ;
+    uint32_t i, differ = 0;
+
+    if (spi_hz == 0) {
+        fprintf(stderr, "usage: %s [spi_hz]\n", argv[0]);
+        return 2;
+    }
+
+    printf("SPI %lu Hz, per sample\n", (unsigned long) spi_hz);
+    printf("%-24s %10s %10s %10s %10s %10s\n", "", "transact.", "bytes", "cs edges", "bus us", "max Hz");
+
+    bench_run(BENCH_BURST, spi_hz, burst);
+    bench_run(BENCH_SINGLE, spi_hz, single);
+
+    for (i = 0; i < BENCH_SAMPLES; i++) {
+        differ += burst[i].x != single[i].x || burst[i].y != single[i].y || burst[i].z != single[i].z;
+    }
+
+    if (differ > 0) {
+        printf("%lu of %u samples differ\n", (unsigned long) differ, BENCH_SAMPLES);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* private functions */
+
+/* one register, one chip select cycle */
+static bool bench_read_reg(uint8_t reg, uint8_t *value) {
+    uint8_t address = reg | L3GD20_SPI_READ;
+    bool ok;
+
+    L3GD20_CS_LOW;
+    ok = HAL_SPI_Transmit(&board_spi, &address, 1, L3GD20_SPI_TIMEOUT) == HAL_OK
+         && HAL_SPI_Receive(&board_spi, value, 1, L3GD20_SPI_TIMEOUT) == HAL_OK;
+    L3GD20_CS_HIGH;
+
+    return ok;
+}
+
+/* STATUS_REG, then low and high byte of every axis */
+static bool bench_read_single(l3gd20_data_t *data) {
+    uint8_t status, out[6];
+    uint8_t i;
+
+    if (!bench_read_reg(L3GD20_REG_STATUS_REG, &status)) {
+        return false;
+    }
+
+    for (i = 0; i < 6; i++) {
+        if (!bench_read_reg(L3GD20_REG_OUT_X_L + i, &out[i])) {
+            return false;
+        }
+    }
+
+    data->x = (int16_t) (out[1] << 8 | out[0]);
+    data->y = (int16_t) (out[3] << 8 | out[2]);
+    data->z = (int16_t) (out[5] << 8 | out[4]);
+
+    return (status & L3GD20_SR_ZYXDA) != 0;
+}
+
+static bool bench_read(bench_mode_t mode, l3gd20_data_t *data) {
+    if (mode == BENCH_BURST) {
+        return l3gd20_read_raw(data) == L3GD20_OK;
+    }
+
+    return bench_read_single(data);
+}
+
+static void bench_run(bench_mode_t mode, uint32_t spi_hz, l3gd20_data_t samples[BENCH_SAMPLES]) {
+    hal_sim_bus_stats_t stats;
+    uint32_t missed = 0, i;
+
+    board_init(spi_hz, BOARD_I2C_HZ);
+    l3gd20_emu_set_rate(&board_gyro, 10.0f, -20.0f, 30.0f);
+    l3gd20_init(&board_spi, L3GD20_SCALE_250);
+    l3gd20_set_odr(L3GD20_CR1_DR_760 | L3GD20_CR1_BW);
+
+    hal_sim_run_until(board_gyro.next_ns);
+    hal_sim_clear_stats();
+
+    for (i = 0; i < BENCH_SAMPLES; i++) {
+        if (!bench_read(mode, &samples[i])) {
+            missed++;
+        }
+        hal_sim_run_until(board_gyro.next_ns);
+    }
+
+    hal_sim_spi_stats(&board_spi, &stats);
+
+    printf("%-24s %10.1f %10.1f %10.1f %10.2f %10.0f%s\n", bench_names[mode],
+           (double) stats.transactions / BENCH_SAMPLES,
+           (double) stats.bytes / BENCH_SAMPLES,
+           (double) stats.cs_toggles / BENCH_SAMPLES,
+           (double) stats.busy_ns / 1000.0 / BENCH_SAMPLES,
+           1e9 * BENCH_SAMPLES / (double) stats.busy_ns,
+           (missed > 0) ? "  (samples missed)" : "");
+}
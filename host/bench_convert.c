@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#include "board.h"
+#include "stm32f3xx_lsm303dlhc.h"
+
+/*
+ * Conversion cost per sample on the host CPU, on the wall clock: the per-sample functions called
+ * in a loop against the batch (AoS) and SoA converters, over blocks of 32 samples as drained from
+ * the accelerometer FIFO. The batch results have to match the per-sample ones. A soft-iron matrix
+ * with cross terms takes the per-sample path in every variant, it is listed for comparison.
+ *   bench_convert
+ */
+
+#define BENCH_BLOCK        32
+#define BENCH_BLOCKS       200000u
+
+typedef enum {
+    BENCH_ACC, BENCH_MAG, BENCH_MAG_SOFT
+} bench_sensor_t;
+
+/* private variables */
+static const char *const bench_names[] = { "acc", "mag", "mag, soft iron" };
+
+static lsm303dlhc_data_raw_t bench_raw[BENCH_BLOCK];
+static lsm303dlhc_data_t bench_conv[BENCH_BLOCK];
+static lsm303dlhc_data_t bench_ref[BENCH_BLOCK];
+static float bench_x[BENCH_BLOCK], bench_y[BENCH_BLOCK], bench_z[BENCH_BLOCK];
+
+/* private functions */
+static uint64_t bench_now_ns(void);
+static void bench_setup(bench_sensor_t sensor);
+static void bench_scalar(bench_sensor_t sensor, lsm303dlhc_data_t conv[]);
+static void bench_batch(bench_sensor_t sensor);
+static void bench_soa(bench_sensor_t sensor);
+static float bench_differ(void);
+static void bench_run(bench_sensor_t sensor);
+
+int main(void) {
+    uint8_t i;
+
+    /* a spread of values, negative ones included */
+    for (i = 0; i < BENCH_BLOCK; i++) {
+        bench_raw[i] = (lsm303dlhc_data_raw_t) { (int16_t) (i * 61 - 900), (int16_t) (700 - i * 37), (int16_t) (i * i - 400) };
+    }
+
+    printf("%-24s %10s %10s %10s %10s\n", "ns/sample", "scalar", "batch", "soa", "max diff");
+
+    bench_run(BENCH_ACC);
+    bench_run(BENCH_MAG);
+    bench_run(BENCH_MAG_SOFT);
+
+    return 0;
+}
+
+/* private functions */
+static uint64_t bench_now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/* a calibrated device, so the conversions carry an offset */
+static void bench_setup(bench_sensor_t sensor) {
+    const lsm303dlhc_acc_init_t acc = {
+        .ctrl_reg1_a = LSM303DLHC_ACR1A_ODR30_100_HZ | LSM303DLHC_ACR1A_XEN | LSM303DLHC_ACR1A_YEN | LSM303DLHC_ACR1A_ZEN,
+        .ctrl_reg4_a = LSM303DLHC_ACR4A_HR,
+        .fifo_mode = LSM303DLHC_ACCFIFO_BYPASS
+    };
+    const lsm303dlhc_mag_init_t mag = {
+        .op = LSM303DLHC_MAGOP_CONT,
+        .rate = LSM303DLHC_MAGRATE_75,
+        .gain = LSM303DLHC_MAGGAIN_1_3,
+        .auto_range = false
+    };
+    const float acc_offset[3] = { 0.3f, -0.2f, 0.45f };
+    const float acc_scale[3] = { 1.03f, 0.97f, 1.05f };
+    const float mag_offset[3] = { 35.0f, -20.0f, 60.0f };
+    const float diagonal[3][3] = { { 1.1f, 0.0f, 0.0f }, { 0.0f, 0.92f, 0.0f }, { 0.0f, 0.0f, 1.0f } };
+    const float soft[3][3] = { { 1.1f, 0.05f, -0.03f }, { 0.05f, 0.92f, 0.04f }, { -0.03f, 0.04f, 1.0f } };
+
+    board_init(0, 0);
+    lsm303dlhc_init_acc(&board_i2c, &acc);
+    lsm303dlhc_init_mag(&board_i2c, &mag);
+
+    lsm303dlhc_set_acc_calib(acc_offset, acc_scale);
+    lsm303dlhc_set_mag_calib(mag_offset, (sensor == BENCH_MAG_SOFT) ? soft : diagonal);
+}
+
+static void bench_scalar(bench_sensor_t sensor, lsm303dlhc_data_t conv[]) {
+    lsm303dlhc_t *dev = lsm303dlhc_get_default();
+    uint8_t i;
+
+    for (i = 0; i < BENCH_BLOCK; i++) {
+        if (sensor == BENCH_ACC) {
+            lsm303dlhc_dev_convert_acc(dev, &conv[i], &bench_raw[i]);
+        } else {
+            lsm303dlhc_dev_convert_mag(dev, &conv[i], &bench_raw[i]);
+        }
+    }
+}
+
+static void bench_batch(bench_sensor_t sensor) {
+    if (sensor == BENCH_ACC) {
+        lsm303dlhc_dev_convert_acc_batch(lsm303dlhc_get_default(), bench_conv, bench_raw, BENCH_BLOCK);
+    } else {
+        lsm303dlhc_dev_convert_mag_batch(lsm303dlhc_get_default(), bench_conv, bench_raw, BENCH_BLOCK);
+    }
+}
+
+static void bench_soa(bench_sensor_t sensor) {
+    if (sensor == BENCH_ACC) {
+        lsm303dlhc_dev_convert_acc_soa(lsm303dlhc_get_default(), bench_x, bench_y, bench_z, bench_raw, BENCH_BLOCK);
+    } else {
+        lsm303dlhc_dev_convert_mag_soa(lsm303dlhc_get_default(), bench_x, bench_y, bench_z, bench_raw, BENCH_BLOCK);
+    }
+}
+
+/* largest difference of the batch and SoA results to the per-sample ones */
+static float bench_differ(void) {
+    float d = 0.0f;
+    uint8_t i;
+
+    for (i = 0; i < BENCH_BLOCK; i++) {
+        d = fmaxf(d, fabsf(bench_conv[i].x - bench_ref[i].x));
+        d = fmaxf(d, fabsf(bench_conv[i].y - bench_ref[i].y));
+        d = fmaxf(d, fabsf(bench_conv[i].z - bench_ref[i].z));
+        d = fmaxf(d, fabsf(bench_x[i] - bench_ref[i].x));
+        d = fmaxf(d, fabsf(bench_y[i] - bench_ref[i].y));
+        d = fmaxf(d, fabsf(bench_z[i] - bench_ref[i].z));
+    }
+
+    return d;
+}
+
+static void bench_run(bench_sensor_t sensor) {
+    const double samples = (double) BENCH_BLOCKS * BENCH_BLOCK;
+    uint64_t start, scalar, batch, soa;
+    uint32_t i;
+
+    bench_setup(sensor);
+    bench_scalar(sensor, bench_ref);
+
+    start = bench_now_ns();
+    for (i = 0; i < BENCH_BLOCKS; i++) {
+        bench_scalar(sensor, bench_conv);
+    }
+    scalar = bench_now_ns() - start;
+
+    start = bench_now_ns();
+    for (i = 0; i < BENCH_BLOCKS; i++) {
+        bench_batch(sensor);
+    }
+    batch = bench_now_ns() - start;
+
+    start = bench_now_ns();
+    for (i = 0; i < BENCH_BLOCKS; i++) {
+        bench_soa(sensor);
+    }
+    soa = bench_now_ns() - start;
+
+    printf("%-24s %10.2f %10.2f %10.2f %10.2g\n", bench_names[sensor],
+           (double) scalar / samples, (double) batch / samples, (double) soa / samples, (double) bench_differ());
+}
@@ -0,0 +1,222 @@
+#include <cstdio>
+#include <cstring>
+
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+#include "board.h"
+#include "stm32f3xx_l3gd20.hpp"
+#include "stm32f3xx_lsm303dlhc.hpp"
+
+/*
+ * Instructions executed by the C++ front-end against the C API for the same work, on the host
+ * CPU. Each path runs in a forked child that is single-stepped with ptrace from one SIGSTOP to
+ * the next, so the count is exact without performance counters; the cost of the markers is
+ * measured on an empty path and subtracted. The reads run on the simulator, whose bus emulation
+ * is counted in both columns alike, so their difference is the cost of the front-end. The C++
+ * conversions have to give the C results bit for bit.
+ *   bench_cpp
+ */
+
+struct BenchSpi {
+    static SPI_HandleTypeDef *handle() { return &board_spi; }
+};
+
+struct BenchCs {
+    static GPIO_TypeDef *port() { return L3GD20_CS_PORT; }
+    static constexpr uint16_t pin = L3GD20_CS_PIN;
+};
+
+struct BenchI2c {
+    static I2C_HandleTypeDef *handle() { return &board_i2c; }
+};
+
+using BenchGyro = L3gd20<BenchSpi, BenchCs, L3GD20_SCALE_500>;
+using BenchAcc = Lsm303dlhcAcc<BenchI2c, Lsm303dlhcAccConfig<LSM303DLHC_ACR1A_ODR30_400_HZ, LSM303DLHC_ACR4A_FS10_2MG>>;
+
+typedef void (*bench_fn_t)(void);
+
+/* private variables */
+static l3gd20_t bench_gyro;
+static lsm303dlhc_t bench_acc;
+static l3gd20_data_t bench_gyro_raw = { 1234, -567, 89 };
+static lsm303dlhc_data_raw_t bench_acc_raw = { -321, 45, 1002 };
+static l3gd20_data_dps_t bench_dps;
+static lsm303dlhc_data_t bench_ms2;
+
+/* private functions */
+static long bench_count(bench_fn_t setup, bench_fn_t path);
+static void bench_setup(void);
+static void bench_nothing(void);
+static void bench_c_dps(void);
+static void bench_cpp_dps(void);
+static void bench_c_ms2(void);
+static void bench_cpp_ms2(void);
+static void bench_c_read_dps(void);
+static void bench_cpp_read_dps(void);
+static void bench_c_read_ms2(void);
+static void bench_cpp_read_ms2(void);
+static bool bench_same(void);
+static void bench_row(const char *name, bench_fn_t setup, bench_fn_t c, bench_fn_t cpp, long markers);
+
+int main(void) {
+    long markers = bench_count(bench_nothing, bench_nothing);
+
+    if (markers < 0) {
+        std::fprintf(stderr, "ptrace single-stepping is not available\n");
+        return 2;
+    }
+
+    std::printf("%-24s %10s %10s %10s\n", "instructions", "C", "C++", "C++ - C");
+
+    bench_row("convert dps", bench_setup, bench_c_dps, bench_cpp_dps, markers);
+    bench_row("convert m/s^2", bench_setup, bench_c_ms2, bench_cpp_ms2, markers);
+    bench_row("read + convert dps", bench_setup, bench_c_read_dps, bench_cpp_read_dps, markers);
+    bench_row("read + convert m/s^2", bench_setup, bench_c_read_ms2, bench_cpp_read_ms2, markers);
+
+    if (!bench_same()) {
+        std::printf("the C++ conversions differ from the C ones\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+/* private functions */
+
+/* instructions of path, counted in a child stopped before and after it; -1 without ptrace */
+static long bench_count(bench_fn_t setup, bench_fn_t path) {
+    long count = 0;
+    int status;
+    pid_t pid;
+
+    std::fflush(stdout);
+    pid = fork();
+
+    if (pid == 0) {
+        setup();
+        ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+        raise(SIGSTOP);
+        path();
+        raise(SIGSTOP);
+        _exit(0);
+    }
+
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFSTOPPED(status)) {
+        return -1;
+    }
+
+    for (;;) {
+        if (ptrace(PTRACE_SINGLESTEP, pid, nullptr, nullptr) != 0) {
+            count = -1;
+            break;
+        }
+
+        if (waitpid(pid, &status, 0) != pid || !WIFSTOPPED(status) || WSTOPSIG(status) == SIGSTOP) {
+            break;
+        }
+
+        count++;
+    }
+
+    kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+
+    return count;
+}
+
+/* both front-ends on the same sensors, a new sample waiting in each */
+static void bench_setup(void) {
+    const lsm303dlhc_acc_init_t acc = {
+        BenchAcc::ctrl_reg1_a, 0, 0, BenchAcc::ctrl_reg4_a, 0, 0, LSM303DLHC_ACCFIFO_BYPASS, 0
+    };
+
+    board_init(0, 0);
+    l3gd20_emu_set_rate(&board_gyro, 10.0f, -20.0f, 30.0f);
+    lsm303dlhc_emu_set_acc(&board_lsm, 100.0f, -50.0f, 1000.0f);
+
+    l3gd20_dev_init(&bench_gyro, &board_spi, L3GD20_CS_PORT, L3GD20_CS_PIN, L3GD20_SCALE_500);
+    BenchGyro::init();
+    lsm303dlhc_dev_init_acc(&bench_acc, &board_i2c, &acc);
+    BenchAcc::init();
+
+    hal_sim_run_until(board_gyro.next_ns > board_lsm.acc.next_ns ? board_gyro.next_ns : board_lsm.acc.next_ns);
+}
+
+__attribute__((noinline)) static void bench_nothing(void) {
+    asm volatile("");
+}
+
+__attribute__((noinline)) static void bench_c_dps(void) {
+    l3gd20_dev_convert_dps(&bench_gyro, &bench_dps, &bench_gyro_raw);
+}
+
+__attribute__((noinline)) static void bench_cpp_dps(void) {
+    bench_dps = BenchGyro::to_dps(bench_gyro_raw);
+}
+
+__attribute__((noinline)) static void bench_c_ms2(void) {
+    lsm303dlhc_dev_convert_acc(&bench_acc, &bench_ms2, &bench_acc_raw);
+}
+
+__attribute__((noinline)) static void bench_cpp_ms2(void) {
+    bench_ms2 = BenchAcc::to_ms2(bench_acc_raw);
+}
+
+__attribute__((noinline)) static void bench_c_read_dps(void) {
+    if (l3gd20_dev_read_raw(&bench_gyro, &bench_gyro_raw) == L3GD20_OK) {
+        l3gd20_dev_convert_dps(&bench_gyro, &bench_dps, &bench_gyro_raw);
+    }
+}
+
+__attribute__((noinline)) static void bench_cpp_read_dps(void) {
+    if (BenchGyro::read_raw(bench_gyro_raw) == L3GD20_OK) {
+        bench_dps = BenchGyro::to_dps(bench_gyro_raw);
+    }
+}
+
+__attribute__((noinline)) static void bench_c_read_ms2(void) {
+    if (lsm303dlhc_dev_read_acc_raw(&bench_acc, &bench_acc_raw) == LSM303DLHC_OK) {
+        lsm303dlhc_dev_convert_acc(&bench_acc, &bench_ms2, &bench_acc_raw);
+    }
+}
+
+__attribute__((noinline)) static void bench_cpp_read_ms2(void) {
+    if (BenchAcc::read_raw(bench_acc_raw) == LSM303DLHC_OK) {
+        bench_ms2 = BenchAcc::to_ms2(bench_acc_raw);
+    }
+}
+
+/* nominal C++ conversions against the uncalibrated C devices, over the whole input range */
+static bool bench_same(void) {
+    l3gd20_data_dps_t dps;
+    lsm303dlhc_data_t ms2;
+    int32_t v;
+
+    bench_setup();
+
+    for (v = -32768; v <= 32767; v += 7) {
+        bench_gyro_raw = { (int16_t) v, (int16_t) -v, (int16_t) (v / 3) };
+        bench_acc_raw = { (int16_t) v, (int16_t) -v, (int16_t) (v / 3) };
+
+        l3gd20_dev_convert_dps(&bench_gyro, &dps, &bench_gyro_raw);
+        bench_dps = BenchGyro::to_dps(bench_gyro_raw);
+        lsm303dlhc_dev_convert_acc(&bench_acc, &ms2, &bench_acc_raw);
+        bench_ms2 = BenchAcc::to_ms2(bench_acc_raw);
+
+        if (std::memcmp(&dps, &bench_dps, sizeof(dps)) != 0 || std::memcmp(&ms2, &bench_ms2, sizeof(ms2)) != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void bench_row(const char *name, bench_fn_t setup, bench_fn_t c, bench_fn_t cpp, long markers) {
+    long c_count = bench_count(setup, c) - markers;
+    long cpp_count = bench_count(setup, cpp) - markers;
+
+    std::printf("%-24s %10ld %10ld %+10ld\n", name, c_count, cpp_count, cpp_count - c_count);
+}
@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "board.h"
+#include "stm32f3xx_l3gd20.h"
+#include "stm32f3xx_lsm303dlhc.h"
+
+/*
+ * Bus throughput of the blocking reads on the simulator, at the fastest output data rate of each
+ * sensor. Polled: the read is called back to back for one second, every call goes to the bus.
+ * Paced: one read per sample, right after it is converted.
+ *   bench_read [spi_hz] [i2c_hz]
+ */
+
+#define BENCH_NS           1000000000ull
+#define BENCH_PACED        200             // samples
+
+typedef enum {
+    BENCH_GYRO, BENCH_ACC, BENCH_MAG
+} bench_sensor_t;
+
+/* private variables */
+static const char *const bench_names[] = { "l3gd20_read", "lsm303dlhc_read_acc_raw", "lsm303dlhc_read_mag_raw" };
+
+/* private functions */
+static void bench_setup(bench_sensor_t sensor, uint32_t spi_hz, uint32_t i2c_hz);
+static bool bench_read(bench_sensor_t sensor);
+static uint64_t bench_next_sample(bench_sensor_t sensor);
+static uint64_t bench_busy_ns(bench_sensor_t sensor);
+static void bench_run(bench_sensor_t sensor, uint32_t spi_hz, uint32_t i2c_hz);
+
+int main(int argc, char **argv) {
+    uint32_t spi_hz = (argc > 1) ? (uint32_t) strtoul(argv[1], NULL, 0) : BOARD_SPI_HZ;
+    uint32_t i2c_hz = (argc > 2) ? (uint32_t) strtoul(argv[2], NULL, 0) : BOARD_I2C_HZ;
+
+    if (spi_hz == 0 || i2c_hz == 0) {
+        fprintf(stderr, "usage: %s [spi_hz] [i2c_hz]\n", argv[0]);
+        return 2;
+    }
+
+    printf("SPI %lu Hz, I2C %lu Hz\n", (unsigned long) spi_hz, (unsigned long) i2c_hz);
+    printf("%-24s %10s %10s %10s | %10s %10s %10s\n", "", "calls/s", "samples/s", "bus %", "odr Hz", "us/read", "bus %");
+
+    bench_run(BENCH_GYRO, spi_hz, i2c_hz);
+    bench_run(BENCH_ACC, spi_hz, i2c_hz);
+    bench_run(BENCH_MAG, spi_hz, i2c_hz);
+
+    return 0;
+}
+
+/* private functions */
+static void bench_setup(bench_sensor_t sensor, uint32_t spi_hz, uint32_t i2c_hz) {
+    const lsm303dlhc_acc_init_t acc = {
+        .ctrl_reg1_a = LSM303DLHC_ACR1A_ODR30_5376_HZ | LSM303DLHC_ACR1A_XEN | LSM303DLHC_ACR1A_YEN | LSM303DLHC_ACR1A_ZEN,
+        .ctrl_reg4_a = LSM303DLHC_ACR4A_HR,
+        .fifo_mode = LSM303DLHC_ACCFIFO_BYPASS
+    };
+    const lsm303dlhc_mag_init_t mag = {
+        .op = LSM303DLHC_MAGOP_CONT,
+        .rate = LSM303DLHC_MAGRATE_220,
+        .gain = LSM303DLHC_MAGGAIN_1_3,
+        .auto_range = false
+    };
+
+    board_init(spi_hz, i2c_hz);
+    l3gd20_emu_set_rate(&board_gyro, 10.0f, -20.0f, 30.0f);
+    lsm303dlhc_emu_set_acc(&board_lsm, 0.0f, 0.0f, 1000.0f);
+    lsm303dlhc_emu_set_mag(&board_lsm, 0.2f, 0.0f, -0.4f);
+
+    switch (sensor) {
+    case BENCH_GYRO:
+        l3gd20_init(&board_spi, L3GD20_SCALE_250);
+        break;
+
+    case BENCH_ACC:
+        lsm303dlhc_init_acc(&board_i2c, &acc);
+        break;
+
+    case BENCH_MAG:
+        lsm303dlhc_init_mag(&board_i2c, &mag);
+        break;
+    }
+}
+
+/* true if the read returned a sample */
+static bool bench_read(bench_sensor_t sensor) {
+    l3gd20_data_t gyro;
+    lsm303dlhc_data_raw_t raw;
+
+    switch (sensor) {
+    case BENCH_GYRO:
+        return l3gd20_read(&gyro) == L3GD20_OK;
+
+    case BENCH_ACC:
+        return lsm303dlhc_read_acc_raw(&raw) == LSM303DLHC_OK;
+
+    case BENCH_MAG:
+        return lsm303dlhc_read_mag_raw(&raw) == LSM303DLHC_OK;
+    }
+
+    return false;
+}
+
+static uint64_t bench_next_sample(bench_sensor_t sensor) {
+    switch (sensor) {
+    case BENCH_GYRO:
+        return board_gyro.next_ns;
+
+    case BENCH_ACC:
+        return board_lsm.acc.next_ns;
+
+    case BENCH_MAG:
+        return board_lsm.mag.next_ns;
+    }
+
+    return 0;
+}
+
+static uint64_t bench_busy_ns(bench_sensor_t sensor) {
+    hal_sim_bus_stats_t stats;
+
+    if (sensor == BENCH_GYRO) {
+        hal_sim_spi_stats(&board_spi, &stats);
+    } else {
+        hal_sim_i2c_stats(&board_i2c, &stats);
+    }
+
+    return stats.busy_ns;
+}
+
+static void bench_run(bench_sensor_t sensor, uint32_t spi_hz, uint32_t i2c_hz) {
+    uint32_t calls = 0, samples = 0, i;
+    uint64_t start, end, first, period;
+
+    /* polled, the bus never idles */
+    bench_setup(sensor, spi_hz, i2c_hz);
+    hal_sim_clear_stats();
+    start = hal_sim_now_ns();
+    end = start + BENCH_NS;
+
+    while (hal_sim_now_ns() < end) {
+        calls++;
+        if (bench_read(sensor)) {
+            samples++;
+        }
+    }
+
+    printf("%-24s %10.0f %10.0f %10.1f |", bench_names[sensor],
+           (double) calls * 1e9 / (double) (hal_sim_now_ns() - start),
+           (double) samples * 1e9 / (double) (hal_sim_now_ns() - start),
+           (double) bench_busy_ns(sensor) * 100.0 / (double) (hal_sim_now_ns() - start));
+
+    /* paced, one read per sample */
+    bench_setup(sensor, spi_hz, i2c_hz);
+    hal_sim_run_until(bench_next_sample(sensor));
+    first = hal_sim_now_ns();
+    period = bench_next_sample(sensor) - first;
+    hal_sim_clear_stats();
+    samples = 0;
+
+    for (i = 0; i < BENCH_PACED; i++) {
+        if (bench_read(sensor)) {
+            samples++;
+        }
+        hal_sim_run_until(bench_next_sample(sensor));
+    }
+
+    printf(" %10.1f %10.1f %10.1f%s\n", 1e9 / (double) period,
+           (double) bench_busy_ns(sensor) / 1000.0 / BENCH_PACED,
+           (double) bench_busy_ns(sensor) * 100.0 / (double) (hal_sim_now_ns() - first),
+           (samples < BENCH_PACED) ? "  (samples missed)" : "");
+}
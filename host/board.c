@@ -0,0 +1,67 @@
+#include "board.h"
+#include "stm32f3xx_l3gd20.h"
+#include "stm32f3xx_lsm303dlhc.h"
+
+SPI_HandleTypeDef board_spi;
+I2C_HandleTypeDef board_i2c;
+l3gd20_emu_t board_gyro;
+lsm303dlhc_emu_t board_lsm;
+
+void board_init(uint32_t spi_hz, uint32_t i2c_hz) {
+    GPIO_InitTypeDef gpio = { 0 };
+
+    hal_sim_reset();
+
+    hal_sim_attach_spi(&board_spi, (spi_hz != 0) ? spi_hz : BOARD_SPI_HZ);
+    hal_sim_attach_i2c(&board_i2c, (i2c_hz != 0) ? i2c_hz : BOARD_I2C_HZ);
+    hal_sim_attach_i2c_pins(&board_i2c, GPIOB, BOARD_SCL_PIN, GPIOB, BOARD_SDA_PIN);
+
+    l3gd20_emu_init(&board_gyro);
+    l3gd20_emu_attach(&board_gyro, &board_spi, L3GD20_CS_PORT, L3GD20_CS_PIN);
+    l3gd20_emu_attach_drdy(&board_gyro, GPIOE, BOARD_GYRO_DRDY_PIN);
+
+    lsm303dlhc_emu_init(&board_lsm);
+    lsm303dlhc_emu_attach(&board_lsm, &board_i2c);
+    lsm303dlhc_emu_attach_int1(&board_lsm, GPIOE, BOARD_ACC_INT1_PIN);
+    lsm303dlhc_emu_attach_drdy(&board_lsm, GPIOE, BOARD_MAG_DRDY_PIN);
+
+    gpio.Pin = BOARD_GYRO_DRDY_PIN | BOARD_MAG_DRDY_PIN | BOARD_ACC_INT1_PIN;
+    gpio.Mode = GPIO_MODE_IT_RISING;
+    HAL_GPIO_Init(GPIOE, &gpio);
+}
+
+/* HAL callbacks */
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin) {
+    switch (GPIO_Pin) {
+    case BOARD_GYRO_DRDY_PIN:
+        l3gd20_on_drdy();
+        break;
+
+    case BOARD_MAG_DRDY_PIN:
+        lsm303dlhc_on_drdy_mag();
+        break;
+
+    case BOARD_ACC_INT1_PIN:
+        lsm303dlhc_on_drdy_acc();
+        break;
+
+    default:
+        break;
+    }
+}
+
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi) {
+    l3gd20_spi_txrx_cplt(hspi);
+}
+
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi) {
+    l3gd20_spi_error(hspi);
+}
+
+void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c) {
+    lsm303dlhc_i2c_rx_cplt(hi2c);
+}
+
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c) {
+    lsm303dlhc_i2c_error(hi2c);
+}
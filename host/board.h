@@ -0,0 +1,43 @@
+#ifndef __BOARD_H__
+#define __BOARD_H__
+
+/* C++ detection */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "hal_sim.h"
+#include "l3gd20_emu.h"
+#include "lsm303dlhc_emu.h"
+
+/*
+ * STM32F3 Discovery on the simulator
+ * SPI1 with the L3GD20 on CS PE3 and DRDY/INT2 on PE1, I2C1 on PB6/PB7 with the LSM303DLHC,
+ * its DRDY on PE2 and INT1 on PE4. The interrupt pins are set up for rising edges and the HAL
+ * callbacks are routed to the drivers, as the application of the board does it.
+ */
+
+#define BOARD_SPI_HZ    4500000     // SPI1 at 72 MHz / 16
+#define BOARD_I2C_HZ    400000
+
+#define BOARD_GYRO_DRDY_PIN    GPIO_PIN_1
+#define BOARD_MAG_DRDY_PIN     GPIO_PIN_2
+#define BOARD_ACC_INT1_PIN     GPIO_PIN_4
+#define BOARD_SCL_PIN          GPIO_PIN_6
+#define BOARD_SDA_PIN          GPIO_PIN_7
+
+extern SPI_HandleTypeDef board_spi;
+extern I2C_HandleTypeDef board_i2c;
+extern l3gd20_emu_t board_gyro;
+extern lsm303dlhc_emu_t board_lsm;
+
+void board_init(uint32_t spi_hz, uint32_t i2c_hz);    // resets the simulator, 0 for the default clocks
+
+/* C++ detection */
+#ifdef __cplusplus
+}
+#endif
+
+#endif
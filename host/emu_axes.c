@@ -0,0 +1,114 @@
+#include "emu_axes.h"
+
+void emu_axes_reset(emu_axes_t *axes) {
+    *axes = (emu_axes_t) { 0 };
+}
+
+void emu_axes_set_mode(emu_axes_t *axes, emu_axes_mode_t mode, uint8_t watermark) {
+    if (mode == EMU_AXES_BYPASS) {
+        axes->head = 0;
+        axes->level = 0;
+    }
+
+    axes->mode = mode;
+    axes->watermark = watermark & EMU_AXES_SRC_FSS;
+}
+
+void emu_axes_sample(emu_axes_t *axes, const int16_t v[3], uint8_t enabled, bool bdu) {
+    uint8_t i;
+
+    for (i = 0; i < 3; i++) {
+        if (!(enabled & (1 << i))) {
+            continue;
+        }
+
+        axes->latest[i] = v[i];
+
+        if (!bdu || !(axes->locked & (1 << i))) {
+            axes->out[i] = v[i];
+        }
+
+        if (axes->status & (1 << i)) {
+            axes->status |= (uint8_t) (0x10 << i);
+        }
+        axes->status |= (uint8_t) (1 << i);
+    }
+
+    if (axes->status & EMU_AXES_SR_ZYXDA) {
+        axes->status |= EMU_AXES_SR_ZYXOR;
+    }
+    axes->status |= EMU_AXES_SR_ZYXDA;
+
+    if (axes->mode == EMU_AXES_BYPASS) {
+        return;
+    }
+
+    if (axes->level == EMU_AXES_FIFO_SIZE) {
+        if (axes->mode == EMU_AXES_FIFO) {
+            return;
+        }
+
+        /* stream: the oldest sample is overwritten */
+        axes->head = (axes->head + 1) % EMU_AXES_FIFO_SIZE;
+        axes->level--;
+    }
+
+    for (i = 0; i < 3; i++) {
+        axes->fifo[(axes->head + axes->level) % EMU_AXES_FIFO_SIZE][i] = axes->latest[i];
+    }
+    axes->level++;
+}
+
+uint8_t emu_axes_read(emu_axes_t *axes, uint8_t index, bool ble, bool bdu) {
+    uint8_t axis = index / 2;
+    bool second = (index & 1) != 0;
+    bool high = second != ble;
+    bool from_fifo = emu_axes_fifo_on(axes) && axes->level > 0;
+    int16_t value = from_fifo ? axes->fifo[axes->head][axis] : axes->out[axis];
+
+    if (!second) {
+        axes->locked |= (uint8_t) (1 << axis);
+    } else {
+        axes->locked &= (uint8_t) ~(1 << axis);
+
+        if (bdu) {
+            axes->out[axis] = axes->latest[axis];
+        }
+
+        axes->status &= (uint8_t) ~((1 << axis) | (0x10 << axis));
+        if (!(axes->status & EMU_AXES_SR_DA)) {
+            axes->status &= (uint8_t) ~(EMU_AXES_SR_ZYXDA | EMU_AXES_SR_ZYXOR);
+        }
+    }
+
+    /* the FIFO moves on once the whole sample has been read */
+    if (from_fifo && index == 5) {
+        axes->head = (axes->head + 1) % EMU_AXES_FIFO_SIZE;
+        axes->level--;
+    }
+
+    return high ? (uint8_t) ((uint16_t) value >> 8) : (uint8_t) value;
+}
+
+uint8_t emu_axes_fifo_src(const emu_axes_t *axes) {
+    uint8_t src = (axes->level > EMU_AXES_SRC_FSS) ? EMU_AXES_SRC_FSS : axes->level;
+
+    if (axes->level == 0) {
+        src |= EMU_AXES_SRC_EMPTY;
+    }
+
+    /* the FIFO is full: FIFO mode has stopped, stream mode overwrites with the next sample */
+    if (axes->level == EMU_AXES_FIFO_SIZE) {
+        src |= EMU_AXES_SRC_OVRN;
+    }
+
+    if (axes->level >= axes->watermark) {
+        src |= EMU_AXES_SRC_WTM;
+    }
+
+    return src;
+}
+
+bool emu_axes_fifo_on(const emu_axes_t *axes) {
+    return axes->mode != EMU_AXES_BYPASS;
+}
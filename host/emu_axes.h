@@ -0,0 +1,65 @@
+#ifndef __EMU_AXES_H__
+#define __EMU_AXES_H__
+
+/* C++ detection */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * three-axis output block of the ST sensors, shared by the L3GD20 and the LSM303DLHC accelerometer
+ * emulators: STATUS_REG, OUT_X_L .. OUT_Z_H with BDU and BLE, and the 32 sample FIFO with its
+ * FIFO_SRC_REG. Both parts lay these out the same way from 0x27 to 0x2F.
+ */
+
+#define EMU_AXES_FIFO_SIZE    32
+
+/* STATUS_REG */
+#define EMU_AXES_SR_DA       0x07    // per axis new data, cleared by reading the second byte of the axis
+#define EMU_AXES_SR_ZYXDA    0x08
+#define EMU_AXES_SR_OR       0x70    // per axis overrun, a sample replaced an unread one
+#define EMU_AXES_SR_ZYXOR    0x80
+
+/* FIFO_SRC_REG */
+#define EMU_AXES_SRC_FSS      0x1F
+#define EMU_AXES_SRC_EMPTY    0x20
+#define EMU_AXES_SRC_OVRN     0x40
+#define EMU_AXES_SRC_WTM      0x80
+
+/* a physical quantity over time, in the unit of the emulator */
+typedef void (*emu_source_t)(void *ctx, uint64_t t_ns, float value[3]);
+
+typedef enum {
+    EMU_AXES_BYPASS,    // output registers only
+    EMU_AXES_FIFO,      // fill up, then stop
+    EMU_AXES_STREAM     // keep the newest samples
+} emu_axes_mode_t;
+
+typedef struct {
+    uint8_t status;
+    int16_t latest[3];          // newest sample
+    int16_t out[3];             // what the output registers show
+    uint8_t locked;             // BDU: axes read half way, held until their second byte is read
+    int16_t fifo[EMU_AXES_FIFO_SIZE][3];
+    uint8_t head;
+    uint8_t level;
+    emu_axes_mode_t mode;
+    uint8_t watermark;
+} emu_axes_t;
+
+void emu_axes_reset(emu_axes_t *axes);
+void emu_axes_set_mode(emu_axes_t *axes, emu_axes_mode_t mode, uint8_t watermark);    // bypass empties the FIFO
+void emu_axes_sample(emu_axes_t *axes, const int16_t v[3], uint8_t enabled, bool bdu);    // enabled: bit per axis
+uint8_t emu_axes_read(emu_axes_t *axes, uint8_t index, bool ble, bool bdu);    // byte index of OUT_X_L, pops the FIFO after the last
+uint8_t emu_axes_fifo_src(const emu_axes_t *axes);
+bool emu_axes_fifo_on(const emu_axes_t *axes);
+
+/* C++ detection */
+#ifdef __cplusplus
+}
+#endif
+
+#endif
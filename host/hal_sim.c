@@ -0,0 +1,1122 @@
+#include "hal_sim.h"
+#include "imu_clock.h"
+
+#include <string.h>
+
+#ifndef IMU_CLOCK_EXTERNAL
+#error "build the simulator and the drivers with IMU_CLOCK_EXTERNAL, imu_clock.h then runs on the virtual clock"
+#endif
+
+#define HAL_SIM_NS_PER_MS    1000000ull
+
+typedef struct {
+    GPIO_TypeDef *port;
+    uint16_t pin;
+    hal_sim_spi_slave_t slave;
+} hal_sim_cs_t;
+
+struct hal_sim_spi {
+    SPI_HandleTypeDef *hspi;
+    uint64_t byte_ns;
+    hal_sim_cs_t cs[HAL_SIM_SLAVES];
+    uint8_t cs_count;
+    hal_sim_fault_t fault;
+    uint32_t fault_calls;
+    hal_sim_bus_stats_t stats;
+
+    /* DMA transfer */
+    uint8_t *dma_tx;
+    uint8_t *dma_rx;
+    uint16_t dma_len;
+    uint16_t dma_pos;
+    hal_sim_fault_t dma_fault;
+};
+
+typedef struct {
+    uint8_t address;
+    hal_sim_i2c_slave_t slave;
+} hal_sim_addr_t;
+
+/* phases of an interrupt or DMA memory read */
+typedef enum {
+    HAL_SIM_MEM_ADDRESS,
+    HAL_SIM_MEM_SUBADDRESS,
+    HAL_SIM_MEM_RESTART,
+    HAL_SIM_MEM_DATA,
+    HAL_SIM_MEM_STOP
+} hal_sim_mem_phase_t;
+
+struct hal_sim_i2c {
+    I2C_HandleTypeDef *hi2c;
+    I2C_TypeDef regs;
+    uint64_t bit_ns;
+    hal_sim_addr_t slaves[HAL_SIM_SLAVES];
+    uint8_t slave_count;
+    const hal_sim_i2c_slave_t *active;     // addressed until the STOP
+    GPIO_TypeDef *scl_port;
+    uint16_t scl_pin;
+    GPIO_TypeDef *sda_port;
+    uint16_t sda_pin;
+    uint8_t stuck;                  // SCL pulses until SDA is released, 0 if it is not held
+    hal_sim_fault_t fault;
+    uint32_t fault_calls;
+    hal_sim_bus_stats_t stats;
+
+    /* interrupt or DMA memory read */
+    uint16_t mem_dev;
+    uint8_t mem_reg;
+    uint8_t *mem_buf;
+    uint16_t mem_len;
+    uint16_t mem_pos;
+    hal_sim_mem_phase_t mem_phase;
+    hal_sim_fault_t mem_fault;
+    uint32_t mem_error;
+};
+
+typedef struct {
+    uint64_t at;
+    uint32_t seq;           // events due at the same time run in the order they were scheduled
+    hal_sim_fn_t fn;
+    void *ctx;
+    bool used;
+} hal_sim_event_t;
+
+typedef struct {
+    hal_sim_fn_t fn;
+    void *ctx;
+} hal_sim_pending_t;
+
+GPIO_TypeDef hal_sim_gpio[6];
+
+/* private variables */
+static struct {
+    uint64_t now;
+    uint32_t primask;
+    bool in_irq;
+    uint32_t seq;
+    hal_sim_event_t events[HAL_SIM_EVENTS];
+    hal_sim_pending_t irqs[HAL_SIM_IRQS];
+    uint8_t irq_count;
+    hal_sim_fn_t hook;
+    void *hook_ctx;
+    struct hal_sim_spi spi[HAL_SIM_SPI_BUSES];
+    uint8_t spi_count;
+    struct hal_sim_i2c i2c[HAL_SIM_I2C_BUSES];
+    uint8_t i2c_count;
+} sim;
+
+/* private functions */
+static void hal_sim_advance_to(uint64_t t, bool preempt);
+static void hal_sim_preempt(void);
+static void hal_sim_irq_cancel(hal_sim_fn_t fn, void *ctx);
+static void hal_sim_wait_tick(uint32_t tick);
+static hal_sim_fault_t hal_sim_take_fault(hal_sim_fault_t *fault, uint32_t *calls, hal_sim_bus_stats_t *stats);
+static void hal_sim_exti(void *ctx);
+static void hal_sim_pin_changed(GPIO_TypeDef *port, uint16_t pin, bool level);
+static uint8_t hal_sim_spi_byte(struct hal_sim_spi *bus, uint8_t mosi);
+static HAL_StatusTypeDef hal_sim_spi_blocking(SPI_HandleTypeDef *hspi, uint8_t *tx, uint8_t *rx, uint16_t size, uint32_t timeout, HAL_SPI_StateTypeDef state);
+static void hal_sim_spi_dma_byte(void *ctx);
+static void hal_sim_spi_dma_done(void *ctx);
+static bool hal_sim_i2c_address(struct hal_sim_i2c *bus, uint16_t dev, bool read);
+static bool hal_sim_i2c_write(struct hal_sim_i2c *bus, uint8_t data);
+static uint8_t hal_sim_i2c_read(struct hal_sim_i2c *bus);
+static void hal_sim_i2c_stop(struct hal_sim_i2c *bus);
+static HAL_StatusTypeDef hal_sim_i2c_blocking(I2C_HandleTypeDef *hi2c, uint16_t dev, const uint8_t *reg, uint8_t *tx, uint8_t *rx, uint16_t size, uint32_t timeout);
+static HAL_StatusTypeDef hal_sim_i2c_mem_read_async(I2C_HandleTypeDef *hi2c, uint16_t dev, uint16_t reg, uint8_t *data, uint16_t size);
+static void hal_sim_i2c_mem_step(void *ctx);
+static void hal_sim_i2c_mem_done(void *ctx);
+
+void hal_sim_reset(void) {
+    uint8_t i;
+
+    for (i = 0; i < sim.spi_count; i++) {
+        sim.spi[i].hspi->sim = NULL;
+    }
+
+    for (i = 0; i < sim.i2c_count; i++) {
+        sim.i2c[i].hi2c->sim = NULL;
+        sim.i2c[i].hi2c->Instance = NULL;
+    }
+
+    memset(&sim, 0, sizeof(sim));
+    memset(hal_sim_gpio, 0, sizeof(hal_sim_gpio));
+}
+
+uint64_t hal_sim_now_ns(void) {
+    return sim.now;
+}
+
+void hal_sim_advance_us(uint32_t us) {
+    hal_sim_advance_to(sim.now + (uint64_t) us * 1000, true);
+}
+
+void hal_sim_run_until(uint64_t t_ns) {
+    hal_sim_advance_to(t_ns, true);
+}
+
+void hal_sim_schedule(uint64_t at_ns, hal_sim_fn_t fn, void *ctx) {
+    uint8_t i;
+
+    for (i = 0; i < HAL_SIM_EVENTS; i++) {
+        if (!sim.events[i].used) {
+            sim.events[i] = (hal_sim_event_t) { .at = at_ns, .seq = sim.seq++, .fn = fn, .ctx = ctx, .used = true };
+            return;
+        }
+    }
+}
+
+void hal_sim_cancel(hal_sim_fn_t fn, void *ctx) {
+    uint8_t i;
+
+    for (i = 0; i < HAL_SIM_EVENTS; i++) {
+        if (sim.events[i].used && sim.events[i].fn == fn && sim.events[i].ctx == ctx) {
+            sim.events[i].used = false;
+        }
+    }
+}
+
+void hal_sim_irq(hal_sim_fn_t fn, void *ctx) {
+    if (sim.irq_count < HAL_SIM_IRQS) {
+        sim.irqs[sim.irq_count++] = (hal_sim_pending_t) { fn, ctx };
+    }
+}
+
+void hal_sim_set_irq_hook(hal_sim_fn_t fn, void *ctx) {
+    sim.hook = fn;
+    sim.hook_ctx = ctx;
+}
+
+bool hal_sim_in_irq(void) {
+    return sim.in_irq;
+}
+
+void hal_sim_attach_spi(SPI_HandleTypeDef *hspi, uint32_t clock_hz) {
+    struct hal_sim_spi *bus = hspi->sim;
+
+    if (bus == NULL) {
+        if (sim.spi_count >= HAL_SIM_SPI_BUSES) {
+            return;
+        }
+
+        bus = &sim.spi[sim.spi_count++];
+        bus->hspi = hspi;
+        hspi->sim = bus;
+    }
+
+    bus->byte_ns = (8000000000ull + clock_hz - 1) / clock_hz;
+
+    hspi->Lock = HAL_UNLOCKED;
+    hspi->State = HAL_SPI_STATE_READY;
+    hspi->ErrorCode = HAL_SPI_ERROR_NONE;
+}
+
+void hal_sim_attach_cs(SPI_HandleTypeDef *hspi, GPIO_TypeDef *port, uint16_t pin, const hal_sim_spi_slave_t *slave) {
+    struct hal_sim_spi *bus = hspi->sim;
+    uint8_t i;
+
+    if (bus == NULL || bus->cs_count >= HAL_SIM_SLAVES) {
+        return;
+    }
+
+    bus->cs[bus->cs_count++] = (hal_sim_cs_t) { port, pin, *slave };
+
+    /* an output idling high, as the board init leaves it */
+    port->ODR |= pin;
+    for (i = 0; i < 16; i++) {
+        if (pin & (1u << i)) {
+            port->mode[i] = GPIO_MODE_OUTPUT_PP;
+        }
+    }
+}
+
+void hal_sim_attach_i2c(I2C_HandleTypeDef *hi2c, uint32_t clock_hz) {
+    struct hal_sim_i2c *bus = hi2c->sim;
+
+    if (bus == NULL) {
+        if (sim.i2c_count >= HAL_SIM_I2C_BUSES) {
+            return;
+        }
+
+        bus = &sim.i2c[sim.i2c_count++];
+        bus->hi2c = hi2c;
+        hi2c->sim = bus;
+    }
+
+    bus->bit_ns = (1000000000ull + clock_hz - 1) / clock_hz;
+
+    hi2c->Instance = &bus->regs;
+    hi2c->Lock = HAL_UNLOCKED;
+    hi2c->State = HAL_I2C_STATE_READY;
+    hi2c->ErrorCode = HAL_I2C_ERROR_NONE;
+}
+
+void hal_sim_attach_i2c_slave(I2C_HandleTypeDef *hi2c, uint8_t address, const hal_sim_i2c_slave_t *slave) {
+    struct hal_sim_i2c *bus = hi2c->sim;
+
+    if (bus == NULL || bus->slave_count >= HAL_SIM_SLAVES) {
+        return;
+    }
+
+    bus->slaves[bus->slave_count++] = (hal_sim_addr_t) { address & 0xFE, *slave };
+}
+
+void hal_sim_attach_i2c_pins(I2C_HandleTypeDef *hi2c, GPIO_TypeDef *scl_port, uint16_t scl_pin, GPIO_TypeDef *sda_port, uint16_t sda_pin) {
+    struct hal_sim_i2c *bus = hi2c->sim;
+
+    if (bus == NULL) {
+        return;
+    }
+
+    bus->scl_port = scl_port;
+    bus->scl_pin = scl_pin;
+    bus->sda_port = sda_port;
+    bus->sda_pin = sda_pin;
+}
+
+void hal_sim_set_pin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState level) {
+    uint32_t old = port->IDR & pin;
+    uint8_t i;
+
+    if (level == GPIO_PIN_SET) {
+        port->IDR |= pin;
+    } else {
+        port->IDR &= ~(uint32_t) pin;
+    }
+
+    if ((port->IDR & pin) == old) {
+        return;
+    }
+
+    for (i = 0; i < 16; i++) {
+        if (!(pin & (1u << i))) {
+            continue;
+        }
+
+        if ((level == GPIO_PIN_SET && port->mode[i] == GPIO_MODE_IT_RISING) ||
+            (level == GPIO_PIN_RESET && port->mode[i] == GPIO_MODE_IT_FALLING)) {
+            hal_sim_irq(hal_sim_exti, (void *) (uintptr_t) (1u << i));
+        }
+    }
+}
+
+void hal_sim_fault_spi(SPI_HandleTypeDef *hspi, hal_sim_fault_t fault, uint32_t calls) {
+    if (hspi->sim != NULL) {
+        hspi->sim->fault = fault;
+        hspi->sim->fault_calls = calls;
+    }
+}
+
+void hal_sim_fault_i2c(I2C_HandleTypeDef *hi2c, hal_sim_fault_t fault, uint32_t calls) {
+    if (hi2c->sim != NULL) {
+        hi2c->sim->fault = fault;
+        hi2c->sim->fault_calls = calls;
+    }
+}
+
+void hal_sim_stuck_sda(I2C_HandleTypeDef *hi2c, uint8_t clocks) {
+    struct hal_sim_i2c *bus = hi2c->sim;
+
+    if (bus == NULL) {
+        return;
+    }
+
+    bus->stuck = clocks;
+
+    if (clocks > 0) {
+        bus->regs.ISR |= I2C_FLAG_BUSY;
+    } else {
+        bus->regs.ISR &= ~I2C_FLAG_BUSY;
+    }
+}
+
+void hal_sim_spi_stats(const SPI_HandleTypeDef *hspi, hal_sim_bus_stats_t *stats) {
+    *stats = (hspi->sim != NULL) ? hspi->sim->stats : (hal_sim_bus_stats_t) { 0 };
+}
+
+void hal_sim_i2c_stats(const I2C_HandleTypeDef *hi2c, hal_sim_bus_stats_t *stats) {
+    *stats = (hi2c->sim != NULL) ? hi2c->sim->stats : (hal_sim_bus_stats_t) { 0 };
+}
+
+void hal_sim_clear_stats(void) {
+    uint8_t i;
+
+    for (i = 0; i < sim.spi_count; i++) {
+        sim.spi[i].stats = (hal_sim_bus_stats_t) { 0 };
+    }
+
+    for (i = 0; i < sim.i2c_count; i++) {
+        sim.i2c[i].stats = (hal_sim_bus_stats_t) { 0 };
+    }
+}
+
+/* HAL */
+uint32_t HAL_GetTick(void) {
+    return (uint32_t) (sim.now / HAL_SIM_NS_PER_MS);
+}
+
+void HAL_Delay(uint32_t delay) {
+    /* at least delay whole ticks, one more as the HAL adds */
+    hal_sim_wait_tick(HAL_GetTick() + delay + 1);
+}
+
+uint32_t __get_PRIMASK(void) {
+    return sim.primask;
+}
+
+void __set_PRIMASK(uint32_t primask) {
+    sim.primask = primask & 1;
+    hal_sim_preempt();
+}
+
+void __disable_irq(void) {
+    sim.primask = 1;
+}
+
+void __enable_irq(void) {
+    sim.primask = 0;
+    hal_sim_preempt();
+}
+
+void HAL_GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_Init) {
+    uint8_t i;
+
+    for (i = 0; i < 16; i++) {
+        if (GPIO_Init->Pin & (1u << i)) {
+            GPIOx->mode[i] = GPIO_Init->Mode;
+        }
+    }
+}
+
+void HAL_GPIO_DeInit(GPIO_TypeDef *GPIOx, uint32_t GPIO_Pin) {
+    uint8_t i;
+
+    for (i = 0; i < 16; i++) {
+        if (GPIO_Pin & (1u << i)) {
+            GPIOx->mode[i] = GPIO_MODE_INPUT;
+        }
+    }
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin) {
+    uint8_t i;
+
+    hal_sim_preempt();
+
+    /* SDA is pulled up, a stuck slave or the pin itself pull it down */
+    for (i = 0; i < sim.i2c_count; i++) {
+        struct hal_sim_i2c *bus = &sim.i2c[i];
+
+        if (bus->sda_port == GPIOx && bus->sda_pin == GPIO_Pin) {
+            if (bus->stuck > 0 || (GPIOx->mode[__builtin_ctz(GPIO_Pin)] == GPIO_MODE_OUTPUT_OD && !(GPIOx->ODR & GPIO_Pin))) {
+                return GPIO_PIN_RESET;
+            }
+
+            return GPIO_PIN_SET;
+        }
+    }
+
+    i = (uint8_t) __builtin_ctz(GPIO_Pin);
+    if (GPIOx->mode[i] == GPIO_MODE_OUTPUT_PP || GPIOx->mode[i] == GPIO_MODE_OUTPUT_OD) {
+        return (GPIOx->ODR & GPIO_Pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+    }
+
+    return (GPIOx->IDR & GPIO_Pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState) {
+    uint32_t old;
+
+    hal_sim_preempt();
+
+    old = GPIOx->ODR & GPIO_Pin;
+
+    if (PinState == GPIO_PIN_SET) {
+        GPIOx->ODR |= GPIO_Pin;
+    } else {
+        GPIOx->ODR &= ~(uint32_t) GPIO_Pin;
+    }
+
+    if ((GPIOx->ODR & GPIO_Pin) != old) {
+        hal_sim_pin_changed(GPIOx, GPIO_Pin, PinState == GPIO_PIN_SET);
+    }
+}
+
+__weak void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin) {
+    (void) GPIO_Pin;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout) {
+    return hal_sim_spi_blocking(hspi, pData, NULL, Size, Timeout, HAL_SPI_STATE_BUSY_TX);
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout) {
+    /* a full-duplex master clocks the buffer out while it receives, as the HAL does */
+    return hal_sim_spi_blocking(hspi, pData, pData, Size, Timeout, HAL_SPI_STATE_BUSY_RX);
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size, uint32_t Timeout) {
+    return hal_sim_spi_blocking(hspi, pTxData, pRxData, Size, Timeout, HAL_SPI_STATE_BUSY_TX_RX);
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size) {
+    struct hal_sim_spi *bus = hspi->sim;
+    hal_sim_fault_t fault;
+
+    hal_sim_preempt();
+
+    if (bus == NULL || Size == 0) {
+        return HAL_ERROR;
+    }
+
+    fault = hal_sim_take_fault(&bus->fault, &bus->fault_calls, &bus->stats);
+
+    if (hspi->Lock == HAL_LOCKED || fault == HAL_SIM_FAULT_LOCKED || hspi->State != HAL_SPI_STATE_READY) {
+        return HAL_BUSY;
+    }
+
+    hspi->State = HAL_SPI_STATE_BUSY_TX_RX;
+    hspi->ErrorCode = HAL_SPI_ERROR_NONE;
+
+    bus->dma_tx = pTxData;
+    bus->dma_rx = pRxData;
+    bus->dma_len = Size;
+    bus->dma_pos = 0;
+    bus->dma_fault = fault;
+
+    hal_sim_schedule(sim.now + bus->byte_ns, hal_sim_spi_dma_byte, bus);
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef *hspi) {
+    if (hspi->sim != NULL) {
+        hal_sim_cancel(hal_sim_spi_dma_byte, hspi->sim);
+        hal_sim_irq_cancel(hal_sim_spi_dma_done, hspi->sim);
+    }
+
+    hspi->State = HAL_SPI_STATE_READY;
+    hspi->Lock = HAL_UNLOCKED;
+
+    return HAL_OK;
+}
+
+HAL_SPI_StateTypeDef HAL_SPI_GetState(SPI_HandleTypeDef *hspi) {
+    return hspi->State;
+}
+
+uint32_t HAL_SPI_GetError(SPI_HandleTypeDef *hspi) {
+    return hspi->ErrorCode;
+}
+
+__weak void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi) {
+    (void) hspi;
+}
+
+__weak void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi) {
+    (void) hspi;
+}
+
+HAL_StatusTypeDef HAL_I2C_Init(I2C_HandleTypeDef *hi2c) {
+    if (hi2c == NULL) {
+        return HAL_ERROR;
+    }
+
+    /* MspInit would hand the pins back to the peripheral, a slave holding SDA keeps holding it */
+    if (hi2c->sim != NULL) {
+        hi2c->Instance = &hi2c->sim->regs;
+    }
+
+    hi2c->ErrorCode = HAL_I2C_ERROR_NONE;
+    hi2c->State = HAL_I2C_STATE_READY;
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_DeInit(I2C_HandleTypeDef *hi2c) {
+    if (hi2c == NULL) {
+        return HAL_ERROR;
+    }
+
+    if (hi2c->sim != NULL) {
+        hal_sim_cancel(hal_sim_i2c_mem_step, hi2c->sim);
+        hal_sim_irq_cancel(hal_sim_i2c_mem_done, hi2c->sim);
+        hi2c->sim->active = NULL;
+        hi2c->sim->stats.resets++;
+    }
+
+    hi2c->ErrorCode = HAL_I2C_ERROR_NONE;
+    hi2c->State = HAL_I2C_STATE_RESET;
+    hi2c->Lock = HAL_UNLOCKED;
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_Master_Transmit(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData, uint16_t Size, uint32_t Timeout) {
+    return hal_sim_i2c_blocking(hi2c, DevAddress & 0xFE, NULL, pData, NULL, Size, Timeout);
+}
+
+HAL_StatusTypeDef HAL_I2C_Master_Receive(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData, uint16_t Size, uint32_t Timeout) {
+    return hal_sim_i2c_blocking(hi2c, DevAddress | 0x01, NULL, NULL, pData, Size, Timeout);
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size, uint32_t Timeout) {
+    uint8_t reg = (uint8_t) MemAddress;
+
+    if (MemAddSize != I2C_MEMADD_SIZE_8BIT) {
+        return HAL_ERROR;
+    }
+
+    return hal_sim_i2c_blocking(hi2c, DevAddress | 0x01, &reg, NULL, pData, Size, Timeout);
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read_IT(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size) {
+    if (MemAddSize != I2C_MEMADD_SIZE_8BIT) {
+        return HAL_ERROR;
+    }
+
+    return hal_sim_i2c_mem_read_async(hi2c, DevAddress, MemAddress, pData, Size);
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read_DMA(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size) {
+    if (MemAddSize != I2C_MEMADD_SIZE_8BIT) {
+        return HAL_ERROR;
+    }
+
+    return hal_sim_i2c_mem_read_async(hi2c, DevAddress, MemAddress, pData, Size);
+}
+
+HAL_I2C_StateTypeDef HAL_I2C_GetState(I2C_HandleTypeDef *hi2c) {
+    return hi2c->State;
+}
+
+uint32_t HAL_I2C_GetError(I2C_HandleTypeDef *hi2c) {
+    return hi2c->ErrorCode;
+}
+
+__weak void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c) {
+    (void) hi2c;
+}
+
+__weak void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c) {
+    (void) hi2c;
+}
+
+/* imu_clock.h with IMU_CLOCK_EXTERNAL, ticks are ns of virtual time */
+void imu_clock_init(void) {
+}
+
+uint32_t imu_clock_now(void) {
+    return (uint32_t) sim.now;
+}
+
+uint32_t imu_clock_ticks_per_us(void) {
+    return 1000;
+}
+
+void imu_clock_delay_us(uint32_t us) {
+    hal_sim_advance_to(sim.now + (uint64_t) us * 1000, true);
+}
+
+/* private functions */
+static void hal_sim_advance_to(uint64_t t, bool preempt) {
+    hal_sim_event_t *next;
+    hal_sim_fn_t fn;
+    void *ctx;
+    uint8_t i;
+
+    for (;;) {
+        next = NULL;
+
+        for (i = 0; i < HAL_SIM_EVENTS; i++) {
+            hal_sim_event_t *ev = &sim.events[i];
+
+            if (ev->used && ev->at <= t && (next == NULL || ev->at < next->at || (ev->at == next->at && ev->seq < next->seq))) {
+                next = ev;
+            }
+        }
+
+        if (next == NULL) {
+            break;
+        }
+
+        if (next->at > sim.now) {
+            sim.now = next->at;
+        }
+
+        fn = next->fn;
+        ctx = next->ctx;
+        next->used = false;
+        fn(ctx);
+
+        if (preempt) {
+            hal_sim_preempt();
+        }
+    }
+
+    if (t > sim.now) {
+        sim.now = t;
+    }
+
+    if (preempt) {
+        hal_sim_preempt();
+    }
+}
+
+static void hal_sim_preempt(void) {
+    hal_sim_pending_t irq;
+    uint8_t i;
+
+    if (sim.primask != 0 || sim.in_irq) {
+        return;
+    }
+
+    sim.in_irq = true;
+
+    if (sim.hook != NULL) {
+        sim.hook(sim.hook_ctx);
+    }
+
+    /* in the order they were raised, one priority level */
+    while (sim.irq_count > 0) {
+        irq = sim.irqs[0];
+        sim.irq_count--;
+
+        for (i = 0; i < sim.irq_count; i++) {
+            sim.irqs[i] = sim.irqs[i + 1];
+        }
+
+        irq.fn(irq.ctx);
+    }
+
+    sim.in_irq = false;
+}
+
+static void hal_sim_irq_cancel(hal_sim_fn_t fn, void *ctx) {
+    uint8_t i, n = 0;
+
+    for (i = 0; i < sim.irq_count; i++) {
+        if (sim.irqs[i].fn != fn || sim.irqs[i].ctx != ctx) {
+            sim.irqs[n++] = sim.irqs[i];
+        }
+    }
+
+    sim.irq_count = n;
+}
+
+/* busy wait of the HAL until HAL_GetTick reaches tick, interrupts are served */
+static void hal_sim_wait_tick(uint32_t tick) {
+    hal_sim_advance_to((uint64_t) tick * HAL_SIM_NS_PER_MS, true);
+}
+
+static hal_sim_fault_t hal_sim_take_fault(hal_sim_fault_t *fault, uint32_t *calls, hal_sim_bus_stats_t *stats) {
+    if (*calls == 0 || *fault == HAL_SIM_FAULT_NONE) {
+        return HAL_SIM_FAULT_NONE;
+    }
+
+    (*calls)--;
+    stats->faults++;
+
+    return *fault;
+}
+
+static void hal_sim_exti(void *ctx) {
+    HAL_GPIO_EXTI_Callback((uint16_t) (uintptr_t) ctx);
+}
+
+static void hal_sim_pin_changed(GPIO_TypeDef *port, uint16_t pin, bool level) {
+    uint8_t i, j;
+
+    for (i = 0; i < sim.spi_count; i++) {
+        struct hal_sim_spi *bus = &sim.spi[i];
+
+        for (j = 0; j < bus->cs_count; j++) {
+            hal_sim_cs_t *cs = &bus->cs[j];
+
+            if (cs->port != port || cs->pin != pin) {
+                continue;
+            }
+
+            bus->stats.cs_toggles++;
+
+            if (bus->hspi->State != HAL_SPI_STATE_READY) {
+                bus->stats.glitches++;
+            }
+
+            if (level) {
+                cs->slave.deselect(cs->slave.ctx);
+            } else {
+                bus->stats.transactions++;
+                cs->slave.select(cs->slave.ctx);
+            }
+        }
+    }
+
+    /* recovery pulses count while SCL is a GPIO output */
+    for (i = 0; i < sim.i2c_count; i++) {
+        struct hal_sim_i2c *bus = &sim.i2c[i];
+
+        if (bus->scl_port == port && bus->scl_pin == pin && level && bus->stuck > 0 &&
+            port->mode[__builtin_ctz(pin)] == GPIO_MODE_OUTPUT_OD) {
+            if (--bus->stuck == 0) {
+                bus->regs.ISR &= ~I2C_FLAG_BUSY;
+            }
+        }
+    }
+}
+
+static uint8_t hal_sim_spi_byte(struct hal_sim_spi *bus, uint8_t mosi) {
+    uint8_t miso = 0xFF;
+    uint8_t selected = 0;
+    uint8_t i;
+
+    /* open MISO lines of several selected slaves read as their AND */
+    for (i = 0; i < bus->cs_count; i++) {
+        if (!(bus->cs[i].port->ODR & bus->cs[i].pin)) {
+            miso &= bus->cs[i].slave.exchange(bus->cs[i].slave.ctx, mosi);
+            selected++;
+        }
+    }
+
+    bus->stats.bytes++;
+    bus->stats.busy_ns += bus->byte_ns;
+
+    if (selected == 0) {
+        bus->stats.unselected++;
+    } else if (selected > 1) {
+        bus->stats.conflicts++;
+    }
+
+    return miso;
+}
+
+static HAL_StatusTypeDef hal_sim_spi_blocking(SPI_HandleTypeDef *hspi, uint8_t *tx, uint8_t *rx, uint16_t size, uint32_t timeout, HAL_SPI_StateTypeDef state) {
+    struct hal_sim_spi *bus = hspi->sim;
+    HAL_StatusTypeDef status = HAL_OK;
+    hal_sim_fault_t fault;
+    uint32_t tickstart;
+    uint16_t i;
+    uint8_t miso;
+
+    hal_sim_preempt();
+
+    if (bus == NULL || size == 0) {
+        return HAL_ERROR;
+    }
+
+    fault = hal_sim_take_fault(&bus->fault, &bus->fault_calls, &bus->stats);
+
+    if (hspi->Lock == HAL_LOCKED || fault == HAL_SIM_FAULT_LOCKED || hspi->State != HAL_SPI_STATE_READY) {
+        return HAL_BUSY;
+    }
+
+    hspi->Lock = HAL_LOCKED;
+    hspi->State = state;
+    hspi->ErrorCode = HAL_SPI_ERROR_NONE;
+    tickstart = HAL_GetTick();
+
+    if (fault == HAL_SIM_FAULT_TIMEOUT) {
+        hal_sim_wait_tick(tickstart + timeout);
+        status = HAL_TIMEOUT;
+    } else if (fault == HAL_SIM_FAULT_ERROR) {
+        hspi->ErrorCode = HAL_SPI_ERROR_OVR;
+        status = HAL_ERROR;
+    } else {
+        /* one byte at a time, an interrupt may come in between */
+        for (i = 0; i < size; i++) {
+            miso = hal_sim_spi_byte(bus, (tx != NULL) ? tx[i] : 0xFF);
+
+            if (rx != NULL) {
+                rx[i] = miso;
+            }
+
+            hal_sim_advance_to(sim.now + bus->byte_ns, false);
+            hal_sim_preempt();
+        }
+    }
+
+    hspi->State = HAL_SPI_STATE_READY;
+    hspi->Lock = HAL_UNLOCKED;
+
+    hal_sim_preempt();
+
+    return status;
+}
+
+static void hal_sim_spi_dma_byte(void *ctx) {
+    struct hal_sim_spi *bus = ctx;
+    uint8_t miso = 0xFF;
+
+    /* a stalled transfer clocks nothing, the slave keeps its data */
+    if (bus->dma_fault != HAL_SIM_FAULT_TIMEOUT) {
+        miso = hal_sim_spi_byte(bus, bus->dma_tx[bus->dma_pos]);
+    }
+
+    bus->dma_rx[bus->dma_pos++] = miso;
+
+    if (bus->dma_pos < bus->dma_len) {
+        hal_sim_schedule(sim.now + bus->byte_ns, hal_sim_spi_dma_byte, bus);
+    } else {
+        hal_sim_irq(hal_sim_spi_dma_done, bus);
+    }
+}
+
+static void hal_sim_spi_dma_done(void *ctx) {
+    struct hal_sim_spi *bus = ctx;
+    SPI_HandleTypeDef *hspi = bus->hspi;
+
+    hspi->State = HAL_SPI_STATE_READY;
+
+    if (bus->dma_fault != HAL_SIM_FAULT_NONE) {
+        hspi->ErrorCode = HAL_SPI_ERROR_DMA;
+        HAL_SPI_ErrorCallback(hspi);
+    } else {
+        HAL_SPI_TxRxCpltCallback(hspi);
+    }
+}
+
+static bool hal_sim_i2c_address(struct hal_sim_i2c *bus, uint16_t dev, bool read) {
+    uint8_t i;
+
+    bus->active = NULL;
+
+    for (i = 0; i < bus->slave_count; i++) {
+        if (bus->slaves[i].address == (dev & 0xFE)) {
+            if (bus->slaves[i].slave.start(bus->slaves[i].slave.ctx, read)) {
+                bus->active = &bus->slaves[i].slave;
+            }
+            break;
+        }
+    }
+
+    /* START, eight bits and the acknowledge */
+    bus->stats.bytes++;
+    bus->stats.busy_ns += 10 * bus->bit_ns;
+
+    return bus->active != NULL;
+}
+
+static bool hal_sim_i2c_write(struct hal_sim_i2c *bus, uint8_t data) {
+    bus->stats.bytes++;
+    bus->stats.busy_ns += 9 * bus->bit_ns;
+
+    return bus->active != NULL && bus->active->write(bus->active->ctx, data);
+}
+
+static uint8_t hal_sim_i2c_read(struct hal_sim_i2c *bus) {
+    bus->stats.bytes++;
+    bus->stats.busy_ns += 9 * bus->bit_ns;
+
+    return (bus->active != NULL) ? bus->active->read(bus->active->ctx) : 0xFF;
+}
+
+static void hal_sim_i2c_stop(struct hal_sim_i2c *bus) {
+    if (bus->active != NULL) {
+        bus->active->stop(bus->active->ctx);
+        bus->active = NULL;
+    }
+
+    bus->stats.transactions++;
+    bus->stats.busy_ns += bus->bit_ns;
+
+    if (bus->stuck == 0) {
+        bus->regs.ISR &= ~I2C_FLAG_BUSY;
+    }
+}
+
+/* Master_Transmit (tx), Master_Receive (rx) or Mem_Read (reg and rx), bit 0 of dev is the direction of the data */
+static HAL_StatusTypeDef hal_sim_i2c_blocking(I2C_HandleTypeDef *hi2c, uint16_t dev, const uint8_t *reg, uint8_t *tx, uint8_t *rx, uint16_t size, uint32_t timeout) {
+    struct hal_sim_i2c *bus = hi2c->sim;
+    hal_sim_fault_t fault;
+    uint32_t tickstart;
+    bool ack;
+    uint16_t i;
+
+    hal_sim_preempt();
+
+    if (bus == NULL || size == 0) {
+        return HAL_ERROR;
+    }
+
+    fault = hal_sim_take_fault(&bus->fault, &bus->fault_calls, &bus->stats);
+
+    if (hi2c->State != HAL_I2C_STATE_READY || hi2c->Lock == HAL_LOCKED || fault == HAL_SIM_FAULT_LOCKED) {
+        return HAL_BUSY;
+    }
+
+    hi2c->Lock = HAL_LOCKED;
+    tickstart = HAL_GetTick();
+
+    /* I2C_WaitOnFlagUntilTimeout(I2C_FLAG_BUSY, I2C_TIMEOUT_BUSY) */
+    if (bus->regs.ISR & I2C_FLAG_BUSY) {
+        hal_sim_wait_tick(tickstart + HAL_SIM_I2C_BUSY_MS);
+
+        if (bus->regs.ISR & I2C_FLAG_BUSY) {
+            hi2c->ErrorCode |= HAL_I2C_ERROR_TIMEOUT;
+            hi2c->State = HAL_I2C_STATE_READY;
+            hi2c->Lock = HAL_UNLOCKED;
+            hal_sim_preempt();
+            return HAL_ERROR;
+        }
+    }
+
+    hi2c->State = (rx != NULL) ? HAL_I2C_STATE_BUSY_RX : HAL_I2C_STATE_BUSY_TX;
+    hi2c->ErrorCode = HAL_I2C_ERROR_NONE;
+    bus->regs.ISR |= I2C_FLAG_BUSY;
+
+    ack = hal_sim_i2c_address(bus, (reg != NULL) ? (dev & 0xFE) : dev, (reg == NULL) && (dev & 0x01)) && fault != HAL_SIM_FAULT_NACK;
+    hal_sim_advance_to(sim.now + 10 * bus->bit_ns, false);
+    hal_sim_preempt();
+
+    if (!ack) {
+        hi2c->ErrorCode |= HAL_I2C_ERROR_AF;
+    } else if (fault == HAL_SIM_FAULT_ERROR) {
+        hi2c->ErrorCode |= HAL_I2C_ERROR_BERR;
+    } else if (fault == HAL_SIM_FAULT_TIMEOUT) {
+        /* the slave stretches the clock past the deadline */
+        hal_sim_wait_tick(tickstart + timeout);
+        hi2c->ErrorCode |= HAL_I2C_ERROR_TIMEOUT;
+    } else {
+        if (reg != NULL) {
+            ack = hal_sim_i2c_write(bus, *reg);
+            hal_sim_advance_to(sim.now + 9 * bus->bit_ns, false);
+            hal_sim_preempt();
+
+            ack = ack && hal_sim_i2c_address(bus, dev, true);
+            hal_sim_advance_to(sim.now + 10 * bus->bit_ns, false);
+            hal_sim_preempt();
+        }
+
+        for (i = 0; i < size && ack; i++) {
+            if (rx != NULL) {
+                rx[i] = hal_sim_i2c_read(bus);
+            } else {
+                ack = hal_sim_i2c_write(bus, tx[i]);
+            }
+
+            hal_sim_advance_to(sim.now + 9 * bus->bit_ns, false);
+            hal_sim_preempt();
+        }
+
+        if (!ack) {
+            hi2c->ErrorCode |= HAL_I2C_ERROR_AF;
+        }
+    }
+
+    /* AUTOEND, a STOP after the last byte or the NACK */
+    hal_sim_i2c_stop(bus);
+    hal_sim_advance_to(sim.now + bus->bit_ns, false);
+
+    hi2c->State = HAL_I2C_STATE_READY;
+    hi2c->Lock = HAL_UNLOCKED;
+
+    hal_sim_preempt();
+
+    return (hi2c->ErrorCode == HAL_I2C_ERROR_NONE) ? HAL_OK : HAL_ERROR;
+}
+
+static HAL_StatusTypeDef hal_sim_i2c_mem_read_async(I2C_HandleTypeDef *hi2c, uint16_t dev, uint16_t reg, uint8_t *data, uint16_t size) {
+    struct hal_sim_i2c *bus = hi2c->sim;
+    hal_sim_fault_t fault;
+
+    hal_sim_preempt();
+
+    if (bus == NULL || size == 0) {
+        return HAL_ERROR;
+    }
+
+    fault = hal_sim_take_fault(&bus->fault, &bus->fault_calls, &bus->stats);
+
+    if (hi2c->State != HAL_I2C_STATE_READY || hi2c->Lock == HAL_LOCKED || fault == HAL_SIM_FAULT_LOCKED) {
+        return HAL_BUSY;
+    }
+
+    /* the interrupt and DMA variants do not wait for a busy bus */
+    if (bus->regs.ISR & I2C_FLAG_BUSY) {
+        return HAL_BUSY;
+    }
+
+    hi2c->State = HAL_I2C_STATE_BUSY_RX;
+    hi2c->ErrorCode = HAL_I2C_ERROR_NONE;
+    bus->regs.ISR |= I2C_FLAG_BUSY;
+
+    bus->mem_dev = dev & 0xFE;
+    bus->mem_reg = (uint8_t) reg;
+    bus->mem_buf = data;
+    bus->mem_len = size;
+    bus->mem_pos = 0;
+    bus->mem_phase = HAL_SIM_MEM_ADDRESS;
+    bus->mem_fault = fault;
+    bus->mem_error = HAL_I2C_ERROR_NONE;
+
+    hal_sim_schedule(sim.now + 10 * bus->bit_ns, hal_sim_i2c_mem_step, bus);
+
+    return HAL_OK;
+}
+
+/* one phase of an asynchronous memory read has gone over the bus */
+static void hal_sim_i2c_mem_step(void *ctx) {
+    struct hal_sim_i2c *bus = ctx;
+    uint64_t next = 9 * bus->bit_ns;
+
+    switch (bus->mem_phase) {
+    case HAL_SIM_MEM_ADDRESS:
+        if (!hal_sim_i2c_address(bus, bus->mem_dev, false) || bus->mem_fault == HAL_SIM_FAULT_NACK) {
+            bus->mem_error = HAL_I2C_ERROR_AF;
+        } else if (bus->mem_fault == HAL_SIM_FAULT_ERROR) {
+            bus->mem_error = HAL_I2C_ERROR_BERR;
+        } else if (bus->mem_fault == HAL_SIM_FAULT_TIMEOUT) {
+            bus->mem_error = HAL_I2C_ERROR_TIMEOUT;
+        }
+        bus->mem_phase = HAL_SIM_MEM_SUBADDRESS;
+        break;
+
+    case HAL_SIM_MEM_SUBADDRESS:
+        if (!hal_sim_i2c_write(bus, bus->mem_reg)) {
+            bus->mem_error = HAL_I2C_ERROR_AF;
+        }
+        bus->mem_phase = HAL_SIM_MEM_RESTART;
+        next = 10 * bus->bit_ns;
+        break;
+
+    case HAL_SIM_MEM_RESTART:
+        if (!hal_sim_i2c_address(bus, bus->mem_dev, true)) {
+            bus->mem_error = HAL_I2C_ERROR_AF;
+        }
+        bus->mem_phase = HAL_SIM_MEM_DATA;
+        break;
+
+    case HAL_SIM_MEM_DATA:
+        bus->mem_buf[bus->mem_pos++] = hal_sim_i2c_read(bus);
+        if (bus->mem_pos == bus->mem_len) {
+            bus->mem_phase = HAL_SIM_MEM_STOP;
+            next = bus->bit_ns;
+        }
+        break;
+
+    case HAL_SIM_MEM_STOP:
+        hal_sim_i2c_stop(bus);
+        hal_sim_irq(hal_sim_i2c_mem_done, bus);
+        return;
+    }
+
+    if (bus->mem_error != HAL_I2C_ERROR_NONE) {
+        bus->mem_phase = HAL_SIM_MEM_STOP;
+        next = bus->bit_ns;
+    }
+
+    hal_sim_schedule(sim.now + next, hal_sim_i2c_mem_step, bus);
+}
+
+static void hal_sim_i2c_mem_done(void *ctx) {
+    struct hal_sim_i2c *bus = ctx;
+    I2C_HandleTypeDef *hi2c = bus->hi2c;
+
+    hi2c->State = HAL_I2C_STATE_READY;
+    hi2c->ErrorCode = bus->mem_error;
+
+    if (bus->mem_error != HAL_I2C_ERROR_NONE) {
+        HAL_I2C_ErrorCallback(hi2c);
+    } else {
+        HAL_I2C_MemRxCpltCallback(hi2c);
+    }
+}
@@ -0,0 +1,118 @@
+#ifndef __HAL_SIM_H__
+#define __HAL_SIM_H__
+
+/* C++ detection */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "stm32f3xx_hal.h"
+
+/*
+ * host HAL simulator
+ * Implements stm32f3xx_hal.h on a virtual clock in ns. The CPU takes no time, every bus byte takes
+ * its bit times at the clock of its bus, timeouts and delays advance the clock. Bytes go one at a
+ * time to the slaves attached to the bus: SPI slaves to the ones whose chip select is low, I2C
+ * slaves by address. The HAL bookkeeping follows STM32CubeF3: lock and state checks return
+ * HAL_BUSY, blocking SPI calls time out with HAL_TIMEOUT, blocking I2C calls fail with HAL_ERROR
+ * and the cause in ErrorCode, and a transfer waits I2C_TIMEOUT_BUSY (25 ms) for a busy bus.
+ *
+ * Hardware events (sensor samples, DMA bytes) run at their time. Interrupts they raise are pended
+ * and served at the next preemption point: every HAL call, every byte of a blocking transfer and
+ * every step of hal_sim_advance_us, unless masked with __disable_irq or already in an interrupt.
+ * The CMSIS and imu_clock.h (IMU_CLOCK_EXTERNAL) functions are defined here on the same clock.
+ */
+
+#define HAL_SIM_SPI_BUSES       2
+#define HAL_SIM_I2C_BUSES       2
+#define HAL_SIM_SLAVES          4       // per bus
+#define HAL_SIM_EVENTS          32
+#define HAL_SIM_IRQS            16      // pending at once
+#define HAL_SIM_I2C_BUSY_MS     25      // I2C_TIMEOUT_BUSY of the HAL
+
+typedef void (*hal_sim_fn_t)(void *ctx);
+
+/* an SPI slave behind one chip select */
+typedef struct {
+    void (*select)(void *ctx);                  // chip select falling edge
+    uint8_t (*exchange)(void *ctx, uint8_t mosi);    // one byte, returns MISO
+    void (*deselect)(void *ctx);                // rising edge
+    void *ctx;
+} hal_sim_spi_slave_t;
+
+/* an I2C slave at one address */
+typedef struct {
+    bool (*start)(void *ctx, bool read);        // START or repeated START with the address, false NACKs
+    bool (*write)(void *ctx, uint8_t data);     // false NACKs
+    uint8_t (*read)(void *ctx);
+    void (*stop)(void *ctx);
+    void *ctx;
+} hal_sim_i2c_slave_t;
+
+typedef enum {
+    HAL_SIM_FAULT_NONE,
+    HAL_SIM_FAULT_TIMEOUT,  // the call stalls until its timeout, asynchronous transfers fail at the end, SPI DMA clocks nothing
+    HAL_SIM_FAULT_ERROR,    // SPI: HAL_ERROR, HAL_SPI_ERROR_OVR; I2C: HAL_ERROR, HAL_I2C_ERROR_BERR
+    HAL_SIM_FAULT_NACK,     // I2C: the address is not acknowledged, HAL_ERROR, HAL_I2C_ERROR_AF
+    HAL_SIM_FAULT_LOCKED    // the handle is held by another context, HAL_BUSY
+} hal_sim_fault_t;
+
+typedef struct {
+    uint32_t transactions;  // SPI: chip select assertions, I2C: transfers up to their STOP
+    uint32_t bytes;         // on the wire, I2C addresses included
+    uint32_t cs_toggles;    // SPI: chip select edges
+    uint64_t busy_ns;       // modelled bus time
+    uint32_t faults;        // calls that failed by an injected fault
+    uint32_t unselected;    // SPI: bytes clocked with no chip select low
+    uint32_t conflicts;     // SPI: bytes clocked with more than one chip select low
+    uint32_t glitches;      // SPI: chip select edges while a transfer was running on the bus
+    uint32_t resets;        // I2C: HAL_I2C_DeInit calls, a bus recovery
+} hal_sim_bus_stats_t;
+
+void hal_sim_reset(void);   // time 0, no buses, slaves, events or faults, pins low
+
+/* virtual time */
+uint64_t hal_sim_now_ns(void);
+void hal_sim_advance_us(uint32_t us);       // an idle thread, events and interrupts are served in time order
+void hal_sim_run_until(uint64_t t_ns);
+
+/* events and interrupts, for the emulators and the tests */
+void hal_sim_schedule(uint64_t at_ns, hal_sim_fn_t fn, void *ctx);    // runs at its time even with interrupts masked
+void hal_sim_cancel(hal_sim_fn_t fn, void *ctx);
+void hal_sim_irq(hal_sim_fn_t fn, void *ctx);      // pends an interrupt
+void hal_sim_set_irq_hook(hal_sim_fn_t fn, void *ctx);    // called as an interrupt at every preemption point, NULL removes it
+bool hal_sim_in_irq(void);
+
+/* buses */
+void hal_sim_attach_spi(SPI_HandleTypeDef *hspi, uint32_t clock_hz);
+void hal_sim_attach_cs(SPI_HandleTypeDef *hspi, GPIO_TypeDef *port, uint16_t pin, const hal_sim_spi_slave_t *slave);
+void hal_sim_attach_i2c(I2C_HandleTypeDef *hi2c, uint32_t clock_hz);
+void hal_sim_attach_i2c_slave(I2C_HandleTypeDef *hi2c, uint8_t address, const hal_sim_i2c_slave_t *slave);
+void hal_sim_attach_i2c_pins(I2C_HandleTypeDef *hi2c, GPIO_TypeDef *scl_port, uint16_t scl_pin, GPIO_TypeDef *sda_port, uint16_t sda_pin);
+
+/* inputs, a rising edge on a pin set up as GPIO_MODE_IT_RISING pends HAL_GPIO_EXTI_Callback */
+void hal_sim_set_pin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState level);
+
+/* fault injection, the given number of transfer calls on the bus fail from the next one */
+void hal_sim_fault_spi(SPI_HandleTypeDef *hspi, hal_sim_fault_t fault, uint32_t calls);
+void hal_sim_fault_i2c(I2C_HandleTypeDef *hi2c, hal_sim_fault_t fault, uint32_t calls);
+
+/*
+ * A slave holds SDA low: the bus stays busy until clocks SCL pulses on the recovery pins, which
+ * must be driven as outputs then. SDA reads low on its pin meanwhile, as it does in AF mode.
+ */
+void hal_sim_stuck_sda(I2C_HandleTypeDef *hi2c, uint8_t clocks);
+
+void hal_sim_spi_stats(const SPI_HandleTypeDef *hspi, hal_sim_bus_stats_t *stats);
+void hal_sim_i2c_stats(const I2C_HandleTypeDef *hi2c, hal_sim_bus_stats_t *stats);
+void hal_sim_clear_stats(void);
+
+/* C++ detection */
+#ifdef __cplusplus
+}
+#endif
+
+#endif
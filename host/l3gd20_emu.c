@@ -0,0 +1,279 @@
+#include "l3gd20_emu.h"
+
+#include <math.h>
+
+#define L3GD20_EMU_WHO_AM_I       0x0F
+#define L3GD20_EMU_CTRL_REG1      0x20
+#define L3GD20_EMU_CTRL_REG3      0x22
+#define L3GD20_EMU_CTRL_REG4      0x23
+#define L3GD20_EMU_CTRL_REG5      0x24
+#define L3GD20_EMU_OUT_TEMP       0x26
+#define L3GD20_EMU_STATUS_REG     0x27
+#define L3GD20_EMU_OUT_X_L        0x28
+#define L3GD20_EMU_OUT_Z_H        0x2D
+#define L3GD20_EMU_FIFO_CTRL      0x2E
+#define L3GD20_EMU_FIFO_SRC       0x2F
+
+#define L3GD20_EMU_CR1_AXES       0x07
+#define L3GD20_EMU_CR1_PD         0x08
+#define L3GD20_EMU_CR3_I2_EMPTY   0x01
+#define L3GD20_EMU_CR3_I2_ORUN    0x02
+#define L3GD20_EMU_CR3_I2_WTM     0x04
+#define L3GD20_EMU_CR3_I2_DRDY    0x08
+#define L3GD20_EMU_CR4_BLE        0x40
+#define L3GD20_EMU_CR4_BDU        0x80
+#define L3GD20_EMU_CR5_FIFO_EN    0x40
+
+/* private variables */
+static const uint32_t l3gd20_emu_odr_hz[4] = { 95, 190, 380, 760 };
+
+/* mdps per digit by the FS bits */
+static const float l3gd20_emu_mdps[4] = { 8.75f, 17.5f, 70.0f, 70.0f };
+
+/* private functions */
+static void l3gd20_emu_select(void *ctx);
+static uint8_t l3gd20_emu_exchange(void *ctx, uint8_t mosi);
+static void l3gd20_emu_deselect(void *ctx);
+static uint8_t l3gd20_emu_read(l3gd20_emu_t *emu, uint8_t address);
+static void l3gd20_emu_write(l3gd20_emu_t *emu, uint8_t address, uint8_t data);
+static bool l3gd20_emu_writable(uint8_t address);
+static void l3gd20_emu_fifo_mode(l3gd20_emu_t *emu);
+static void l3gd20_emu_tick(void *ctx);
+static void l3gd20_emu_update_pin(l3gd20_emu_t *emu);
+
+void l3gd20_emu_init(l3gd20_emu_t *emu) {
+    *emu = (l3gd20_emu_t) { 0 };
+    emu->reg[L3GD20_EMU_CTRL_REG1] = 0x07;
+    emu->temp = 25.0f;
+
+    emu_axes_reset(&emu->axes);
+}
+
+void l3gd20_emu_attach(l3gd20_emu_t *emu, SPI_HandleTypeDef *hspi, GPIO_TypeDef *cs_port, uint16_t cs_pin) {
+    hal_sim_spi_slave_t slave = { l3gd20_emu_select, l3gd20_emu_exchange, l3gd20_emu_deselect, emu };
+
+    hal_sim_attach_cs(hspi, cs_port, cs_pin, &slave);
+}
+
+void l3gd20_emu_attach_drdy(l3gd20_emu_t *emu, GPIO_TypeDef *port, uint16_t pin) {
+    emu->drdy_port = port;
+    emu->drdy_pin = pin;
+
+    l3gd20_emu_update_pin(emu);
+}
+
+void l3gd20_emu_set_rate(l3gd20_emu_t *emu, float x, float y, float z) {
+    emu->rate[0] = x;
+    emu->rate[1] = y;
+    emu->rate[2] = z;
+}
+
+void l3gd20_emu_set_source(l3gd20_emu_t *emu, emu_source_t source, void *ctx) {
+    emu->source = source;
+    emu->source_ctx = ctx;
+}
+
+void l3gd20_emu_set_temp(l3gd20_emu_t *emu, float temp) {
+    emu->temp = temp;
+}
+
+uint8_t l3gd20_emu_peek(const l3gd20_emu_t *emu, uint8_t address) {
+    l3gd20_emu_t copy = *emu;
+
+    /* a read on a copy, the pin of the copy is not driven */
+    copy.drdy_port = NULL;
+
+    return l3gd20_emu_read(&copy, address & (L3GD20_EMU_REGS - 1));
+}
+
+/* private functions */
+static void l3gd20_emu_select(void *ctx) {
+    l3gd20_emu_t *emu = ctx;
+
+    emu->command = true;
+}
+
+static uint8_t l3gd20_emu_exchange(void *ctx, uint8_t mosi) {
+    l3gd20_emu_t *emu = ctx;
+    uint8_t miso = 0xFF;
+
+    if (emu->command) {
+        emu->command = false;
+        emu->read = (mosi & 0x80) != 0;
+        emu->inc = (mosi & 0x40) != 0;
+        emu->address = mosi & 0x3F;
+        return miso;
+    }
+
+    if (emu->read) {
+        miso = l3gd20_emu_read(emu, emu->address);
+    } else {
+        l3gd20_emu_write(emu, emu->address, mosi);
+    }
+
+    if (emu->inc) {
+        /* the output registers wrap while the FIFO is enabled, a burst drains several samples */
+        if (emu->address == L3GD20_EMU_OUT_Z_H && emu_axes_fifo_on(&emu->axes)) {
+            emu->address = L3GD20_EMU_OUT_X_L;
+        } else {
+            emu->address = (emu->address + 1) & (L3GD20_EMU_REGS - 1);
+        }
+    }
+
+    return miso;
+}
+
+static void l3gd20_emu_deselect(void *ctx) {
+    l3gd20_emu_t *emu = ctx;
+
+    emu->command = false;
+}
+
+static uint8_t l3gd20_emu_read(l3gd20_emu_t *emu, uint8_t address) {
+    uint8_t cr4 = emu->reg[L3GD20_EMU_CTRL_REG4];
+    uint8_t value;
+    long temp;
+
+    switch (address) {
+    case L3GD20_EMU_WHO_AM_I:
+        return 0xD4;
+
+    case L3GD20_EMU_OUT_TEMP:
+        /* -1 digit per degC, 0 near 25 degC */
+        temp = lroundf(25.0f - emu->temp);
+        if (temp > 127) {
+            temp = 127;
+        } else if (temp < -128) {
+            temp = -128;
+        }
+        return (uint8_t) (int8_t) temp;
+
+    case L3GD20_EMU_STATUS_REG:
+        return emu->axes.status;
+
+    case L3GD20_EMU_FIFO_SRC:
+        return emu_axes_fifo_src(&emu->axes);
+
+    default:
+        break;
+    }
+
+    if (address >= L3GD20_EMU_OUT_X_L && address <= L3GD20_EMU_OUT_Z_H) {
+        value = emu_axes_read(&emu->axes, address - L3GD20_EMU_OUT_X_L, (cr4 & L3GD20_EMU_CR4_BLE) != 0, (cr4 & L3GD20_EMU_CR4_BDU) != 0);
+        l3gd20_emu_update_pin(emu);
+        return value;
+    }
+
+    /* reserved addresses read 0, the register file only holds what was written */
+    return emu->reg[address];
+}
+
+static void l3gd20_emu_write(l3gd20_emu_t *emu, uint8_t address, uint8_t data) {
+    if (!l3gd20_emu_writable(address)) {
+        return;
+    }
+
+    emu->reg[address] = data;
+
+    switch (address) {
+    case L3GD20_EMU_CTRL_REG1:
+        if ((data & L3GD20_EMU_CR1_PD) && !emu->running) {
+            emu->running = true;
+            emu->next_ns = hal_sim_now_ns() + 1000000000ull / l3gd20_emu_odr_hz[data >> 6];
+            hal_sim_schedule(emu->next_ns, l3gd20_emu_tick, emu);
+        }
+        break;
+
+    case L3GD20_EMU_CTRL_REG5:
+    case L3GD20_EMU_FIFO_CTRL:
+        l3gd20_emu_fifo_mode(emu);
+        l3gd20_emu_update_pin(emu);
+        break;
+
+    case L3GD20_EMU_CTRL_REG3:
+        l3gd20_emu_update_pin(emu);
+        break;
+
+    default:
+        break;
+    }
+}
+
+static bool l3gd20_emu_writable(uint8_t address) {
+    return (address >= L3GD20_EMU_CTRL_REG1 && address <= 0x25) || address == L3GD20_EMU_FIFO_CTRL || address == 0x30 ||
+           (address >= 0x32 && address <= 0x38);
+}
+
+static void l3gd20_emu_fifo_mode(l3gd20_emu_t *emu) {
+    uint8_t ctrl = emu->reg[L3GD20_EMU_FIFO_CTRL];
+    emu_axes_mode_t mode;
+
+    /* no interrupt generator is modelled: stream-to-FIFO keeps streaming, bypass-to-stream bypassing */
+    if (!(emu->reg[L3GD20_EMU_CTRL_REG5] & L3GD20_EMU_CR5_FIFO_EN)) {
+        mode = EMU_AXES_BYPASS;
+    } else if ((ctrl & 0xE0) == 0x20) {
+        mode = EMU_AXES_FIFO;
+    } else if ((ctrl & 0xE0) == 0x40 || (ctrl & 0xE0) == 0x60) {
+        mode = EMU_AXES_STREAM;
+    } else {
+        mode = EMU_AXES_BYPASS;
+    }
+
+    emu_axes_set_mode(&emu->axes, mode, ctrl & 0x1F);
+}
+
+static void l3gd20_emu_tick(void *ctx) {
+    l3gd20_emu_t *emu = ctx;
+    uint8_t cr1 = emu->reg[L3GD20_EMU_CTRL_REG1];
+    uint8_t cr4 = emu->reg[L3GD20_EMU_CTRL_REG4];
+    float mdps = l3gd20_emu_mdps[(cr4 >> 4) & 0x03];
+    float dps[3] = { emu->rate[0], emu->rate[1], emu->rate[2] };
+    int16_t v[3];
+    long raw;
+    uint8_t i;
+
+    if (!(cr1 & L3GD20_EMU_CR1_PD)) {
+        emu->running = false;
+        return;
+    }
+
+    if (emu->source != NULL) {
+        emu->source(emu->source_ctx, hal_sim_now_ns(), dps);
+    }
+
+    for (i = 0; i < 3; i++) {
+        raw = lroundf(dps[i] * 1000.0f / mdps);
+        if (raw > INT16_MAX) {
+            raw = INT16_MAX;
+        } else if (raw < INT16_MIN) {
+            raw = INT16_MIN;
+        }
+        v[i] = (int16_t) raw;
+    }
+
+    emu_axes_sample(&emu->axes, v, cr1 & L3GD20_EMU_CR1_AXES, (cr4 & L3GD20_EMU_CR4_BDU) != 0);
+    emu->samples++;
+
+    l3gd20_emu_update_pin(emu);
+
+    /* on the sensor clock, the period of the current DR bits */
+    emu->next_ns += 1000000000ull / l3gd20_emu_odr_hz[cr1 >> 6];
+    hal_sim_schedule(emu->next_ns, l3gd20_emu_tick, emu);
+}
+
+static void l3gd20_emu_update_pin(l3gd20_emu_t *emu) {
+    uint8_t cr3 = emu->reg[L3GD20_EMU_CTRL_REG3];
+    uint8_t src = emu_axes_fifo_src(&emu->axes);
+    bool level;
+
+    if (emu->drdy_port == NULL) {
+        return;
+    }
+
+    level = ((cr3 & L3GD20_EMU_CR3_I2_DRDY) && (emu->axes.status & EMU_AXES_SR_ZYXDA)) ||
+            ((cr3 & L3GD20_EMU_CR3_I2_WTM) && (src & EMU_AXES_SRC_WTM)) ||
+            ((cr3 & L3GD20_EMU_CR3_I2_ORUN) && (src & EMU_AXES_SRC_OVRN)) ||
+            ((cr3 & L3GD20_EMU_CR3_I2_EMPTY) && (src & EMU_AXES_SRC_EMPTY));
+
+    hal_sim_set_pin(emu->drdy_port, emu->drdy_pin, level ? GPIO_PIN_SET : GPIO_PIN_RESET);
+}
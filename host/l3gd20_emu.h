@@ -0,0 +1,62 @@
+#ifndef __L3GD20_EMU_H__
+#define __L3GD20_EMU_H__
+
+/* C++ detection */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hal_sim.h"
+#include "emu_axes.h"
+
+/*
+ * L3GD20 register emulator, an SPI slave of hal_sim
+ * The first byte of a transaction is RW (bit 7), MS (bit 6, auto-increment) and the address.
+ * Registers come up as after power-on: WHO_AM_I 0xD4, CTRL_REG1 0x07 (powered down). Setting PD
+ * starts sampling at the rate of the DR bits; each sample takes the source at that instant,
+ * scaled by the FS bits of CTRL_REG4 and clamped to 16 bits, for the axes that are enabled.
+ * STATUS_REG, BDU, BLE and the FIFO follow the datasheet, with the address wrapping from OUT_Z_H
+ * to OUT_X_L while the FIFO is enabled. The filters are not modelled, the output is the source.
+ * DRDY/INT2 follows ZYXDA and the FIFO flags selected in CTRL_REG3.
+ */
+
+#define L3GD20_EMU_REGS    0x40
+
+typedef struct {
+    uint8_t reg[L3GD20_EMU_REGS];   // control registers as written
+    emu_axes_t axes;
+    float rate[3];                  // dps when there is no source
+    emu_source_t source;
+    void *source_ctx;
+    float temp;                     // degC
+    GPIO_TypeDef *drdy_port;
+    uint16_t drdy_pin;
+    bool running;                   // a sample is scheduled
+    uint64_t next_ns;
+
+    /* SPI transaction */
+    bool command;                   // the next byte is the command
+    bool read;
+    bool inc;
+    uint8_t address;
+
+    uint32_t samples;               // taken since init
+} l3gd20_emu_t;
+
+void l3gd20_emu_init(l3gd20_emu_t *emu);    // power-on state, call after hal_sim_reset
+void l3gd20_emu_attach(l3gd20_emu_t *emu, SPI_HandleTypeDef *hspi, GPIO_TypeDef *cs_port, uint16_t cs_pin);
+void l3gd20_emu_attach_drdy(l3gd20_emu_t *emu, GPIO_TypeDef *port, uint16_t pin);    // DRDY/INT2
+void l3gd20_emu_set_rate(l3gd20_emu_t *emu, float x, float y, float z);    // constant dps
+void l3gd20_emu_set_source(l3gd20_emu_t *emu, emu_source_t source, void *ctx);    // dps over time, NULL for the constant rate
+void l3gd20_emu_set_temp(l3gd20_emu_t *emu, float temp);
+uint8_t l3gd20_emu_peek(const l3gd20_emu_t *emu, uint8_t address);    // as a read would return it, without its side effects
+
+/* C++ detection */
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,508 @@
+#include "lsm303dlhc_emu.h"
+
+#include <math.h>
+
+#define LSM303DLHC_EMU_ADDR_ACC       0x32
+#define LSM303DLHC_EMU_ADDR_MAG       0x3C
+
+#define LSM303DLHC_EMU_CTRL_REG1_A    0x20
+#define LSM303DLHC_EMU_CTRL_REG3_A    0x22
+#define LSM303DLHC_EMU_CTRL_REG4_A    0x23
+#define LSM303DLHC_EMU_CTRL_REG5_A    0x24
+#define LSM303DLHC_EMU_STATUS_REG_A   0x27
+#define LSM303DLHC_EMU_OUT_X_L_A      0x28
+#define LSM303DLHC_EMU_OUT_Z_H_A      0x2D
+#define LSM303DLHC_EMU_FIFO_CTRL_A    0x2E
+#define LSM303DLHC_EMU_FIFO_SRC_A     0x2F
+
+#define LSM303DLHC_EMU_CR1A_AXES      0x07
+#define LSM303DLHC_EMU_CR1A_LPEN      0x08
+#define LSM303DLHC_EMU_CR3A_OVERRUN   0x02
+#define LSM303DLHC_EMU_CR3A_WTM       0x04
+#define LSM303DLHC_EMU_CR3A_DRDY1     0x10
+#define LSM303DLHC_EMU_CR4A_HR        0x08
+#define LSM303DLHC_EMU_CR4A_BLE       0x40
+#define LSM303DLHC_EMU_CR4A_BDU       0x80
+#define LSM303DLHC_EMU_CR5A_FIFO_EN   0x40
+
+#define LSM303DLHC_EMU_CRA_M          0x00
+#define LSM303DLHC_EMU_CRB_M          0x01
+#define LSM303DLHC_EMU_MR_M           0x02
+#define LSM303DLHC_EMU_OUT_X_H_M      0x03
+#define LSM303DLHC_EMU_OUT_Y_L_M      0x08
+#define LSM303DLHC_EMU_SR_M           0x09
+#define LSM303DLHC_EMU_IRA_M          0x0A
+#define LSM303DLHC_EMU_TEMP_OUT_H_M   0x31
+#define LSM303DLHC_EMU_TEMP_OUT_L_M   0x32
+
+#define LSM303DLHC_EMU_SR_DRDY        0x01
+#define LSM303DLHC_EMU_SR_LOCK        0x02
+#define LSM303DLHC_EMU_CRA_TEMP_EN    0x80
+#define LSM303DLHC_EMU_MR_SINGLE      0x01
+#define LSM303DLHC_EMU_MR_SLEEP       0x03
+
+/* private variables */
+
+/* mHz by ODR3..0 of CTRL_REG1_A, the last one is 5376 Hz in low-power mode */
+static const uint32_t lsm303dlhc_emu_acc_odr[10] = { 0, 1000, 10000, 25000, 50000, 100000, 200000, 400000, 1620000, 1344000 };
+
+/* mg per 12 bit digit by FS */
+static const float lsm303dlhc_emu_acc_mg[4] = { 1.0f, 2.0f, 4.0f, 12.0f };
+
+/* mHz by DO2..0 of CRA_REG_M */
+static const uint32_t lsm303dlhc_emu_mag_odr[8] = { 750, 1500, 3000, 7500, 15000, 30000, 75000, 220000 };
+
+/* lsb per gauss of x/y and z by GN2..0 of CRB_REG_M, GN 0 is not a valid setting and behaves as 1 */
+static const float lsm303dlhc_emu_mag_lsb[8][2] = {
+    { 1100, 980 }, { 1100, 980 }, { 855, 760 }, { 670, 600 }, { 450, 400 }, { 400, 355 }, { 330, 295 }, { 230, 205 }
+};
+
+/* OUT_X_H_M .. OUT_Y_L_M carry X, Z, Y */
+static const uint8_t lsm303dlhc_emu_mag_axis[3] = { 0, 2, 1 };
+
+/* private functions */
+static bool lsm303dlhc_emu_acc_start(void *ctx, bool read);
+static bool lsm303dlhc_emu_acc_write(void *ctx, uint8_t data);
+static uint8_t lsm303dlhc_emu_acc_read(void *ctx);
+static bool lsm303dlhc_emu_mag_start(void *ctx, bool read);
+static bool lsm303dlhc_emu_mag_write(void *ctx, uint8_t data);
+static uint8_t lsm303dlhc_emu_mag_read(void *ctx);
+static void lsm303dlhc_emu_stop(void *ctx);
+static uint8_t lsm303dlhc_emu_acc_reg_read(lsm303dlhc_emu_acc_t *acc, uint8_t address);
+static void lsm303dlhc_emu_acc_reg_write(lsm303dlhc_emu_acc_t *acc, uint8_t address, uint8_t data);
+static bool lsm303dlhc_emu_acc_writable(uint8_t address);
+static uint64_t lsm303dlhc_emu_acc_period_ns(uint8_t ctrl_reg1_a);
+static void lsm303dlhc_emu_acc_fifo_mode(lsm303dlhc_emu_acc_t *acc);
+static void lsm303dlhc_emu_acc_tick(void *ctx);
+static void lsm303dlhc_emu_acc_update_pin(lsm303dlhc_emu_acc_t *acc);
+static uint8_t lsm303dlhc_emu_mag_reg_read(lsm303dlhc_emu_mag_t *mag, uint8_t address);
+static void lsm303dlhc_emu_mag_reg_write(lsm303dlhc_emu_mag_t *mag, uint8_t address, uint8_t data);
+static uint64_t lsm303dlhc_emu_mag_period_ns(uint8_t cra_reg_m);
+static void lsm303dlhc_emu_mag_tick(void *ctx);
+static void lsm303dlhc_emu_mag_update_pin(lsm303dlhc_emu_mag_t *mag);
+
+void lsm303dlhc_emu_init(lsm303dlhc_emu_t *emu) {
+    *emu = (lsm303dlhc_emu_t) { 0 };
+    emu->temp = 25.0f;
+
+    emu->acc.reg[LSM303DLHC_EMU_CTRL_REG1_A] = 0x07;
+    emu_axes_reset(&emu->acc.axes);
+
+    emu->mag.reg[LSM303DLHC_EMU_CRA_M] = 0x10;
+    emu->mag.reg[LSM303DLHC_EMU_CRB_M] = 0x20;
+    emu->mag.reg[LSM303DLHC_EMU_MR_M] = LSM303DLHC_EMU_MR_SLEEP;
+    emu->mag.temp = &emu->temp;
+}
+
+void lsm303dlhc_emu_attach(lsm303dlhc_emu_t *emu, I2C_HandleTypeDef *hi2c) {
+    hal_sim_i2c_slave_t acc = { lsm303dlhc_emu_acc_start, lsm303dlhc_emu_acc_write, lsm303dlhc_emu_acc_read, lsm303dlhc_emu_stop, &emu->acc };
+    hal_sim_i2c_slave_t mag = { lsm303dlhc_emu_mag_start, lsm303dlhc_emu_mag_write, lsm303dlhc_emu_mag_read, lsm303dlhc_emu_stop, &emu->mag };
+
+    hal_sim_attach_i2c_slave(hi2c, LSM303DLHC_EMU_ADDR_ACC, &acc);
+    hal_sim_attach_i2c_slave(hi2c, LSM303DLHC_EMU_ADDR_MAG, &mag);
+}
+
+void lsm303dlhc_emu_attach_int1(lsm303dlhc_emu_t *emu, GPIO_TypeDef *port, uint16_t pin) {
+    emu->acc.int1_port = port;
+    emu->acc.int1_pin = pin;
+
+    lsm303dlhc_emu_acc_update_pin(&emu->acc);
+}
+
+void lsm303dlhc_emu_attach_drdy(lsm303dlhc_emu_t *emu, GPIO_TypeDef *port, uint16_t pin) {
+    emu->mag.drdy_port = port;
+    emu->mag.drdy_pin = pin;
+
+    lsm303dlhc_emu_mag_update_pin(&emu->mag);
+}
+
+void lsm303dlhc_emu_set_acc(lsm303dlhc_emu_t *emu, float x, float y, float z) {
+    emu->acc.value[0] = x;
+    emu->acc.value[1] = y;
+    emu->acc.value[2] = z;
+}
+
+void lsm303dlhc_emu_set_acc_source(lsm303dlhc_emu_t *emu, emu_source_t source, void *ctx) {
+    emu->acc.source = source;
+    emu->acc.source_ctx = ctx;
+}
+
+void lsm303dlhc_emu_set_mag(lsm303dlhc_emu_t *emu, float x, float y, float z) {
+    emu->mag.value[0] = x;
+    emu->mag.value[1] = y;
+    emu->mag.value[2] = z;
+}
+
+void lsm303dlhc_emu_set_mag_source(lsm303dlhc_emu_t *emu, emu_source_t source, void *ctx) {
+    emu->mag.source = source;
+    emu->mag.source_ctx = ctx;
+}
+
+void lsm303dlhc_emu_set_temp(lsm303dlhc_emu_t *emu, float temp) {
+    emu->temp = temp;
+}
+
+/* private functions */
+static bool lsm303dlhc_emu_acc_start(void *ctx, bool read) {
+    lsm303dlhc_emu_acc_t *acc = ctx;
+
+    acc->subaddress = !read;
+
+    return true;
+}
+
+static bool lsm303dlhc_emu_acc_write(void *ctx, uint8_t data) {
+    lsm303dlhc_emu_acc_t *acc = ctx;
+
+    if (acc->subaddress) {
+        acc->subaddress = false;
+        acc->inc = (data & 0x80) != 0;
+        acc->pointer = data & 0x7F;
+        return true;
+    }
+
+    lsm303dlhc_emu_acc_reg_write(acc, acc->pointer, data);
+
+    if (acc->inc) {
+        acc->pointer = (acc->pointer + 1) & 0x7F;
+    }
+
+    return true;
+}
+
+static uint8_t lsm303dlhc_emu_acc_read(void *ctx) {
+    lsm303dlhc_emu_acc_t *acc = ctx;
+    uint8_t value = lsm303dlhc_emu_acc_reg_read(acc, acc->pointer);
+
+    if (acc->inc) {
+        /* the output registers wrap while the FIFO is enabled */
+        if (acc->pointer == LSM303DLHC_EMU_OUT_Z_H_A && emu_axes_fifo_on(&acc->axes)) {
+            acc->pointer = LSM303DLHC_EMU_OUT_X_L_A;
+        } else {
+            acc->pointer = (acc->pointer + 1) & 0x7F;
+        }
+    }
+
+    return value;
+}
+
+static bool lsm303dlhc_emu_mag_start(void *ctx, bool read) {
+    lsm303dlhc_emu_mag_t *mag = ctx;
+
+    mag->subaddress = !read;
+
+    return true;
+}
+
+static bool lsm303dlhc_emu_mag_write(void *ctx, uint8_t data) {
+    lsm303dlhc_emu_mag_t *mag = ctx;
+
+    if (mag->subaddress) {
+        mag->subaddress = false;
+        mag->pointer = data;
+        return true;
+    }
+
+    lsm303dlhc_emu_mag_reg_write(mag, mag->pointer, data);
+    mag->pointer++;
+
+    return true;
+}
+
+static uint8_t lsm303dlhc_emu_mag_read(void *ctx) {
+    lsm303dlhc_emu_mag_t *mag = ctx;
+    uint8_t value = lsm303dlhc_emu_mag_reg_read(mag, mag->pointer);
+
+    mag->pointer = (mag->pointer == LSM303DLHC_EMU_OUT_Y_L_M) ? LSM303DLHC_EMU_OUT_X_H_M : mag->pointer + 1;
+
+    return value;
+}
+
+static void lsm303dlhc_emu_stop(void *ctx) {
+    (void) ctx;
+}
+
+static uint8_t lsm303dlhc_emu_acc_reg_read(lsm303dlhc_emu_acc_t *acc, uint8_t address) {
+    uint8_t cr4 = acc->reg[LSM303DLHC_EMU_CTRL_REG4_A];
+    uint8_t value;
+
+    if (address >= LSM303DLHC_EMU_ACC_REGS) {
+        return 0;
+    }
+
+    if (address == LSM303DLHC_EMU_STATUS_REG_A) {
+        return acc->axes.status;
+    }
+
+    if (address == LSM303DLHC_EMU_FIFO_SRC_A) {
+        return emu_axes_fifo_src(&acc->axes);
+    }
+
+    if (address >= LSM303DLHC_EMU_OUT_X_L_A && address <= LSM303DLHC_EMU_OUT_Z_H_A) {
+        value = emu_axes_read(&acc->axes, address - LSM303DLHC_EMU_OUT_X_L_A, (cr4 & LSM303DLHC_EMU_CR4A_BLE) != 0, (cr4 & LSM303DLHC_EMU_CR4A_BDU) != 0);
+        lsm303dlhc_emu_acc_update_pin(acc);
+        return value;
+    }
+
+    return acc->reg[address];
+}
+
+static void lsm303dlhc_emu_acc_reg_write(lsm303dlhc_emu_acc_t *acc, uint8_t address, uint8_t data) {
+    if (!lsm303dlhc_emu_acc_writable(address)) {
+        return;
+    }
+
+    acc->reg[address] = data;
+
+    switch (address) {
+    case LSM303DLHC_EMU_CTRL_REG1_A:
+        if (lsm303dlhc_emu_acc_period_ns(data) != 0 && !acc->running) {
+            acc->running = true;
+            acc->next_ns = hal_sim_now_ns() + lsm303dlhc_emu_acc_period_ns(data);
+            hal_sim_schedule(acc->next_ns, lsm303dlhc_emu_acc_tick, acc);
+        }
+        break;
+
+    case LSM303DLHC_EMU_CTRL_REG5_A:
+    case LSM303DLHC_EMU_FIFO_CTRL_A:
+        lsm303dlhc_emu_acc_fifo_mode(acc);
+        lsm303dlhc_emu_acc_update_pin(acc);
+        break;
+
+    case LSM303DLHC_EMU_CTRL_REG3_A:
+        lsm303dlhc_emu_acc_update_pin(acc);
+        break;
+
+    default:
+        break;
+    }
+}
+
+static bool lsm303dlhc_emu_acc_writable(uint8_t address) {
+    return (address >= LSM303DLHC_EMU_CTRL_REG1_A && address <= 0x26) || address == LSM303DLHC_EMU_FIFO_CTRL_A || address == 0x30 ||
+           (address >= 0x32 && address <= 0x34) || (address >= 0x36 && address <= 0x38) || (address >= 0x3A && address <= 0x3D);
+}
+
+static uint64_t lsm303dlhc_emu_acc_period_ns(uint8_t ctrl_reg1_a) {
+    uint8_t odr = ctrl_reg1_a >> 4;
+    uint32_t mhz;
+
+    if (odr == 0 || odr >= sizeof(lsm303dlhc_emu_acc_odr) / sizeof(lsm303dlhc_emu_acc_odr[0])) {
+        return 0;
+    }
+
+    mhz = (odr == 9 && (ctrl_reg1_a & LSM303DLHC_EMU_CR1A_LPEN)) ? 5376000 : lsm303dlhc_emu_acc_odr[odr];
+
+    return 1000000000000ull / mhz;
+}
+
+static void lsm303dlhc_emu_acc_fifo_mode(lsm303dlhc_emu_acc_t *acc) {
+    uint8_t ctrl = acc->reg[LSM303DLHC_EMU_FIFO_CTRL_A];
+    emu_axes_mode_t mode;
+
+    /* no interrupt generator is modelled, the trigger mode keeps streaming */
+    if (!(acc->reg[LSM303DLHC_EMU_CTRL_REG5_A] & LSM303DLHC_EMU_CR5A_FIFO_EN) || (ctrl & 0xC0) == 0x00) {
+        mode = EMU_AXES_BYPASS;
+    } else if ((ctrl & 0xC0) == 0x40) {
+        mode = EMU_AXES_FIFO;
+    } else {
+        mode = EMU_AXES_STREAM;
+    }
+
+    emu_axes_set_mode(&acc->axes, mode, ctrl & 0x1F);
+}
+
+static void lsm303dlhc_emu_acc_tick(void *ctx) {
+    lsm303dlhc_emu_acc_t *acc = ctx;
+    uint8_t cr1 = acc->reg[LSM303DLHC_EMU_CTRL_REG1_A];
+    uint8_t cr4 = acc->reg[LSM303DLHC_EMU_CTRL_REG4_A];
+    uint64_t period = lsm303dlhc_emu_acc_period_ns(cr1);
+    float mg[3] = { acc->value[0], acc->value[1], acc->value[2] };
+    uint16_t mask;
+    int16_t v[3];
+    long count;
+    uint8_t i;
+
+    if (period == 0) {
+        acc->running = false;
+        return;
+    }
+
+    if (acc->source != NULL) {
+        acc->source(acc->source_ctx, hal_sim_now_ns(), mg);
+    }
+
+    /* left-justified, the low bits below the resolution of the mode read 0 */
+    if (cr4 & LSM303DLHC_EMU_CR4A_HR) {
+        mask = 0xFFF0;
+    } else if (cr1 & LSM303DLHC_EMU_CR1A_LPEN) {
+        mask = 0xFF00;
+    } else {
+        mask = 0xFFC0;
+    }
+
+    for (i = 0; i < 3; i++) {
+        count = lroundf(mg[i] / lsm303dlhc_emu_acc_mg[(cr4 >> 4) & 0x03]);
+        if (count > 2047) {
+            count = 2047;
+        } else if (count < -2048) {
+            count = -2048;
+        }
+        v[i] = (int16_t) ((uint16_t) (count * 16) & mask);
+    }
+
+    emu_axes_sample(&acc->axes, v, cr1 & LSM303DLHC_EMU_CR1A_AXES, (cr4 & LSM303DLHC_EMU_CR4A_BDU) != 0);
+    acc->samples++;
+
+    lsm303dlhc_emu_acc_update_pin(acc);
+
+    acc->next_ns += period;
+    hal_sim_schedule(acc->next_ns, lsm303dlhc_emu_acc_tick, acc);
+}
+
+static void lsm303dlhc_emu_acc_update_pin(lsm303dlhc_emu_acc_t *acc) {
+    uint8_t cr3 = acc->reg[LSM303DLHC_EMU_CTRL_REG3_A];
+    uint8_t src = emu_axes_fifo_src(&acc->axes);
+    bool level;
+
+    if (acc->int1_port == NULL) {
+        return;
+    }
+
+    level = ((cr3 & LSM303DLHC_EMU_CR3A_DRDY1) && (acc->axes.status & EMU_AXES_SR_ZYXDA)) ||
+            ((cr3 & LSM303DLHC_EMU_CR3A_WTM) && (src & EMU_AXES_SRC_WTM)) ||
+            ((cr3 & LSM303DLHC_EMU_CR3A_OVERRUN) && (src & EMU_AXES_SRC_OVRN));
+
+    hal_sim_set_pin(acc->int1_port, acc->int1_pin, level ? GPIO_PIN_SET : GPIO_PIN_RESET);
+}
+
+static uint8_t lsm303dlhc_emu_mag_reg_read(lsm303dlhc_emu_mag_t *mag, uint8_t address) {
+    static const uint8_t ir[3] = { 0x48, 0x34, 0x33 };
+    uint8_t index;
+    int16_t value;
+
+    if (address >= LSM303DLHC_EMU_OUT_X_H_M && address <= LSM303DLHC_EMU_OUT_Y_L_M) {
+        index = address - LSM303DLHC_EMU_OUT_X_H_M;
+
+        /* the first output read locks the registers, the last one releases them */
+        if (!(mag->sr & LSM303DLHC_EMU_SR_LOCK)) {
+            mag->sr = (mag->sr & ~LSM303DLHC_EMU_SR_DRDY) | LSM303DLHC_EMU_SR_LOCK;
+            lsm303dlhc_emu_mag_update_pin(mag);
+        }
+
+        value = mag->out[lsm303dlhc_emu_mag_axis[index / 2]];
+
+        if (address == LSM303DLHC_EMU_OUT_Y_L_M) {
+            mag->sr &= ~LSM303DLHC_EMU_SR_LOCK;
+
+            if (mag->pending) {
+                mag->pending = false;
+                mag->out[0] = mag->held[0];
+                mag->out[1] = mag->held[1];
+                mag->out[2] = mag->held[2];
+                mag->sr |= LSM303DLHC_EMU_SR_DRDY;
+                lsm303dlhc_emu_mag_update_pin(mag);
+            }
+        }
+
+        return (index & 1) ? (uint8_t) value : (uint8_t) ((uint16_t) value >> 8);
+    }
+
+    switch (address) {
+    case LSM303DLHC_EMU_CRA_M:
+    case LSM303DLHC_EMU_CRB_M:
+    case LSM303DLHC_EMU_MR_M:
+        return mag->reg[address];
+
+    case LSM303DLHC_EMU_SR_M:
+        return mag->sr;
+
+    case LSM303DLHC_EMU_IRA_M:
+    case LSM303DLHC_EMU_IRA_M + 1:
+    case LSM303DLHC_EMU_IRA_M + 2:
+        return ir[address - LSM303DLHC_EMU_IRA_M];
+
+    case LSM303DLHC_EMU_TEMP_OUT_H_M:
+        return (uint8_t) ((uint16_t) mag->temp_out >> 8);
+
+    case LSM303DLHC_EMU_TEMP_OUT_L_M:
+        return (uint8_t) mag->temp_out;
+
+    default:
+        return 0;
+    }
+}
+
+static void lsm303dlhc_emu_mag_reg_write(lsm303dlhc_emu_mag_t *mag, uint8_t address, uint8_t data) {
+    if (address > LSM303DLHC_EMU_MR_M) {
+        return;
+    }
+
+    mag->reg[address] = data;
+
+    /* continuous or single conversion */
+    if (address == LSM303DLHC_EMU_MR_M && (data & 0x03) <= LSM303DLHC_EMU_MR_SINGLE && !mag->running) {
+        mag->running = true;
+        mag->next_ns = hal_sim_now_ns() + lsm303dlhc_emu_mag_period_ns(mag->reg[LSM303DLHC_EMU_CRA_M]);
+        hal_sim_schedule(mag->next_ns, lsm303dlhc_emu_mag_tick, mag);
+    }
+}
+
+static uint64_t lsm303dlhc_emu_mag_period_ns(uint8_t cra_reg_m) {
+    return 1000000000000ull / lsm303dlhc_emu_mag_odr[(cra_reg_m >> 2) & 0x07];
+}
+
+static void lsm303dlhc_emu_mag_tick(void *ctx) {
+    lsm303dlhc_emu_mag_t *mag = ctx;
+    uint8_t mode = mag->reg[LSM303DLHC_EMU_MR_M] & 0x03;
+    const float *lsb = lsm303dlhc_emu_mag_lsb[mag->reg[LSM303DLHC_EMU_CRB_M] >> 5];
+    float gauss[3] = { mag->value[0], mag->value[1], mag->value[2] };
+    int16_t *v;
+    long raw;
+    uint8_t i;
+
+    if (mode > LSM303DLHC_EMU_MR_SINGLE) {
+        mag->running = false;
+        return;
+    }
+
+    if (mag->source != NULL) {
+        mag->source(mag->source_ctx, hal_sim_now_ns(), gauss);
+    }
+
+    /* a conversion while the outputs are being read waits for the last byte */
+    if (mag->sr & LSM303DLHC_EMU_SR_LOCK) {
+        v = mag->held;
+        mag->pending = true;
+    } else {
+        v = mag->out;
+        mag->sr |= LSM303DLHC_EMU_SR_DRDY;
+    }
+
+    for (i = 0; i < 3; i++) {
+        raw = lroundf(gauss[i] * lsb[(i == 2) ? 1 : 0]);
+        v[i] = (raw > 2047 || raw < -2048) ? -4096 : (int16_t) raw;
+    }
+
+    if (mag->reg[LSM303DLHC_EMU_CRA_M] & LSM303DLHC_EMU_CRA_TEMP_EN) {
+        mag->temp_out = (int16_t) (lroundf((*mag->temp - 25.0f) * 8.0f) * 16);
+    }
+
+    mag->samples++;
+    lsm303dlhc_emu_mag_update_pin(mag);
+
+    if (mode == LSM303DLHC_EMU_MR_SINGLE) {
+        mag->reg[LSM303DLHC_EMU_MR_M] = (mag->reg[LSM303DLHC_EMU_MR_M] & ~0x03) | LSM303DLHC_EMU_MR_SLEEP;
+        mag->running = false;
+        return;
+    }
+
+    mag->next_ns += lsm303dlhc_emu_mag_period_ns(mag->reg[LSM303DLHC_EMU_CRA_M]);
+    hal_sim_schedule(mag->next_ns, lsm303dlhc_emu_mag_tick, mag);
+}
+
+static void lsm303dlhc_emu_mag_update_pin(lsm303dlhc_emu_mag_t *mag) {
+    if (mag->drdy_port != NULL) {
+        hal_sim_set_pin(mag->drdy_port, mag->drdy_pin, (mag->sr & LSM303DLHC_EMU_SR_DRDY) ? GPIO_PIN_SET : GPIO_PIN_RESET);
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef __LSM303DLHC_EMU_H__
+#define __LSM303DLHC_EMU_H__
+
+/* C++ detection */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hal_sim.h"
+#include "emu_axes.h"
+
+/*
+ * LSM303DLHC register emulator, two I2C slaves of hal_sim
+ * Accelerometer at 0x32: the MSB of the sub-address turns on auto-increment, the pointer stays
+ * across a STOP. CTRL_REG1_A comes up as 0x07 (powered down); the ODR bits start sampling. The
+ * source in mg is converted at 1, 2, 4 or 12 mg per 12 bit digit by FS, clamped, left-justified
+ * and cut to 12 bits with HR, 8 with LPen, 10 otherwise. STATUS_REG_A, BDU, BLE and the FIFO are
+ * the ones of the L3GD20 (emu_axes.h), the trigger mode streams. INT1 follows the I1_DRDY1,
+ * I1_WTM and I1_OVERRUN sources of CTRL_REG3_A.
+ *
+ * Magnetometer at 0x3C: the pointer always increments and rolls from OUT_Y_L_M back to OUT_X_H_M.
+ * CRA 0x10, CRB 0x20 and MR 0x03 (sleep) after power-on. Continuous mode converts at the DO rate,
+ * single mode once after one period and then sleeps. Outputs are X, Z, Y high byte first at the
+ * gain of CRB, an axis beyond +-2047 reads -4096. Reading the first output byte clears DRDY and
+ * sets LOCK in SR_REG_M, conversions are held until the last byte is read. TEMP_OUT follows the
+ * die temperature at 8 digits per degC from 25 degC while TEMP_EN is set. DRDY is always driven.
+ */
+
+#define LSM303DLHC_EMU_ACC_REGS    0x40
+#define LSM303DLHC_EMU_MAG_REGS    0x33
+
+typedef struct {
+    uint8_t reg[LSM303DLHC_EMU_ACC_REGS];
+    emu_axes_t axes;
+    float value[3];                 // mg when there is no source
+    emu_source_t source;
+    void *source_ctx;
+    GPIO_TypeDef *int1_port;
+    uint16_t int1_pin;
+    bool running;
+    uint64_t next_ns;
+    bool subaddress;                // the next written byte is the sub-address
+    bool inc;
+    uint8_t pointer;
+    uint32_t samples;
+} lsm303dlhc_emu_acc_t;
+
+typedef struct {
+    uint8_t reg[LSM303DLHC_EMU_MAG_REGS];
+    int16_t out[3];                 // X, Y, Z as the output registers show them
+    int16_t held[3];                // converted while locked
+    bool pending;
+    uint8_t sr;
+    int16_t temp_out;
+    float value[3];                 // gauss when there is no source
+    emu_source_t source;
+    void *source_ctx;
+    GPIO_TypeDef *drdy_port;
+    uint16_t drdy_pin;
+    bool running;
+    uint64_t next_ns;
+    bool subaddress;
+    uint8_t pointer;
+    uint32_t samples;
+    const float *temp;              // degC of the package, lsm303dlhc_emu_t::temp
+} lsm303dlhc_emu_mag_t;
+
+typedef struct {
+    lsm303dlhc_emu_acc_t acc;
+    lsm303dlhc_emu_mag_t mag;
+    float temp;                     // degC
+} lsm303dlhc_emu_t;
+
+void lsm303dlhc_emu_init(lsm303dlhc_emu_t *emu);    // power-on state, call after hal_sim_reset
+void lsm303dlhc_emu_attach(lsm303dlhc_emu_t *emu, I2C_HandleTypeDef *hi2c);    // both slave addresses
+void lsm303dlhc_emu_attach_int1(lsm303dlhc_emu_t *emu, GPIO_TypeDef *port, uint16_t pin);
+void lsm303dlhc_emu_attach_drdy(lsm303dlhc_emu_t *emu, GPIO_TypeDef *port, uint16_t pin);
+void lsm303dlhc_emu_set_acc(lsm303dlhc_emu_t *emu, float x, float y, float z);    // constant mg
+void lsm303dlhc_emu_set_acc_source(lsm303dlhc_emu_t *emu, emu_source_t source, void *ctx);
+void lsm303dlhc_emu_set_mag(lsm303dlhc_emu_t *emu, float x, float y, float z);    // constant gauss
+void lsm303dlhc_emu_set_mag_source(lsm303dlhc_emu_t *emu, emu_source_t source, void *ctx);
+void lsm303dlhc_emu_set_temp(lsm303dlhc_emu_t *emu, float temp);
+
+/* C++ detection */
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef __STM32F3XX_HAL_H__
+#define __STM32F3XX_HAL_H__
+
+/* C++ detection */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * host stand-in of the STM32CubeF3 HAL
+ * Declares the part of the HAL the drivers use, with the same status, state and error codes, and
+ * a few CMSIS intrinsics. The calls are implemented by hal_sim.c on a virtual clock, bus traffic
+ * goes to the sensor emulators attached there. Handles carry the fields the HAL itself keeps
+ * (lock, state, error code); the peripheral configuration is not modelled, set the bus clocks
+ * with hal_sim_attach_spi and hal_sim_attach_i2c instead.
+ */
+
+#define __weak    __attribute__((weak))
+
+typedef enum {
+    HAL_OK = 0x00,
+    HAL_ERROR = 0x01,
+    HAL_BUSY = 0x02,
+    HAL_TIMEOUT = 0x03
+} HAL_StatusTypeDef;
+
+typedef enum {
+    HAL_UNLOCKED = 0x00,
+    HAL_LOCKED = 0x01
+} HAL_LockTypeDef;
+
+typedef enum {
+    RESET = 0,
+    SET = !RESET
+} FlagStatus;
+
+uint32_t HAL_GetTick(void);         // ms of virtual time
+void HAL_Delay(uint32_t delay);     // advances virtual time, interrupts are served meanwhile
+
+/* CMSIS, masking defers the simulated interrupts */
+uint32_t __get_PRIMASK(void);
+void __set_PRIMASK(uint32_t primask);
+void __disable_irq(void);
+void __enable_irq(void);
+
+/* GPIO */
+typedef struct {
+    volatile uint32_t IDR;      // pin levels, outputs read back what they drive
+    volatile uint32_t ODR;
+    uint32_t mode[16];          // host: GPIO_MODE_* of every pin
+} GPIO_TypeDef;
+
+typedef struct {
+    uint32_t Pin;
+    uint32_t Mode;
+    uint32_t Pull;
+    uint32_t Speed;
+    uint32_t Alternate;
+} GPIO_InitTypeDef;
+
+typedef enum {
+    GPIO_PIN_RESET = 0,
+    GPIO_PIN_SET
+} GPIO_PinState;
+
+extern GPIO_TypeDef hal_sim_gpio[6];
+
+#define GPIOA    (&hal_sim_gpio[0])
+#define GPIOB    (&hal_sim_gpio[1])
+#define GPIOC    (&hal_sim_gpio[2])
+#define GPIOD    (&hal_sim_gpio[3])
+#define GPIOE    (&hal_sim_gpio[4])
+#define GPIOF    (&hal_sim_gpio[5])
+
+#define GPIO_PIN_0      ((uint16_t) 0x0001)
+#define GPIO_PIN_1      ((uint16_t) 0x0002)
+#define GPIO_PIN_2      ((uint16_t) 0x0004)
+#define GPIO_PIN_3      ((uint16_t) 0x0008)
+#define GPIO_PIN_4      ((uint16_t) 0x0010)
+#define GPIO_PIN_5      ((uint16_t) 0x0020)
+#define GPIO_PIN_6      ((uint16_t) 0x0040)
+#define GPIO_PIN_7      ((uint16_t) 0x0080)
+#define GPIO_PIN_8      ((uint16_t) 0x0100)
+#define GPIO_PIN_9      ((uint16_t) 0x0200)
+#define GPIO_PIN_10     ((uint16_t) 0x0400)
+#define GPIO_PIN_11     ((uint16_t) 0x0800)
+#define GPIO_PIN_12     ((uint16_t) 0x1000)
+#define GPIO_PIN_13     ((uint16_t) 0x2000)
+#define GPIO_PIN_14     ((uint16_t) 0x4000)
+#define GPIO_PIN_15     ((uint16_t) 0x8000)
+#define GPIO_PIN_All    ((uint16_t) 0xFFFF)
+
+#define GPIO_MODE_INPUT         0x00000000u
+#define GPIO_MODE_OUTPUT_PP     0x00000001u
+#define GPIO_MODE_OUTPUT_OD     0x00000011u
+#define GPIO_MODE_AF_PP         0x00000002u
+#define GPIO_MODE_AF_OD         0x00000012u
+#define GPIO_MODE_ANALOG        0x00000003u
+#define GPIO_MODE_IT_RISING     0x10110000u
+#define GPIO_MODE_IT_FALLING    0x10210000u
+
+#define GPIO_NOPULL      0x00000000u
+#define GPIO_PULLUP      0x00000001u
+#define GPIO_PULLDOWN    0x00000002u
+
+#define GPIO_SPEED_FREQ_LOW       0x00000000u
+#define GPIO_SPEED_FREQ_MEDIUM    0x00000001u
+#define GPIO_SPEED_FREQ_HIGH      0x00000003u
+
+void HAL_GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_Init);
+void HAL_GPIO_DeInit(GPIO_TypeDef *GPIOx, uint32_t GPIO_Pin);
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin);
+
+/* SPI */
+typedef enum {
+    HAL_SPI_STATE_RESET = 0x00,
+    HAL_SPI_STATE_READY = 0x01,
+    HAL_SPI_STATE_BUSY = 0x02,
+    HAL_SPI_STATE_BUSY_TX = 0x03,
+    HAL_SPI_STATE_BUSY_RX = 0x04,
+    HAL_SPI_STATE_BUSY_TX_RX = 0x05,
+    HAL_SPI_STATE_ERROR = 0x06,
+    HAL_SPI_STATE_ABORT = 0x07
+} HAL_SPI_StateTypeDef;
+
+#define HAL_SPI_ERROR_NONE     0x00000000u
+#define HAL_SPI_ERROR_MODF     0x00000001u
+#define HAL_SPI_ERROR_CRC      0x00000002u
+#define HAL_SPI_ERROR_OVR      0x00000004u
+#define HAL_SPI_ERROR_FRE      0x00000008u
+#define HAL_SPI_ERROR_DMA      0x00000010u
+#define HAL_SPI_ERROR_FLAG     0x00000020u
+#define HAL_SPI_ERROR_ABORT    0x00000040u
+
+typedef struct __SPI_HandleTypeDef {
+    HAL_LockTypeDef Lock;
+    volatile HAL_SPI_StateTypeDef State;
+    volatile uint32_t ErrorCode;
+    struct hal_sim_spi *sim;    // host: bus model, set by hal_sim_attach_spi
+} SPI_HandleTypeDef;
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size);
+HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef *hspi);
+HAL_SPI_StateTypeDef HAL_SPI_GetState(SPI_HandleTypeDef *hspi);
+uint32_t HAL_SPI_GetError(SPI_HandleTypeDef *hspi);
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi);
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi);
+
+/* I2C */
+typedef struct {
+    volatile uint32_t ISR;
+} I2C_TypeDef;
+
+typedef enum {
+    HAL_I2C_STATE_RESET = 0x00,
+    HAL_I2C_STATE_READY = 0x20,
+    HAL_I2C_STATE_BUSY = 0x24,
+    HAL_I2C_STATE_BUSY_TX = 0x21,
+    HAL_I2C_STATE_BUSY_RX = 0x22,
+    HAL_I2C_STATE_LISTEN = 0x28,
+    HAL_I2C_STATE_ABORT = 0x60,
+    HAL_I2C_STATE_TIMEOUT = 0xA0,
+    HAL_I2C_STATE_ERROR = 0xE0
+} HAL_I2C_StateTypeDef;
+
+#define HAL_I2C_ERROR_NONE       0x00000000u
+#define HAL_I2C_ERROR_BERR       0x00000001u
+#define HAL_I2C_ERROR_ARLO       0x00000002u
+#define HAL_I2C_ERROR_AF         0x00000004u    // not acknowledged
+#define HAL_I2C_ERROR_OVR        0x00000008u
+#define HAL_I2C_ERROR_DMA        0x00000010u
+#define HAL_I2C_ERROR_TIMEOUT    0x00000020u    // blocking calls return HAL_ERROR with this set
+#define HAL_I2C_ERROR_SIZE       0x00000040u
+
+#define I2C_FLAG_BUSY            0x00008000u    // ISR BUSY, set from START until STOP and while SDA is held low
+#define I2C_MEMADD_SIZE_8BIT     0x00000001u
+#define I2C_MEMADD_SIZE_16BIT    0x00000002u
+
+#define __HAL_I2C_GET_FLAG(__HANDLE__, __FLAG__)    ((((__HANDLE__)->Instance->ISR) & (__FLAG__)) == (__FLAG__) ? SET : RESET)
+
+typedef struct __I2C_HandleTypeDef {
+    I2C_TypeDef *Instance;
+    HAL_LockTypeDef Lock;
+    volatile HAL_I2C_StateTypeDef State;
+    volatile uint32_t ErrorCode;
+    struct hal_sim_i2c *sim;    // host: bus model, set by hal_sim_attach_i2c
+} I2C_HandleTypeDef;
+
+HAL_StatusTypeDef HAL_I2C_Init(I2C_HandleTypeDef *hi2c);
+HAL_StatusTypeDef HAL_I2C_DeInit(I2C_HandleTypeDef *hi2c);
+HAL_StatusTypeDef HAL_I2C_Master_Transmit(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_I2C_Master_Receive(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_I2C_Mem_Read(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_I2C_Mem_Read_IT(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_I2C_Mem_Read_DMA(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size);
+HAL_I2C_StateTypeDef HAL_I2C_GetState(I2C_HandleTypeDef *hi2c);
+uint32_t HAL_I2C_GetError(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c);
+
+/* C++ detection */
+#ifdef __cplusplus
+}
+#endif
+
+#endif
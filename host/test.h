@@ -0,0 +1,55 @@
+#ifndef __TEST_H__
+#define __TEST_H__
+
+#include <stdio.h>
+#include <math.h>
+
+/* checks of the host tests, a failed check is reported and counted, the test goes on */
+
+static unsigned test_checks;
+static unsigned test_failures;
+
+#define CHECK(cond) \
+    test_check((cond), __FILE__, __LINE__, #cond)
+
+#define CHECK_EQ(a, b) \
+    test_check_eq((long long) (a), (long long) (b), __FILE__, __LINE__, #a, #b)
+
+#define CHECK_NEAR(a, b, tol) \
+    test_check_near((double) (a), (double) (b), (double) (tol), __FILE__, __LINE__, #a, #b)
+
+static inline void test_check(int ok, const char *file, int line, const char *expr) {
+    test_checks++;
+
+    if (!ok) {
+        test_failures++;
+        printf("%s:%d: CHECK(%s) failed\n", file, line, expr);
+    }
+}
+
+static inline void test_check_eq(long long a, long long b, const char *file, int line, const char *ea, const char *eb) {
+    test_checks++;
+
+    if (a != b) {
+        test_failures++;
+        printf("%s:%d: %s == %s failed, %lld != %lld\n", file, line, ea, eb, a, b);
+    }
+}
+
+static inline void test_check_near(double a, double b, double tol, const char *file, int line, const char *ea, const char *eb) {
+    test_checks++;
+
+    if (!(fabs(a - b) <= tol)) {
+        test_failures++;
+        printf("%s:%d: %s near %s failed, %g and %g differ by more than %g\n", file, line, ea, eb, a, b, tol);
+    }
+}
+
+/* the exit code of main */
+static inline int test_report(const char *name) {
+    printf("%s: %u checks, %u failed\n", name, test_checks, test_failures);
+
+    return (test_failures == 0) ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,233 @@
+#include "test.h"
+#include "imu_ahrs.h"
+
+/*
+ * Replay of a synthetic flight through imu_ahrs_update_record, in the float and the fixed-point
+ * build (make builds this file both ways). The body turns on all three axes; the gyroscope,
+ * accelerometer and magnetometer records are derived from the true attitude at the rates and
+ * scales of the drivers, timestamped in host clock ticks (ns) so that they wrap during the replay.
+ */
+
+#define TEST_PI            3.14159265358979
+#define TEST_GYRO_HZ       760
+#define TEST_ACC_HZ        100
+#define TEST_MAG_HZ        75
+#define TEST_SECONDS       40
+#define TEST_STARTUP       6           // seconds at the start-up gain
+#define TEST_STARTUP_KP    5.0f
+#define TEST_SETTLE        15          // seconds before the error is checked
+#define TEST_DPS_LSB       0.00875     // L3GD20 at 250 dps
+#define TEST_ACC_LSB       1000.0      // digits per g, 1 mg at +-2 g
+#define TEST_MAG_XY_LSB    1100.0      // digits per gauss at 1.3 gauss
+#define TEST_MAG_Z_LSB     980.0
+
+#ifdef IMU_AHRS_FIXED
+#define TEST_NAME          "test_ahrs_fixed"
+#else
+#define TEST_NAME          "test_ahrs_float"
+#endif
+
+/* private variables */
+static const double test_gravity[3] = { 0.0, 0.0, 1.0 };
+static const double test_field[3] = { 0.22, 0.0, -0.42 };    // gauss, north and down
+
+/* private functions */
+static void test_attitude(double roll, double pitch, double yaw, double q[4]);
+static void test_rate(double t, double dps[3]);
+static void test_rotate(double q[4], const double w[3], double dt);
+static void test_to_body(const double q[4], const double v[3], double out[3]);
+static int16_t test_digits(double value);
+static double test_error_deg(const imu_ahrs_t *ahrs, const double q[4]);
+static void test_replay(double roll, double pitch, double yaw, double *settled_max, double *final);
+static void test_still(void);
+static void test_flight(void);
+
+int main(void) {
+    test_still();
+    test_flight();
+
+    return test_report(TEST_NAME);
+}
+
+/* private functions */
+
+/* z-y-x angles in degrees to the quaternion that turns body into earth */
+static void test_attitude(double roll, double pitch, double yaw, double q[4]) {
+    double cr = cos(roll * TEST_PI / 360.0), sr = sin(roll * TEST_PI / 360.0);
+    double cp = cos(pitch * TEST_PI / 360.0), sp = sin(pitch * TEST_PI / 360.0);
+    double cy = cos(yaw * TEST_PI / 360.0), sy = sin(yaw * TEST_PI / 360.0);
+
+    q[0] = cr * cp * cy + sr * sp * sy;
+    q[1] = sr * cp * cy - cr * sp * sy;
+    q[2] = cr * sp * cy + sr * cp * sy;
+    q[3] = cr * cp * sy - sr * sp * cy;
+}
+
+/* body rates in dps, slow sweeps on every axis */
+static void test_rate(double t, double dps[3]) {
+    dps[0] = 60.0 * sin(2.0 * TEST_PI * 0.21 * t);
+    dps[1] = 40.0 * sin(2.0 * TEST_PI * 0.13 * t + 1.0);
+    dps[2] = 90.0 * sin(2.0 * TEST_PI * 0.07 * t + 2.0);
+}
+
+/* q = q * exp(w dt / 2), w in rad/s of the body frame */
+static void test_rotate(double q[4], const double w[3], double dt) {
+    double angle = sqrt(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]) * dt;
+    double r[4], p[4], n;
+    uint8_t i;
+
+    if (angle == 0.0) {
+        return;
+    }
+
+    r[0] = cos(angle / 2.0);
+    for (i = 0; i < 3; i++) {
+        r[i + 1] = sin(angle / 2.0) * w[i] * dt / angle;
+    }
+
+    p[0] = q[0] * r[0] - q[1] * r[1] - q[2] * r[2] - q[3] * r[3];
+    p[1] = q[0] * r[1] + q[1] * r[0] + q[2] * r[3] - q[3] * r[2];
+    p[2] = q[0] * r[2] - q[1] * r[3] + q[2] * r[0] + q[3] * r[1];
+    p[3] = q[0] * r[3] + q[1] * r[2] - q[2] * r[1] + q[3] * r[0];
+
+    n = sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2] + p[3] * p[3]);
+    for (i = 0; i < 4; i++) {
+        q[i] = p[i] / n;
+    }
+}
+
+/* an earth frame vector seen from the body, q turns body into earth */
+static void test_to_body(const double q[4], const double v[3], double out[3]) {
+    double w = q[0], x = q[1], y = q[2], z = q[3];
+
+    out[0] = (1 - 2 * (y * y + z * z)) * v[0] + 2 * (x * y + w * z) * v[1] + 2 * (x * z - w * y) * v[2];
+    out[1] = 2 * (x * y - w * z) * v[0] + (1 - 2 * (x * x + z * z)) * v[1] + 2 * (y * z + w * x) * v[2];
+    out[2] = 2 * (x * z + w * y) * v[0] + 2 * (y * z - w * x) * v[1] + (1 - 2 * (x * x + y * y)) * v[2];
+}
+
+static int16_t test_digits(double value) {
+    return (int16_t) lround(value);
+}
+
+/* angle of the rotation from the estimate to the truth */
+static double test_error_deg(const imu_ahrs_t *ahrs, const double q[4]) {
+    imu_ahrs_quat_t e;
+    double d[4];
+
+    imu_ahrs_get_quat(ahrs, &e);
+
+    /* d = conj(e) * q, atan2 keeps small angles exact where acos does not */
+    d[0] = e.w * q[0] + e.x * q[1] + e.y * q[2] + e.z * q[3];
+    d[1] = e.w * q[1] - e.x * q[0] - e.y * q[3] + e.z * q[2];
+    d[2] = e.w * q[2] + e.x * q[3] - e.y * q[0] - e.z * q[1];
+    d[3] = e.w * q[3] - e.x * q[2] + e.y * q[1] - e.z * q[0];
+
+    return 2.0 * atan2(sqrt(d[1] * d[1] + d[2] * d[2] + d[3] * d[3]), fabs(d[0])) * 180.0 / TEST_PI;
+}
+
+/*
+ * Replays TEST_SECONDS from the given true attitude, the estimate starts level and pointing north.
+ * The first TEST_STARTUP seconds run at a high gain, as an application would to converge quickly.
+ */
+static void test_replay(double roll, double pitch, double yaw, double *settled_max, double *final) {
+    imu_ahrs_t ahrs;
+    imu_ring_record_t rec = { 0 };
+    double q[4];
+    double dps[3], w[3], v[3];
+    double t, dt = 1.0 / TEST_GYRO_HZ, error = 0.0;
+    uint32_t ticks = 0xF0000000u;       // host ticks are ns, the first wrap comes after 0.27 s
+    uint32_t k, acc_k = 0, mag_k = 0;
+    uint8_t i;
+
+    test_attitude(roll, pitch, yaw, q);
+    imu_ahrs_init(&ahrs, (float) TEST_DPS_LSB, (float) (TEST_MAG_XY_LSB / TEST_MAG_Z_LSB));
+    imu_ahrs_set_gains(&ahrs, TEST_STARTUP_KP, IMU_AHRS_KI);
+    *settled_max = 0.0;
+
+    for (k = 0; k < TEST_SECONDS * TEST_GYRO_HZ; k++) {
+        t = k * dt;
+
+        if (k == TEST_STARTUP * TEST_GYRO_HZ) {
+            imu_ahrs_set_gains(&ahrs, IMU_AHRS_KP, IMU_AHRS_KI);
+        }
+
+        /* the slower sensors deliver whenever their period has passed */
+        if (acc_k * TEST_GYRO_HZ <= k * TEST_ACC_HZ) {
+            test_to_body(q, test_gravity, v);
+            rec = (imu_ring_record_t) { ticks, 0, test_digits(v[0] * TEST_ACC_LSB), test_digits(v[1] * TEST_ACC_LSB), test_digits(v[2] * TEST_ACC_LSB), IMU_RING_ACC, IMU_RING_FLAG_RAW };
+            imu_ahrs_update_record(&ahrs, &rec);
+            acc_k++;
+        }
+
+        if (mag_k * TEST_GYRO_HZ <= k * TEST_MAG_HZ) {
+            test_to_body(q, test_field, v);
+            rec = (imu_ring_record_t) { ticks, 0, test_digits(v[0] * TEST_MAG_XY_LSB), test_digits(v[1] * TEST_MAG_XY_LSB), test_digits(v[2] * TEST_MAG_Z_LSB), IMU_RING_MAG, IMU_RING_FLAG_RAW };
+            imu_ahrs_update_record(&ahrs, &rec);
+            mag_k++;
+        }
+
+        /* the gyroscope sample is the rate over the period that ends with it */
+        test_rate(t, dps);
+        for (i = 0; i < 3; i++) {
+            w[i] = dps[i] * TEST_PI / 180.0;
+        }
+        test_rotate(q, w, dt);
+        ticks += 1000000000u / TEST_GYRO_HZ;
+
+        rec = (imu_ring_record_t) { ticks, 0, test_digits(dps[0] / TEST_DPS_LSB), test_digits(dps[1] / TEST_DPS_LSB), test_digits(dps[2] / TEST_DPS_LSB), IMU_RING_GYRO, IMU_RING_FLAG_RAW };
+        imu_ahrs_update_record(&ahrs, &rec);
+
+        error = test_error_deg(&ahrs, q);
+        if (t >= TEST_SETTLE && error > *settled_max) {
+            *settled_max = error;
+        }
+    }
+
+    *final = error;
+}
+
+/* at rest the estimate converges from level to a tilted, turned attitude */
+static void test_still(void) {
+    imu_ahrs_t ahrs;
+    imu_ahrs_euler_t euler;
+    lsm303dlhc_data_raw_t acc, mag;
+    l3gd20_data_t gyro = { 0, 0, 0 };
+    double q[4], v[3];
+    uint32_t k;
+
+    test_attitude(30.0, -20.0, 40.0, q);
+
+    test_to_body(q, test_gravity, v);
+    acc = (lsm303dlhc_data_raw_t) { test_digits(v[0] * TEST_ACC_LSB), test_digits(v[1] * TEST_ACC_LSB), test_digits(v[2] * TEST_ACC_LSB) };
+    test_to_body(q, test_field, v);
+    mag = (lsm303dlhc_data_raw_t) { test_digits(v[0] * TEST_MAG_XY_LSB), test_digits(v[1] * TEST_MAG_XY_LSB), test_digits(v[2] * TEST_MAG_Z_LSB) };
+
+    imu_ahrs_init(&ahrs, (float) TEST_DPS_LSB, (float) (TEST_MAG_XY_LSB / TEST_MAG_Z_LSB));
+    imu_ahrs_set_gains(&ahrs, TEST_STARTUP_KP, IMU_AHRS_KI);
+    imu_ahrs_update_acc(&ahrs, &acc);
+    imu_ahrs_update_mag(&ahrs, &mag);
+
+    for (k = 0; k < 20 * TEST_GYRO_HZ; k++) {
+        imu_ahrs_update_gyro(&ahrs, &gyro, 1000000 / TEST_GYRO_HZ);
+    }
+
+    CHECK(test_error_deg(&ahrs, q) < 0.1);
+
+    imu_ahrs_get_euler(&ahrs, &euler);
+    CHECK_NEAR(euler.roll * 180.0 / TEST_PI, 30.0, 0.1);
+    CHECK_NEAR(euler.pitch * 180.0 / TEST_PI, -20.0, 0.1);
+    CHECK_NEAR(euler.yaw * 180.0 / TEST_PI, 40.0, 0.1);
+}
+
+/* in motion the estimate follows the truth within a degree once settled */
+static void test_flight(void) {
+    double settled_max, final;
+
+    test_replay(0.0, 0.0, 0.0, &settled_max, &final);
+    printf("%s: level start, max error %.3f deg after %d s, %.3f deg at the end\n", TEST_NAME, settled_max, TEST_SETTLE, final);
+    CHECK(settled_max < 1.0);
+
+    test_replay(30.0, -20.0, 40.0, &settled_max, &final);
+    printf("%s: turned start, max error %.3f deg after %d s, %.3f deg at the end\n", TEST_NAME, settled_max, TEST_SETTLE, final);
+    CHECK(settled_max < 1.0);
+}
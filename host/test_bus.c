@@ -0,0 +1,139 @@
+#include "test.h"
+#include "board.h"
+#include "stm32f3xx_lsm303dlhc.h"
+
+/* private variables */
+static const lsm303dlhc_acc_init_t test_acc_init = {
+    .ctrl_reg1_a = LSM303DLHC_ACR1A_ODR30_100_HZ | LSM303DLHC_ACR1A_XEN | LSM303DLHC_ACR1A_YEN | LSM303DLHC_ACR1A_ZEN,
+    .ctrl_reg4_a = LSM303DLHC_ACR4A_HR | LSM303DLHC_ACR4A_FS10_1MG,
+    .fifo_mode = LSM303DLHC_ACCFIFO_BYPASS
+};
+
+/* a deadline well below the 25 ms the HAL waits for a busy bus */
+static const imu_bus_policy_t test_policy = {
+    .timeout_us = 2000,
+    .retries = 1,
+    .backoff_us = 100
+};
+
+static uint32_t test_callbacks;
+
+/* private functions */
+static void test_setup(void);
+static uint32_t test_resets(void);
+static void test_callback(lsm303dlhc_t *dev, lsm303dlhc_result_t result, const lsm303dlhc_data_raw_t *data);
+static void test_stuck_sda(void);
+static void test_stuck_sda_no_pins(void);
+static void test_no_recovery(void);
+static void test_recover_busy(void);
+
+int main(void) {
+    test_stuck_sda();
+    test_stuck_sda_no_pins();
+    test_no_recovery();
+    test_recover_busy();
+
+    return test_report("test_bus");
+}
+
+/* private functions */
+static void test_setup(void) {
+    board_init(0, 0);
+    CHECK_EQ(lsm303dlhc_init_acc(&board_i2c, &test_acc_init), LSM303DLHC_OK);
+    CHECK_EQ(lsm303dlhc_set_bus_policy(&test_policy), LSM303DLHC_OK);
+    lsm303dlhc_set_recovery(GPIOB, BOARD_SCL_PIN, GPIOB, BOARD_SDA_PIN);
+    hal_sim_clear_stats();
+}
+
+static uint32_t test_resets(void) {
+    hal_sim_bus_stats_t stats;
+
+    hal_sim_i2c_stats(&board_i2c, &stats);
+
+    return stats.resets;
+}
+
+static void test_callback(lsm303dlhc_t *dev, lsm303dlhc_result_t result, const lsm303dlhc_data_raw_t *data) {
+    (void) dev;
+    (void) data;
+
+    CHECK_EQ(result, LSM303DLHC_OK);
+    test_callbacks++;
+}
+
+/* a slave holding SDA: the busy bus times out under the deadline, SCL is clocked and the retry succeeds */
+static void test_stuck_sda(void) {
+    lsm303dlhc_data_raw_t data;
+    uint64_t start;
+
+    test_setup();
+    hal_sim_stuck_sda(&board_i2c, 5);
+
+    start = hal_sim_now_ns();
+    CHECK_EQ(lsm303dlhc_read_acc_raw(&data), LSM303DLHC_OK);
+    CHECK((hal_sim_now_ns() - start) / 1000 <= lsm303dlhc_dev_read_acc_bound_us(lsm303dlhc_get_default()));
+    CHECK((hal_sim_now_ns() - start) / 1000 < HAL_SIM_I2C_BUSY_MS * 1000);
+    CHECK_EQ(test_resets(), 1);
+    CHECK_EQ(__HAL_I2C_GET_FLAG(&board_i2c, I2C_FLAG_BUSY), RESET);
+}
+
+/* without recovery pins the bus stays stuck, the read still fails within its bound */
+static void test_stuck_sda_no_pins(void) {
+    lsm303dlhc_data_raw_t data;
+    uint64_t start;
+
+    test_setup();
+    lsm303dlhc_set_recovery(NULL, 0, NULL, 0);
+    hal_sim_stuck_sda(&board_i2c, 5);
+
+    start = hal_sim_now_ns();
+    CHECK_EQ(lsm303dlhc_read_acc_raw(&data), LSM303DLHC_ERROR);
+    CHECK((hal_sim_now_ns() - start) / 1000 <= lsm303dlhc_dev_read_acc_bound_us(lsm303dlhc_get_default()));
+    CHECK_EQ(test_resets(), 0);
+    CHECK_EQ(lsm303dlhc_recover(), LSM303DLHC_ERROR);
+
+    hal_sim_stuck_sda(&board_i2c, 0);
+}
+
+/* HAL_BUSY, a NACK and a timeout with SDA high all leave the peripheral alone */
+static void test_no_recovery(void) {
+    lsm303dlhc_data_raw_t data;
+
+    test_setup();
+
+    hal_sim_fault_i2c(&board_i2c, HAL_SIM_FAULT_LOCKED, 2);
+    CHECK(lsm303dlhc_read_acc_raw(&data) != LSM303DLHC_OK);
+    CHECK_EQ(test_resets(), 0);
+
+    hal_sim_fault_i2c(&board_i2c, HAL_SIM_FAULT_NACK, 2);
+    CHECK_EQ(lsm303dlhc_read_acc_raw(&data), LSM303DLHC_ERROR);
+    CHECK_EQ(test_resets(), 0);
+
+    hal_sim_fault_i2c(&board_i2c, HAL_SIM_FAULT_TIMEOUT, 2);
+    CHECK_EQ(lsm303dlhc_read_acc_raw(&data), LSM303DLHC_ERROR);
+    CHECK_EQ(test_resets(), 0);
+
+    /* the bus works afterwards */
+    CHECK_EQ(lsm303dlhc_read_acc_raw(&data), LSM303DLHC_OK);
+}
+
+/* recovery is refused while a transfer holds the handle */
+static void test_recover_busy(void) {
+    test_setup();
+    test_callbacks = 0;
+
+    CHECK_EQ(lsm303dlhc_read_acc_raw_async(test_callback), LSM303DLHC_OK);
+    CHECK_EQ(lsm303dlhc_recover(), LSM303DLHC_BUSY);
+
+    hal_sim_advance_us(1000);
+    CHECK_EQ(test_callbacks, 1);
+
+    /* a transfer of another context on the handle */
+    board_i2c.State = HAL_I2C_STATE_BUSY_TX;
+    CHECK_EQ(lsm303dlhc_recover(), LSM303DLHC_BUSY);
+    board_i2c.State = HAL_I2C_STATE_READY;
+
+    CHECK_EQ(test_resets(), 0);
+    CHECK_EQ(lsm303dlhc_recover(), LSM303DLHC_OK);
+    CHECK_EQ(test_resets(), 1);
+}
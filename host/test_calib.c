@@ -0,0 +1,259 @@
+#include "test.h"
+#include "imu_calib.h"
+
+#include <string.h>
+
+/*
+ * imu_calib on synthetic samples of known distortion: a gyroscope bias under noise and motion,
+ * an accelerometer with offset and scale per axis turned through its poses, and a magnetometer
+ * with a hard-iron offset larger than the earth field and a soft-iron matrix turned around the
+ * sphere. The fits have to give the distortion back.
+ */
+
+#define TEST_DPS_LSB       0.00875f                        // L3GD20 at 250 dps
+#define TEST_ACC_LSB       (0.001f * IMU_CALIB_GRAVITY)    // m/s^2 per digit, 1 mg at +-2 g
+#define TEST_MAG_XY_LSB    1100.0f                         // digits per gauss at 1.3 gauss
+#define TEST_MAG_Z_LSB     980.0f
+#define TEST_FIELD         48.0f                           // uT
+#define TEST_MAG_SAMPLES   400
+
+/* private variables */
+static const int16_t test_gyro_bias[3] = { 120, -45, 30 };            // digits
+static const float test_acc_offset[3] = { 0.30f, -0.20f, 0.45f };     // m/s^2
+static const float test_acc_scale[3] = { 1.03f, 0.97f, 1.05f };
+static const float test_hard[3] = { 35.0f, -20.0f, 60.0f };           // uT
+static const float test_soft[3][3] = {                                // field to sample, symmetric
+    { 1.10f, 0.05f, -0.03f },
+    { 0.05f, 0.92f, 0.04f },
+    { -0.03f, 0.04f, 1.00f }
+};
+
+static uint32_t test_seed = 1;
+
+/* private functions */
+static int16_t test_noise(int16_t amplitude);
+static int16_t test_digits(float value);
+static void test_acc_pose(imu_calib_t *calib, float gx, float gy, float gz);
+static void test_mag_sample(float field[3], lsm303dlhc_mag_sample_t *sample, uint32_t i);
+static void test_gyro(void);
+static void test_acc(void);
+static void test_mag(void);
+static void test_blob(void);
+
+int main(void) {
+    test_gyro();
+    test_acc();
+    test_mag();
+    test_blob();
+
+    return test_report("test_calib");
+}
+
+/* private functions */
+
+/* uniform in +-amplitude, the same sequence every run */
+static int16_t test_noise(int16_t amplitude) {
+    test_seed = test_seed * 1103515245u + 12345u;
+
+    return (int16_t) ((int32_t) ((test_seed >> 16) % (2u * amplitude + 1u)) - amplitude);
+}
+
+static int16_t test_digits(float value) {
+    return (int16_t) lroundf(value);
+}
+
+/* two blocks at rest with gravity along g, seen through the distortion */
+static void test_acc_pose(imu_calib_t *calib, float gx, float gy, float gz) {
+    const float g[3] = { gx, gy, gz };
+    lsm303dlhc_data_raw_t raw;
+    int16_t d[3];
+    uint8_t i, k;
+
+    for (i = 0; i < 3; i++) {
+        d[i] = test_digits((g[i] * IMU_CALIB_GRAVITY / test_acc_scale[i] + test_acc_offset[i]) / TEST_ACC_LSB);
+    }
+
+    for (k = 0; k < 2 * IMU_CALIB_BLOCK; k++) {
+        raw = (lsm303dlhc_data_raw_t) { d[0] + test_noise(8), d[1] + test_noise(8), d[2] + test_noise(8) };
+        imu_calib_push_acc(calib, &raw);
+    }
+}
+
+/* point i of a Fibonacci sphere as the field, and the distorted sample of it at 1.3 gauss */
+static void test_mag_sample(float field[3], lsm303dlhc_mag_sample_t *sample, uint32_t i) {
+    float z = 1.0f - (2.0f * i + 1.0f) / TEST_MAG_SAMPLES;
+    float r = sqrtf(1.0f - z * z);
+    float a = 2.39996323f * i;          // golden angle
+    float m[3];
+    uint8_t j;
+
+    field[0] = TEST_FIELD * r * cosf(a);
+    field[1] = TEST_FIELD * r * sinf(a);
+    field[2] = TEST_FIELD * z;
+
+    for (j = 0; j < 3; j++) {
+        m[j] = test_soft[j][0] * field[0] + test_soft[j][1] * field[1] + test_soft[j][2] * field[2] + test_hard[j];
+    }
+
+    /* uT to gauss to digits */
+    sample->raw.x = test_digits(m[0] / 100.0f * TEST_MAG_XY_LSB) + test_noise(1);
+    sample->raw.y = test_digits(m[1] / 100.0f * TEST_MAG_XY_LSB) + test_noise(1);
+    sample->raw.z = test_digits(m[2] / 100.0f * TEST_MAG_Z_LSB) + test_noise(1);
+    sample->gain = LSM303DLHC_MAGGAIN_1_3;
+}
+
+/* rest blocks give the bias, blocks in motion are left out */
+static void test_gyro(void) {
+    imu_calib_t calib;
+    imu_calib_params_t params;
+    l3gd20_data_t raw;
+    uint32_t k;
+
+    imu_calib_init(&calib, TEST_DPS_LSB, TEST_ACC_LSB);
+    CHECK_EQ(imu_calib_solve(&calib, &params) & IMU_CALIB_GYRO, 0);
+
+    for (k = 0; k < 40 * IMU_CALIB_BLOCK; k++) {
+        /* every other block turns at up to 30 dps */
+        if ((k / IMU_CALIB_BLOCK) & 1) {
+            raw = (l3gd20_data_t) { test_gyro_bias[0] + test_noise(3400), test_gyro_bias[1], test_gyro_bias[2] + test_noise(3400) };
+        } else {
+            raw = (l3gd20_data_t) { test_gyro_bias[0] + test_noise(20), test_gyro_bias[1] + test_noise(20), test_gyro_bias[2] + test_noise(20) };
+        }
+        imu_calib_push_gyro(&calib, &raw);
+    }
+
+    CHECK(imu_calib_solve(&calib, &params) & IMU_CALIB_GYRO);
+    CHECK_NEAR(params.gyro_bias[0], test_gyro_bias[0] * TEST_DPS_LSB, 0.02);
+    CHECK_NEAR(params.gyro_bias[1], test_gyro_bias[1] * TEST_DPS_LSB, 0.02);
+    CHECK_NEAR(params.gyro_bias[2], test_gyro_bias[2] * TEST_DPS_LSB, 0.02);
+}
+
+/* six faces and two oblique poses give offset and scale back, a repeated pose does not count */
+static void test_acc(void) {
+    const float s = 0.57735027f;
+    imu_calib_t calib;
+    imu_calib_params_t params;
+    lsm303dlhc_data_raw_t raw;
+    float a[3], n;
+    uint8_t i, k;
+
+    imu_calib_init(&calib, TEST_DPS_LSB, TEST_ACC_LSB);
+
+    /* lying still for long is one pose, and one way up per axis is not enough */
+    test_acc_pose(&calib, 0.0f, 0.0f, 1.0f);
+    test_acc_pose(&calib, 0.0f, 0.0f, 1.0f);
+    test_acc_pose(&calib, 1.0f, 0.0f, 0.0f);
+    test_acc_pose(&calib, 0.0f, 1.0f, 0.0f);
+    CHECK_EQ(calib.acc_poses, 3);
+    CHECK_EQ(imu_calib_solve(&calib, &params) & IMU_CALIB_ACC, 0);
+
+    test_acc_pose(&calib, 0.0f, 0.0f, -1.0f);
+    test_acc_pose(&calib, -1.0f, 0.0f, 0.0f);
+    test_acc_pose(&calib, 0.0f, -1.0f, 0.0f);
+    test_acc_pose(&calib, s, -s, s);
+    test_acc_pose(&calib, -s, s, -s);
+
+    CHECK(imu_calib_solve(&calib, &params) & IMU_CALIB_ACC);
+
+    for (i = 0; i < 3; i++) {
+        CHECK_NEAR(params.acc_offset[i], test_acc_offset[i], 0.02);
+        CHECK_NEAR(params.acc_scale[i], test_acc_scale[i], 0.005);
+    }
+
+    /* corrected samples of a pose the fit has not seen measure one g */
+    for (k = 0; k < 4; k++) {
+        const float g[3] = { 0.6f, (k & 1) ? 0.64f : -0.64f, (k & 2) ? 0.48f : -0.48f };
+
+        raw.x = test_digits((g[0] * IMU_CALIB_GRAVITY / test_acc_scale[0] + test_acc_offset[0]) / TEST_ACC_LSB);
+        raw.y = test_digits((g[1] * IMU_CALIB_GRAVITY / test_acc_scale[1] + test_acc_offset[1]) / TEST_ACC_LSB);
+        raw.z = test_digits((g[2] * IMU_CALIB_GRAVITY / test_acc_scale[2] + test_acc_offset[2]) / TEST_ACC_LSB);
+
+        a[0] = params.acc_scale[0] * (raw.x * TEST_ACC_LSB - params.acc_offset[0]);
+        a[1] = params.acc_scale[1] * (raw.y * TEST_ACC_LSB - params.acc_offset[1]);
+        a[2] = params.acc_scale[2] * (raw.z * TEST_ACC_LSB - params.acc_offset[2]);
+        n = sqrtf(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+
+        CHECK_NEAR(n, IMU_CALIB_GRAVITY, 0.03);
+    }
+}
+
+/* the ellipsoid fit gives the hard iron back and maps every sample onto one sphere, unrotated */
+static void test_mag(void) {
+    imu_calib_t calib;
+    imu_calib_params_t params;
+    lsm303dlhc_mag_sample_t sample;
+    lsm303dlhc_data_t m;
+    float field[3], c[3], n, dot;
+    float n_min = INFINITY, n_max = 0.0f, dot_min = 1.0f;
+    uint32_t i;
+    uint8_t j;
+
+    imu_calib_init(&calib, TEST_DPS_LSB, TEST_ACC_LSB);
+
+    for (i = 0; i < IMU_CALIB_MAG_SAMPLES / 2; i++) {
+        test_mag_sample(field, &sample, i);
+        imu_calib_push_mag(&calib, &sample);
+    }
+
+    CHECK_EQ(imu_calib_solve(&calib, &params) & IMU_CALIB_MAG, 0);
+
+    for (; i < TEST_MAG_SAMPLES; i++) {
+        test_mag_sample(field, &sample, i);
+        imu_calib_push_mag(&calib, &sample);
+
+        /* the same sample again is skipped */
+        imu_calib_push_mag(&calib, &sample);
+    }
+
+    CHECK_EQ(calib.mag_samples, TEST_MAG_SAMPLES);
+    CHECK(imu_calib_solve(&calib, &params) & IMU_CALIB_MAG);
+
+    for (j = 0; j < 3; j++) {
+        CHECK_NEAR(params.mag_offset[j], test_hard[j], 0.5);
+    }
+
+    /* every corrected sample lies on one sphere and points along its field */
+    for (i = 0; i < TEST_MAG_SAMPLES; i++) {
+        test_mag_sample(field, &sample, i);
+        lsm303dlhc_convert_mag_sample(&m, &sample);
+
+        for (j = 0; j < 3; j++) {
+            c[j] = params.mag_soft[j][0] * (m.x - params.mag_offset[0]) + params.mag_soft[j][1] * (m.y - params.mag_offset[1]) + params.mag_soft[j][2] * (m.z - params.mag_offset[2]);
+        }
+
+        n = sqrtf(c[0] * c[0] + c[1] * c[1] + c[2] * c[2]);
+        dot = (c[0] * field[0] + c[1] * field[1] + c[2] * field[2]) / (n * TEST_FIELD);
+
+        n_min = fminf(n_min, n);
+        n_max = fmaxf(n_max, n);
+        dot_min = fminf(dot_min, dot);
+    }
+
+    printf("test_calib: corrected field %.2f to %.2f uT, worst direction %.3f deg\n", n_min, n_max, acosf(dot_min) * 180.0f / 3.14159265f);
+    CHECK((n_max - n_min) / n_min < 0.015f);
+    CHECK(dot_min > cosf(0.5f * 3.14159265f / 180.0f));
+}
+
+/* the solved parameters survive the blob, a flipped bit does not load */
+static void test_blob(void) {
+    imu_calib_t calib;
+    imu_calib_params_t params, loaded;
+    uint8_t blob[IMU_CALIB_BLOB_LEN];
+    l3gd20_data_t raw = { 80, 80, 80 };
+    uint32_t k;
+
+    imu_calib_init(&calib, TEST_DPS_LSB, TEST_ACC_LSB);
+    for (k = 0; k < IMU_CALIB_BLOCK; k++) {
+        imu_calib_push_gyro(&calib, &raw);
+    }
+    CHECK_EQ(imu_calib_solve(&calib, &params), IMU_CALIB_GYRO);
+
+    imu_calib_save(&params, blob);
+    memset(&loaded, 0, sizeof(loaded));
+    CHECK_EQ(imu_calib_load(&loaded, blob, sizeof(blob)), IMU_CALIB_OK);
+    CHECK_EQ(memcmp(&loaded, &params, sizeof(params)), 0);
+
+    blob[20] ^= 0x01;
+    CHECK_EQ(imu_calib_load(&loaded, blob, sizeof(blob)), IMU_CALIB_ERROR);
+    CHECK_EQ(imu_calib_load(&loaded, blob, IMU_CALIB_BLOB_LEN - 1), IMU_CALIB_ERROR);
+}
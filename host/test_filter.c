@@ -0,0 +1,269 @@
+#include "test.h"
+#include "imu_filter.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * imu_filter on constant, alternating and pseudo-random input: the designed sections have exactly
+ * unity gain at DC (low-pass) or Nyquist (high-pass) and settle to it however low the cut-off, the
+ * CIC decimators keep DC at unity gain and output one sample per ratio, and a stream gives the same
+ * output whether it is processed in one call or in odd-sized chunks.
+ */
+
+#define TEST_RATE_HZ       760.0f
+#define TEST_SETTLE        20000       // samples, processed twice for the lowest cut-off to settle
+#define TEST_CHECKED       64          // last samples checked after settling
+#define TEST_STREAM        1000
+
+#define TEST_ONE           ((int64_t) 1 << IMU_FILTER_Q)
+
+/* private variables */
+static const float test_cutoffs[] = { 0.1f, 1.0f, 10.0f, 100.0f, 300.0f };
+static const float test_qs[] = { 0.5412f, 0.7071f, 1.3066f };
+
+static l3gd20_data_t test_in[TEST_SETTLE];
+static l3gd20_data_t test_out[TEST_SETTLE];
+static l3gd20_data_t test_chunked[TEST_STREAM];
+static int32_t test_history[2][3 * 5];
+static uint32_t test_seed = 1;
+
+/* private functions */
+static int16_t test_noise(int16_t amplitude);
+static void test_constant(int16_t x, int16_t y, int16_t z, uint16_t count);
+static void test_alternating(int16_t x, int16_t y, int16_t z, uint16_t count);
+static bool test_settled(const l3gd20_data_t *out, uint16_t count, int16_t x, int16_t y, int16_t z, bool alternating, int16_t tol);
+static void test_settle(imu_filter_t *filter);
+static void test_coefficients(void);
+static void test_design_errors(void);
+static void test_dc(void);
+static void test_nyquist(void);
+static void test_cic(void);
+static void test_pipeline(imu_filter_t *filter, int32_t history[]);
+static void test_chunks(void);
+
+int main(void) {
+    test_coefficients();
+    test_design_errors();
+    test_dc();
+    test_nyquist();
+    test_cic();
+    test_chunks();
+
+    return test_report("test_filter");
+}
+
+/* private functions */
+
+/* uniform in +-amplitude, the same sequence every run */
+static int16_t test_noise(int16_t amplitude) {
+    test_seed = test_seed * 1103515245u + 12345u;
+
+    return (int16_t) ((int32_t) ((test_seed >> 16) % (2u * amplitude + 1u)) - amplitude);
+}
+
+static void test_constant(int16_t x, int16_t y, int16_t z, uint16_t count) {
+    uint16_t i;
+
+    for (i = 0; i < count; i++) {
+        test_in[i] = (l3gd20_data_t) { x, y, z };
+    }
+}
+
+/* the Nyquist frequency, the sign flips every sample */
+static void test_alternating(int16_t x, int16_t y, int16_t z, uint16_t count) {
+    uint16_t i;
+
+    for (i = 0; i < count; i++) {
+        test_in[i] = (i & 1) ? (l3gd20_data_t) { -x, -y, -z } : (l3gd20_data_t) { x, y, z };
+    }
+}
+
+/* the last TEST_CHECKED outputs within tol of the constant or alternating input */
+static bool test_settled(const l3gd20_data_t *out, uint16_t count, int16_t x, int16_t y, int16_t z, bool alternating, int16_t tol) {
+    uint16_t i;
+
+    for (i = count - TEST_CHECKED; i < count; i++) {
+        int16_t s = (alternating && (i & 1)) ? -1 : 1;
+
+        if (abs(out[i].x - s * x) > tol || abs(out[i].y - s * y) > tol || abs(out[i].z - s * z) > tol) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* the input twice, the output of the second pass in test_out */
+static void test_settle(imu_filter_t *filter) {
+    CHECK_EQ(imu_filter_process_gyro(filter, test_in, test_out, TEST_SETTLE), TEST_SETTLE);
+    CHECK_EQ(imu_filter_process_gyro(filter, test_in, test_out, TEST_SETTLE), TEST_SETTLE);
+}
+
+/* a2 is rounded so the integer coefficients give the unity gain exactly */
+static void test_coefficients(void) {
+    imu_filter_biquad_t c;
+    uint8_t i, k;
+
+    for (i = 0; i < sizeof(test_cutoffs) / sizeof(test_cutoffs[0]); i++) {
+        for (k = 0; k < sizeof(test_qs) / sizeof(test_qs[0]); k++) {
+            /* low-pass: b0 + b1 + b2 == 1 + a1 + a2 at DC, b0 - b1 + b2 == 0 at Nyquist */
+            CHECK_EQ(imu_filter_lowpass(&c, test_cutoffs[i], TEST_RATE_HZ, test_qs[k]), IMU_FILTER_OK);
+            CHECK_EQ((int64_t) c.b0 + c.b1 + c.b2, TEST_ONE + c.a1 + c.a2);
+            CHECK_EQ((int64_t) c.b0 - c.b1 + c.b2, 0);
+
+            /* high-pass: b0 - b1 + b2 == 1 - a1 + a2 at Nyquist, b0 + b1 + b2 == 0 at DC */
+            CHECK_EQ(imu_filter_highpass(&c, test_cutoffs[i], TEST_RATE_HZ, test_qs[k]), IMU_FILTER_OK);
+            CHECK_EQ((int64_t) c.b0 - c.b1 + c.b2, TEST_ONE - c.a1 + c.a2);
+            CHECK_EQ((int64_t) c.b0 + c.b1 + c.b2, 0);
+        }
+    }
+}
+
+static void test_design_errors(void) {
+    imu_filter_biquad_t c;
+    imu_filter_t filter;
+    uint8_t i;
+
+    CHECK_EQ(imu_filter_lowpass(&c, 0.0f, TEST_RATE_HZ, 0.7071f), IMU_FILTER_ERROR);
+    CHECK_EQ(imu_filter_lowpass(&c, TEST_RATE_HZ / 2.0f, TEST_RATE_HZ, 0.7071f), IMU_FILTER_ERROR);
+    CHECK_EQ(imu_filter_highpass(&c, 10.0f, TEST_RATE_HZ, 0.0f), IMU_FILTER_ERROR);
+    CHECK_EQ(imu_filter_lowpass(NULL, 10.0f, TEST_RATE_HZ, 0.7071f), IMU_FILTER_ERROR);
+
+    /* 2^24 is the CIC growth limit, the pipeline holds IMU_FILTER_STAGES */
+    imu_filter_init(&filter);
+    CHECK_EQ(imu_filter_add_cic(&filter, 0, 4), IMU_FILTER_ERROR);
+    CHECK_EQ(imu_filter_add_cic(&filter, IMU_FILTER_CIC_ORDER + 1, 4), IMU_FILTER_ERROR);
+    CHECK_EQ(imu_filter_add_cic(&filter, 2, 1), IMU_FILTER_ERROR);
+    CHECK_EQ(imu_filter_add_cic(&filter, 4, 64), IMU_FILTER_OK);
+    CHECK_EQ(imu_filter_add_cic(&filter, 4, 65), IMU_FILTER_ERROR);
+    CHECK_EQ(imu_filter_add_decimate(&filter, 1), IMU_FILTER_ERROR);
+    CHECK_EQ(imu_filter_add_average(&filter, test_history[0], 0), IMU_FILTER_ERROR);
+    CHECK_EQ(imu_filter_add_average(&filter, test_history[0], IMU_FILTER_AVERAGE_MAX + 1), IMU_FILTER_ERROR);
+
+    for (i = 1; i < IMU_FILTER_STAGES; i++) {
+        CHECK_EQ(imu_filter_add_decimate(&filter, 2), IMU_FILTER_OK);
+    }
+    CHECK_EQ(imu_filter_add_decimate(&filter, 2), IMU_FILTER_ERROR);
+    CHECK_EQ(imu_filter_ratio(&filter), 64 << (IMU_FILTER_STAGES - 1));
+}
+
+/* a low-pass settles on the exact input, a high-pass on exactly 0, even at 0.1 Hz of 760 Hz */
+static void test_dc(void) {
+    imu_filter_biquad_t c;
+    imu_filter_t filter;
+    uint8_t i;
+
+    test_constant(1234, -567, 32000, TEST_SETTLE);
+
+    for (i = 0; i < sizeof(test_cutoffs) / sizeof(test_cutoffs[0]); i++) {
+        imu_filter_init(&filter);
+        CHECK_EQ(imu_filter_lowpass(&c, test_cutoffs[i], TEST_RATE_HZ, 0.5412f), IMU_FILTER_OK);
+        CHECK_EQ(imu_filter_add_biquad(&filter, &c), IMU_FILTER_OK);
+        CHECK_EQ(imu_filter_lowpass(&c, test_cutoffs[i], TEST_RATE_HZ, 1.3066f), IMU_FILTER_OK);
+        CHECK_EQ(imu_filter_add_biquad(&filter, &c), IMU_FILTER_OK);
+        test_settle(&filter);
+        CHECK(test_settled(test_out, TEST_SETTLE, 1234, -567, 32000, false, 0));
+
+        imu_filter_init(&filter);
+        CHECK_EQ(imu_filter_highpass(&c, test_cutoffs[i], TEST_RATE_HZ, 0.7071f), IMU_FILTER_OK);
+        CHECK_EQ(imu_filter_add_biquad(&filter, &c), IMU_FILTER_OK);
+        test_settle(&filter);
+        CHECK(test_settled(test_out, TEST_SETTLE, 0, 0, 0, false, 0));
+    }
+}
+
+/* the low-pass has a zero at Nyquist, the high-pass passes it at unity gain */
+static void test_nyquist(void) {
+    imu_filter_biquad_t c;
+    imu_filter_t filter;
+    uint8_t i;
+
+    test_alternating(1000, -2500, 16000, TEST_SETTLE);
+
+    for (i = 0; i < sizeof(test_cutoffs) / sizeof(test_cutoffs[0]); i++) {
+        imu_filter_init(&filter);
+        CHECK_EQ(imu_filter_lowpass(&c, test_cutoffs[i], TEST_RATE_HZ, 0.7071f), IMU_FILTER_OK);
+        CHECK_EQ(imu_filter_add_biquad(&filter, &c), IMU_FILTER_OK);
+        test_settle(&filter);
+        CHECK(test_settled(test_out, TEST_SETTLE, 0, 0, 0, false, 0));
+
+        imu_filter_init(&filter);
+        CHECK_EQ(imu_filter_highpass(&c, test_cutoffs[i], TEST_RATE_HZ, 0.7071f), IMU_FILTER_OK);
+        CHECK_EQ(imu_filter_add_biquad(&filter, &c), IMU_FILTER_OK);
+        test_settle(&filter);
+        CHECK(test_settled(test_out, TEST_SETTLE, 1000, -2500, 16000, true, 0));
+    }
+}
+
+/* one output per ratio inputs, DC at unity gain whether ratio^order is a power of two or not */
+static void test_cic(void) {
+    static const uint8_t orders[] = { 1, 2, 3, 4, 4 };
+    static const uint8_t ratios[] = { 2, 5, 8, 5, 16 };
+    static const int16_t levels[][3] = { { 1000, -1000, 1 }, { 32767, -32768, -1 } };
+    imu_filter_t filter;
+    uint16_t n;
+    uint8_t i, k;
+
+    for (i = 0; i < sizeof(orders); i++) {
+        for (k = 0; k < 2; k++) {
+            test_constant(levels[k][0], levels[k][1], levels[k][2], TEST_STREAM);
+
+            imu_filter_init(&filter);
+            CHECK_EQ(imu_filter_add_cic(&filter, orders[i], ratios[i]), IMU_FILTER_OK);
+            CHECK_EQ(imu_filter_ratio(&filter), ratios[i]);
+
+            n = imu_filter_process_gyro(&filter, test_in, test_out, TEST_STREAM);
+            CHECK_EQ(n, TEST_STREAM / ratios[i]);
+            CHECK(test_settled(test_out, n, levels[k][0], levels[k][1], levels[k][2], false, 0));
+        }
+    }
+}
+
+/* biquad, moving average, CIC and decimation, 760 Hz down to 95 Hz */
+static void test_pipeline(imu_filter_t *filter, int32_t history[]) {
+    imu_filter_biquad_t c;
+
+    imu_filter_init(filter);
+    CHECK_EQ(imu_filter_lowpass(&c, 40.0f, TEST_RATE_HZ, 0.7071f), IMU_FILTER_OK);
+    CHECK_EQ(imu_filter_add_biquad(filter, &c), IMU_FILTER_OK);
+    CHECK_EQ(imu_filter_add_average(filter, history, 5), IMU_FILTER_OK);
+    CHECK_EQ(imu_filter_add_cic(filter, 3, 2), IMU_FILTER_OK);
+    CHECK_EQ(imu_filter_add_decimate(filter, 2), IMU_FILTER_OK);
+}
+
+/* the state and the decimation phase carry over between calls of any length */
+static void test_chunks(void) {
+    static const uint8_t chunks[] = { 1, 3, 7, 13, 17, 31, 33, 5 };
+    imu_filter_t whole, chunked;
+    uint16_t n, m = 0, done = 0, len;
+    uint8_t i = 0;
+
+    for (n = 0; n < TEST_STREAM; n++) {
+        test_in[n] = (l3gd20_data_t) { (int16_t) (n * 37 + test_noise(3000)), test_noise(30000), (int16_t) (-5000 + test_noise(100)) };
+    }
+
+    test_pipeline(&whole, test_history[0]);
+    test_pipeline(&chunked, test_history[1]);
+    CHECK_EQ(imu_filter_ratio(&whole), 4);
+
+    n = imu_filter_process_gyro(&whole, test_in, test_out, TEST_STREAM);
+    CHECK_EQ(n, TEST_STREAM / 4);
+
+    while (done < TEST_STREAM) {
+        len = chunks[i++ % sizeof(chunks)];
+        len = (len < TEST_STREAM - done) ? len : TEST_STREAM - done;
+
+        m += imu_filter_process_gyro(&chunked, &test_in[done], &test_chunked[m], len);
+        done += len;
+    }
+
+    CHECK_EQ(m, n);
+    CHECK(memcmp(test_out, test_chunked, n * sizeof(test_out[0])) == 0);
+
+    /* in place as well, after a reset */
+    imu_filter_reset(&chunked);
+    memcpy(test_chunked, test_in, sizeof(test_chunked));
+    CHECK_EQ(imu_filter_process_gyro(&chunked, test_chunked, test_chunked, TEST_STREAM), n);
+    CHECK(memcmp(test_out, test_chunked, n * sizeof(test_out[0])) == 0);
+}
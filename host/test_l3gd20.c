@@ -0,0 +1,426 @@
+#include "test.h"
+#include "board.h"
+#include "stm32f3xx_l3gd20.h"
+
+#define TEST_SPI_HZ     1000000     // 8 us per byte
+#define TEST_RACE_POINTS    32      // preemption points swept, more than a blocking read has
+
+/* private variables */
+static uint32_t test_preempt;
+static uint32_t test_trigger_at;
+static uint32_t test_triggers;
+static l3gd20_data_t test_streamed;
+static uint32_t test_streamed_count;
+static uint32_t test_stream_errors;
+
+/* bias of X rises 1 dps per degC from 0 degC */
+static const imu_tempcomp_t test_temp_table = {
+    .t0 = 0.0f,
+    .step = 50.0f,
+    .count = 2,
+    .bias = { { 0.0f, 0.0f, 0.0f }, { 50.0f, 0.0f, 0.0f } },
+    .scale = { { 1.0f, 1.0f, 1.0f }, { 1.0f, 1.0f, 1.0f } }
+};
+
+/* private functions */
+static void test_counter_source(void *ctx, uint64_t t_ns, float value[3]);
+static void test_spi_read(uint8_t command, uint8_t *data, uint16_t len);
+static void test_samples(uint32_t count);
+static void test_init(void);
+static void test_auto_increment(void);
+static void test_status(void);
+static void test_fifo(void);
+static void test_temp(void);
+static void test_stream_callback(l3gd20_t *dev, l3gd20_result_t result, const l3gd20_data_t *data);
+static void test_stream_temp(void);
+static void test_counters(void);
+static void test_trigger_hook(void *ctx);
+static void test_stream_race(void);
+static void test_fault_callback(l3gd20_t *dev, l3gd20_result_t result, const l3gd20_data_t *data);
+static void test_drdy_fault(void);
+
+int main(void) {
+    test_init();
+    test_auto_increment();
+    test_status();
+    test_fifo();
+    test_temp();
+    test_stream_temp();
+    test_counters();
+    test_stream_race();
+    test_drdy_fault();
+
+    return test_report("test_l3gd20");
+}
+
+/* private functions */
+
+/* sample n reads n digits on X, -n on Y and 2n on Z at 250 dps */
+static void test_counter_source(void *ctx, uint64_t t_ns, float value[3]) {
+    uint32_t *n = ctx;
+
+    (void) t_ns;
+    (*n)++;
+
+    value[0] = (float) *n * 0.00875f;
+    value[1] = (float) *n * -0.00875f;
+    value[2] = (float) *n * 0.0175f;
+}
+
+/* one transaction of the command byte and len bytes read, as a second master would issue it */
+static void test_spi_read(uint8_t command, uint8_t *data, uint16_t len) {
+    HAL_GPIO_WritePin(L3GD20_CS_PORT, L3GD20_CS_PIN, GPIO_PIN_RESET);
+    HAL_SPI_Transmit(&board_spi, &command, 1, 10);
+    HAL_SPI_Receive(&board_spi, data, len, 10);
+    HAL_GPIO_WritePin(L3GD20_CS_PORT, L3GD20_CS_PIN, GPIO_PIN_SET);
+}
+
+/* runs up to the given number of samples, the bus is idle until the next one */
+static void test_samples(uint32_t count) {
+    while (count-- > 0) {
+        hal_sim_run_until(board_gyro.next_ns);
+    }
+}
+
+static void test_init(void) {
+    board_init(TEST_SPI_HZ, 0);
+
+    CHECK_EQ(l3gd20_emu_peek(&board_gyro, L3GD20_REG_WHO_AM_I), L3GD20_WHO_AM_I);
+    CHECK_EQ(l3gd20_emu_peek(&board_gyro, L3GD20_REG_CTRL_REG1), 0x07);
+
+    CHECK_EQ(l3gd20_init(&board_spi, L3GD20_SCALE_250), L3GD20_OK);
+
+    /* CTRL_REG1 .. CTRL_REG5 in one burst */
+    CHECK_EQ(board_gyro.reg[L3GD20_REG_CTRL_REG1], 0xFF);
+    CHECK_EQ(board_gyro.reg[L3GD20_REG_CTRL_REG4], 0x00);
+    CHECK_EQ(board_gyro.reg[L3GD20_REG_CTRL_REG5], L3GD20_CR5_OUT_SEL_HPF);
+    CHECK(board_gyro.running);
+
+    /* a sensor that does not answer is not taken for an L3GD20 */
+    hal_sim_reset();
+    hal_sim_attach_spi(&board_spi, TEST_SPI_HZ);
+    CHECK_EQ(l3gd20_init(&board_spi, L3GD20_SCALE_250), L3GD20_ERROR);
+}
+
+static void test_auto_increment(void) {
+    uint8_t buf[5];
+
+    board_init(TEST_SPI_HZ, 0);
+    CHECK_EQ(l3gd20_init(&board_spi, L3GD20_SCALE_500), L3GD20_OK);
+
+    /* without MS the address stays put */
+    test_spi_read(L3GD20_SPI_READ | L3GD20_REG_CTRL_REG1, buf, 5);
+    CHECK_EQ(buf[0], 0xFF);
+    CHECK_EQ(buf[4], 0xFF);
+
+    test_spi_read(L3GD20_SPI_READ | L3GD20_SPI_MS | L3GD20_REG_CTRL_REG1, buf, 5);
+    CHECK_EQ(buf[0], 0xFF);
+    CHECK_EQ(buf[1], 0x00);
+    CHECK_EQ(buf[3], 0x10);    // FS 500 dps
+    CHECK_EQ(buf[4], L3GD20_CR5_OUT_SEL_HPF);
+
+    /* reserved registers read 0, read-only ones are not written */
+    test_spi_read(L3GD20_SPI_READ | L3GD20_SPI_MS | (L3GD20_REG_WHO_AM_I - 1), buf, 3);
+    CHECK_EQ(buf[0], 0x00);
+    CHECK_EQ(buf[1], L3GD20_WHO_AM_I);
+    CHECK_EQ(buf[2], 0x00);
+}
+
+static void test_status(void) {
+    l3gd20_data_t data;
+    uint32_t n = 0;
+
+    board_init(TEST_SPI_HZ, 0);
+    l3gd20_emu_set_source(&board_gyro, test_counter_source, &n);
+    CHECK_EQ(l3gd20_init(&board_spi, L3GD20_SCALE_250), L3GD20_OK);
+
+    CHECK_EQ(l3gd20_read_raw(&data), L3GD20_NO_DATA);
+    CHECK_EQ(l3gd20_get_status(), 0x00);
+
+    test_samples(1);
+    CHECK_EQ(l3gd20_emu_peek(&board_gyro, L3GD20_REG_STATUS_REG), L3GD20_SR_ZYXDA | 0x07);
+
+    CHECK_EQ(l3gd20_read_raw(&data), L3GD20_OK);
+    CHECK_EQ(data.x, 1);
+    CHECK_EQ(data.y, -1);
+    CHECK_EQ(data.z, 2);
+    CHECK_EQ(l3gd20_get_status(), L3GD20_SR_ZYXDA | 0x07);
+
+    /* reading every axis clears the flags */
+    CHECK_EQ(l3gd20_emu_peek(&board_gyro, L3GD20_REG_STATUS_REG), 0x00);
+    CHECK_EQ(l3gd20_read_raw(&data), L3GD20_NO_DATA);
+
+    /* a sample over an unread one sets the overrun bits, the read returns the newest */
+    test_samples(3);
+    CHECK_EQ(l3gd20_read_raw(&data), L3GD20_OK);
+    CHECK_EQ(l3gd20_get_status(), 0xFF);
+    CHECK_EQ(data.x, (int32_t) n);
+    CHECK_EQ(data.z, 2 * (int32_t) n);
+
+    /* full scale clamps */
+    l3gd20_emu_set_source(&board_gyro, NULL, NULL);
+    l3gd20_emu_set_rate(&board_gyro, 1000.0f, -1000.0f, 0.0f);
+    test_samples(1);
+    CHECK_EQ(l3gd20_read_raw(&data), L3GD20_OK);
+    CHECK_EQ(data.x, INT16_MAX);
+    CHECK_EQ(data.y, INT16_MIN);
+    CHECK_EQ(data.z, 0);
+}
+
+static void test_fifo(void) {
+    l3gd20_data_t data[L3GD20_FIFO_SIZE];
+    l3gd20_fifo_status_t status;
+    hal_sim_bus_stats_t stats;
+    uint32_t n = 0, last;
+    uint8_t count;
+
+    board_init(TEST_SPI_HZ, 0);
+    l3gd20_emu_set_source(&board_gyro, test_counter_source, &n);
+    CHECK_EQ(l3gd20_init(&board_spi, L3GD20_SCALE_250), L3GD20_OK);
+    l3gd20_dev_set_raw(l3gd20_get_default(), true);
+
+    /* stream keeps the newest 32 */
+    CHECK_EQ(l3gd20_set_fifo(L3GD20_FIFO_STREAM, 10), L3GD20_OK);
+    test_samples(12);
+    CHECK_EQ(l3gd20_emu_peek(&board_gyro, L3GD20_REG_FIFO_SRC_REG), L3GD20_FIFO_SRC_WTM | 12);
+
+    /* one burst drains them, wrapping from OUT_Z_H to OUT_X_L */
+    hal_sim_clear_stats();
+    CHECK_EQ(l3gd20_read_fifo(data, L3GD20_FIFO_SIZE, &count), L3GD20_OK);
+    CHECK_EQ(count, 12);
+    CHECK_EQ(data[0].x, 1);
+    CHECK_EQ(data[11].x, 12);
+    CHECK_EQ(data[11].y, -12);
+    CHECK_EQ(data[11].z, 24);
+    hal_sim_spi_stats(&board_spi, &stats);
+    CHECK_EQ(stats.transactions, 2);
+    CHECK_EQ(stats.bytes, 2 + 1 + 12 * L3GD20_SAMPLE_LEN);
+    CHECK_EQ(l3gd20_emu_peek(&board_gyro, L3GD20_REG_FIFO_SRC_REG), L3GD20_FIFO_SRC_EMPTY);
+
+    /* a sample lands while the burst runs, it does not disturb the samples being read */
+    test_samples(40);
+    last = n;
+    CHECK_EQ(l3gd20_read_fifo(data, L3GD20_FIFO_SIZE, &count), L3GD20_OVERRUN);
+    CHECK_EQ(count, L3GD20_FIFO_SIZE);
+    CHECK_EQ(data[L3GD20_FIFO_SIZE - 1].x, (int32_t) last);
+    CHECK_EQ(data[0].x, (int32_t) last - L3GD20_FIFO_SIZE + 1);
+
+    /* FIFO mode stops when full and is re-armed by the drain */
+    CHECK_EQ(l3gd20_set_fifo(L3GD20_FIFO_FIFO, 0), L3GD20_OK);
+    test_samples(40);
+    CHECK_EQ(l3gd20_read_fifo(data, L3GD20_FIFO_SIZE, &count), L3GD20_OVERRUN);
+    CHECK_EQ(count, L3GD20_FIFO_SIZE);
+    CHECK_EQ(data[1].x - data[0].x, 1);
+    CHECK(data[L3GD20_FIFO_SIZE - 1].x < (int32_t) n);
+    l3gd20_get_fifo_status(&status);
+    CHECK(status.overrun);
+    CHECK_EQ(status.overruns, 2);
+    CHECK_EQ(l3gd20_emu_peek(&board_gyro, L3GD20_REG_FIFO_SRC_REG), L3GD20_FIFO_SRC_EMPTY | L3GD20_FIFO_SRC_WTM);
+
+    /* bypass leaves the output registers */
+    CHECK_EQ(l3gd20_set_fifo(L3GD20_FIFO_BYPASS, 0), L3GD20_OK);
+    CHECK_EQ(board_gyro.axes.level, 0);
+}
+
+static void test_temp(void) {
+    l3gd20_data_t data;
+    int8_t temp;
+
+    board_init(TEST_SPI_HZ, 0);
+    l3gd20_emu_set_temp(&board_gyro, 31.0f);
+    CHECK_EQ(l3gd20_init(&board_spi, L3GD20_SCALE_250), L3GD20_OK);
+
+    CHECK_EQ((int8_t) l3gd20_emu_peek(&board_gyro, L3GD20_REG_OUT_TEMP), -6);
+
+    l3gd20_set_temp_rate(4);
+    test_samples(1);
+    CHECK_EQ(l3gd20_read_raw(&data), L3GD20_OK);
+    CHECK_EQ(l3gd20_get_temp(&temp), L3GD20_OK);
+    CHECK_EQ(temp, 31);
+    l3gd20_set_temp_rate(0);
+}
+
+static void test_stream_callback(l3gd20_t *dev, l3gd20_result_t result, const l3gd20_data_t *data) {
+    (void) dev;
+
+    CHECK_EQ(result, L3GD20_OK);
+    test_streamed = *data;
+    test_streamed_count++;
+}
+
+/* the stream only latches OUT_TEMP, the factors change when the thread applies it */
+static void test_stream_temp(void) {
+    const l3gd20_t *gyro = l3gd20_get_default();
+    uint8_t idx;
+    int8_t temp;
+
+    board_init(TEST_SPI_HZ, 0);
+    l3gd20_emu_set_temp(&board_gyro, 31.0f);
+    CHECK_EQ(l3gd20_init(&board_spi, L3GD20_SCALE_250), L3GD20_OK);
+    l3gd20_set_temp_comp(&test_temp_table);
+    l3gd20_set_temp_rate(1);
+
+    test_streamed_count = 0;
+    CHECK_EQ(l3gd20_set_int(L3GD20_CR3_I2_DRDY), L3GD20_OK);
+    CHECK_EQ(l3gd20_stream_start(test_stream_callback), L3GD20_OK);
+    test_samples(3);
+    hal_sim_advance_us(1000);
+
+    idx = gyro->factors_idx;
+    CHECK(test_streamed_count >= 2);
+    CHECK(gyro->temp_new);
+    CHECK_EQ(l3gd20_get_temp(&temp), L3GD20_NO_DATA);
+    CHECK_EQ(test_streamed.x, 0);
+
+    l3gd20_apply_temp();
+    CHECK(!gyro->temp_new);
+    CHECK_EQ(l3gd20_get_temp(&temp), L3GD20_OK);
+    CHECK_EQ(temp, 31);
+    CHECK(gyro->factors_idx != idx);
+
+    test_samples(1);
+    hal_sim_advance_us(1000);
+    CHECK_EQ(test_streamed.x, -31);
+
+    /* an unchanged reading leaves the factors alone */
+    idx = gyro->factors_idx;
+    l3gd20_apply_temp();
+    CHECK_EQ(gyro->factors_idx, idx);
+
+    l3gd20_stream_stop();
+    hal_sim_advance_us(1000);
+    CHECK_EQ(l3gd20_set_int(0), L3GD20_OK);
+    l3gd20_set_temp_rate(0);
+    l3gd20_set_temp_comp(NULL);
+}
+
+static void test_counters(void) {
+    hal_sim_bus_stats_t stats;
+    l3gd20_data_t data;
+    uint64_t byte_ns;
+
+    /* at the board clock */
+    board_init(0, 0);
+    byte_ns = (8000000000ull + BOARD_SPI_HZ - 1) / BOARD_SPI_HZ;
+    CHECK_EQ(l3gd20_init(&board_spi, L3GD20_SCALE_250), L3GD20_OK);
+
+    /* WHO_AM_I, then the control burst */
+    hal_sim_spi_stats(&board_spi, &stats);
+    CHECK_EQ(stats.transactions, 2);
+    CHECK_EQ(stats.bytes, 2 + 1 + L3GD20_CTRL_COUNT);
+    CHECK_EQ(stats.cs_toggles, 4);
+    CHECK_EQ(stats.busy_ns, stats.bytes * byte_ns);
+    CHECK_EQ(stats.unselected, 0);
+    CHECK_EQ(stats.glitches, 0);
+
+    /* a read is STATUS_REG and the axes in one transaction */
+    test_samples(1);
+    hal_sim_clear_stats();
+    CHECK_EQ(l3gd20_read_raw(&data), L3GD20_OK);
+    hal_sim_spi_stats(&board_spi, &stats);
+    CHECK_EQ(stats.transactions, L3GD20_READ_TRANSACTIONS);
+    CHECK_EQ(stats.bytes, 2 + L3GD20_SAMPLE_LEN);
+    CHECK_EQ(stats.cs_toggles, 2);
+    CHECK_EQ(stats.busy_ns, (2 + L3GD20_SAMPLE_LEN) * byte_ns);
+}
+
+/* a stream trigger from an interrupt at one preemption point */
+static void test_trigger_hook(void *ctx) {
+    (void) ctx;
+
+    if (++test_preempt == test_trigger_at) {
+        l3gd20_stream_trigger();
+        test_triggers++;
+    }
+}
+
+/* a trigger at every point of a blocking read is deferred to its end, never interleaved */
+static void test_stream_race(void) {
+    hal_sim_bus_stats_t stats;
+    l3gd20_data_t data;
+    uint32_t transfers = 0;
+
+    board_init(TEST_SPI_HZ, 0);
+    CHECK_EQ(l3gd20_init(&board_spi, L3GD20_SCALE_250), L3GD20_OK);
+    CHECK_EQ(l3gd20_stream_start(NULL), L3GD20_OK);
+    hal_sim_advance_us(1000);
+
+    hal_sim_clear_stats();
+    test_triggers = 0;
+
+    for (test_trigger_at = 1; test_trigger_at <= TEST_RACE_POINTS; test_trigger_at++) {
+        test_preempt = 0;
+        hal_sim_set_irq_hook(test_trigger_hook, NULL);
+
+        if (l3gd20_read_raw(&data) != L3GD20_BUSY) {
+            transfers++;
+        }
+
+        hal_sim_set_irq_hook(NULL, NULL);
+        CHECK(!l3gd20_get_default()->stream_pending);
+        hal_sim_advance_us(1000);
+    }
+
+    hal_sim_spi_stats(&board_spi, &stats);
+    CHECK(test_triggers > 0);
+    CHECK_EQ(stats.transactions, transfers + test_triggers);
+    CHECK_EQ(stats.glitches, 0);
+    CHECK_EQ(stats.conflicts, 0);
+    CHECK_EQ(stats.unselected, 0);
+
+    l3gd20_stream_stop();
+}
+
+static void test_fault_callback(l3gd20_t *dev, l3gd20_result_t result, const l3gd20_data_t *data) {
+    (void) dev;
+    (void) data;
+
+    if (result == L3GD20_OK) {
+        test_streamed_count++;
+    } else {
+        test_stream_errors++;
+    }
+}
+
+/* DRDY stays high after a failed read, the sample behind it is read again and acquisition goes on */
+static void test_drdy_fault(void) {
+    l3gd20_data_t data;
+    uint32_t ok = 0, i;
+
+    board_init(TEST_SPI_HZ, 0);
+    CHECK_EQ(l3gd20_init(&board_spi, L3GD20_SCALE_250), L3GD20_OK);
+    CHECK_EQ(l3gd20_set_int(L3GD20_CR3_I2_DRDY), L3GD20_OK);
+
+    test_samples(1);
+    hal_sim_fault_spi(&board_spi, HAL_SIM_FAULT_TIMEOUT, 1);
+    CHECK_EQ(l3gd20_read_raw(&data), L3GD20_ERROR);
+    CHECK_EQ(l3gd20_read_raw(&data), L3GD20_OK);
+    CHECK_EQ(l3gd20_read_raw(&data), L3GD20_NO_DATA);
+
+    for (i = 0; i < 100; i++) {
+        test_samples(1);
+        ok += l3gd20_read_raw(&data) == L3GD20_OK;
+    }
+    CHECK_EQ(ok, 100);
+
+    /* a streamed transfer that fails is started again when it ends */
+    test_streamed_count = 0;
+    test_stream_errors = 0;
+    CHECK_EQ(l3gd20_stream_start(test_fault_callback), L3GD20_OK);
+    hal_sim_advance_us(1000);
+
+    hal_sim_fault_spi(&board_spi, HAL_SIM_FAULT_TIMEOUT, 1);
+    test_samples(1);
+    hal_sim_advance_us(1000);
+    CHECK_EQ(test_stream_errors, 1);
+    CHECK_EQ(test_streamed_count, 1);
+
+    test_samples(100);
+    hal_sim_advance_us(1000);
+    CHECK_EQ(test_streamed_count, 101);
+    CHECK_EQ(test_stream_errors, 1);
+
+    l3gd20_stream_stop();
+    hal_sim_advance_us(1000);
+    CHECK_EQ(l3gd20_set_int(0), L3GD20_OK);
+}
@@ -0,0 +1,278 @@
+#include "test.h"
+#include "imu_log.h"
+
+#include <string.h>
+
+/*
+ * imu_log encoded and decoded again: three interleaved streams with jittered timestamps, random
+ * walks and full-range jumps, and sequence gaps, through ping-pong output buffers and a decoder
+ * fed in odd-sized pieces. Every sample has to come back with its sequence, its value and its
+ * timestamp at the resolution of the stream, across a wrap of the clock. A header that does not
+ * fit the output buffer drops its keyframe, so no sample is decoded with the scale of an earlier
+ * header.
+ */
+
+#define TEST_SAMPLES       4000
+#define TEST_BUF           512         // bytes per output buffer, swapped when half full
+#define TEST_GAP_EVERY     37          // records of a stream between sequence gaps
+#define TEST_T0            0xFFF00000u // ticks of the first sample time
+
+typedef struct {
+    imu_ring_record_t rec[IMU_LOG_STREAMS][TEST_SAMPLES];
+    uint32_t count[IMU_LOG_STREAMS];    // records encoded
+    uint32_t next[IMU_LOG_STREAMS];     // records decoded
+    float scale[IMU_LOG_STREAMS];       // expected of the decoded samples
+    bool ok;
+} test_log_t;
+
+/* private variables */
+static const uint8_t test_bits[IMU_LOG_STREAMS] = { 16, 12, 12 };
+static const uint32_t test_period_ns[IMU_LOG_STREAMS] = { 1315789, 10000000, 13333333 };
+
+static imu_log_encoder_t test_enc;
+static imu_log_decoder_t test_dec;
+static test_log_t test_log;
+static uint8_t test_buf[2][TEST_BUF];
+static uint8_t test_active;
+static uint32_t test_seed = 1;
+
+/* private functions */
+static uint32_t test_random(void);
+static int16_t test_clamp(int32_t v, uint8_t bits);
+static void test_sample(void *ctx, const imu_log_sample_t *sample);
+static void test_drain(void);
+static void test_configure(float gyro_scale);
+static void test_round_trip(void);
+static void test_header_full(void);
+static void test_errors(void);
+
+int main(void) {
+    test_round_trip();
+    test_header_full();
+    test_errors();
+
+    return test_report("test_log");
+}
+
+/* private functions */
+
+/* the same sequence every run */
+static uint32_t test_random(void) {
+    test_seed = test_seed * 1103515245u + 12345u;
+
+    return test_seed >> 8;
+}
+
+/* into the signed range of bits */
+static int16_t test_clamp(int32_t v, uint8_t bits) {
+    int32_t top = (1 << (bits - 1)) - 1;
+
+    return (int16_t) ((v > top) ? top : (v < -top - 1) ? -top - 1 : v);
+}
+
+/* the next expected record of the stream, at the timestamp resolution of its header */
+static void test_sample(void *ctx, const imu_log_sample_t *sample) {
+    test_log_t *log = (test_log_t *) ctx;
+    const imu_ring_record_t *rec;
+    uint8_t shift = sample->header->shift;
+
+    if (log->next[sample->sensor] >= log->count[sample->sensor]) {
+        log->ok = false;
+        return;
+    }
+
+    rec = &log->rec[sample->sensor][log->next[sample->sensor]++];
+
+    if (sample->sequence != rec->sequence || sample->x != rec->x || sample->y != rec->y || sample->z != rec->z
+        || sample->timestamp != (rec->timestamp >> shift) << shift || sample->header->scale != log->scale[sample->sensor]) {
+        log->ok = false;
+    }
+}
+
+/* the filled buffer to the decoder in pieces of 1 to 61 bytes */
+static void test_drain(void) {
+    uint8_t *data;
+    uint32_t n, done = 0, len;
+
+    n = imu_log_swap(&test_enc, test_buf[test_active ^ 1], TEST_BUF, &data);
+    test_active ^= 1;
+
+    while (done < n) {
+        len = 1 + test_random() % 61;
+        len = (len < n - done) ? len : n - done;
+
+        imu_log_decode(&test_dec, &data[done], len, test_sample, &test_log);
+        done += len;
+    }
+}
+
+static void test_configure(float gyro_scale) {
+    CHECK_EQ(imu_log_set_stream(&test_enc, IMU_RING_GYRO, test_bits[IMU_RING_GYRO], 0x10, gyro_scale), IMU_LOG_OK);
+    CHECK_EQ(imu_log_set_stream(&test_enc, IMU_RING_ACC, test_bits[IMU_RING_ACC], 0x08, 0.0098f), IMU_LOG_OK);
+    CHECK_EQ(imu_log_set_stream(&test_enc, IMU_RING_MAG, test_bits[IMU_RING_MAG], 0x20, 0.0909f), IMU_LOG_OK);
+
+    test_log.scale[IMU_RING_GYRO] = gyro_scale;
+    test_log.scale[IMU_RING_ACC] = 0.0098f;
+    test_log.scale[IMU_RING_MAG] = 0.0909f;
+}
+
+static void test_round_trip(void) {
+    uint64_t next_ns[IMU_LOG_STREAMS] = { 0, 0, 0 };
+    uint32_t sequence[IMU_LOG_STREAMS] = { 0, 0, 0 };
+    int32_t v[IMU_LOG_STREAMS][3] = { { 0 } };
+    uint32_t gaps = 0, i;
+    uint8_t sensor, k, axis;
+
+    memset(&test_log, 0, sizeof(test_log));
+    test_log.ok = true;
+    test_active = 0;
+    imu_log_encoder_init(&test_enc, test_buf[0], TEST_BUF);
+    imu_log_decoder_init(&test_dec);
+    test_configure(0.0175f);
+
+    for (i = 0; i < TEST_SAMPLES; i++) {
+        imu_ring_record_t *rec;
+
+        /* the stream with the earliest sample next */
+        sensor = 0;
+        for (k = 1; k < IMU_LOG_STREAMS; k++) {
+            sensor = (next_ns[k] < next_ns[sensor]) ? k : sensor;
+        }
+
+        rec = &test_log.rec[sensor][test_log.count[sensor]];
+
+        /* a few samples missing now and then, also right after a keyframe */
+        if (test_log.count[sensor] % TEST_GAP_EVERY == TEST_GAP_EVERY - 1) {
+            sequence[sensor] += 1 + test_random() % 5;
+            gaps++;
+        }
+
+        /* a random walk, a jump across the whole range every 100th sample */
+        for (axis = 0; axis < 3; axis++) {
+            if (test_log.count[sensor] % 100 == 50) {
+                v[sensor][axis] = -v[sensor][axis] + ((axis == 1) ? 1 << 15 : -(1 << 15));
+            } else {
+                v[sensor][axis] += (int32_t) (test_random() % 401) - 200;
+            }
+
+            v[sensor][axis] = test_clamp(v[sensor][axis], test_bits[sensor]);
+        }
+
+        *rec = (imu_ring_record_t) {
+            .timestamp = TEST_T0 + (uint32_t) (next_ns[sensor] + test_random() % 20000),
+            .sequence = sequence[sensor]++,
+            .x = (int16_t) v[sensor][0],
+            .y = (int16_t) v[sensor][1],
+            .z = (int16_t) v[sensor][2],
+            .sensor = sensor
+        };
+        test_log.count[sensor]++;
+        next_ns[sensor] += test_period_ns[sensor];
+
+        CHECK_EQ(imu_log_encode(&test_enc, rec), IMU_LOG_OK);
+
+        if (test_enc.used > TEST_BUF / 2) {
+            test_drain();
+        }
+    }
+
+    CHECK_EQ(imu_log_flush(&test_enc), IMU_LOG_OK);
+    CHECK_EQ(imu_log_write_stats(&test_enc), IMU_LOG_OK);
+    test_drain();
+
+    CHECK(gaps > 100);
+    CHECK(test_log.ok);
+    CHECK_EQ(test_enc.lost, 0);
+    CHECK_EQ(test_dec.crc_errors, 0);
+    CHECK_EQ(test_dec.skipped, 0);
+    CHECK_EQ(test_dec.unsynced, 0);
+
+    for (sensor = 0; sensor < IMU_LOG_STREAMS; sensor++) {
+        CHECK_EQ(test_log.next[sensor], test_log.count[sensor]);
+    }
+
+    /* the timestamps wrap early in the run */
+    CHECK(test_log.rec[IMU_RING_GYRO][test_log.count[IMU_RING_GYRO] - 1].timestamp < test_log.rec[IMU_RING_GYRO][0].timestamp);
+
+    CHECK(test_dec.stats_valid);
+    CHECK_EQ(test_dec.stats.samples, TEST_SAMPLES);
+    CHECK_EQ(test_dec.stats.bytes, test_enc.bytes - (IMU_LOG_OVERHEAD + 24));
+    CHECK(test_enc.bytes < TEST_SAMPLES * sizeof(imu_ring_record_t) / 2);
+}
+
+/* a new scale whose header is lost with the output buffer full: its first sample goes as well */
+static void test_header_full(void) {
+    imu_ring_record_t rec = { .timestamp = 5000000, .sequence = 0, .x = 100, .y = -200, .z = 300, .sensor = IMU_RING_GYRO };
+    uint8_t small[8];
+    uint8_t *data;
+    uint32_t i;
+
+    memset(&test_log, 0, sizeof(test_log));
+    test_log.ok = true;
+    test_active = 0;
+    imu_log_encoder_init(&test_enc, test_buf[0], TEST_BUF);
+    imu_log_decoder_init(&test_dec);
+    test_configure(0.0175f);
+
+    /* the decoder knows the old scale */
+    for (i = 0; i < 10; i++) {
+        test_log.rec[IMU_RING_GYRO][test_log.count[IMU_RING_GYRO]++] = rec;
+        CHECK_EQ(imu_log_encode(&test_enc, &rec), IMU_LOG_OK);
+        rec.sequence++;
+        rec.timestamp += 1315789;
+        rec.x += 7;
+    }
+
+    CHECK_EQ(imu_log_flush(&test_enc), IMU_LOG_OK);
+    test_drain();
+    CHECK_EQ(test_log.next[IMU_RING_GYRO], 10);
+
+    /* no room for the header of the new scale, nor for anything else */
+    imu_log_swap(&test_enc, small, sizeof(small), &data);
+    CHECK_EQ(imu_log_set_stream(&test_enc, IMU_RING_GYRO, 16, 0x20, 0.07f), IMU_LOG_OK);
+    test_log.scale[IMU_RING_GYRO] = 0.07f;
+
+    CHECK_EQ(imu_log_encode(&test_enc, &rec), IMU_LOG_FULL);
+    CHECK_EQ(test_enc.lost, 1);
+    CHECK_EQ(test_enc.used, 0);
+    rec.sequence++;
+    rec.timestamp += 1315789;
+
+    /* the next sample is the keyframe, after its header */
+    imu_log_swap(&test_enc, test_buf[test_active], TEST_BUF, &data);
+
+    for (i = 0; i < 10; i++) {
+        test_log.rec[IMU_RING_GYRO][test_log.count[IMU_RING_GYRO]++] = rec;
+        CHECK_EQ(imu_log_encode(&test_enc, &rec), IMU_LOG_OK);
+        rec.sequence++;
+        rec.timestamp += 1315789;
+        rec.x -= 3;
+    }
+
+    CHECK_EQ(imu_log_flush(&test_enc), IMU_LOG_OK);
+    test_drain();
+
+    CHECK(test_log.ok);
+    CHECK_EQ(test_log.next[IMU_RING_GYRO], 20);
+    CHECK_EQ(test_dec.header[IMU_RING_GYRO].gain, 0x20);
+    CHECK_EQ(test_dec.unsynced, 0);
+}
+
+static void test_errors(void) {
+    imu_ring_record_t rec = { .timestamp = 0, .sequence = 0, .x = 2048, .y = 0, .z = 0, .sensor = IMU_RING_ACC };
+
+    imu_log_encoder_init(&test_enc, test_buf[0], TEST_BUF);
+
+    /* unconfigured, out of range and too wide for the stream */
+    CHECK_EQ(imu_log_encode(&test_enc, &rec), IMU_LOG_ERROR);
+    CHECK_EQ(imu_log_set_stream(&test_enc, (imu_ring_sensor_t) IMU_LOG_STREAMS, 12, 0, 1.0f), IMU_LOG_ERROR);
+    CHECK_EQ(imu_log_set_stream(&test_enc, IMU_RING_ACC, 0, 0, 1.0f), IMU_LOG_ERROR);
+    CHECK_EQ(imu_log_set_stream(&test_enc, IMU_RING_ACC, 17, 0, 1.0f), IMU_LOG_ERROR);
+    CHECK_EQ(imu_log_set_stream(&test_enc, IMU_RING_ACC, 12, 0, 1.0f), IMU_LOG_OK);
+    CHECK_EQ(imu_log_encode(&test_enc, &rec), IMU_LOG_ERROR);
+
+    rec.x = 2047;
+    CHECK_EQ(imu_log_encode(&test_enc, &rec), IMU_LOG_OK);
+    rec.sensor = IMU_LOG_STREAMS;
+    CHECK_EQ(imu_log_encode(&test_enc, &rec), IMU_LOG_ERROR);
+}
@@ -0,0 +1,612 @@
+#include "test.h"
+#include "board.h"
+#include "stm32f3xx_lsm303dlhc.h"
+#include "imu_stats.h"
+
+#include <string.h>
+
+/* private variables */
+static const lsm303dlhc_acc_init_t test_acc_init = {
+    .ctrl_reg1_a = LSM303DLHC_ACR1A_ODR30_100_HZ | LSM303DLHC_ACR1A_XEN | LSM303DLHC_ACR1A_YEN | LSM303DLHC_ACR1A_ZEN,
+    .ctrl_reg4_a = LSM303DLHC_ACR4A_HR | LSM303DLHC_ACR4A_FS10_1MG,
+    .fifo_mode = LSM303DLHC_ACCFIFO_BYPASS
+};
+
+static const lsm303dlhc_mag_init_t test_mag_init = {
+    .op = LSM303DLHC_MAGOP_CONT,
+    .rate = LSM303DLHC_MAGRATE_75,
+    .gain = LSM303DLHC_MAGGAIN_1_3,
+    .auto_range = false
+};
+
+static const lsm303dlhc_mag_init_t test_mag_sleep_init = {
+    .op = LSM303DLHC_MAGOP_SLEEP2,
+    .rate = LSM303DLHC_MAGRATE_75,
+    .gain = LSM303DLHC_MAGGAIN_1_3,
+    .auto_range = false
+};
+
+/* completions of the asynchronous reads, 'A', 'M' or 'E' in the order they were called back */
+#define TEST_ASYNC_MAX    8
+
+static char test_async_order[TEST_ASYNC_MAX + 1];
+static uint8_t test_async_count;
+static const lsm303dlhc_data_raw_t *test_async_data[TEST_ASYNC_MAX];
+static lsm303dlhc_data_raw_t test_async_copy[TEST_ASYNC_MAX];
+static lsm303dlhc_xfer_t test_async_xfer[TEST_ASYNC_MAX];    // transfer running while the callback ran
+static uint8_t test_async_restart;                          // reads to start from the callback
+
+/* private functions */
+static void test_counter_source(void *ctx, uint64_t t_ns, float value[3]);
+static void test_i2c_read(uint8_t address, uint8_t reg, uint8_t *data, uint16_t len);
+static void test_acc_samples(uint32_t count);
+static void test_mag_samples(uint32_t count);
+static void test_init(void);
+static void test_auto_increment(void);
+static void test_acc_status(void);
+static void test_acc_fifo(void);
+static void test_mag(void);
+static void test_mag_saturation(void);
+static void test_mag_lock(void);
+static void test_counters(void);
+static void test_stats_timeout(void);
+static void test_async_record(lsm303dlhc_t *dev, char kind, lsm303dlhc_result_t result, const lsm303dlhc_data_raw_t *data);
+static void test_async_acc(lsm303dlhc_t *dev, lsm303dlhc_result_t result, const lsm303dlhc_data_raw_t *data);
+static void test_async_mag(lsm303dlhc_t *dev, lsm303dlhc_result_t result, const lsm303dlhc_data_raw_t *data);
+static void test_async_reset(void);
+static void test_async_ownership(void);
+static void test_async_order_drdy(void);
+static void test_async_error(void);
+static void test_drdy_fault(void);
+
+int main(void) {
+    test_init();
+    test_auto_increment();
+    test_acc_status();
+    test_acc_fifo();
+    test_mag();
+    test_mag_saturation();
+    test_mag_lock();
+    test_counters();
+    test_stats_timeout();
+    test_async_ownership();
+    test_async_order_drdy();
+    test_async_error();
+    test_drdy_fault();
+
+    return test_report("test_lsm303dlhc");
+}
+
+/* private functions */
+
+/* sample n reads n mg on X, -n on Y and 2n on Z */
+static void test_counter_source(void *ctx, uint64_t t_ns, float value[3]) {
+    uint32_t *n = ctx;
+
+    (void) t_ns;
+    (*n)++;
+
+    value[0] = (float) *n;
+    value[1] = -(float) *n;
+    value[2] = 2.0f * (float) *n;
+}
+
+/* the sub-address, then len bytes in a second transfer */
+static void test_i2c_read(uint8_t address, uint8_t reg, uint8_t *data, uint16_t len) {
+    HAL_I2C_Master_Transmit(&board_i2c, address, &reg, 1, 10);
+    HAL_I2C_Master_Receive(&board_i2c, address, data, len, 10);
+}
+
+/* runs up to the given number of samples, the bus is idle until the next one */
+static void test_acc_samples(uint32_t count) {
+    while (count-- > 0) {
+        hal_sim_run_until(board_lsm.acc.next_ns);
+    }
+}
+
+static void test_mag_samples(uint32_t count) {
+    while (count-- > 0) {
+        hal_sim_run_until(board_lsm.mag.next_ns);
+    }
+}
+
+static void test_init(void) {
+    board_init(0, 0);
+
+    CHECK_EQ(board_lsm.acc.reg[LSM303DLHC_REG_ACC_CTRL_REG1_A], 0x07);
+    CHECK_EQ(board_lsm.mag.reg[LSM303DLHC_REG_MAG_MR_REG_M], LSM303DLHC_MAGOP_SLEEP2);
+
+    CHECK_EQ(lsm303dlhc_init_acc(&board_i2c, &test_acc_init), LSM303DLHC_OK);
+    CHECK_EQ(board_lsm.acc.reg[LSM303DLHC_REG_ACC_CTRL_REG1_A], test_acc_init.ctrl_reg1_a);
+    CHECK_EQ(board_lsm.acc.reg[LSM303DLHC_REG_ACC_CTRL_REG4_A], test_acc_init.ctrl_reg4_a);
+    CHECK(board_lsm.acc.running);
+
+    CHECK_EQ(lsm303dlhc_init_mag(&board_i2c, &test_mag_init), LSM303DLHC_OK);
+    CHECK_EQ(board_lsm.mag.reg[LSM303DLHC_REG_MAG_CRA_REG_M], LSM303DLHC_MAGRATE_75 << 2);
+    CHECK_EQ(board_lsm.mag.reg[LSM303DLHC_REG_MAG_CRB_REG_M], LSM303DLHC_MAGGAIN_1_3);
+    CHECK_EQ(board_lsm.mag.reg[LSM303DLHC_REG_MAG_MR_REG_M], LSM303DLHC_MAGOP_CONT);
+    CHECK(board_lsm.mag.running);
+
+    /* nothing answers at the addresses: the read-back fails */
+    hal_sim_reset();
+    hal_sim_attach_i2c(&board_i2c, BOARD_I2C_HZ);
+    CHECK_EQ(lsm303dlhc_init_acc(&board_i2c, &test_acc_init), LSM303DLHC_ERROR);
+    CHECK_EQ(HAL_I2C_GetError(&board_i2c), HAL_I2C_ERROR_AF);
+}
+
+static void test_auto_increment(void) {
+    uint8_t buf[4];
+
+    board_init(0, 0);
+    CHECK_EQ(lsm303dlhc_init_acc(&board_i2c, &test_acc_init), LSM303DLHC_OK);
+    CHECK_EQ(lsm303dlhc_init_mag(&board_i2c, &test_mag_init), LSM303DLHC_OK);
+
+    /* the accelerometer increments only with the MSB of the sub-address */
+    test_i2c_read(LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_CTRL_REG1_A, buf, 4);
+    CHECK_EQ(buf[0], test_acc_init.ctrl_reg1_a);
+    CHECK_EQ(buf[3], test_acc_init.ctrl_reg1_a);
+
+    test_i2c_read(LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_CTRL_REG1_A | 0x80, buf, 4);
+    CHECK_EQ(buf[0], test_acc_init.ctrl_reg1_a);
+    CHECK_EQ(buf[1], 0x00);
+    CHECK_EQ(buf[3], test_acc_init.ctrl_reg4_a);
+
+    /* the pointer stays across the STOP */
+    HAL_I2C_Master_Receive(&board_i2c, LSM303DLHC_ADDR_ACC, buf, 1, 10);
+    CHECK_EQ(buf[0], 0x00);    // CTRL_REG5_A
+
+    /* the magnetometer always increments, over the identification registers too */
+    test_i2c_read(LSM303DLHC_ADDR_MAG, LSM303DLHC_REG_MAG_CRA_REG_M, buf, 3);
+    CHECK_EQ(buf[0], LSM303DLHC_MAGRATE_75 << 2);
+    CHECK_EQ(buf[1], LSM303DLHC_MAGGAIN_1_3);
+    CHECK_EQ(buf[2], LSM303DLHC_MAGOP_CONT);
+
+    test_i2c_read(LSM303DLHC_ADDR_MAG, 0x0A, buf, 3);
+    CHECK_EQ(buf[0], 'H');
+    CHECK_EQ(buf[1], '4');
+    CHECK_EQ(buf[2], '3');
+}
+
+static void test_acc_status(void) {
+    lsm303dlhc_data_raw_t data;
+    uint8_t status;
+
+    board_init(0, 0);
+    lsm303dlhc_emu_set_acc(&board_lsm, 1000.0f, -500.0f, 250.4f);
+    CHECK_EQ(lsm303dlhc_init_acc(&board_i2c, &test_acc_init), LSM303DLHC_OK);
+
+    test_acc_samples(1);
+    test_i2c_read(LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_STATUS_REG_A, &status, 1);
+    CHECK_EQ(status, 0x0F);
+
+    CHECK_EQ(lsm303dlhc_read_acc_raw(&data), LSM303DLHC_OK);
+    CHECK_EQ(data.x, 1000);
+    CHECK_EQ(data.y, -500);
+    CHECK_EQ(data.z, 250);
+
+    test_i2c_read(LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_STATUS_REG_A, &status, 1);
+    CHECK_EQ(status, 0x00);
+
+    /* unread samples overrun */
+    test_acc_samples(2);
+    test_i2c_read(LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_STATUS_REG_A, &status, 1);
+    CHECK_EQ(status, 0xFF);
+
+    /* clamped to 12 bits, normal mode leaves 10 */
+    lsm303dlhc_emu_set_acc(&board_lsm, 5000.0f, -5000.0f, 7.0f);
+    CHECK_EQ(lsm303dlhc_set_acc_scale(LSM303DLHC_ACR4A_FS10_1MG), LSM303DLHC_OK);
+    test_acc_samples(1);
+    CHECK_EQ(lsm303dlhc_read_acc_raw(&data), LSM303DLHC_OK);
+    CHECK_EQ(data.x, 2044);
+    CHECK_EQ(data.y, -2048);
+    CHECK_EQ(data.z, 4);
+}
+
+static void test_acc_fifo(void) {
+    const lsm303dlhc_acc_init_t init = {
+        .ctrl_reg1_a = LSM303DLHC_ACR1A_ODR30_400_HZ | LSM303DLHC_ACR1A_XEN | LSM303DLHC_ACR1A_YEN | LSM303DLHC_ACR1A_ZEN,
+        .ctrl_reg4_a = LSM303DLHC_ACR4A_HR,
+        .fifo_mode = LSM303DLHC_ACCFIFO_STREAM,
+        .fifo_watermark = 8
+    };
+    lsm303dlhc_data_raw_t data[LSM303DLHC_ACC_FIFO_SIZE];
+    lsm303dlhc_fifo_status_t status;
+    uint32_t n = 0, last;
+    uint8_t count;
+
+    board_init(0, 0);
+    lsm303dlhc_emu_set_acc_source(&board_lsm, test_counter_source, &n);
+    CHECK_EQ(lsm303dlhc_init_acc(&board_i2c, &init), LSM303DLHC_OK);
+    CHECK_EQ(board_lsm.acc.reg[LSM303DLHC_REG_ACC_CTRL_REG5_A], LSM303DLHC_ACR5A_FIFO_EN);
+
+    test_acc_samples(10);
+    CHECK_EQ(lsm303dlhc_read_acc_fifo(data, LSM303DLHC_ACC_FIFO_SIZE, &count), LSM303DLHC_OK);
+    CHECK_EQ(count, 10);
+    CHECK_EQ(data[0].x, 1);
+    CHECK_EQ(data[9].x, 10);
+    CHECK_EQ(data[9].y, -10);
+    CHECK_EQ(data[9].z, 20);
+    lsm303dlhc_get_acc_fifo_status(&status);
+    CHECK(status.watermark);
+    CHECK(!status.overrun);
+
+    test_acc_samples(40);
+    last = n;
+    CHECK_EQ(lsm303dlhc_read_acc_fifo(data, LSM303DLHC_ACC_FIFO_SIZE, &count), LSM303DLHC_OVERRUN);
+    CHECK_EQ(count, LSM303DLHC_ACC_FIFO_SIZE);
+    CHECK_EQ(data[0].x, (int32_t) last - LSM303DLHC_ACC_FIFO_SIZE + 1);
+    CHECK_EQ(data[LSM303DLHC_ACC_FIFO_SIZE - 1].x, (int32_t) last);
+    lsm303dlhc_get_acc_fifo_status(&status);
+    CHECK_EQ(status.overruns, 1);
+
+    /* FIFO mode stops when full */
+    CHECK_EQ(lsm303dlhc_set_acc_fifo(LSM303DLHC_ACCFIFO_FIFO, 0), LSM303DLHC_OK);
+    test_acc_samples(40);
+    CHECK_EQ(lsm303dlhc_read_acc_fifo(data, LSM303DLHC_ACC_FIFO_SIZE, &count), LSM303DLHC_OVERRUN);
+    CHECK_EQ(count, LSM303DLHC_ACC_FIFO_SIZE);
+    CHECK_EQ(data[LSM303DLHC_ACC_FIFO_SIZE - 1].x - data[0].x, LSM303DLHC_ACC_FIFO_SIZE - 1);
+    CHECK(data[LSM303DLHC_ACC_FIFO_SIZE - 1].x < (int32_t) n);
+}
+
+static void test_mag(void) {
+    lsm303dlhc_data_raw_t data;
+    float temp;
+
+    board_init(0, 0);
+    lsm303dlhc_emu_set_mag(&board_lsm, 0.5f, -0.25f, 1.0f);
+    lsm303dlhc_emu_set_temp(&board_lsm, 30.0f);
+    CHECK_EQ(lsm303dlhc_init_mag(&board_i2c, &test_mag_init), LSM303DLHC_OK);
+
+    CHECK_EQ(lsm303dlhc_read_mag_raw(&data), LSM303DLHC_NO_DATA);
+
+    /* X, Z, Y on the bus, the driver puts them in order */
+    test_mag_samples(1);
+    CHECK_EQ(lsm303dlhc_read_mag_raw(&data), LSM303DLHC_OK);
+    CHECK_EQ(data.x, 550);
+    CHECK_EQ(data.y, -275);
+    CHECK_EQ(data.z, 980);
+    CHECK_EQ(lsm303dlhc_read_mag_raw(&data), LSM303DLHC_NO_DATA);
+
+    /* the temperature comes with the next reading once enabled */
+    CHECK_EQ(lsm303dlhc_set_temp_rate(1), LSM303DLHC_OK);
+    CHECK(board_lsm.mag.reg[LSM303DLHC_REG_MAG_CRA_REG_M] & LSM303DLHC_CRAM_TEMP_EN);
+    test_mag_samples(1);
+    CHECK_EQ(lsm303dlhc_read_mag_raw(&data), LSM303DLHC_OK);
+    CHECK_EQ(lsm303dlhc_get_temp(&temp), LSM303DLHC_OK);
+    CHECK_NEAR(temp, 30.0f, 0.125f);
+    CHECK_EQ(lsm303dlhc_set_temp_rate(0), LSM303DLHC_OK);
+
+    /* single mode converts once, then sleeps */
+    CHECK_EQ(lsm303dlhc_mag_trigger(), LSM303DLHC_OK);
+    hal_sim_advance_us(lsm303dlhc_mag_conversion_us(board_lsm.mag.reg[LSM303DLHC_REG_MAG_CRA_REG_M]) + 1000);
+    CHECK_EQ(board_lsm.mag.reg[LSM303DLHC_REG_MAG_MR_REG_M] & 0x03, LSM303DLHC_MAGOP_SLEEP2);
+    CHECK(!board_lsm.mag.running);
+}
+
+static void test_mag_saturation(void) {
+    lsm303dlhc_mag_init_t init = test_mag_init;
+    lsm303dlhc_mag_sample_t sample;
+    lsm303dlhc_data_raw_t data;
+    lsm303dlhc_data_t conv;
+
+    board_init(0, 0);
+    lsm303dlhc_emu_set_mag(&board_lsm, 2.0f, 0.1f, -2.5f);
+    CHECK_EQ(lsm303dlhc_init_mag(&board_i2c, &init), LSM303DLHC_OK);
+
+    /* beyond the range of the gain an axis reads -4096 */
+    test_mag_samples(1);
+    CHECK_EQ(lsm303dlhc_read_mag_raw(&data), LSM303DLHC_OK);
+    CHECK_EQ(data.x, -4096);
+    CHECK_EQ(data.y, 110);
+    CHECK_EQ(data.z, -4096);
+
+    /* auto-ranging drops it and widens, the first sample after every gain change is dropped too */
+    init.auto_range = true;
+    CHECK_EQ(lsm303dlhc_init_mag(&board_i2c, &init), LSM303DLHC_OK);
+    test_mag_samples(1);
+    CHECK_EQ(lsm303dlhc_read_mag_raw(&data), LSM303DLHC_NO_DATA);
+    CHECK_EQ(board_lsm.mag.reg[LSM303DLHC_REG_MAG_CRB_REG_M], LSM303DLHC_MAGGAIN_1_3);
+    test_mag_samples(1);
+    CHECK_EQ(lsm303dlhc_read_mag_raw(&data), LSM303DLHC_NO_DATA);
+    CHECK_EQ(board_lsm.mag.reg[LSM303DLHC_REG_MAG_CRB_REG_M], LSM303DLHC_MAGGAIN_1_9);
+    test_mag_samples(1);
+    CHECK_EQ(lsm303dlhc_read_mag_raw(&data), LSM303DLHC_NO_DATA);
+
+    /* near the top of the range the sample is kept with its gain and the next gain is already set */
+    test_mag_samples(1);
+    CHECK_EQ(lsm303dlhc_read_mag_sample(&sample), LSM303DLHC_OK);
+    CHECK_EQ(sample.raw.x, 1710);
+    CHECK_EQ(sample.raw.z, -1900);
+    CHECK_EQ(sample.gain, LSM303DLHC_MAGGAIN_1_9);
+    CHECK_EQ(board_lsm.mag.reg[LSM303DLHC_REG_MAG_CRB_REG_M], LSM303DLHC_MAGGAIN_2_5);
+    lsm303dlhc_convert_mag_sample(&conv, &sample);
+    CHECK_NEAR(conv.x, 200.0f, 0.5f);
+    CHECK_NEAR(conv.z, -250.0f, 0.5f);
+
+    /* untagged it would be converted at the new gain, so it is dropped as well */
+    init.gain = LSM303DLHC_MAGGAIN_1_9;
+    CHECK_EQ(lsm303dlhc_init_mag(&board_i2c, &init), LSM303DLHC_OK);
+    test_mag_samples(1);
+    CHECK_EQ(lsm303dlhc_read_mag_raw(&data), LSM303DLHC_NO_DATA);    // after the gain change of init
+    CHECK_EQ(board_lsm.mag.reg[LSM303DLHC_REG_MAG_CRB_REG_M], LSM303DLHC_MAGGAIN_1_9);
+    test_mag_samples(1);
+    CHECK_EQ(lsm303dlhc_read_mag_raw(&data), LSM303DLHC_NO_DATA);
+    CHECK_EQ(board_lsm.mag.reg[LSM303DLHC_REG_MAG_CRB_REG_M], LSM303DLHC_MAGGAIN_2_5);
+    test_mag_samples(1);
+    CHECK_EQ(lsm303dlhc_read_mag_raw(&data), LSM303DLHC_NO_DATA);
+    test_mag_samples(1);
+    CHECK_EQ(lsm303dlhc_read_mag_raw(&data), LSM303DLHC_OK);
+    CHECK_EQ(data.z, -1500);
+    lsm303dlhc_convert_mag(&conv, &data);
+    CHECK_NEAR(conv.x, 200.0f, 0.5f);
+    CHECK_NEAR(conv.z, -250.0f, 0.5f);
+}
+
+static void test_mag_lock(void) {
+    uint8_t buf[6], sr;
+
+    board_init(0, 0);
+    lsm303dlhc_emu_set_mag(&board_lsm, 0.1f, 0.2f, 0.3f);
+    CHECK_EQ(lsm303dlhc_init_mag(&board_i2c, &test_mag_init), LSM303DLHC_OK);
+    test_mag_samples(1);
+
+    test_i2c_read(LSM303DLHC_ADDR_MAG, LSM303DLHC_REG_MAG_SR_REG_Mg, &sr, 1);
+    CHECK_EQ(sr, 0x01);
+
+    /* a conversion while the outputs are half read is held back */
+    test_i2c_read(LSM303DLHC_ADDR_MAG, LSM303DLHC_REG_MAG_OUT_X_H_M, buf, 2);
+    test_i2c_read(LSM303DLHC_ADDR_MAG, LSM303DLHC_REG_MAG_SR_REG_Mg, &sr, 1);
+    CHECK_EQ(sr, 0x02);
+
+    lsm303dlhc_emu_set_mag(&board_lsm, -0.1f, 0.2f, 0.3f);
+    test_mag_samples(1);
+    test_i2c_read(LSM303DLHC_ADDR_MAG, LSM303DLHC_REG_MAG_SR_REG_Mg, &sr, 1);
+    CHECK_EQ(sr, 0x02);
+
+    test_i2c_read(LSM303DLHC_ADDR_MAG, LSM303DLHC_REG_MAG_OUT_X_H_M + 2, buf, 4);
+    test_i2c_read(LSM303DLHC_ADDR_MAG, LSM303DLHC_REG_MAG_SR_REG_Mg, &sr, 1);
+    CHECK_EQ(sr, 0x01);
+
+    /* the pointer rolls over from OUT_Y_L_M, the released sample is there */
+    test_i2c_read(LSM303DLHC_ADDR_MAG, LSM303DLHC_REG_MAG_OUT_X_H_M, buf, 6);
+    CHECK_EQ((int16_t) (buf[0] << 8 | buf[1]), -110);
+    HAL_I2C_Master_Receive(&board_i2c, LSM303DLHC_ADDR_MAG, buf, 2, 10);
+    CHECK_EQ((int16_t) (buf[0] << 8 | buf[1]), -110);
+}
+
+static void test_counters(void) {
+    lsm303dlhc_data_raw_t data;
+    hal_sim_bus_stats_t stats;
+    uint64_t bit_ns = (1000000000ull + BOARD_I2C_HZ - 1) / BOARD_I2C_HZ;
+
+    board_init(0, 0);
+    CHECK_EQ(lsm303dlhc_init_acc(&board_i2c, &test_acc_init), LSM303DLHC_OK);
+    CHECK_EQ(lsm303dlhc_init_mag(&board_i2c, &test_mag_init), LSM303DLHC_OK);
+    test_acc_samples(1);
+
+    /* the sub-address, a repeated transfer of the axes; START and address, 9 bits a byte, STOP */
+    hal_sim_clear_stats();
+    CHECK_EQ(lsm303dlhc_read_acc_raw(&data), LSM303DLHC_OK);
+    hal_sim_i2c_stats(&board_i2c, &stats);
+    CHECK_EQ(stats.transactions, 2 * LSM303DLHC_READ_ACC_TRANSACTIONS);
+    CHECK_EQ(stats.bytes, 2 + 1 + LSM303DLHC_ACC_LEN);
+    CHECK_EQ(stats.busy_ns, (10 + 9 + 1 + 10 + 9 * LSM303DLHC_ACC_LEN + 1) * bit_ns);
+    CHECK_EQ(stats.cs_toggles, 0);
+
+    /* status, then the outputs */
+    test_mag_samples(1);
+    hal_sim_clear_stats();
+    CHECK_EQ(lsm303dlhc_read_mag_raw(&data), LSM303DLHC_OK);
+    hal_sim_i2c_stats(&board_i2c, &stats);
+    CHECK_EQ(stats.transactions, 4);
+    CHECK_EQ(stats.bytes, 2 * 2 + 1 + 1 + 1 + LSM303DLHC_MAG_LEN);
+}
+
+static void test_stats_timeout(void) {
+    lsm303dlhc_data_raw_t data;
+    imu_stats_t stats;
+
+    board_init(0, 0);
+    CHECK_EQ(lsm303dlhc_init_acc(&board_i2c, &test_acc_init), LSM303DLHC_OK);
+    imu_stats_reset();
+
+    /* HAL_ERROR with HAL_I2C_ERROR_TIMEOUT is a timeout, a NACK an error */
+    hal_sim_fault_i2c(&board_i2c, HAL_SIM_FAULT_TIMEOUT, 1);
+    CHECK_EQ(lsm303dlhc_read_acc_raw(&data), LSM303DLHC_ERROR);
+    imu_stats_snapshot(IMU_STATS_LSM303DLHC_READ_I2C, &stats);
+    CHECK_EQ(stats.calls, 1);
+    CHECK_EQ(stats.timeouts, 1);
+    CHECK_EQ(stats.errors, 0);
+
+    hal_sim_fault_i2c(&board_i2c, HAL_SIM_FAULT_NACK, 1);
+    CHECK_EQ(lsm303dlhc_read_acc_raw(&data), LSM303DLHC_ERROR);
+    imu_stats_snapshot(IMU_STATS_LSM303DLHC_READ_I2C, &stats);
+    CHECK_EQ(stats.timeouts, 1);
+    CHECK_EQ(stats.errors, 1);
+}
+
+static void test_async_record(lsm303dlhc_t *dev, char kind, lsm303dlhc_result_t result, const lsm303dlhc_data_raw_t *data) {
+    uint8_t n = test_async_count;
+
+    if (n >= TEST_ASYNC_MAX) {
+        return;
+    }
+
+    test_async_order[n] = (result == LSM303DLHC_OK) ? kind : 'E';
+    test_async_data[n] = data;
+    test_async_xfer[n] = dev->xfer;
+    if (data != NULL) {
+        test_async_copy[n] = *data;
+    }
+    test_async_count++;
+}
+
+static void test_async_acc(lsm303dlhc_t *dev, lsm303dlhc_result_t result, const lsm303dlhc_data_raw_t *data) {
+    test_async_record(dev, 'A', result, data);
+
+    /* the buffer handed over stays untouched, a new read can start right away */
+    if (test_async_restart > 0) {
+        test_async_restart--;
+        CHECK_EQ(lsm303dlhc_dev_read_acc_raw_async(dev, test_async_acc), LSM303DLHC_OK);
+    }
+}
+
+static void test_async_mag(lsm303dlhc_t *dev, lsm303dlhc_result_t result, const lsm303dlhc_data_raw_t *data) {
+    test_async_record(dev, 'M', result, data);
+}
+
+static void test_async_reset(void) {
+    memset(test_async_order, 0, sizeof(test_async_order));
+    test_async_count = 0;
+    test_async_restart = 0;
+}
+
+/* a sample stays valid until the transfer after the next one completes */
+static void test_async_ownership(void) {
+    uint32_t n = 0;
+
+    board_init(0, 0);
+    lsm303dlhc_emu_set_acc_source(&board_lsm, test_counter_source, &n);
+    CHECK_EQ(lsm303dlhc_init_acc(&board_i2c, &test_acc_init), LSM303DLHC_OK);
+    test_async_reset();
+
+    /* one read at a time */
+    test_acc_samples(1);
+    CHECK_EQ(lsm303dlhc_read_acc_raw_async(test_async_acc), LSM303DLHC_OK);
+    CHECK_EQ(lsm303dlhc_read_acc_raw_async(test_async_acc), LSM303DLHC_BUSY);
+    CHECK_EQ(test_async_count, 0);
+    hal_sim_advance_us(1000);
+    CHECK_EQ(test_async_count, 1);
+    CHECK_EQ(test_async_copy[0].x, (int16_t) n);
+    CHECK_EQ(test_async_copy[0].y, -(int16_t) n);
+    CHECK_EQ(test_async_copy[0].z, 2 * (int16_t) n);
+
+    /* the next sample goes to the other buffer */
+    test_acc_samples(1);
+    CHECK_EQ(lsm303dlhc_read_acc_raw_async(test_async_acc), LSM303DLHC_OK);
+    hal_sim_advance_us(1000);
+    CHECK_EQ(test_async_count, 2);
+    CHECK(test_async_data[1] != test_async_data[0]);
+    CHECK_EQ(test_async_copy[1].x, (int16_t) n);
+    CHECK_EQ(test_async_data[0]->x, test_async_copy[0].x);
+
+    /* the third reuses the first */
+    test_acc_samples(1);
+    CHECK_EQ(lsm303dlhc_read_acc_raw_async(test_async_acc), LSM303DLHC_OK);
+    hal_sim_advance_us(1000);
+    CHECK_EQ(test_async_count, 3);
+    CHECK(test_async_data[2] == test_async_data[0]);
+    CHECK_EQ(test_async_data[1]->x, test_async_copy[1].x);
+
+    /* restarted from the callback: the bus is free, the previous sample is kept */
+    test_async_reset();
+    test_async_restart = 2;
+    CHECK_EQ(lsm303dlhc_read_acc_raw_async(test_async_acc), LSM303DLHC_OK);
+    hal_sim_advance_us(2000);
+    CHECK_EQ(test_async_count, 3);
+    CHECK_EQ(test_async_xfer[0], LSM303DLHC_XFER_NONE);
+    CHECK(test_async_data[1] != test_async_data[0]);
+    CHECK(test_async_data[2] == test_async_data[0]);
+    CHECK_EQ(test_async_data[1]->x, test_async_copy[1].x);
+    CHECK_EQ(lsm303dlhc_get_default()->xfer, LSM303DLHC_XFER_NONE);
+}
+
+/* a data-ready interrupt that found the bus busy is started before the callback of the running read */
+static void test_async_order_drdy(void) {
+    board_init(0, 0);
+    lsm303dlhc_emu_set_mag(&board_lsm, 0.5f, -0.25f, 1.0f);
+    CHECK_EQ(lsm303dlhc_init_acc(&board_i2c, &test_acc_init), LSM303DLHC_OK);
+    CHECK_EQ(lsm303dlhc_init_mag(&board_i2c, &test_mag_sleep_init), LSM303DLHC_OK);
+    test_async_reset();
+
+    test_acc_samples(1);
+    CHECK_EQ(lsm303dlhc_read_acc_raw_async(test_async_acc), LSM303DLHC_OK);
+    CHECK_EQ(lsm303dlhc_set_drdy_mag(true, test_async_mag), LSM303DLHC_OK);
+    CHECK_EQ(lsm303dlhc_get_default()->xfer, LSM303DLHC_XFER_ACC);
+
+    hal_sim_advance_us(2000);
+    CHECK_EQ(test_async_count, 2);
+    CHECK(strcmp(test_async_order, "AM") == 0);
+    CHECK_EQ(test_async_xfer[0], LSM303DLHC_XFER_MAG);
+    CHECK_EQ(test_async_xfer[1], LSM303DLHC_XFER_NONE);
+    CHECK(test_async_data[1] != test_async_data[0]);
+
+    CHECK_EQ(lsm303dlhc_set_drdy_mag(false, NULL), LSM303DLHC_OK);
+}
+
+/* a failed transfer calls back without data and frees the bus */
+static void test_async_error(void) {
+    lsm303dlhc_data_raw_t data;
+
+    board_init(0, 0);
+    CHECK_EQ(lsm303dlhc_init_acc(&board_i2c, &test_acc_init), LSM303DLHC_OK);
+    test_async_reset();
+
+    hal_sim_fault_i2c(&board_i2c, HAL_SIM_FAULT_NACK, 1);
+    CHECK_EQ(lsm303dlhc_read_acc_raw_async(test_async_acc), LSM303DLHC_OK);
+    hal_sim_advance_us(1000);
+    CHECK_EQ(test_async_count, 1);
+    CHECK(strcmp(test_async_order, "E") == 0);
+    CHECK(test_async_data[0] == NULL);
+    CHECK_EQ(lsm303dlhc_get_default()->xfer, LSM303DLHC_XFER_NONE);
+
+    /* blocking reads refuse while an asynchronous one holds the bus */
+    test_acc_samples(1);
+    CHECK_EQ(lsm303dlhc_read_acc_raw_async(test_async_acc), LSM303DLHC_OK);
+    CHECK(lsm303dlhc_read_acc_raw(&data) != LSM303DLHC_OK);
+    hal_sim_advance_us(1000);
+    CHECK_EQ(test_async_count, 2);
+    test_acc_samples(1);
+    CHECK_EQ(lsm303dlhc_read_acc_raw(&data), LSM303DLHC_OK);
+}
+
+/* DRDY stays high after a failed read, the sample behind it is read again and acquisition goes on */
+static void test_drdy_fault(void) {
+    lsm303dlhc_data_raw_t data;
+    uint32_t acc = 0, mag = 0, i;
+
+    board_init(0, 0);
+    CHECK_EQ(lsm303dlhc_init_acc(&board_i2c, &test_acc_init), LSM303DLHC_OK);
+    CHECK_EQ(lsm303dlhc_init_mag(&board_i2c, &test_mag_init), LSM303DLHC_OK);
+    CHECK_EQ(lsm303dlhc_set_drdy_acc(true, NULL), LSM303DLHC_OK);
+    CHECK_EQ(lsm303dlhc_set_drdy_mag(true, NULL), LSM303DLHC_OK);
+
+    test_acc_samples(1);
+    hal_sim_fault_i2c(&board_i2c, HAL_SIM_FAULT_TIMEOUT, 1);
+    CHECK_EQ(lsm303dlhc_read_acc_raw(&data), LSM303DLHC_ERROR);
+    CHECK_EQ(lsm303dlhc_read_acc_raw(&data), LSM303DLHC_OK);
+
+    test_mag_samples(1);
+    hal_sim_fault_i2c(&board_i2c, HAL_SIM_FAULT_TIMEOUT, 1);
+    CHECK_EQ(lsm303dlhc_read_mag_raw(&data), LSM303DLHC_ERROR);
+    CHECK_EQ(lsm303dlhc_read_mag_raw(&data), LSM303DLHC_OK);
+
+    /* 1 s of both */
+    for (i = 0; i < 100; i++) {
+        test_acc_samples(1);
+        acc += lsm303dlhc_read_acc_raw(&data) == LSM303DLHC_OK;
+        mag += lsm303dlhc_read_mag_raw(&data) == LSM303DLHC_OK;
+    }
+    CHECK_EQ(acc, 100);
+    CHECK(mag >= 74);
+
+    CHECK_EQ(lsm303dlhc_set_drdy_mag(false, NULL), LSM303DLHC_OK);
+
+    /* an asynchronous read that fails is started again when it ends */
+    test_async_reset();
+    CHECK_EQ(lsm303dlhc_set_drdy_acc(true, test_async_acc), LSM303DLHC_OK);
+    hal_sim_advance_us(1000);
+    CHECK(strcmp(test_async_order, "A") == 0);
+
+    hal_sim_fault_i2c(&board_i2c, HAL_SIM_FAULT_NACK, 1);
+    test_acc_samples(1);
+    hal_sim_advance_us(2000);
+    CHECK(strcmp(test_async_order, "AEA") == 0);
+
+    test_acc_samples(4);
+    hal_sim_advance_us(1000);
+    CHECK(strcmp(test_async_order, "AEAAAAA") == 0);
+
+    CHECK_EQ(lsm303dlhc_set_drdy_acc(false, NULL), LSM303DLHC_OK);
+    CHECK_EQ(lsm303dlhc_get_default()->xfer, LSM303DLHC_XFER_NONE);
+}
@@ -0,0 +1,200 @@
+#include "test.h"
+#include "imu_ring.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+/*
+ * imu_ring without the simulator: a producer thread stands in for the interrupt, the main thread
+ * is the consumer. Only the consumer checks, the counters of test.h are not shared.
+ */
+
+#define TEST_RING_CAPACITY    64
+#define TEST_RING_SAMPLES     1000000u
+
+/* private variables */
+static uint32_t test_clock;
+static imu_ring_t test_ring;
+static imu_ring_record_t test_buf[TEST_RING_CAPACITY];
+static uint32_t test_full;          // IMU_RING_FULL returns seen by the producer
+static uint32_t test_received;      // published by the consumer, paces the first half
+static int test_done;
+
+/* private functions */
+static void *test_producer(void *arg);
+static void test_wrap(void);
+static void test_threads(void);
+
+/* the ring stamps its records with this, only the producer calls it */
+uint32_t imu_clock_now(void) {
+    return test_clock++;
+}
+
+int main(void) {
+    test_wrap();
+    test_threads();
+
+    return test_report("test_ring");
+}
+
+/* private functions */
+
+/*
+ * Sample i carries i in x and y, the sequence of the ring counts the same. The first half waits
+ * for room, so the consumer has to keep up however the threads are scheduled; the second half
+ * runs free and may drop.
+ */
+static void *test_producer(void *arg) {
+    uint32_t full = 0;
+    uint32_t i;
+
+    (void) arg;
+
+    for (i = 0; i < TEST_RING_SAMPLES; i++) {
+        while (i < TEST_RING_SAMPLES / 2 && i - __atomic_load_n(&test_received, __ATOMIC_ACQUIRE) >= TEST_RING_CAPACITY) {
+            sched_yield();
+        }
+
+        if (imu_ring_push(&test_ring, IMU_RING_GYRO, 0, (int16_t) (i & 0xFFFF), (int16_t) (i >> 16), 0) == IMU_RING_FULL) {
+            full++;
+        }
+    }
+
+    test_full = full;
+    __atomic_store_n(&test_done, 1, __ATOMIC_RELEASE);
+
+    return NULL;
+}
+
+/* full and drop counting, then the two spans of a wrapped ring */
+static void test_wrap(void) {
+    imu_ring_record_t buf[8];
+    imu_ring_record_t out[8];
+    const imu_ring_record_t *span;
+    uint32_t i;
+
+    CHECK_EQ(imu_ring_init(&test_ring, buf, 6), IMU_RING_ERROR);
+    CHECK_EQ(imu_ring_init(&test_ring, buf, 8), IMU_RING_OK);
+    CHECK_EQ(imu_ring_peek(&test_ring, &span), 0);
+
+    for (i = 0; i < 8; i++) {
+        CHECK_EQ(imu_ring_push(&test_ring, IMU_RING_ACC, IMU_RING_FLAG_RAW, (int16_t) i, 0, 0), IMU_RING_OK);
+    }
+
+    CHECK_EQ(imu_ring_push(&test_ring, IMU_RING_ACC, 0, 8, 0, 0), IMU_RING_FULL);
+    CHECK_EQ(imu_ring_drops(&test_ring), 1);
+    CHECK_EQ(imu_ring_count(&test_ring), 8);
+
+    CHECK_EQ(imu_ring_pop(&test_ring, out, 3), 3);
+    CHECK_EQ(out[0].sequence, 0);
+    CHECK_EQ(out[2].x, 2);
+    CHECK_EQ(out[2].sensor, IMU_RING_ACC);
+    CHECK_EQ(out[2].flags, IMU_RING_FLAG_RAW);
+
+    /* three more land at the start of the buffer, the dropped sample is a gap in the sequence */
+    for (i = 9; i < 12; i++) {
+        CHECK_EQ(imu_ring_push(&test_ring, IMU_RING_MAG, 0, (int16_t) i, 0, 0), IMU_RING_OK);
+    }
+
+    CHECK_EQ(imu_ring_count(&test_ring), 8);
+
+    CHECK_EQ(imu_ring_peek(&test_ring, &span), 5);
+    CHECK(span == &buf[3]);
+    CHECK_EQ(span[0].sequence, 3);
+    CHECK_EQ(span[4].sequence, 7);
+
+    /* a partial consume leaves the rest of the span */
+    imu_ring_consume(&test_ring, 2);
+    CHECK_EQ(imu_ring_peek(&test_ring, &span), 3);
+    CHECK_EQ(span[0].x, 5);
+    imu_ring_consume(&test_ring, 3);
+
+    CHECK_EQ(imu_ring_peek(&test_ring, &span), 3);
+    CHECK(span == &buf[0]);
+    CHECK_EQ(span[0].sequence, 9);
+    CHECK_EQ(span[0].x, 9);
+    CHECK_EQ(span[2].sensor, IMU_RING_MAG);
+    imu_ring_consume(&test_ring, 3);
+
+    CHECK_EQ(imu_ring_count(&test_ring), 0);
+    CHECK_EQ(imu_ring_peek(&test_ring, &span), 0);
+
+    /* pop copies across the wrap */
+    for (i = 0; i < 6; i++) {
+        imu_ring_push(&test_ring, IMU_RING_GYRO, 0, (int16_t) i, 0, 0);
+    }
+
+    CHECK_EQ(imu_ring_pop(&test_ring, out, 8), 6);
+    CHECK_EQ(out[0].sequence, 12);
+    CHECK_EQ(out[5].sequence, 17);
+    CHECK_EQ(out[5].x, 5);
+}
+
+/* every record arrives whole and in order, delivered plus dropped is what was offered */
+static void test_threads(void) {
+    imu_ring_record_t out[TEST_RING_CAPACITY / 4];
+    const imu_ring_record_t *span;
+    pthread_t producer;
+    uint32_t received = 0;
+    uint32_t torn = 0;
+    uint32_t disorder = 0;
+    uint32_t next = 0;          // lowest sequence the next record may have
+    uint32_t stamp = 0;
+    uint32_t rounds = 0;
+    uint32_t before;
+    uint32_t n, i;
+    bool done;
+
+    CHECK_EQ(imu_ring_init(&test_ring, test_buf, TEST_RING_CAPACITY), IMU_RING_OK);
+    test_clock = 0;
+    test_received = 0;
+    test_done = 0;
+
+    CHECK_EQ(pthread_create(&producer, NULL, test_producer, NULL), 0);
+
+    do {
+        /* read the flag first, then drain what was published up to it */
+        done = __atomic_load_n(&test_done, __ATOMIC_ACQUIRE) != 0;
+        before = received;
+
+        /* alternate the zero-copy spans and pop */
+        if (rounds++ & 1) {
+            while ((n = imu_ring_peek(&test_ring, &span)) > 0) {
+                for (i = 0; i < n; i++) {
+                    torn += (uint32_t) (uint16_t) span[i].x + ((uint32_t) (uint16_t) span[i].y << 16) != span[i].sequence;
+                    disorder += span[i].sequence < next || span[i].timestamp < stamp;
+                    next = span[i].sequence + 1;
+                    stamp = span[i].timestamp;
+                }
+                imu_ring_consume(&test_ring, n);
+                received += n;
+                __atomic_store_n(&test_received, received, __ATOMIC_RELEASE);
+            }
+        } else {
+            while ((n = imu_ring_pop(&test_ring, out, TEST_RING_CAPACITY / 4)) > 0) {
+                for (i = 0; i < n; i++) {
+                    torn += (uint32_t) (uint16_t) out[i].x + ((uint32_t) (uint16_t) out[i].y << 16) != out[i].sequence;
+                    disorder += out[i].sequence < next || out[i].timestamp < stamp;
+                    next = out[i].sequence + 1;
+                    stamp = out[i].timestamp;
+                }
+                received += n;
+                __atomic_store_n(&test_received, received, __ATOMIC_RELEASE);
+            }
+        }
+
+        /* an empty ring hands the CPU to the producer, the test also runs on a single core */
+        if (received == before) {
+            sched_yield();
+        }
+    } while (!done);
+
+    pthread_join(producer, NULL);
+
+    CHECK_EQ(torn, 0);
+    CHECK_EQ(disorder, 0);
+    CHECK(received >= TEST_RING_SAMPLES / 2);
+    CHECK_EQ(imu_ring_drops(&test_ring), test_full);
+    CHECK_EQ(received + imu_ring_drops(&test_ring), TEST_RING_SAMPLES);
+    CHECK_EQ(imu_ring_count(&test_ring), 0);
+}
@@ -0,0 +1,226 @@
+#include "test.h"
+#include "imu_sync.h"
+#include "imu_clock.h"
+
+#include <stdlib.h>
+
+/*
+ * imu_sync on three synthetic streams: the gyroscope near 760 Hz, the accelerometer near 100 Hz
+ * and the magnetometer near 75 Hz, each on its own slightly detuned clock, with interrupt latency
+ * on every timestamp and dropped samples. Every axis is a ramp of the true sample time, so an
+ * interpolated frame has to read the ramp at its own time. The magnetometer does not gate, it
+ * also stops for longer than IMU_SYNC_GAP_MAX periods and is held meanwhile. The timestamps start
+ * just before the wrap of the 32 bit clock.
+ */
+
+#define TEST_RATE_HZ        200
+#define TEST_SECONDS        4
+#define TEST_T0             0xFFF00000u     // ticks of the first sample time
+#define TEST_LATENCY_NS     50000           // interrupt latency, uniform up to this
+#define TEST_MAG_OUTAGE     150             // magnetometer samples missing from this one on
+#define TEST_MAG_OUTAGE_LEN 15
+#define TEST_MARGIN_NS      200000          // around the newest magnetometer sample, neither held nor interpolated for sure
+
+typedef struct {
+    double period_ns;       // of the sensor clock
+    double phase_ns;
+    uint32_t drop_every;    // samples, 0 for none
+    int16_t offset;         // of the ramp
+    int16_t sign;
+} test_stream_t;
+
+/* private variables */
+static const test_stream_t test_streams[3] = {
+    [IMU_RING_GYRO] = { 1e9 / 757.3, 130000.0, 97, 0, 1 },
+    [IMU_RING_ACC] = { 1e9 / 100.4, 2100000.0, 50, -10000, 1 },
+    [IMU_RING_MAG] = { 1e9 / 74.8, 6400000.0, 0, 10000, -1 }
+};
+
+static uint32_t test_seed = 1;
+
+/* private functions */
+static uint32_t test_latency(void);
+static int16_t test_ramp(const test_stream_t *stream, double t_ns, uint8_t axis);
+static bool test_dropped(imu_ring_sensor_t sensor, uint32_t n);
+static void test_check_axes(const int16_t v[3], const test_stream_t *stream, double t_ns, bool *ok);
+static void test_streams_run(void);
+static void test_init(void);
+
+int main(void) {
+    test_init();
+    test_streams_run();
+
+    return test_report("test_sync");
+}
+
+/* private functions */
+
+/* uniform in 0 .. TEST_LATENCY_NS, the same sequence every run */
+static uint32_t test_latency(void) {
+    test_seed = test_seed * 1103515245u + 12345u;
+
+    return (test_seed >> 8) % (TEST_LATENCY_NS + 1);
+}
+
+/* 5 digits per ms on X, the negative on Y and half of it on Z */
+static int16_t test_ramp(const test_stream_t *stream, double t_ns, uint8_t axis) {
+    double v = (double) stream->sign * t_ns / 200000.0;
+
+    if (axis == 1) {
+        v = -v;
+    } else if (axis == 2) {
+        v /= 2.0;
+    }
+
+    return (int16_t) lround(v + stream->offset);
+}
+
+static bool test_dropped(imu_ring_sensor_t sensor, uint32_t n) {
+    if (sensor == IMU_RING_MAG) {
+        return n >= TEST_MAG_OUTAGE && n < TEST_MAG_OUTAGE + TEST_MAG_OUTAGE_LEN;
+    }
+
+    return test_streams[sensor].drop_every != 0 && n % test_streams[sensor].drop_every == test_streams[sensor].drop_every - 1;
+}
+
+/* within 2 digits of the ramp, the timestamps are smoothed but not exact */
+static void test_check_axes(const int16_t v[3], const test_stream_t *stream, double t_ns, bool *ok) {
+    uint8_t axis;
+
+    for (axis = 0; axis < 3; axis++) {
+        if (abs(v[axis] - test_ramp(stream, t_ns, axis)) > 2) {
+            *ok = false;
+        }
+    }
+}
+
+static void test_streams_run(void) {
+    imu_sync_t sync;
+    imu_sync_frame_t frame;
+    uint32_t n[3] = { 0, 0, 0 };
+    uint32_t period = imu_clock_ticks_per_us() * (1000000 / TEST_RATE_HZ);
+    uint32_t frames = 0, held = 0, outage = 0, interpolated = 0, sequence = 0, last_timestamp = 0;
+    int16_t mag_last[3] = { 0, 0, 0 };
+    double mag_last_ns = -1.0;
+    bool monotonic = true, gating_valid = true, mag_valid = true, gyro_ok = true, acc_ok = true;
+    bool mag_held_ok = true, mag_interpolated_ok = true;
+    uint8_t i, next;
+
+    CHECK_EQ(imu_sync_init(&sync, TEST_RATE_HZ, IMU_SYNC_GYRO | IMU_SYNC_ACC), IMU_SYNC_OK);
+
+    for (;;) {
+        double t_ns = 0.0;
+        uint32_t timestamp;
+        int16_t v[3];
+
+        /* the sensor with the earliest sample next, the streams arrive merged in time */
+        next = 3;
+        for (i = 0; i < 3; i++) {
+            double t = test_streams[i].phase_ns + n[i] * test_streams[i].period_ns;
+
+            if (next == 3 || t < t_ns) {
+                next = i;
+                t_ns = t;
+            }
+        }
+
+        if (t_ns > TEST_SECONDS * 1e9) {
+            break;
+        }
+
+        if (!test_dropped((imu_ring_sensor_t) next, n[next]++)) {
+            for (i = 0; i < 3; i++) {
+                v[i] = test_ramp(&test_streams[next], t_ns, i);
+            }
+
+            timestamp = TEST_T0 + (uint32_t) llround(t_ns) + test_latency();
+            imu_sync_push(&sync, (imu_ring_sensor_t) next, timestamp, v[0], v[1], v[2]);
+
+            if (next == IMU_RING_MAG) {
+                mag_last[0] = v[0];
+                mag_last[1] = v[1];
+                mag_last[2] = v[2];
+                mag_last_ns = t_ns;
+            }
+        }
+
+        while (imu_sync_next(&sync, &frame)) {
+            /* ns since TEST_T0, valid across the wrap for the length of the run */
+            double frame_ns = (double) (uint32_t) (frame.timestamp - TEST_T0);
+
+            if (frames > 0 && (frame.sequence != sequence + 1 || frame.timestamp - last_timestamp != period)) {
+                monotonic = false;
+            }
+            sequence = frame.sequence;
+            last_timestamp = frame.timestamp;
+            frames++;
+
+            if ((frame.valid & (IMU_SYNC_GYRO | IMU_SYNC_ACC)) != (IMU_SYNC_GYRO | IMU_SYNC_ACC)) {
+                gating_valid = false;
+            }
+
+            test_check_axes(frame.gyro, &test_streams[IMU_RING_GYRO], frame_ns, &gyro_ok);
+            test_check_axes(frame.acc, &test_streams[IMU_RING_ACC], frame_ns, &acc_ok);
+
+            if (mag_last_ns < 0.0) {
+                mag_valid = mag_valid && !(frame.valid & IMU_SYNC_MAG);
+                continue;
+            }
+
+            mag_valid = mag_valid && (frame.valid & IMU_SYNC_MAG);
+
+            /* after the newest sample it is held as it is, before it interpolated */
+            if (frame_ns > mag_last_ns + TEST_LATENCY_NS + TEST_MARGIN_NS) {
+                held++;
+                outage += frame_ns > mag_last_ns + 2.0 * test_streams[IMU_RING_MAG].period_ns;
+                mag_held_ok = mag_held_ok && frame.mag[0] == mag_last[0] && frame.mag[1] == mag_last[1] && frame.mag[2] == mag_last[2];
+            } else if (frame_ns < mag_last_ns - TEST_MARGIN_NS) {
+                interpolated++;
+                test_check_axes(frame.mag, &test_streams[IMU_RING_MAG], frame_ns, &mag_interpolated_ok);
+            }
+        }
+    }
+
+    /* the estimates follow the sensor clocks, not the nominal rates */
+    CHECK_NEAR(imu_sync_rate_mhz(&sync, IMU_RING_GYRO), 757300, 757300 / 2000);
+    CHECK_NEAR(imu_sync_rate_mhz(&sync, IMU_RING_ACC), 100400, 100400 / 2000);
+    CHECK_NEAR(imu_sync_rate_mhz(&sync, IMU_RING_MAG), 74800, 74800 / 2000);
+    CHECK_EQ(sync.sensor[IMU_RING_GYRO].gaps, 0);
+    CHECK_EQ(sync.sensor[IMU_RING_ACC].gaps, 0);
+    CHECK_EQ(sync.sensor[IMU_RING_MAG].gaps, 1);
+
+    /* frames at the output rate up to the newest accelerometer sample, less the start */
+    CHECK(frames >= (TEST_SECONDS - 1) * TEST_RATE_HZ && frames <= TEST_SECONDS * TEST_RATE_HZ);
+    CHECK(monotonic);
+    CHECK(gating_valid);
+    CHECK(mag_valid);
+    CHECK(gyro_ok);
+    CHECK(acc_ok);
+    CHECK_EQ(sync.late, 0);
+
+    /*
+     * A frame waits for the accelerometer only, so the magnetometer has a newer sample for about
+     * 40 % of them and is held for the rest. In the outage it is held from two periods after its
+     * last sample on, but for the frames that wait for the accelerometer past its end.
+     */
+    CHECK(interpolated > frames / 4);
+    CHECK(held > frames / 4);
+    CHECK(outage >= (TEST_MAG_OUTAGE_LEN - 2) * TEST_RATE_HZ / 75);
+    CHECK(mag_held_ok);
+    CHECK(mag_interpolated_ok);
+}
+
+static void test_init(void) {
+    imu_sync_t sync;
+    imu_sync_frame_t frame;
+
+    CHECK_EQ(imu_sync_init(&sync, 0, IMU_SYNC_GYRO), IMU_SYNC_ERROR);
+    CHECK_EQ(imu_sync_init(&sync, TEST_RATE_HZ, 0), IMU_SYNC_ERROR);
+
+    /* nothing is ready before every gating sensor has a sample, and no rate is known */
+    CHECK_EQ(imu_sync_init(&sync, TEST_RATE_HZ, IMU_SYNC_GYRO | IMU_SYNC_ACC), IMU_SYNC_OK);
+    imu_sync_push(&sync, IMU_RING_GYRO, 1000, 1, 2, 3);
+    CHECK(!imu_sync_next(&sync, &frame));
+    CHECK_EQ(imu_sync_rate_mhz(&sync, IMU_RING_GYRO), 0);
+    CHECK_EQ(imu_sync_rate_mhz(&sync, IMU_RING_ACC), 0);
+}
@@ -0,0 +1,308 @@
+#include "imu_ahrs.h"
+#include "imu_clock.h"
+
+#include <math.h>
+
+#define IMU_AHRS_PI    3.14159265358979
+
+#ifdef IMU_AHRS_FIXED
+#define IMU_AHRS_ONE            ((imu_ahrs_real_t) 1 << IMU_AHRS_Q)
+#define IMU_AHRS_MUL(a, b)      ((imu_ahrs_real_t) (((int64_t) (a) * (b)) >> IMU_AHRS_Q))
+#define IMU_AHRS_FLOAT(a)       ((float) (a) * (1.0f / IMU_AHRS_ONE))
+#define IMU_AHRS_K(f)           ((int64_t) ((f) * (double) ((int64_t) 1 << (IMU_AHRS_Q + 20)) + 0.5))    // Q49 per us
+#define IMU_AHRS_DT(k, dt)      ((imu_ahrs_real_t) (((k) * (int64_t) (dt)) >> 20))                        // Q49 * us -> Q29
+#else
+#define IMU_AHRS_ONE            1.0f
+#define IMU_AHRS_MUL(a, b)      ((a) * (b))
+#define IMU_AHRS_FLOAT(a)       (a)
+#define IMU_AHRS_K(f)           ((float) (f))
+#define IMU_AHRS_DT(k, dt)      ((k) * (float) (dt))
+#endif
+
+#define IMU_AHRS_HALF           (IMU_AHRS_ONE / 2)
+#define IMU_AHRS_TWICE(a)       ((a) + (a))
+
+/* private functions */
+static bool imu_ahrs_normalize(imu_ahrs_real_t *v, uint8_t n);
+
+void imu_ahrs_init(imu_ahrs_t *ahrs, float gyro_dps_lsb, float mag_z_ratio) {
+    *ahrs = (imu_ahrs_t) { 0 };
+
+    ahrs->q[0] = IMU_AHRS_ONE;
+    ahrs->gyro_k = IMU_AHRS_K(gyro_dps_lsb * (IMU_AHRS_PI / 180.0) * 0.5e-6);
+#ifdef IMU_AHRS_FIXED
+    ahrs->mag_z = (imu_ahrs_real_t) (mag_z_ratio * IMU_AHRS_ONE);
+#else
+    ahrs->mag_z = mag_z_ratio;
+#endif
+
+    imu_ahrs_set_gains(ahrs, IMU_AHRS_KP, IMU_AHRS_KI);
+}
+
+void imu_ahrs_set_gains(imu_ahrs_t *ahrs, float kp, float ki) {
+    ahrs->kp_k = IMU_AHRS_K(kp * 0.5e-6);
+    ahrs->ki_k = IMU_AHRS_K(ki * 1e-6);
+
+    if (ki == 0.0f) {
+        ahrs->integral[0] = 0;
+        ahrs->integral[1] = 0;
+        ahrs->integral[2] = 0;
+    }
+}
+
+void imu_ahrs_update_acc(imu_ahrs_t *ahrs, const lsm303dlhc_data_raw_t *raw) {
+    ahrs->acc[0] = raw->x;
+    ahrs->acc[1] = raw->y;
+    ahrs->acc[2] = raw->z;
+
+    /* the scale does not matter, only the direction */
+    ahrs->acc_valid = imu_ahrs_normalize(ahrs->acc, 3);
+}
+
+void imu_ahrs_update_mag(imu_ahrs_t *ahrs, const lsm303dlhc_data_raw_t *raw) {
+#ifdef IMU_AHRS_FIXED
+    /* keep some fraction bits for the z correction */
+    ahrs->mag[0] = (imu_ahrs_real_t) raw->x << 12;
+    ahrs->mag[1] = (imu_ahrs_real_t) raw->y << 12;
+    ahrs->mag[2] = IMU_AHRS_MUL((imu_ahrs_real_t) raw->z << 12, ahrs->mag_z);
+#else
+    ahrs->mag[0] = raw->x;
+    ahrs->mag[1] = raw->y;
+    ahrs->mag[2] = raw->z * ahrs->mag_z;
+#endif
+
+    ahrs->mag_valid = imu_ahrs_normalize(ahrs->mag, 3);
+}
+
+void imu_ahrs_update_gyro(imu_ahrs_t *ahrs, const l3gd20_data_t *raw, uint32_t dt_us) {
+    imu_ahrs_real_t *q = ahrs->q;
+    imu_ahrs_real_t *a = ahrs->acc;
+    imu_ahrs_real_t *m = ahrs->mag;
+    imu_ahrs_real_t q0q0, q0q1, q0q2, q0q3, q1q1, q1q2, q1q3, q2q2, q2q3, q3q3;
+    imu_ahrs_real_t v[3], h[3], b[2], w[3], e[3] = { 0, 0, 0 }, t[3];
+    imu_ahrs_real_t kp, ki, half, qw, qx, qy, qz;
+    uint8_t i;
+
+    if (dt_us > IMU_AHRS_DT_MAX) {
+        dt_us = IMU_AHRS_DT_MAX;
+    }
+
+    q0q0 = IMU_AHRS_MUL(q[0], q[0]);
+    q0q1 = IMU_AHRS_MUL(q[0], q[1]);
+    q0q2 = IMU_AHRS_MUL(q[0], q[2]);
+    q0q3 = IMU_AHRS_MUL(q[0], q[3]);
+    q1q1 = IMU_AHRS_MUL(q[1], q[1]);
+    q1q2 = IMU_AHRS_MUL(q[1], q[2]);
+    q1q3 = IMU_AHRS_MUL(q[1], q[3]);
+    q2q2 = IMU_AHRS_MUL(q[2], q[2]);
+    q2q3 = IMU_AHRS_MUL(q[2], q[3]);
+    q3q3 = IMU_AHRS_MUL(q[3], q[3]);
+
+    if (ahrs->acc_valid) {
+        /* estimated direction of gravity, error is the cross product with the measured one */
+        v[0] = IMU_AHRS_TWICE(q1q3 - q0q2);
+        v[1] = IMU_AHRS_TWICE(q0q1 + q2q3);
+        v[2] = q0q0 - q1q1 - q2q2 + q3q3;
+
+        e[0] = IMU_AHRS_MUL(a[1], v[2]) - IMU_AHRS_MUL(a[2], v[1]);
+        e[1] = IMU_AHRS_MUL(a[2], v[0]) - IMU_AHRS_MUL(a[0], v[2]);
+        e[2] = IMU_AHRS_MUL(a[0], v[1]) - IMU_AHRS_MUL(a[1], v[0]);
+
+        if (ahrs->mag_valid) {
+            /* earth frame field, its horizontal part is turned onto x */
+            h[0] = IMU_AHRS_TWICE(IMU_AHRS_MUL(m[0], IMU_AHRS_HALF - q2q2 - q3q3) + IMU_AHRS_MUL(m[1], q1q2 - q0q3) + IMU_AHRS_MUL(m[2], q1q3 + q0q2));
+            h[1] = IMU_AHRS_TWICE(IMU_AHRS_MUL(m[0], q1q2 + q0q3) + IMU_AHRS_MUL(m[1], IMU_AHRS_HALF - q1q1 - q3q3) + IMU_AHRS_MUL(m[2], q2q3 - q0q1));
+            h[2] = IMU_AHRS_TWICE(IMU_AHRS_MUL(m[0], q1q3 - q0q2) + IMU_AHRS_MUL(m[1], q2q3 + q0q1) + IMU_AHRS_MUL(m[2], IMU_AHRS_HALF - q1q1 - q2q2));
+
+            /* bx = |hx, hy| as the dot product with its own direction, no square root */
+            b[0] = h[0];
+            b[1] = h[1];
+            if (imu_ahrs_normalize(b, 2)) {
+                b[0] = IMU_AHRS_MUL(h[0], b[0]) + IMU_AHRS_MUL(h[1], b[1]);
+            } else {
+                b[0] = 0;
+            }
+            b[1] = h[2];
+
+            /* estimated direction of the field */
+            w[0] = IMU_AHRS_TWICE(IMU_AHRS_MUL(b[0], IMU_AHRS_HALF - q2q2 - q3q3) + IMU_AHRS_MUL(b[1], q1q3 - q0q2));
+            w[1] = IMU_AHRS_TWICE(IMU_AHRS_MUL(b[0], q1q2 - q0q3) + IMU_AHRS_MUL(b[1], q0q1 + q2q3));
+            w[2] = IMU_AHRS_TWICE(IMU_AHRS_MUL(b[0], q0q2 + q1q3) + IMU_AHRS_MUL(b[1], IMU_AHRS_HALF - q1q1 - q2q2));
+
+            e[0] += IMU_AHRS_MUL(m[1], w[2]) - IMU_AHRS_MUL(m[2], w[1]);
+            e[1] += IMU_AHRS_MUL(m[2], w[0]) - IMU_AHRS_MUL(m[0], w[2]);
+            e[2] += IMU_AHRS_MUL(m[0], w[1]) - IMU_AHRS_MUL(m[1], w[0]);
+        }
+    }
+
+    /* half rotation angle of this period: gyroscope, proportional and integral correction */
+    kp = IMU_AHRS_DT(ahrs->kp_k, dt_us);
+    half = IMU_AHRS_DT(IMU_AHRS_K(0.5e-6), dt_us);
+
+    t[0] = IMU_AHRS_DT(ahrs->gyro_k * raw->x, dt_us);
+    t[1] = IMU_AHRS_DT(ahrs->gyro_k * raw->y, dt_us);
+    t[2] = IMU_AHRS_DT(ahrs->gyro_k * raw->z, dt_us);
+
+    if (ahrs->ki_k != 0) {
+        ki = IMU_AHRS_DT(ahrs->ki_k, dt_us);
+
+        for (i = 0; i < 3; i++) {
+            ahrs->integral[i] += IMU_AHRS_MUL(e[i], ki);
+            t[i] += IMU_AHRS_MUL(ahrs->integral[i], half);
+        }
+    }
+
+    for (i = 0; i < 3; i++) {
+        t[i] += IMU_AHRS_MUL(e[i], kp);
+    }
+
+    /* q += q * (0, t) */
+    qw = q[0];
+    qx = q[1];
+    qy = q[2];
+    qz = q[3];
+
+    q[0] -= IMU_AHRS_MUL(qx, t[0]) + IMU_AHRS_MUL(qy, t[1]) + IMU_AHRS_MUL(qz, t[2]);
+    q[1] += IMU_AHRS_MUL(qw, t[0]) + IMU_AHRS_MUL(qy, t[2]) - IMU_AHRS_MUL(qz, t[1]);
+    q[2] += IMU_AHRS_MUL(qw, t[1]) - IMU_AHRS_MUL(qx, t[2]) + IMU_AHRS_MUL(qz, t[0]);
+    q[3] += IMU_AHRS_MUL(qw, t[2]) + IMU_AHRS_MUL(qx, t[1]) - IMU_AHRS_MUL(qy, t[0]);
+
+    imu_ahrs_normalize(q, 4);
+}
+
+void imu_ahrs_update_record(imu_ahrs_t *ahrs, const imu_ring_record_t *rec) {
+    lsm303dlhc_data_raw_t sample = { rec->x, rec->y, rec->z };
+    l3gd20_data_t rate = { rec->x, rec->y, rec->z };
+
+    switch (rec->sensor) {
+    case IMU_RING_ACC:
+        imu_ahrs_update_acc(ahrs, &sample);
+        break;
+
+    case IMU_RING_MAG:
+        imu_ahrs_update_mag(ahrs, &sample);
+        break;
+
+    case IMU_RING_GYRO:
+        /* whole dps are too coarse to integrate */
+        if (!(rec->flags & IMU_RING_FLAG_RAW)) {
+            break;
+        }
+
+        if (ahrs->gyro_timestamp_valid) {
+            imu_ahrs_update_gyro(ahrs, &rate, imu_clock_us(rec->timestamp - ahrs->gyro_timestamp));
+        }
+
+        ahrs->gyro_timestamp = rec->timestamp;
+        ahrs->gyro_timestamp_valid = true;
+        break;
+    }
+}
+
+void imu_ahrs_get_quat(const imu_ahrs_t *ahrs, imu_ahrs_quat_t *q) {
+    q->w = IMU_AHRS_FLOAT(ahrs->q[0]);
+    q->x = IMU_AHRS_FLOAT(ahrs->q[1]);
+    q->y = IMU_AHRS_FLOAT(ahrs->q[2]);
+    q->z = IMU_AHRS_FLOAT(ahrs->q[3]);
+}
+
+void imu_ahrs_get_euler(const imu_ahrs_t *ahrs, imu_ahrs_euler_t *euler) {
+    imu_ahrs_quat_t q;
+    float sinp;
+
+    imu_ahrs_get_quat(ahrs, &q);
+
+    sinp = 2.0f * (q.w * q.y - q.z * q.x);
+    if (sinp > 1.0f) {
+        sinp = 1.0f;
+    } else if (sinp < -1.0f) {
+        sinp = -1.0f;
+    }
+
+    euler->roll = atan2f(2.0f * (q.w * q.x + q.y * q.z), 1.0f - 2.0f * (q.x * q.x + q.y * q.y));
+    euler->pitch = asinf(sinp);
+    euler->yaw = atan2f(2.0f * (q.w * q.z + q.x * q.y), 1.0f - 2.0f * (q.y * q.y + q.z * q.z));
+}
+
+#ifdef IMU_AHRS_FIXED
+
+/* 1 / sqrt(x) for x in [0.5, 2) */
+static imu_ahrs_real_t imu_ahrs_invsqrt(imu_ahrs_real_t x) {
+    imu_ahrs_real_t y = IMU_AHRS_ONE + IMU_AHRS_HALF - (x >> 1);    // tangent at 1
+    uint8_t i;
+
+    for (i = 0; i < 4; i++) {
+        y = IMU_AHRS_MUL(y, 3 * IMU_AHRS_ONE - IMU_AHRS_MUL(x, IMU_AHRS_MUL(y, y))) >> 1;
+    }
+
+    return y;
+}
+
+static bool imu_ahrs_normalize(imu_ahrs_real_t *v, uint8_t n) {
+    uint64_t n2 = 0;
+    imu_ahrs_real_t x, y;
+    int8_t msb, shift;
+    uint8_t i;
+
+    for (i = 0; i < n; i++) {
+        n2 += (int64_t) v[i] * v[i];
+    }
+
+    if (n2 == 0) {
+        return false;
+    }
+
+    /* n2 = x * 2^shift with x in [0.5, 2) and an odd shift, so that Q + shift halves exactly */
+    msb = 63 - __builtin_clzll(n2);
+    shift = msb - 28;
+    if (!(shift & 1)) {
+        shift--;
+    }
+
+    x = (imu_ahrs_real_t) ((shift >= 0) ? (n2 >> shift) : (n2 << -shift));
+    y = imu_ahrs_invsqrt(x);
+
+    shift = (IMU_AHRS_Q + shift) / 2;
+    for (i = 0; i < n; i++) {
+        v[i] = (imu_ahrs_real_t) (((int64_t) v[i] * y) >> shift);
+    }
+
+    return true;
+}
+
+#else
+
+static float imu_ahrs_invsqrt(float x) {
+    union {
+        float f;
+        uint32_t i;
+    } u = { x };
+
+    u.i = 0x5F3759DF - (u.i >> 1);
+    u.f *= 1.5f - 0.5f * x * u.f * u.f;
+    u.f *= 1.5f - 0.5f * x * u.f * u.f;
+
+    return u.f;
+}
+
+static bool imu_ahrs_normalize(imu_ahrs_real_t *v, uint8_t n) {
+    float n2 = 0.0f, inv;
+    uint8_t i;
+
+    for (i = 0; i < n; i++) {
+        n2 += v[i] * v[i];
+    }
+
+    if (n2 <= 0.0f) {
+        return false;
+    }
+
+    inv = imu_ahrs_invsqrt(n2);
+    for (i = 0; i < n; i++) {
+        v[i] *= inv;
+    }
+
+    return true;
+}
+
+#endif
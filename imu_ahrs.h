@@ -0,0 +1,96 @@
+#ifndef __IMU_AHRS_H__
+#define __IMU_AHRS_H__
+
+/* C++ detection */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "stm32f3xx_l3gd20.h"
+#include "stm32f3xx_lsm303dlhc.h"
+#include "imu_ring.h"
+
+/*
+ * Mahony attitude and heading reference
+ * Fuses raw driver samples of all three sensors, which must share one body frame. Every gyroscope
+ * sample advances the orientation, the latest accelerometer and magnetometer samples are held and
+ * correct it until newer ones arrive, so the sensors can run at different rates.
+ * Define IMU_AHRS_FIXED for the fixed-point build, which keeps the update path free of floats.
+ * Neither build divides or takes square roots in the update path.
+ */
+
+/* default gains */
+#define IMU_AHRS_KP    0.5f     // proportional, rad/s per unit error
+#define IMU_AHRS_KI    0.0f     // integral, gyroscope bias estimation
+
+#define IMU_AHRS_DT_MAX    100000    // us, longer gyroscope gaps are clamped
+
+#ifdef IMU_AHRS_FIXED
+#define IMU_AHRS_Q     29       // fraction bits of imu_ahrs_real_t
+typedef int32_t imu_ahrs_real_t;
+#else
+typedef float imu_ahrs_real_t;
+#endif
+
+typedef struct {
+    float w;
+    float x;
+    float y;
+    float z;
+} imu_ahrs_quat_t;
+
+/* radians, aerospace sequence z-y-x */
+typedef struct {
+    float roll;
+    float pitch;
+    float yaw;
+} imu_ahrs_euler_t;
+
+typedef struct {
+    imu_ahrs_real_t q[4];           // w, x, y, z
+    imu_ahrs_real_t integral[3];    // rad/s
+    imu_ahrs_real_t acc[3];         // last accelerometer sample, normalized
+    imu_ahrs_real_t mag[3];         // last magnetometer sample, normalized
+    bool acc_valid;
+    bool mag_valid;
+
+    /* scale and gains, see imu_ahrs_init and imu_ahrs_set_gains */
+    imu_ahrs_real_t mag_z;          // magnetometer z lsb relative to x and y
+#ifdef IMU_AHRS_FIXED
+    int64_t gyro_k;                 // half angle per lsb per us, Q49
+    int64_t kp_k;                   // kp / 2 per us, Q49
+    int64_t ki_k;                   // ki per us, Q49
+#else
+    float gyro_k;                   // half angle per lsb per us
+    float kp_k;                     // kp / 2 per us
+    float ki_k;                     // ki per us
+#endif
+
+    /* ring records */
+    uint32_t gyro_timestamp;
+    bool gyro_timestamp_valid;
+} imu_ahrs_t;
+
+/* gyro_dps_lsb is l3gd20_t dps_lsb, mag_z_ratio is lsm303dlhc_t mag_scale_z / mag_scale_xy */
+void imu_ahrs_init(imu_ahrs_t *ahrs, float gyro_dps_lsb, float mag_z_ratio);
+void imu_ahrs_set_gains(imu_ahrs_t *ahrs, float kp, float ki);
+
+void imu_ahrs_update_acc(imu_ahrs_t *ahrs, const lsm303dlhc_data_raw_t *raw);
+void imu_ahrs_update_mag(imu_ahrs_t *ahrs, const lsm303dlhc_data_raw_t *raw);
+void imu_ahrs_update_gyro(imu_ahrs_t *ahrs, const l3gd20_data_t *raw, uint32_t dt_us);
+
+/* dispatches a ring record, the gyroscope period is taken from the timestamps. Gyroscope records must be raw */
+void imu_ahrs_update_record(imu_ahrs_t *ahrs, const imu_ring_record_t *rec);
+
+void imu_ahrs_get_quat(const imu_ahrs_t *ahrs, imu_ahrs_quat_t *q);
+void imu_ahrs_get_euler(const imu_ahrs_t *ahrs, imu_ahrs_euler_t *euler);
+
+/* C++ detection */
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,33 @@
+#include "imu_bus.h"
+#include "imu_clock.h"
+
+#include "stm32f3xx_hal.h"
+
+uint32_t imu_bus_timeout_ms(const imu_bus_policy_t *policy) {
+    uint32_t ms = (policy->timeout_us + 999) / 1000;
+
+    return (ms == 0) ? 1 : ms;
+}
+
+uint32_t imu_bus_remaining_ms(const imu_bus_policy_t *policy, uint32_t start_tick) {
+    uint32_t elapsed = HAL_GetTick() - start_tick;
+    uint32_t timeout = imu_bus_timeout_ms(policy);
+
+    return (elapsed >= timeout) ? 0 : timeout - elapsed;
+}
+
+void imu_bus_backoff(const imu_bus_policy_t *policy, uint8_t attempt) {
+    if (policy->backoff_us == 0 || attempt == 0) {
+        return;
+    }
+
+    imu_clock_delay_us(policy->backoff_us << (attempt - 1));
+}
+
+uint32_t imu_bus_worst_case_us(const imu_bus_policy_t *policy, uint8_t transactions, uint32_t recovery_us) {
+    /* the HAL compares its timeouts against a 1 ms tick, the last call of a transaction can overrun by up to 2 ticks */
+    uint32_t attempt_us = (imu_bus_timeout_ms(policy) + 2) * 1000 + recovery_us;
+    uint32_t backoff_us = policy->backoff_us * ((1u << policy->retries) - 1);
+
+    return transactions * ((policy->retries + 1) * attempt_us + backoff_us);
+}
@@ -0,0 +1,37 @@
+#ifndef __IMU_BUS_H__
+#define __IMU_BUS_H__
+
+/* C++ detection */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/*
+ * bus deadlines and retry policy
+ * A blocking transaction of a driver (one register access, sub-address and data) ends within
+ * timeout_us. A failed transaction is repeated up to retries times, each time after a busy wait
+ * that starts at backoff_us and doubles. imu_bus_worst_case_us bounds a driver call from the
+ * number of transactions it issues, interrupts that preempt the caller are not included.
+ */
+
+#define IMU_BUS_RETRIES_MAX    8
+
+typedef struct {
+    uint32_t timeout_us;    // deadline of one transaction, the HAL rounds it up to whole ms
+    uint8_t retries;        // further attempts after a failure, up to IMU_BUS_RETRIES_MAX
+    uint32_t backoff_us;    // wait before the first retry
+} imu_bus_policy_t;
+
+uint32_t imu_bus_timeout_ms(const imu_bus_policy_t *policy);                        // HAL timeout of the first call of a transaction
+uint32_t imu_bus_remaining_ms(const imu_bus_policy_t *policy, uint32_t start_tick);  // HAL timeout of a further call, 0 once the deadline has passed
+void imu_bus_backoff(const imu_bus_policy_t *policy, uint8_t attempt);              // attempt counts from 1
+uint32_t imu_bus_worst_case_us(const imu_bus_policy_t *policy, uint8_t transactions, uint32_t recovery_us);
+
+/* C++ detection */
+#ifdef __cplusplus
+}
+#endif
+
+#endif
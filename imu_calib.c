@@ -0,0 +1,517 @@
+#include "imu_calib.h"
+
+#include <math.h>
+#include <string.h>
+
+#define IMU_CALIB_RLS_MAX       9           // parameters of the largest fit
+#define IMU_CALIB_JACOBI_SWEEPS 16
+
+/* private functions */
+static bool imu_calib_block_push(imu_calib_block_t *block, int16_t x, int16_t y, int16_t z, float rest_lsb2, float mean[3]);
+static void imu_calib_rls(float *theta, float *p, const float *phi, float y, uint8_t n);
+static void imu_calib_rls_reset(float *theta, float *p, uint8_t n);
+static bool imu_calib_moved(const float last[3], const float v[3], float step);
+static bool imu_calib_solve_acc(const imu_calib_t *calib, imu_calib_params_t *params);
+static bool imu_calib_solve_mag(const imu_calib_t *calib, imu_calib_params_t *params);
+static void imu_calib_jacobi(float a[3][3], float v[3][3]);
+static void imu_calib_put_u32(uint8_t *buf, uint32_t value);
+static uint32_t imu_calib_get_u32(const uint8_t *buf);
+static uint32_t imu_calib_crc32(const uint8_t *buf, uint16_t len);
+
+void imu_calib_init(imu_calib_t *calib, float gyro_dps_lsb, float acc_ms2_lsb) {
+    uint8_t i;
+
+    *calib = (imu_calib_t) { 0 };
+
+    calib->gyro_dps_lsb = gyro_dps_lsb;
+    calib->acc_g_lsb = acc_ms2_lsb / IMU_CALIB_GRAVITY;
+    calib->gyro_rest_lsb2 = (IMU_CALIB_GYRO_REST / gyro_dps_lsb) * (IMU_CALIB_GYRO_REST / gyro_dps_lsb);
+    calib->acc_rest_lsb2 = (IMU_CALIB_ACC_REST / calib->acc_g_lsb) * (IMU_CALIB_ACC_REST / calib->acc_g_lsb);
+
+    imu_calib_rls_reset(calib->acc_theta, &calib->acc_p[0][0], 6);
+    imu_calib_rls_reset(calib->mag_theta, &calib->mag_p[0][0], 9);
+
+    for (i = 0; i < 3; i++) {
+        calib->acc_min[i] = INFINITY;
+        calib->acc_max[i] = -INFINITY;
+    }
+}
+
+void imu_calib_push_gyro(imu_calib_t *calib, const l3gd20_data_t *raw) {
+    float mean[3];
+    uint8_t i;
+
+    if (!imu_calib_block_push(&calib->gyro_block, raw->x, raw->y, raw->z, calib->gyro_rest_lsb2, mean)) {
+        return;
+    }
+
+    /* running mean over the last rest blocks, so a slow drift is followed */
+    if (calib->gyro_rest < IMU_CALIB_GYRO_AVG) {
+        calib->gyro_rest++;
+    }
+
+    for (i = 0; i < 3; i++) {
+        calib->gyro_bias[i] += (mean[i] * calib->gyro_dps_lsb - calib->gyro_bias[i]) / calib->gyro_rest;
+    }
+}
+
+void imu_calib_push_acc(imu_calib_t *calib, const lsm303dlhc_data_raw_t *raw) {
+    float mean[3];
+    float phi[6];
+    uint8_t i;
+
+    if (!imu_calib_block_push(&calib->acc_block, raw->x, raw->y, raw->z, calib->acc_rest_lsb2, mean)) {
+        return;
+    }
+
+    for (i = 0; i < 3; i++) {
+        mean[i] *= calib->acc_g_lsb;
+    }
+
+    /* one observation per pose, a device left lying must not outweigh the others */
+    if (calib->acc_poses > 0 && !imu_calib_moved(calib->acc_last, mean, IMU_CALIB_ACC_STEP)) {
+        return;
+    }
+
+    for (i = 0; i < 3; i++) {
+        phi[i] = mean[i] * mean[i];
+        phi[3 + i] = mean[i];
+
+        calib->acc_last[i] = mean[i];
+        calib->acc_min[i] = fminf(calib->acc_min[i], mean[i]);
+        calib->acc_max[i] = fmaxf(calib->acc_max[i], mean[i]);
+    }
+
+    imu_calib_rls(calib->acc_theta, &calib->acc_p[0][0], phi, 1.0f, 6);
+    calib->acc_poses++;
+}
+
+void imu_calib_push_mag(imu_calib_t *calib, const lsm303dlhc_mag_sample_t *sample) {
+    lsm303dlhc_data_t conv;
+    float m[3];
+    float phi[9];
+    float xx, yy, zz;
+
+    /* the gain of the sample, the device conversion may already be calibrated */
+    lsm303dlhc_convert_mag_sample(&conv, sample);
+    m[0] = conv.x * (1.0f / IMU_CALIB_MAG_NORM);
+    m[1] = conv.y * (1.0f / IMU_CALIB_MAG_NORM);
+    m[2] = conv.z * (1.0f / IMU_CALIB_MAG_NORM);
+
+    if (calib->mag_samples > 0 && !imu_calib_moved(calib->mag_last, m, IMU_CALIB_MAG_STEP)) {
+        return;
+    }
+
+    /*
+     * the quadric with trace 3 and a free constant term, so the fit holds however far the centre
+     * is from the origin: |m|^2 = t0 (x^2 + y^2 - 2z^2) + t1 (x^2 + z^2 - 2y^2) + 2 t2 xy + 2 t3 xz
+     * + 2 t4 yz + 2 t5 x + 2 t6 y + 2 t7 z + t8
+     */
+    xx = m[0] * m[0];
+    yy = m[1] * m[1];
+    zz = m[2] * m[2];
+    phi[0] = xx + yy - 2.0f * zz;
+    phi[1] = xx + zz - 2.0f * yy;
+    phi[2] = 2.0f * m[0] * m[1];
+    phi[3] = 2.0f * m[0] * m[2];
+    phi[4] = 2.0f * m[1] * m[2];
+    phi[5] = 2.0f * m[0];
+    phi[6] = 2.0f * m[1];
+    phi[7] = 2.0f * m[2];
+    phi[8] = 1.0f;
+
+    imu_calib_rls(calib->mag_theta, &calib->mag_p[0][0], phi, xx + yy + zz, 9);
+
+    calib->mag_last[0] = m[0];
+    calib->mag_last[1] = m[1];
+    calib->mag_last[2] = m[2];
+    calib->mag_samples++;
+}
+
+uint8_t imu_calib_solve(const imu_calib_t *calib, imu_calib_params_t *params) {
+    uint8_t i, j;
+
+    /* nominal first, every fit that converged overwrites its part */
+    *params = (imu_calib_params_t) { 0 };
+
+    for (i = 0; i < 3; i++) {
+        params->acc_scale[i] = 1.0f;
+
+        for (j = 0; j < 3; j++) {
+            params->mag_soft[i][j] = (i == j) ? 1.0f : 0.0f;
+        }
+    }
+
+    if (calib->gyro_rest > 0) {
+        params->gyro_bias[0] = calib->gyro_bias[0];
+        params->gyro_bias[1] = calib->gyro_bias[1];
+        params->gyro_bias[2] = calib->gyro_bias[2];
+        params->valid |= IMU_CALIB_GYRO;
+    }
+
+    if (imu_calib_solve_acc(calib, params)) {
+        params->valid |= IMU_CALIB_ACC;
+    }
+
+    if (imu_calib_solve_mag(calib, params)) {
+        params->valid |= IMU_CALIB_MAG;
+    }
+
+    return params->valid;
+}
+
+void imu_calib_apply(const imu_calib_params_t *params, l3gd20_t *gyro, lsm303dlhc_t *lsm) {
+    if (gyro != NULL) {
+        l3gd20_dev_set_bias(gyro, (params->valid & IMU_CALIB_GYRO) ? params->gyro_bias : NULL);
+    }
+
+    if (lsm == NULL) {
+        return;
+    }
+
+    if (params->valid & IMU_CALIB_ACC) {
+        lsm303dlhc_dev_set_acc_calib(lsm, params->acc_offset, params->acc_scale);
+    } else {
+        lsm303dlhc_dev_set_acc_calib(lsm, NULL, NULL);
+    }
+
+    if (params->valid & IMU_CALIB_MAG) {
+        lsm303dlhc_dev_set_mag_calib(lsm, params->mag_offset, params->mag_soft);
+    } else {
+        lsm303dlhc_dev_set_mag_calib(lsm, NULL, NULL);
+    }
+}
+
+void imu_calib_save(const imu_calib_params_t *params, uint8_t blob[IMU_CALIB_BLOB_LEN]) {
+    const float *values[] = { params->gyro_bias, params->acc_offset, params->acc_scale, params->mag_offset, &params->mag_soft[0][0] };
+    const uint8_t counts[] = { 3, 3, 3, 3, 9 };
+    uint8_t *out = &blob[12];
+    uint32_t bits;
+    uint8_t i, j;
+
+    memset(blob, 0, IMU_CALIB_BLOB_LEN);
+    imu_calib_put_u32(&blob[0], IMU_CALIB_MAGIC);
+    imu_calib_put_u32(&blob[4], IMU_CALIB_VERSION | (IMU_CALIB_BLOB_LEN << 16));
+    blob[8] = params->valid;
+
+    for (i = 0; i < 5; i++) {
+        for (j = 0; j < counts[i]; j++) {
+            memcpy(&bits, &values[i][j], sizeof(bits));
+            imu_calib_put_u32(out, bits);
+            out += 4;
+        }
+    }
+
+    imu_calib_put_u32(&blob[IMU_CALIB_BLOB_LEN - 4], imu_calib_crc32(blob, IMU_CALIB_BLOB_LEN - 4));
+}
+
+imu_calib_result_t imu_calib_load(imu_calib_params_t *params, const uint8_t *blob, uint16_t len) {
+    float *values[] = { params->gyro_bias, params->acc_offset, params->acc_scale, params->mag_offset, &params->mag_soft[0][0] };
+    const uint8_t counts[] = { 3, 3, 3, 3, 9 };
+    const uint8_t *in = &blob[12];
+    uint32_t bits;
+    uint8_t i, j;
+
+    /* params are left untouched unless the whole blob checks out */
+    if (len < IMU_CALIB_BLOB_LEN || imu_calib_get_u32(&blob[0]) != IMU_CALIB_MAGIC) {
+        return IMU_CALIB_ERROR;
+    }
+
+    if (imu_calib_get_u32(&blob[4]) != (IMU_CALIB_VERSION | (IMU_CALIB_BLOB_LEN << 16))) {
+        return IMU_CALIB_ERROR;
+    }
+
+    if (imu_calib_get_u32(&blob[IMU_CALIB_BLOB_LEN - 4]) != imu_calib_crc32(blob, IMU_CALIB_BLOB_LEN - 4)) {
+        return IMU_CALIB_ERROR;
+    }
+
+    params->valid = blob[8] & (IMU_CALIB_GYRO | IMU_CALIB_ACC | IMU_CALIB_MAG);
+
+    for (i = 0; i < 5; i++) {
+        for (j = 0; j < counts[i]; j++) {
+            bits = imu_calib_get_u32(in);
+            memcpy(&values[i][j], &bits, sizeof(bits));
+            in += 4;
+        }
+    }
+
+    return IMU_CALIB_OK;
+}
+
+/* private functions */
+static bool imu_calib_block_push(imu_calib_block_t *block, int16_t x, int16_t y, int16_t z, float rest_lsb2, float mean[3]) {
+    const int16_t v[3] = { x, y, z };
+    bool rest = true;
+    int64_t var;
+    uint8_t i;
+
+    for (i = 0; i < 3; i++) {
+        block->sum[i] += v[i];
+        block->sum2[i] += (int32_t) v[i] * v[i];
+    }
+
+    if (++block->count < IMU_CALIB_BLOCK) {
+        return false;
+    }
+
+    /* n^2 * variance = n * sum2 - sum^2, exact */
+    for (i = 0; i < 3; i++) {
+        var = IMU_CALIB_BLOCK * block->sum2[i] - (int64_t) block->sum[i] * block->sum[i];
+
+        if ((float) var > rest_lsb2 * (IMU_CALIB_BLOCK * IMU_CALIB_BLOCK)) {
+            rest = false;
+        }
+
+        mean[i] = (float) block->sum[i] * (1.0f / IMU_CALIB_BLOCK);
+    }
+
+    *block = (imu_calib_block_t) { 0 };
+
+    return rest;
+}
+
+/* fits phi . theta = y, P is n x n row-major and stays symmetric */
+static void imu_calib_rls(float *theta, float *p, const float *phi, float y, uint8_t n) {
+    float pphi[IMU_CALIB_RLS_MAX];
+    float den = 1.0f;
+    float err = y;
+    float k;
+    uint8_t i, j;
+
+    for (i = 0; i < n; i++) {
+        pphi[i] = 0.0f;
+
+        for (j = 0; j < n; j++) {
+            pphi[i] += p[i * n + j] * phi[j];
+        }
+
+        den += phi[i] * pphi[i];
+        err -= phi[i] * theta[i];
+    }
+
+    for (i = 0; i < n; i++) {
+        k = pphi[i] / den;
+        theta[i] += k * err;
+
+        /* upper triangle only, mirrored, so rounding cannot make P asymmetric */
+        for (j = i; j < n; j++) {
+            p[i * n + j] -= k * pphi[j];
+            p[j * n + i] = p[i * n + j];
+        }
+    }
+}
+
+static void imu_calib_rls_reset(float *theta, float *p, uint8_t n) {
+    uint8_t i, j;
+
+    for (i = 0; i < n; i++) {
+        theta[i] = 0.0f;
+
+        for (j = 0; j < n; j++) {
+            p[i * n + j] = (i == j) ? IMU_CALIB_RLS_P0 : 0.0f;
+        }
+    }
+}
+
+static bool imu_calib_moved(const float last[3], const float v[3], float step) {
+    float dx = v[0] - last[0];
+    float dy = v[1] - last[1];
+    float dz = v[2] - last[2];
+
+    return dx * dx + dy * dy + dz * dz >= step * step;
+}
+
+static bool imu_calib_solve_acc(const imu_calib_t *calib, imu_calib_params_t *params) {
+    const float *t = calib->acc_theta;
+    float o[3];
+    float r = 1.0f;
+    uint8_t i;
+
+    /* every axis must have seen gravity both ways, or its scale and offset cannot be told apart */
+    if (calib->acc_poses < IMU_CALIB_ACC_POSES) {
+        return false;
+    }
+
+    for (i = 0; i < 3; i++) {
+        if (calib->acc_min[i] > -0.5f || calib->acc_max[i] < 0.5f || t[i] <= 0.0f) {
+            return false;
+        }
+    }
+
+    /* sum a_i (m_i - o_i)^2 = 1 + sum a_i o_i^2 */
+    for (i = 0; i < 3; i++) {
+        o[i] = -t[3 + i] / (2.0f * t[i]);
+        r += t[i] * o[i] * o[i];
+    }
+
+    for (i = 0; i < 3; i++) {
+        params->acc_offset[i] = o[i] * IMU_CALIB_GRAVITY;
+        params->acc_scale[i] = sqrtf(t[i] / r);
+    }
+
+    return true;
+}
+
+static bool imu_calib_solve_mag(const imu_calib_t *calib, imu_calib_params_t *params) {
+    const float *t = calib->mag_theta;
+    float a[3][3] = {
+        { 1.0f - t[0] - t[1], -t[2], -t[3] },
+        { -t[2], 1.0f - t[0] + 2.0f * t[1], -t[4] },
+        { -t[3], -t[4], 1.0f + 2.0f * t[0] - t[1] }
+    };
+    const float g[3] = { -t[5], -t[6], -t[7] };
+    float inv[3][3];
+    float v[3][3];
+    float h[3];
+    float det, r, s[3];
+    uint8_t i, j, k;
+
+    if (calib->mag_samples < IMU_CALIB_MAG_SAMPLES) {
+        return false;
+    }
+
+    inv[0][0] = a[1][1] * a[2][2] - a[1][2] * a[2][1];
+    inv[0][1] = a[0][2] * a[2][1] - a[0][1] * a[2][2];
+    inv[0][2] = a[0][1] * a[1][2] - a[0][2] * a[1][1];
+    inv[1][1] = a[0][0] * a[2][2] - a[0][2] * a[2][0];
+    inv[1][2] = a[0][2] * a[1][0] - a[0][0] * a[1][2];
+    inv[2][2] = a[0][0] * a[1][1] - a[0][1] * a[1][0];
+    inv[1][0] = inv[0][1];
+    inv[2][0] = inv[0][2];
+    inv[2][1] = inv[1][2];
+
+    det = a[0][0] * inv[0][0] + a[0][1] * inv[1][0] + a[0][2] * inv[2][0];
+    if (det <= 0.0f) {
+        return false;
+    }
+
+    /* m' A m + 2 g' m - t8 = 0, centre h = -A^-1 g, then (m - h)' A (m - h) = h' A h + t8 */
+    r = t[8];
+    for (i = 0; i < 3; i++) {
+        h[i] = -(inv[i][0] * g[0] + inv[i][1] * g[1] + inv[i][2] * g[2]) / det;
+    }
+
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < 3; j++) {
+            r += h[i] * a[i][j] * h[j];
+        }
+    }
+
+    if (r <= 0.0f) {
+        return false;
+    }
+
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < 3; j++) {
+            a[i][j] /= r;
+        }
+    }
+
+    /* the symmetric square root maps the ellipsoid to a sphere without rotating it */
+    imu_calib_jacobi(a, v);
+
+    if (a[0][0] <= 0.0f || a[1][1] <= 0.0f || a[2][2] <= 0.0f) {
+        return false;
+    }
+
+    /* keep the geometric mean radius, so the field strength stays in uT */
+    r = powf(a[0][0] * a[1][1] * a[2][2], -1.0f / 6.0f);
+
+    for (i = 0; i < 3; i++) {
+        s[i] = sqrtf(a[i][i]) * r;
+    }
+
+    for (i = 0; i < 3; i++) {
+        params->mag_offset[i] = h[i] * IMU_CALIB_MAG_NORM;
+
+        for (j = 0; j < 3; j++) {
+            params->mag_soft[i][j] = 0.0f;
+
+            for (k = 0; k < 3; k++) {
+                params->mag_soft[i][j] += v[i][k] * s[k] * v[j][k];
+            }
+        }
+    }
+
+    return true;
+}
+
+/* diagonalizes the symmetric a in place, the columns of v are the eigenvectors */
+static void imu_calib_jacobi(float a[3][3], float v[3][3]) {
+    uint8_t sweep, p, q, i;
+    float theta, t, c, s, aip, aiq;
+
+    for (p = 0; p < 3; p++) {
+        for (q = 0; q < 3; q++) {
+            v[p][q] = (p == q) ? 1.0f : 0.0f;
+        }
+    }
+
+    for (sweep = 0; sweep < IMU_CALIB_JACOBI_SWEEPS; sweep++) {
+        if (fabsf(a[0][1]) + fabsf(a[0][2]) + fabsf(a[1][2]) < 1e-9f) {
+            return;
+        }
+
+        for (p = 0; p < 2; p++) {
+            for (q = p + 1; q < 3; q++) {
+                if (a[p][q] == 0.0f) {
+                    continue;
+                }
+
+                theta = (a[q][q] - a[p][p]) / (2.0f * a[p][q]);
+                t = copysignf(1.0f, theta) / (fabsf(theta) + sqrtf(theta * theta + 1.0f));
+                c = 1.0f / sqrtf(t * t + 1.0f);
+                s = t * c;
+
+                for (i = 0; i < 3; i++) {
+                    aip = a[i][p];
+                    aiq = a[i][q];
+                    a[i][p] = c * aip - s * aiq;
+                    a[i][q] = s * aip + c * aiq;
+                }
+
+                for (i = 0; i < 3; i++) {
+                    aip = a[p][i];
+                    aiq = a[q][i];
+                    a[p][i] = c * aip - s * aiq;
+                    a[q][i] = s * aip + c * aiq;
+                }
+
+                for (i = 0; i < 3; i++) {
+                    aip = v[i][p];
+                    aiq = v[i][q];
+                    v[i][p] = c * aip - s * aiq;
+                    v[i][q] = s * aip + c * aiq;
+                }
+            }
+        }
+    }
+}
+
+static void imu_calib_put_u32(uint8_t *buf, uint32_t value) {
+    buf[0] = (uint8_t) value;
+    buf[1] = (uint8_t) (value >> 8);
+    buf[2] = (uint8_t) (value >> 16);
+    buf[3] = (uint8_t) (value >> 24);
+}
+
+static uint32_t imu_calib_get_u32(const uint8_t *buf) {
+    return buf[0] | (buf[1] << 8) | ((uint32_t) buf[2] << 16) | ((uint32_t) buf[3] << 24);
+}
+
+/* CRC-32 (IEEE 802.3), bitwise, only run on save and load */
+static uint32_t imu_calib_crc32(const uint8_t *buf, uint16_t len) {
+    uint32_t crc = 0xFFFFFFFF;
+    uint16_t i;
+    uint8_t bit;
+
+    for (i = 0; i < len; i++) {
+        crc ^= buf[i];
+
+        for (bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+
+    return ~crc;
+}
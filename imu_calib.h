@@ -0,0 +1,116 @@
+#ifndef __IMU_CALIB_H__
+#define __IMU_CALIB_H__
+
+/* C++ detection */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "stm32f3xx_l3gd20.h"
+#include "stm32f3xx_lsm303dlhc.h"
+
+/*
+ * online calibration
+ * Every pushed sample costs constant time. Gyroscope samples are grouped into blocks, a block
+ * quiet enough counts as rest and updates the zero-rate bias. Accelerometer blocks at rest are
+ * static poses; they feed a recursive least-squares fit of an axis-aligned ellipsoid, giving
+ * offset and scale per axis. Magnetometer samples feed a recursive least-squares fit of a general
+ * ellipsoid, giving the hard-iron offset and the soft-iron matrix. imu_calib_solve extracts the
+ * parameters and imu_calib_apply folds them into the conversion factors of the drivers.
+ * A hard-iron offset may exceed the earth field, the fit does not assume the origin inside.
+ */
+
+#define IMU_CALIB_BLOCK         32          // samples per rest detection block
+#define IMU_CALIB_GYRO_REST     1.0f        // dps, standard deviation of a gyroscope block at rest
+#define IMU_CALIB_GYRO_AVG      64          // rest blocks averaged into the bias, older ones fade
+#define IMU_CALIB_ACC_REST      0.02f       // g, standard deviation of an accelerometer block at rest
+#define IMU_CALIB_ACC_STEP      0.25f       // g, a new pose differs this much from the previous one
+#define IMU_CALIB_ACC_POSES     6           // poses before the accelerometer fit is trusted
+#define IMU_CALIB_MAG_NORM      50.0f       // uT, magnetometer samples are fitted in units of this
+#define IMU_CALIB_MAG_STEP      0.1f        // IMU_CALIB_MAG_NORM, samples closer to the previous one are skipped
+#define IMU_CALIB_MAG_SAMPLES   100         // samples before the magnetometer fit is trusted
+#define IMU_CALIB_RLS_P0        1000.0f     // initial covariance of the fits
+
+#define IMU_CALIB_GRAVITY       9.80665f    // m/s^2, matches the accelerometer conversion
+
+/* imu_calib_params_t valid bits */
+#define IMU_CALIB_GYRO          0x01
+#define IMU_CALIB_ACC           0x02
+#define IMU_CALIB_MAG           0x04
+
+/* save/load blob: magic, version, length, valid, 21 little-endian floats, CRC-32 */
+#define IMU_CALIB_MAGIC         0x43554D49  // "IMUC"
+#define IMU_CALIB_VERSION       1
+#define IMU_CALIB_BLOB_LEN      100
+
+typedef enum {
+    IMU_CALIB_OK,
+    IMU_CALIB_ERROR
+} imu_calib_result_t;
+
+/* corrected = scale * (sample - offset) for the accelerometer, soft * (sample - offset) for the magnetometer */
+typedef struct {
+    uint8_t valid;              // IMU_CALIB_* bits, the other parameters are nominal
+    float gyro_bias[3];         // dps
+    float acc_offset[3];        // m/s^2
+    float acc_scale[3];
+    float mag_offset[3];        // uT, hard iron
+    float mag_soft[3][3];       // soft iron
+} imu_calib_params_t;
+
+/* sums of one rest detection block, exact in integers */
+typedef struct {
+    int32_t sum[3];
+    int64_t sum2[3];
+    uint8_t count;
+} imu_calib_block_t;
+
+typedef struct {
+    /* nominal conversion of the pushed samples */
+    float gyro_dps_lsb;
+    float acc_g_lsb;
+    float gyro_rest_lsb2;       // rest thresholds as block variance in lsb^2
+    float acc_rest_lsb2;
+
+    imu_calib_block_t gyro_block;
+    float gyro_bias[3];         // dps
+    uint16_t gyro_rest;         // rest blocks seen, saturates at IMU_CALIB_GYRO_AVG
+
+    imu_calib_block_t acc_block;
+    float acc_theta[6];         // x^2, y^2, z^2, x, y, z coefficients, g units
+    float acc_p[6][6];
+    float acc_last[3];
+    float acc_min[3];
+    float acc_max[3];
+    uint16_t acc_poses;
+
+    float mag_theta[9];         // trace-normalized quadric, see imu_calib_push_mag, IMU_CALIB_MAG_NORM units
+    float mag_p[9][9];
+    float mag_last[3];
+    uint32_t mag_samples;
+} imu_calib_t;
+
+/* gyro_dps_lsb is l3gd20_t dps_lsb, acc_ms2_lsb is lsm303dlhc_t acc_scale */
+void imu_calib_init(imu_calib_t *calib, float gyro_dps_lsb, float acc_ms2_lsb);
+
+void imu_calib_push_gyro(imu_calib_t *calib, const l3gd20_data_t *raw);
+void imu_calib_push_acc(imu_calib_t *calib, const lsm303dlhc_data_raw_t *raw);
+void imu_calib_push_mag(imu_calib_t *calib, const lsm303dlhc_mag_sample_t *sample);
+
+/* not for the sample path, the magnetometer fit takes an eigendecomposition. Returns the valid bits */
+uint8_t imu_calib_solve(const imu_calib_t *calib, imu_calib_params_t *params);
+void imu_calib_apply(const imu_calib_params_t *params, l3gd20_t *gyro, lsm303dlhc_t *lsm);    // either device may be NULL
+
+/* blob of IMU_CALIB_BLOB_LEN bytes, e.g. for a flash page */
+void imu_calib_save(const imu_calib_params_t *params, uint8_t blob[IMU_CALIB_BLOB_LEN]);
+imu_calib_result_t imu_calib_load(imu_calib_params_t *params, const uint8_t *blob, uint16_t len);
+
+/* C++ detection */
+#ifdef __cplusplus
+}
+#endif
+
+#endif
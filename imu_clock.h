@@ -0,0 +1,94 @@
+#ifndef __IMU_CLOCK_H__
+#define __IMU_CLOCK_H__
+
+/* C++ detection */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/*
+ * free-running 32 bit timestamp counter
+ * On target the DWT cycle counter is used, on host CLOCK_MONOTONIC in ns. Differences of two
+ * readings are valid across a wrap-around. With IMU_CLOCK_EXTERNAL the functions are defined
+ * elsewhere, by the host HAL simulator on its virtual clock.
+ */
+#if defined(IMU_CLOCK_EXTERNAL)
+
+void imu_clock_init(void);
+uint32_t imu_clock_now(void);
+uint32_t imu_clock_ticks_per_us(void);
+void imu_clock_delay_us(uint32_t us);
+
+#elif defined(__ARM_ARCH)
+
+#include "stm32f3xx_hal.h"
+
+/* enables the cycle counter, call once at startup */
+static inline void imu_clock_init(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+static inline uint32_t imu_clock_now(void) {
+    return DWT->CYCCNT;
+}
+
+static inline uint32_t imu_clock_ticks_per_us(void) {
+    return SystemCoreClock / 1000000;
+}
+
+#else
+
+#include <time.h>
+
+static inline void imu_clock_init(void) {
+}
+
+static inline uint32_t imu_clock_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint32_t) ((uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec);
+}
+
+static inline uint32_t imu_clock_ticks_per_us(void) {
+    return 1000;
+}
+
+#endif
+
+static inline uint32_t imu_clock_us(uint32_t ticks) {
+    return ticks / imu_clock_ticks_per_us();
+}
+
+#if !defined(IMU_CLOCK_EXTERNAL)
+
+/* busy wait, on target the cycle counter is started if nothing did yet */
+static inline void imu_clock_delay_us(uint32_t us) {
+    uint32_t start, ticks;
+
+#if defined(__ARM_ARCH)
+    if (!(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk)) {
+        imu_clock_init();
+    }
+#endif
+
+    start = imu_clock_now();
+    ticks = us * imu_clock_ticks_per_us();
+
+    while (imu_clock_now() - start < ticks) {
+    }
+}
+
+#endif
+
+/* C++ detection */
+#ifdef __cplusplus
+}
+#endif
+
+#endif
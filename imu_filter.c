@@ -0,0 +1,385 @@
+#include "imu_filter.h"
+
+#include <math.h>
+#include <string.h>
+
+#define IMU_FILTER_ONE          (1 << IMU_FILTER_Q)
+#define IMU_FILTER_PI           3.14159265358979
+
+/* private functions */
+static imu_filter_stage_t *imu_filter_add(imu_filter_t *filter, imu_filter_type_t type, uint8_t ratio);
+static void imu_filter_reset_stage(imu_filter_stage_t *stage);
+static bool imu_filter_q30(int32_t *q, double value);
+static imu_filter_result_t imu_filter_design(imu_filter_biquad_t *coeff, float cutoff_hz, float rate_hz, float q, bool high);
+static uint16_t imu_filter_run(imu_filter_t *filter, const int16_t *in, int16_t *out, uint16_t count);
+static uint16_t imu_filter_biquad(imu_filter_stage_t *stage, int32_t (*w)[3], uint16_t n);
+static uint16_t imu_filter_average(imu_filter_stage_t *stage, int32_t (*w)[3], uint16_t n);
+static uint16_t imu_filter_cic(imu_filter_stage_t *stage, int32_t (*w)[3], uint16_t n);
+static uint16_t imu_filter_decimate(imu_filter_stage_t *stage, int32_t (*w)[3], uint16_t n);
+static int16_t imu_filter_output(int32_t value);
+
+void imu_filter_init(imu_filter_t *filter) {
+    filter->stages = 0;
+}
+
+imu_filter_result_t imu_filter_add_biquad(imu_filter_t *filter, const imu_filter_biquad_t *coeff) {
+    imu_filter_stage_t *stage;
+
+    if (coeff == NULL || (stage = imu_filter_add(filter, IMU_FILTER_BIQUAD, 1)) == NULL) {
+        return IMU_FILTER_ERROR;
+    }
+
+    stage->biquad.c = *coeff;
+
+    return IMU_FILTER_OK;
+}
+
+imu_filter_result_t imu_filter_add_average(imu_filter_t *filter, int32_t history[], uint8_t length) {
+    imu_filter_stage_t *stage;
+
+    if (history == NULL || length == 0 || length > IMU_FILTER_AVERAGE_MAX) {
+        return IMU_FILTER_ERROR;
+    }
+
+    if ((stage = imu_filter_add(filter, IMU_FILTER_AVERAGE, 1)) == NULL) {
+        return IMU_FILTER_ERROR;
+    }
+
+    stage->average.history = history;
+    stage->average.length = length;
+    stage->average.gain = (IMU_FILTER_ONE + length / 2) / length;
+    imu_filter_reset_stage(stage);
+
+    return IMU_FILTER_OK;
+}
+
+imu_filter_result_t imu_filter_add_cic(imu_filter_t *filter, uint8_t order, uint8_t ratio) {
+    imu_filter_stage_t *stage;
+    uint64_t gain = 1;
+    uint8_t shift = 0, i;
+
+    if (order == 0 || order > IMU_FILTER_CIC_ORDER || ratio < 2) {
+        return IMU_FILTER_ERROR;
+    }
+
+    for (i = 0; i < order; i++) {
+        gain *= ratio;
+    }
+
+    /* the output is shifted by the next power of two and scaled by the rest */
+    while (((uint64_t) 1 << shift) < gain) {
+        shift++;
+    }
+
+    if (shift > IMU_FILTER_CIC_GROWTH || (stage = imu_filter_add(filter, IMU_FILTER_CIC, ratio)) == NULL) {
+        return IMU_FILTER_ERROR;
+    }
+
+    stage->cic.order = order;
+    stage->cic.shift = shift;
+    stage->cic.gain = (int32_t) ((((uint64_t) IMU_FILTER_ONE << shift) + gain / 2) / gain);
+
+    return IMU_FILTER_OK;
+}
+
+imu_filter_result_t imu_filter_add_decimate(imu_filter_t *filter, uint8_t ratio) {
+    if (ratio < 2 || imu_filter_add(filter, IMU_FILTER_DECIMATE, ratio) == NULL) {
+        return IMU_FILTER_ERROR;
+    }
+
+    return IMU_FILTER_OK;
+}
+
+void imu_filter_reset(imu_filter_t *filter) {
+    uint8_t i;
+
+    for (i = 0; i < filter->stages; i++) {
+        imu_filter_reset_stage(&filter->stage[i]);
+    }
+}
+
+uint16_t imu_filter_ratio(const imu_filter_t *filter) {
+    uint16_t ratio = 1;
+    uint8_t i;
+
+    for (i = 0; i < filter->stages; i++) {
+        ratio *= filter->stage[i].ratio;
+    }
+
+    return ratio;
+}
+
+imu_filter_result_t imu_filter_lowpass(imu_filter_biquad_t *coeff, float cutoff_hz, float rate_hz, float q) {
+    return imu_filter_design(coeff, cutoff_hz, rate_hz, q, false);
+}
+
+imu_filter_result_t imu_filter_highpass(imu_filter_biquad_t *coeff, float cutoff_hz, float rate_hz, float q) {
+    return imu_filter_design(coeff, cutoff_hz, rate_hz, q, true);
+}
+
+uint16_t imu_filter_process_gyro(imu_filter_t *filter, const l3gd20_data_t in[], l3gd20_data_t out[], uint16_t count) {
+    return imu_filter_run(filter, &in[0].x, &out[0].x, count);
+}
+
+uint16_t imu_filter_process_lsm(imu_filter_t *filter, const lsm303dlhc_data_raw_t in[], lsm303dlhc_data_raw_t out[], uint16_t count) {
+    return imu_filter_run(filter, &in[0].x, &out[0].x, count);
+}
+
+static imu_filter_stage_t *imu_filter_add(imu_filter_t *filter, imu_filter_type_t type, uint8_t ratio) {
+    imu_filter_stage_t *stage;
+
+    if (filter->stages >= IMU_FILTER_STAGES) {
+        return NULL;
+    }
+
+    stage = &filter->stage[filter->stages++];
+    memset(stage, 0, sizeof(*stage));
+    stage->type = type;
+    stage->ratio = ratio;
+
+    return stage;
+}
+
+static void imu_filter_reset_stage(imu_filter_stage_t *stage) {
+    stage->phase = 0;
+
+    if (stage->type == IMU_FILTER_BIQUAD) {
+        memset(stage->biquad.x, 0, sizeof(stage->biquad.x));
+        memset(stage->biquad.y, 0, sizeof(stage->biquad.y));
+        memset(stage->biquad.e, 0, sizeof(stage->biquad.e));
+    } else if (stage->type == IMU_FILTER_AVERAGE) {
+        memset(stage->average.history, 0, 3 * stage->average.length * sizeof(int32_t));
+        memset(stage->average.sum, 0, sizeof(stage->average.sum));
+        stage->average.pos = 0;
+    } else if (stage->type == IMU_FILTER_CIC) {
+        memset(stage->cic.integ, 0, sizeof(stage->cic.integ));
+        memset(stage->cic.comb, 0, sizeof(stage->cic.comb));
+    }
+}
+
+/* Q2.30, fails outside [-2, 2) */
+static bool imu_filter_q30(int32_t *q, double value) {
+    double scaled = floor(value * IMU_FILTER_ONE + 0.5);
+
+    if (scaled < -2.0 * IMU_FILTER_ONE || scaled >= 2.0 * IMU_FILTER_ONE) {
+        return false;
+    }
+
+    *q = (int32_t) scaled;
+
+    return true;
+}
+
+static imu_filter_result_t imu_filter_design(imu_filter_biquad_t *coeff, float cutoff_hz, float rate_hz, float q, bool high) {
+    double w0, c, alpha, a0;
+    int64_t a2;
+
+    if (coeff == NULL || !(cutoff_hz > 0.0f) || !(cutoff_hz < rate_hz / 2.0f) || !(q > 0.0f)) {
+        return IMU_FILTER_ERROR;
+    }
+
+    /* in double, at a low cut-off 1 + a1 + a2 is only a few hundred lsb of Q2.30 */
+    w0 = 2.0 * IMU_FILTER_PI * cutoff_hz / rate_hz;
+    c = cos(w0);
+    alpha = sin(w0) / (2.0 * q);
+    a0 = 1.0 + alpha;
+
+    if (!imu_filter_q30(&coeff->b0, (high ? 1.0 + c : 1.0 - c) / 2.0 / a0) || !imu_filter_q30(&coeff->a1, -2.0 * c / a0)) {
+        return IMU_FILTER_ERROR;
+    }
+
+    /* b1 and b2 follow from b0, a2 is rounded so the gain at DC (low-pass) or Nyquist (high-pass) stays exactly 1 */
+    a2 = 4 * (int64_t) coeff->b0 - IMU_FILTER_ONE + (high ? coeff->a1 : -(int64_t) coeff->a1);
+    if (2 * (int64_t) coeff->b0 >= 2 * (int64_t) IMU_FILTER_ONE || a2 < -2 * (int64_t) IMU_FILTER_ONE || a2 >= 2 * (int64_t) IMU_FILTER_ONE) {
+        return IMU_FILTER_ERROR;
+    }
+
+    coeff->b1 = high ? -2 * coeff->b0 : 2 * coeff->b0;
+    coeff->b2 = coeff->b0;
+    coeff->a2 = (int32_t) a2;
+
+    return IMU_FILTER_OK;
+}
+
+/* in and out are x, y, z triples; the blocks are taken in place, a stage never returns more samples than it gets */
+static uint16_t imu_filter_run(imu_filter_t *filter, const int16_t *in, int16_t *out, uint16_t count) {
+    int32_t w[IMU_FILTER_BLOCK][3];
+    uint16_t done, total = 0, n, i;
+    uint8_t j;
+
+    for (done = 0; done < count; done += IMU_FILTER_BLOCK) {
+        n = count - done < IMU_FILTER_BLOCK ? count - done : IMU_FILTER_BLOCK;
+
+        for (i = 0; i < n; i++) {
+            for (j = 0; j < 3; j++) {
+                w[i][j] = (int32_t) in[3 * (done + i) + j] * (1 << IMU_FILTER_FRAC);
+            }
+        }
+
+        for (j = 0; j < filter->stages && n > 0; j++) {
+            imu_filter_stage_t *stage = &filter->stage[j];
+
+            if (stage->type == IMU_FILTER_BIQUAD) {
+                n = imu_filter_biquad(stage, w, n);
+            } else if (stage->type == IMU_FILTER_AVERAGE) {
+                n = imu_filter_average(stage, w, n);
+            } else if (stage->type == IMU_FILTER_CIC) {
+                n = imu_filter_cic(stage, w, n);
+            } else {
+                n = imu_filter_decimate(stage, w, n);
+            }
+        }
+
+        /* total never passes done, so out may alias in */
+        for (i = 0; i < n; i++) {
+            for (j = 0; j < 3; j++) {
+                out[3 * (total + i) + j] = imu_filter_output(w[i][j]);
+            }
+        }
+
+        total += n;
+    }
+
+    return total;
+}
+
+static uint16_t imu_filter_biquad(imu_filter_stage_t *stage, int32_t (*w)[3], uint16_t n) {
+    const imu_filter_biquad_t c = stage->biquad.c;
+    int32_t x1, x2, y1, y2, e, x;
+    int64_t acc;
+    uint16_t i;
+    uint8_t j;
+
+    /* axis by axis, the state stays in registers over the block */
+    for (j = 0; j < 3; j++) {
+        x1 = stage->biquad.x[j][0];
+        x2 = stage->biquad.x[j][1];
+        y1 = stage->biquad.y[j][0];
+        y2 = stage->biquad.y[j][1];
+        e = stage->biquad.e[j];
+
+        for (i = 0; i < n; i++) {
+            x = w[i][j];
+            acc = (int64_t) c.b0 * x + (int64_t) c.b1 * x1 + (int64_t) c.b2 * x2 - (int64_t) c.a1 * y1 - (int64_t) c.a2 * y2 + e;
+
+            /* the truncated fraction goes into the next sample, no error at DC however close the poles are to 1 */
+            x2 = x1;
+            x1 = x;
+            y2 = y1;
+            y1 = (int32_t) (acc >> IMU_FILTER_Q);
+            e = (int32_t) (acc - ((int64_t) y1 << IMU_FILTER_Q));
+            w[i][j] = y1;
+        }
+
+        stage->biquad.x[j][0] = x1;
+        stage->biquad.x[j][1] = x2;
+        stage->biquad.y[j][0] = y1;
+        stage->biquad.y[j][1] = y2;
+        stage->biquad.e[j] = e;
+    }
+
+    return n;
+}
+
+static uint16_t imu_filter_average(imu_filter_stage_t *stage, int32_t (*w)[3], uint16_t n) {
+    int32_t *old;
+    uint16_t i;
+    uint8_t j;
+
+    /* a running sum, one add and one subtract per sample whatever the length */
+    for (i = 0; i < n; i++) {
+        old = &stage->average.history[3 * stage->average.pos];
+
+        for (j = 0; j < 3; j++) {
+            stage->average.sum[j] += w[i][j] - old[j];
+            old[j] = w[i][j];
+            w[i][j] = (int32_t) (((int64_t) stage->average.sum[j] * stage->average.gain + (IMU_FILTER_ONE / 2)) >> IMU_FILTER_Q);
+        }
+
+        if (++stage->average.pos == stage->average.length) {
+            stage->average.pos = 0;
+        }
+    }
+
+    return n;
+}
+
+static uint16_t imu_filter_cic(imu_filter_stage_t *stage, int32_t (*w)[3], uint16_t n) {
+    uint8_t order = stage->cic.order, shift = stage->cic.shift, j, k;
+    uint16_t i, m = 0;
+    uint64_t v, d;
+    int64_t y;
+
+    for (i = 0; i < n; i++) {
+        /* integrators at the input rate, modulo 2^64 */
+        for (j = 0; j < 3; j++) {
+            v = (uint64_t) (int64_t) w[i][j];
+
+            for (k = 0; k < order; k++) {
+                stage->cic.integ[k][j] += v;
+                v = stage->cic.integ[k][j];
+            }
+        }
+
+        if (++stage->phase < stage->ratio) {
+            continue;
+        }
+
+        stage->phase = 0;
+
+        /* combs at the output rate, the result is exact again and fits the growth */
+        for (j = 0; j < 3; j++) {
+            v = stage->cic.integ[order - 1][j];
+
+            for (k = 0; k < order; k++) {
+                d = v - stage->cic.comb[k][j];
+                stage->cic.comb[k][j] = v;
+                v = d;
+            }
+
+            y = (int64_t) v;
+            if (shift > 0) {
+                y = (y + ((int64_t) 1 << (shift - 1))) >> shift;
+            }
+
+            w[m][j] = (int32_t) ((y * stage->cic.gain + (IMU_FILTER_ONE / 2)) >> IMU_FILTER_Q);
+        }
+
+        m++;
+    }
+
+    return m;
+}
+
+static uint16_t imu_filter_decimate(imu_filter_stage_t *stage, int32_t (*w)[3], uint16_t n) {
+    uint16_t i, m = 0;
+    uint8_t j;
+
+    for (i = 0; i < n; i++) {
+        if (stage->phase == 0) {
+            for (j = 0; j < 3; j++) {
+                w[m][j] = w[i][j];
+            }
+            m++;
+        }
+
+        if (++stage->phase == stage->ratio) {
+            stage->phase = 0;
+        }
+    }
+
+    return m;
+}
+
+/* rounds off the guard bits and saturates to raw counts */
+static int16_t imu_filter_output(int32_t value) {
+    value = (value + (1 << (IMU_FILTER_FRAC - 1))) >> IMU_FILTER_FRAC;
+
+    if (value > INT16_MAX) {
+        return INT16_MAX;
+    } else if (value < INT16_MIN) {
+        return INT16_MIN;
+    }
+
+    return (int16_t) value;
+}
@@ -0,0 +1,116 @@
+#ifndef __IMU_FILTER_H__
+#define __IMU_FILTER_H__
+
+/* C++ detection */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "stm32f3xx_l3gd20.h"
+#include "stm32f3xx_lsm303dlhc.h"
+
+/*
+ * fixed-point filter and decimation pipeline
+ * Blocks of raw samples run through up to IMU_FILTER_STAGES stages: biquad sections, moving
+ * averages, CIC decimators and plain decimators, all three axes at once. Between the stages the
+ * samples are int32 with IMU_FILTER_FRAC guard bits below the lsb, so cascaded sections do not
+ * accumulate rounding; the output is rounded and saturated back to int16 raw counts. Coefficients
+ * are Q2.30, the designs below take floats once at setup and the sample path only uses integers.
+ * The sections feed the truncated fraction of each output into the next one, so a cut-off far below
+ * the sample rate still settles to the exact DC value instead of a rounding offset.
+ * Decimating stages return fewer samples than they take, the phase carries over between blocks.
+ */
+
+#define IMU_FILTER_STAGES       4       // stages per pipeline
+#define IMU_FILTER_BLOCK        16      // samples per pass through the stages, on the stack
+#define IMU_FILTER_FRAC         8       // guard bits carried between stages
+#define IMU_FILTER_Q            30      // coefficient fraction bits, Q2.30 covers a1 near -2
+#define IMU_FILTER_AVERAGE_MAX  64      // longest moving average
+#define IMU_FILTER_CIC_ORDER    4       // highest CIC order
+#define IMU_FILTER_CIC_GROWTH   24      // bits, ratio^order must stay below 2^this
+
+typedef enum {
+    IMU_FILTER_OK,
+    IMU_FILTER_ERROR
+} imu_filter_result_t;
+
+typedef enum {
+    IMU_FILTER_BIQUAD,      // second-order IIR section, direct form I
+    IMU_FILTER_AVERAGE,     // moving average, full rate
+    IMU_FILTER_CIC,         // cascaded integrator-comb decimator, unity DC gain
+    IMU_FILTER_DECIMATE     // keeps every ratio-th sample, put a low-pass before it
+} imu_filter_type_t;
+
+/* y = b0 * x + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2, Q2.30 */
+typedef struct {
+    int32_t b0, b1, b2;
+    int32_t a1, a2;
+} imu_filter_biquad_t;
+
+typedef struct {
+    imu_filter_type_t type;
+    uint8_t ratio;          // inputs per output, 1 for the full-rate stages
+    uint8_t phase;          // inputs since the last output
+
+    union {
+        struct {
+            imu_filter_biquad_t c;
+            int32_t x[3][2];            // last two inputs per axis
+            int32_t y[3][2];            // last two outputs per axis
+            int32_t e[3];               // fraction truncated from the last output
+        } biquad;
+
+        struct {
+            int32_t *history;           // length samples of x, y, z
+            int32_t sum[3];
+            int32_t gain;               // 1 / length, Q2.30
+            uint8_t length;
+            uint8_t pos;
+        } average;
+
+        struct {
+            uint64_t integ[IMU_FILTER_CIC_ORDER][3];    // wrap around, only the differences count
+            uint64_t comb[IMU_FILTER_CIC_ORDER][3];
+            int32_t gain;               // 2^shift / ratio^order, Q2.30
+            uint8_t order;
+            uint8_t shift;
+        } cic;
+    };
+} imu_filter_stage_t;
+
+typedef struct {
+    imu_filter_stage_t stage[IMU_FILTER_STAGES];
+    uint8_t stages;
+} imu_filter_t;
+
+void imu_filter_init(imu_filter_t *filter);    // empty pipeline, passes samples through
+
+/* stages run in the order they are added */
+imu_filter_result_t imu_filter_add_biquad(imu_filter_t *filter, const imu_filter_biquad_t *coeff);
+imu_filter_result_t imu_filter_add_average(imu_filter_t *filter, int32_t history[], uint8_t length);    // history holds 3 * length values
+imu_filter_result_t imu_filter_add_cic(imu_filter_t *filter, uint8_t order, uint8_t ratio);
+imu_filter_result_t imu_filter_add_decimate(imu_filter_t *filter, uint8_t ratio);
+
+void imu_filter_reset(imu_filter_t *filter);                // clears the state, e.g. after a rate or scale change
+uint16_t imu_filter_ratio(const imu_filter_t *filter);      // inputs per output of the whole pipeline
+
+/*
+ * section design, RBJ cookbook, cutoff below rate / 2. For a Butterworth of order 2n cascade n
+ * sections with q = 1 / (2 cos((2k + 1) pi / 4n)), k = 0 .. n-1, e.g. 0.5412 and 1.3066 for order 4.
+ */
+imu_filter_result_t imu_filter_lowpass(imu_filter_biquad_t *coeff, float cutoff_hz, float rate_hz, float q);
+imu_filter_result_t imu_filter_highpass(imu_filter_biquad_t *coeff, float cutoff_hz, float rate_hz, float q);
+
+/* returns the samples written to out, at most count; out may be in */
+uint16_t imu_filter_process_gyro(imu_filter_t *filter, const l3gd20_data_t in[], l3gd20_data_t out[], uint16_t count);
+uint16_t imu_filter_process_lsm(imu_filter_t *filter, const lsm303dlhc_data_raw_t in[], lsm303dlhc_data_raw_t out[], uint16_t count);
+
+/* C++ detection */
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,547 @@
+#include "imu_log.h"
+#include "imu_clock.h"
+
+#include <string.h>
+
+#define IMU_LOG_SAMPLE_MAX      14          // bytes of a delta sample at worst, 5 timestamp and 3 per axis
+#define IMU_LOG_HEADER_LEN      12
+#define IMU_LOG_STATS_LEN       24
+
+/* offsets in a data frame */
+#define IMU_LOG_POS_TYPE        2
+#define IMU_LOG_POS_LEN         3
+#define IMU_LOG_POS_PAYLOAD     4
+#define IMU_LOG_POS_COUNT       (IMU_LOG_POS_PAYLOAD + 3)
+
+#define IMU_LOG_ZIGZAG(v)       (((uint32_t) (v) << 1) ^ (uint32_t) ((int32_t) (v) >> 31))
+#define IMU_LOG_UNZIGZAG(u)     ((int32_t) ((u) >> 1) ^ -(int32_t) ((u) & 1))
+
+/* CRC-16/CCITT-FALSE, one nibble at a time */
+static const uint16_t imu_log_crc_table[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+/* private functions */
+static imu_log_result_t imu_log_write(imu_log_encoder_t *enc, const uint8_t *frame, uint16_t len);
+static imu_log_result_t imu_log_write_header(imu_log_encoder_t *enc, imu_ring_sensor_t sensor);
+static uint16_t imu_log_seal(uint8_t *frame, uint8_t type, uint8_t payload_len);
+static imu_log_result_t imu_log_open(imu_log_encoder_t *enc, imu_ring_sensor_t sensor, const imu_ring_record_t *rec, uint32_t timestamp);
+static void imu_log_append(imu_log_stream_t *s, const imu_ring_record_t *rec, uint32_t timestamp);
+static imu_log_result_t imu_log_close(imu_log_encoder_t *enc, imu_log_stream_t *s);
+static bool imu_log_fits(int16_t v, uint8_t bits);
+static uint8_t imu_log_pack_len(uint8_t bits);
+static void imu_log_pack(uint8_t *buf, int16_t x, int16_t y, int16_t z, uint8_t bits);
+static void imu_log_unpack(const uint8_t *buf, int16_t *x, int16_t *y, int16_t *z, uint8_t bits);
+static uint8_t *imu_log_put_varint(uint8_t *buf, uint32_t value);
+static const uint8_t *imu_log_get_varint(const uint8_t *buf, const uint8_t *end, uint32_t *value);
+static void imu_log_put_u32(uint8_t *buf, uint32_t value);
+static uint32_t imu_log_get_u32(const uint8_t *buf);
+static uint16_t imu_log_crc(const uint8_t *buf, uint16_t len);
+static void imu_log_decode_frame(imu_log_decoder_t *dec, imu_log_sample_callback_t callback, void *ctx);
+static void imu_log_decode_data(imu_log_decoder_t *dec, const uint8_t *p, const uint8_t *end, imu_log_sample_callback_t callback, void *ctx);
+static void imu_log_drop(imu_log_decoder_t *dec, uint16_t count);
+
+void imu_log_encoder_init(imu_log_encoder_t *enc, uint8_t *buf, uint32_t size) {
+    *enc = (imu_log_encoder_t) { 0 };
+
+    enc->out = buf;
+    enc->size = size;
+}
+
+imu_log_result_t imu_log_set_stream(imu_log_encoder_t *enc, imu_ring_sensor_t sensor, uint8_t bits, uint8_t gain, float scale) {
+    imu_log_result_t result = IMU_LOG_OK;
+    imu_log_stream_t *s;
+    uint32_t ticks_per_us = imu_clock_ticks_per_us();
+    uint8_t shift = 0;
+
+    if ((uint32_t) sensor >= IMU_LOG_STREAMS || bits == 0 || bits > 16) {
+        return IMU_LOG_ERROR;
+    }
+
+    s = &enc->stream[sensor];
+
+    /* samples already taken belong to the old scale */
+    if (s->len != 0) {
+        result = imu_log_close(enc, s);
+    }
+
+    /* about one microsecond per unit, coarser timestamps give smaller deltas */
+    while ((2u << shift) <= ticks_per_us) {
+        shift++;
+    }
+
+    s->header.bits = bits;
+    s->header.gain = gain;
+    s->header.shift = shift;
+    s->header.scale = scale;
+    s->header.ticks_per_us = ticks_per_us;
+    s->configured = true;
+    s->key = true;
+
+    return result;
+}
+
+imu_log_result_t imu_log_encode(imu_log_encoder_t *enc, const imu_ring_record_t *rec) {
+    uint32_t start = imu_clock_now();
+    imu_log_result_t result = IMU_LOG_OK;
+    imu_log_stream_t *s;
+    uint32_t timestamp;
+
+    if (rec->sensor >= IMU_LOG_STREAMS || !enc->stream[rec->sensor].configured) {
+        return IMU_LOG_ERROR;
+    }
+
+    s = &enc->stream[rec->sensor];
+
+    if (!imu_log_fits(rec->x, s->header.bits) || !imu_log_fits(rec->y, s->header.bits) || !imu_log_fits(rec->z, s->header.bits)) {
+        return IMU_LOG_ERROR;
+    }
+
+    timestamp = rec->timestamp >> s->header.shift;
+
+    /* sequence numbers are implicit, a gap ends the frame */
+    if (s->len != 0 && (rec->sequence != s->sequence || s->count == 255
+                        || s->len - IMU_LOG_POS_PAYLOAD + IMU_LOG_SAMPLE_MAX > IMU_LOG_PAYLOAD_MAX)) {
+        result = imu_log_close(enc, s);
+    }
+
+    if (s->len == 0) {
+        if (imu_log_open(enc, (imu_ring_sensor_t) rec->sensor, rec, timestamp) == IMU_LOG_FULL) {
+            result = IMU_LOG_FULL;
+        }
+    } else {
+        imu_log_append(s, rec, timestamp);
+    }
+
+    s->sequence = rec->sequence + 1;
+    enc->samples++;
+    enc->cycles += imu_clock_now() - start;
+
+    return result;
+}
+
+imu_log_result_t imu_log_flush(imu_log_encoder_t *enc) {
+    imu_log_result_t result = IMU_LOG_OK;
+    uint8_t i;
+
+    for (i = 0; i < IMU_LOG_STREAMS; i++) {
+        if (enc->stream[i].len != 0 && imu_log_close(enc, &enc->stream[i]) != IMU_LOG_OK) {
+            result = IMU_LOG_FULL;
+        }
+    }
+
+    return result;
+}
+
+imu_log_result_t imu_log_write_stats(imu_log_encoder_t *enc) {
+    uint8_t frame[IMU_LOG_OVERHEAD + IMU_LOG_STATS_LEN];
+    uint8_t *p = &frame[IMU_LOG_POS_PAYLOAD];
+
+    imu_log_put_u32(&p[0], enc->samples);
+    imu_log_put_u32(&p[4], (uint32_t) enc->cycles);
+    imu_log_put_u32(&p[8], (uint32_t) (enc->cycles >> 32));
+    imu_log_put_u32(&p[12], enc->bytes);
+    imu_log_put_u32(&p[16], enc->lost);
+    imu_log_put_u32(&p[20], imu_clock_ticks_per_us());
+
+    return imu_log_write(enc, frame, imu_log_seal(frame, IMU_LOG_TYPE_STATS, IMU_LOG_STATS_LEN));
+}
+
+uint32_t imu_log_swap(imu_log_encoder_t *enc, uint8_t *buf, uint32_t size, uint8_t **data) {
+    uint32_t used = enc->used;
+
+    *data = enc->out;
+    enc->out = buf;
+    enc->size = size;
+    enc->used = 0;
+
+    return used;
+}
+
+void imu_log_decoder_init(imu_log_decoder_t *dec) {
+    *dec = (imu_log_decoder_t) { 0 };
+}
+
+void imu_log_decode(imu_log_decoder_t *dec, const uint8_t *data, uint32_t len, imu_log_sample_callback_t callback, void *ctx) {
+    uint32_t i;
+
+    for (i = 0; i < len; i++) {
+        dec->frame[dec->len++] = data[i];
+        imu_log_decode_frame(dec, callback, ctx);
+    }
+}
+
+/* private functions */
+static imu_log_result_t imu_log_write(imu_log_encoder_t *enc, const uint8_t *frame, uint16_t len) {
+    /* whole frames only, a partial one would cost the decoder a resync */
+    if (enc->out == NULL || enc->size - enc->used < len) {
+        enc->lost++;
+        return IMU_LOG_FULL;
+    }
+
+    memcpy(&enc->out[enc->used], frame, len);
+    enc->used += len;
+    enc->bytes += len;
+
+    return IMU_LOG_OK;
+}
+
+static imu_log_result_t imu_log_write_header(imu_log_encoder_t *enc, imu_ring_sensor_t sensor) {
+    const imu_log_header_t *h = &enc->stream[sensor].header;
+    uint8_t frame[IMU_LOG_OVERHEAD + IMU_LOG_HEADER_LEN];
+    uint8_t *p = &frame[IMU_LOG_POS_PAYLOAD];
+    uint32_t bits;
+
+    memcpy(&bits, &h->scale, sizeof(bits));
+
+    p[0] = (uint8_t) sensor;
+    p[1] = h->bits;
+    p[2] = h->gain;
+    p[3] = h->shift;
+    imu_log_put_u32(&p[4], bits);
+    imu_log_put_u32(&p[8], h->ticks_per_us);
+
+    return imu_log_write(enc, frame, imu_log_seal(frame, IMU_LOG_TYPE_HEADER, IMU_LOG_HEADER_LEN));
+}
+
+/* fills in sync word, type, length and CRC around a payload at IMU_LOG_POS_PAYLOAD, returns the frame length */
+static uint16_t imu_log_seal(uint8_t *frame, uint8_t type, uint8_t payload_len) {
+    uint16_t len = IMU_LOG_POS_PAYLOAD + payload_len;
+    uint16_t crc;
+
+    frame[0] = IMU_LOG_SYNC0;
+    frame[1] = IMU_LOG_SYNC1;
+    frame[IMU_LOG_POS_TYPE] = type;
+    frame[IMU_LOG_POS_LEN] = payload_len;
+
+    crc = imu_log_crc(&frame[IMU_LOG_POS_TYPE], len - IMU_LOG_POS_TYPE);
+    frame[len] = (uint8_t) crc;
+    frame[len + 1] = (uint8_t) (crc >> 8);
+
+    return len + 2;
+}
+
+static imu_log_result_t imu_log_open(imu_log_encoder_t *enc, imu_ring_sensor_t sensor, const imu_ring_record_t *rec, uint32_t timestamp) {
+    imu_log_stream_t *s = &enc->stream[sensor];
+    uint8_t *p = &s->frame[IMU_LOG_POS_PAYLOAD];
+    uint8_t bits = s->header.bits;
+
+    p[0] = (uint8_t) sensor;
+    p[1] = s->key ? IMU_LOG_FLAG_KEY : 0;
+    p[2] = s->counter;
+    imu_log_put_u32(&p[4], rec->sequence);
+    p += 8;
+
+    if (!s->key) {
+        s->len = p - s->frame;
+        s->count = 0;
+        imu_log_append(s, rec, timestamp);
+
+        return IMU_LOG_OK;
+    }
+
+    /* a decoder joining here needs the scale first, without it the sample is lost and the next one is the keyframe */
+    if (imu_log_write_header(enc, sensor) != IMU_LOG_OK) {
+        s->period = timestamp - s->timestamp;
+        s->timestamp = timestamp;
+
+        return IMU_LOG_FULL;
+    }
+
+    s->period = timestamp - s->timestamp;
+    s->timestamp = timestamp;
+    s->x = rec->x;
+    s->y = rec->y;
+    s->z = rec->z;
+
+    imu_log_put_u32(p, timestamp);
+    p = imu_log_put_varint(p + 4, s->period);
+    imu_log_pack(p, rec->x, rec->y, rec->z, bits);
+    p += imu_log_pack_len(bits);
+
+    s->len = p - s->frame;
+    s->count = 1;
+    s->key = false;
+    s->since_key = 0;
+
+    return IMU_LOG_OK;
+}
+
+static void imu_log_append(imu_log_stream_t *s, const imu_ring_record_t *rec, uint32_t timestamp) {
+    uint8_t *p = &s->frame[s->len];
+    uint32_t period = timestamp - s->timestamp;
+
+    /* a steady rate leaves only the jitter of the period */
+    p = imu_log_put_varint(p, IMU_LOG_ZIGZAG((int32_t) (period - s->period)));
+    p = imu_log_put_varint(p, IMU_LOG_ZIGZAG((int32_t) rec->x - s->x));
+    p = imu_log_put_varint(p, IMU_LOG_ZIGZAG((int32_t) rec->y - s->y));
+    p = imu_log_put_varint(p, IMU_LOG_ZIGZAG((int32_t) rec->z - s->z));
+
+    s->period = period;
+    s->timestamp = timestamp;
+    s->x = rec->x;
+    s->y = rec->y;
+    s->z = rec->z;
+    s->len = p - s->frame;
+    s->count++;
+}
+
+static imu_log_result_t imu_log_close(imu_log_encoder_t *enc, imu_log_stream_t *s) {
+    imu_log_result_t result;
+
+    s->frame[IMU_LOG_POS_COUNT] = s->count;
+    result = imu_log_write(enc, s->frame, imu_log_seal(s->frame, IMU_LOG_TYPE_DATA, s->len - IMU_LOG_POS_PAYLOAD));
+
+    /* the decoder notices the missing counter and waits for the keyframe */
+    s->counter++;
+    s->len = 0;
+
+    if (result != IMU_LOG_OK || ++s->since_key >= IMU_LOG_KEY_INTERVAL) {
+        s->key = true;
+    }
+
+    return result;
+}
+
+static bool imu_log_fits(int16_t v, uint8_t bits) {
+    int16_t top = v >> (bits - 1);
+
+    return top == 0 || top == -1;
+}
+
+static uint8_t imu_log_pack_len(uint8_t bits) {
+    return (3 * bits + 7) / 8;
+}
+
+/* three bits wide fields, least significant bit first */
+static void imu_log_pack(uint8_t *buf, int16_t x, int16_t y, int16_t z, uint8_t bits) {
+    uint64_t mask = ((uint64_t) 1 << bits) - 1;
+    uint64_t v = ((uint16_t) x & mask) | (((uint16_t) y & mask) << bits) | (((uint16_t) z & mask) << (2 * bits));
+    uint8_t i;
+
+    for (i = 0; i < imu_log_pack_len(bits); i++) {
+        buf[i] = (uint8_t) (v >> (8 * i));
+    }
+}
+
+static void imu_log_unpack(const uint8_t *buf, int16_t *x, int16_t *y, int16_t *z, uint8_t bits) {
+    uint64_t v = 0;
+    uint8_t i;
+
+    for (i = 0; i < imu_log_pack_len(bits); i++) {
+        v |= (uint64_t) buf[i] << (8 * i);
+    }
+
+    /* sign-extend from the top of each field */
+    *x = (int16_t) ((int32_t) ((uint32_t) v << (32 - bits)) >> (32 - bits));
+    *y = (int16_t) ((int32_t) ((uint32_t) (v >> bits) << (32 - bits)) >> (32 - bits));
+    *z = (int16_t) ((int32_t) ((uint32_t) (v >> (2 * bits)) << (32 - bits)) >> (32 - bits));
+}
+
+static uint8_t *imu_log_put_varint(uint8_t *buf, uint32_t value) {
+    while (value >= 0x80) {
+        *buf++ = (uint8_t) value | 0x80;
+        value >>= 7;
+    }
+
+    *buf++ = (uint8_t) value;
+
+    return buf;
+}
+
+/* NULL if the varint runs past end or is longer than 32 bits */
+static const uint8_t *imu_log_get_varint(const uint8_t *buf, const uint8_t *end, uint32_t *value) {
+    uint8_t shift;
+
+    *value = 0;
+
+    for (shift = 0; shift < 35 && buf < end; shift += 7) {
+        *value |= (uint32_t) (*buf & 0x7F) << shift;
+
+        if ((*buf++ & 0x80) == 0) {
+            return buf;
+        }
+    }
+
+    return NULL;
+}
+
+static void imu_log_put_u32(uint8_t *buf, uint32_t value) {
+    buf[0] = (uint8_t) value;
+    buf[1] = (uint8_t) (value >> 8);
+    buf[2] = (uint8_t) (value >> 16);
+    buf[3] = (uint8_t) (value >> 24);
+}
+
+static uint32_t imu_log_get_u32(const uint8_t *buf) {
+    return buf[0] | (buf[1] << 8) | ((uint32_t) buf[2] << 16) | ((uint32_t) buf[3] << 24);
+}
+
+static uint16_t imu_log_crc(const uint8_t *buf, uint16_t len) {
+    uint16_t crc = 0xFFFF;
+    uint16_t i;
+
+    for (i = 0; i < len; i++) {
+        crc = (uint16_t) (crc << 4) ^ imu_log_crc_table[(crc >> 12) ^ (buf[i] >> 4)];
+        crc = (uint16_t) (crc << 4) ^ imu_log_crc_table[(crc >> 12) ^ (buf[i] & 0x0F)];
+    }
+
+    return crc;
+}
+
+/* handles every complete frame at the start of the reassembly buffer */
+static void imu_log_decode_frame(imu_log_decoder_t *dec, imu_log_sample_callback_t callback, void *ctx) {
+    const uint8_t *f = dec->frame;
+    const uint8_t *p = &f[IMU_LOG_POS_PAYLOAD];
+    uint16_t payload_len, len;
+    uint32_t bits;
+    uint8_t sensor, i;
+
+    while (dec->len > 0) {
+        if (f[0] != IMU_LOG_SYNC0 || (dec->len > 1 && f[1] != IMU_LOG_SYNC1)) {
+            dec->skipped++;
+            imu_log_drop(dec, 1);
+            continue;
+        }
+
+        if (dec->len <= IMU_LOG_POS_LEN) {
+            return;
+        }
+
+        payload_len = f[IMU_LOG_POS_LEN];
+        len = IMU_LOG_OVERHEAD + payload_len;
+
+        if (dec->len < len) {
+            return;
+        }
+
+        /* a corrupt frame may have been anybody's delta, every stream waits for its keyframe */
+        if (imu_log_crc(&f[IMU_LOG_POS_TYPE], len - 4) != (f[len - 2] | (f[len - 1] << 8))) {
+            dec->crc_errors++;
+            dec->skipped++;
+
+            for (i = 0; i < IMU_LOG_STREAMS; i++) {
+                dec->synced[i] = false;
+            }
+
+            imu_log_drop(dec, 1);
+            continue;
+        }
+
+        dec->frames++;
+
+        if (f[IMU_LOG_POS_TYPE] == IMU_LOG_TYPE_HEADER && payload_len >= IMU_LOG_HEADER_LEN && p[0] < IMU_LOG_STREAMS) {
+            sensor = p[0];
+            bits = imu_log_get_u32(&p[4]);
+
+            dec->header[sensor].bits = p[1];
+            dec->header[sensor].gain = p[2];
+            dec->header[sensor].shift = p[3];
+            memcpy(&dec->header[sensor].scale, &bits, sizeof(bits));
+            dec->header[sensor].ticks_per_us = imu_log_get_u32(&p[8]);
+            dec->configured[sensor] = dec->header[sensor].bits != 0 && dec->header[sensor].bits <= 16;
+        } else if (f[IMU_LOG_POS_TYPE] == IMU_LOG_TYPE_DATA) {
+            imu_log_decode_data(dec, p, p + payload_len, callback, ctx);
+        } else if (f[IMU_LOG_POS_TYPE] == IMU_LOG_TYPE_STATS && payload_len >= IMU_LOG_STATS_LEN) {
+            dec->stats.samples = imu_log_get_u32(&p[0]);
+            dec->stats.cycles = imu_log_get_u32(&p[4]) | ((uint64_t) imu_log_get_u32(&p[8]) << 32);
+            dec->stats.bytes = imu_log_get_u32(&p[12]);
+            dec->stats.lost = imu_log_get_u32(&p[16]);
+            dec->stats.ticks_per_us = imu_log_get_u32(&p[20]);
+            dec->stats_valid = true;
+        }
+
+        imu_log_drop(dec, len);
+    }
+}
+
+static void imu_log_decode_data(imu_log_decoder_t *dec, const uint8_t *p, const uint8_t *end, imu_log_sample_callback_t callback, void *ctx) {
+    imu_log_sample_t sample;
+    const imu_log_header_t *h;
+    uint32_t sequence, dt, dx, dy, dz;
+    uint8_t sensor, flags, counter, count, i;
+
+    if (end - p < 8 || p[0] >= IMU_LOG_STREAMS || !dec->configured[p[0]]) {
+        dec->unsynced++;
+        return;
+    }
+
+    sensor = p[0];
+    flags = p[1];
+    counter = p[2];
+    count = p[3];
+    h = &dec->header[sensor];
+
+    sample.sensor = (imu_ring_sensor_t) sensor;
+    sample.header = h;
+    sequence = imu_log_get_u32(&p[4]);
+    p += 8;
+
+    /* deltas continue from the previous frame of the stream, which must not be missing */
+    if ((flags & IMU_LOG_FLAG_KEY) == 0 && (!dec->synced[sensor] || counter != (uint8_t) (dec->counter[sensor] + 1))) {
+        dec->synced[sensor] = false;
+        dec->unsynced++;
+        return;
+    }
+
+    dec->counter[sensor] = counter;
+    i = 0;
+
+    if (flags & IMU_LOG_FLAG_KEY) {
+        if (end - p < 4) {
+            dec->synced[sensor] = false;
+            return;
+        }
+
+        dec->timestamp[sensor] = imu_log_get_u32(p);
+        p = imu_log_get_varint(p + 4, end, &dec->period[sensor]);
+
+        if (p == NULL || end - p < imu_log_pack_len(h->bits) || count == 0) {
+            dec->synced[sensor] = false;
+            return;
+        }
+
+        imu_log_unpack(p, &dec->x[sensor], &dec->y[sensor], &dec->z[sensor], h->bits);
+        p += imu_log_pack_len(h->bits);
+        dec->synced[sensor] = true;
+        i = 1;
+
+        sample.sequence = sequence;
+        sample.timestamp = dec->timestamp[sensor] << h->shift;
+        sample.x = dec->x[sensor];
+        sample.y = dec->y[sensor];
+        sample.z = dec->z[sensor];
+        callback(ctx, &sample);
+    }
+
+    for (; i < count; i++) {
+        p = imu_log_get_varint(p, end, &dt);
+        p = (p != NULL) ? imu_log_get_varint(p, end, &dx) : NULL;
+        p = (p != NULL) ? imu_log_get_varint(p, end, &dy) : NULL;
+        p = (p != NULL) ? imu_log_get_varint(p, end, &dz) : NULL;
+
+        if (p == NULL) {
+            dec->synced[sensor] = false;
+            return;
+        }
+
+        dec->period[sensor] += (uint32_t) IMU_LOG_UNZIGZAG(dt);
+        dec->timestamp[sensor] += dec->period[sensor];
+        dec->x[sensor] = (int16_t) (dec->x[sensor] + IMU_LOG_UNZIGZAG(dx));
+        dec->y[sensor] = (int16_t) (dec->y[sensor] + IMU_LOG_UNZIGZAG(dy));
+        dec->z[sensor] = (int16_t) (dec->z[sensor] + IMU_LOG_UNZIGZAG(dz));
+
+        sample.sequence = sequence + i;
+        sample.timestamp = dec->timestamp[sensor] << h->shift;
+        sample.x = dec->x[sensor];
+        sample.y = dec->y[sensor];
+        sample.z = dec->z[sensor];
+        callback(ctx, &sample);
+    }
+}
+
+static void imu_log_drop(imu_log_decoder_t *dec, uint16_t count) {
+    dec->len -= count;
+    memmove(dec->frame, &dec->frame[count], dec->len);
+}
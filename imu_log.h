@@ -0,0 +1,159 @@
+#ifndef __IMU_LOG_H__
+#define __IMU_LOG_H__
+
+/* C++ detection */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "imu_ring.h"
+
+/*
+ * compact binary sample log
+ * A byte stream of frames: sync word, type, payload length, payload and CRC-16. Header frames
+ * carry the significant bits, gain register and scale of a stream. Data frames carry up to 255
+ * consecutive samples of one stream: a keyframe starts with an absolute timestamp and a bit-packed
+ * sample, every other sample is a zig-zag varint delta per axis and a second-order timestamp delta.
+ * Keyframes are repeated, so a decoder joining late or losing a frame resynchronizes.
+ * Neither side allocates; this file builds on host too, without the HAL.
+ */
+
+#define IMU_LOG_SYNC0           0xA5
+#define IMU_LOG_SYNC1           0x5A
+#define IMU_LOG_OVERHEAD        6           // sync word, type, length, CRC
+#ifndef IMU_LOG_PAYLOAD_MAX
+#define IMU_LOG_PAYLOAD_MAX     128         // bytes, a data frame is closed before it grows larger
+#endif
+#define IMU_LOG_KEY_INTERVAL    16          // data frames per stream between keyframes
+#define IMU_LOG_STREAMS         3           // by imu_ring_sensor_t
+
+/* frame types */
+#define IMU_LOG_TYPE_HEADER     0x01
+#define IMU_LOG_TYPE_DATA       0x02
+#define IMU_LOG_TYPE_STATS      0x03
+
+/* data frame flags */
+#define IMU_LOG_FLAG_KEY        (1 << 0)
+
+typedef enum {
+    IMU_LOG_OK,
+    IMU_LOG_ERROR,
+    IMU_LOG_FULL      // output buffer full, the frame was lost and the next one is a keyframe
+} imu_log_result_t;
+
+/* per-stream header, sent before every keyframe */
+typedef struct {
+    uint8_t bits;               // significant bits per axis, 12 for the accelerometer after the >> 4
+    uint8_t gain;               // gain or scale register of the sensor, informative
+    uint8_t shift;              // timestamps are stored in units of 2^shift clock ticks
+    float scale;                // physical unit per lsb
+    uint32_t ticks_per_us;      // imu_clock ticks
+} imu_log_header_t;
+
+typedef struct {
+    imu_log_header_t header;
+    bool configured;
+
+    /* delta state, also mirrored by the decoder */
+    int16_t x;
+    int16_t y;
+    int16_t z;
+    uint32_t timestamp;         // in units
+    uint32_t period;            // last timestamp delta
+    uint32_t sequence;          // expected next record sequence
+
+    /* open frame */
+    uint8_t frame[IMU_LOG_OVERHEAD + IMU_LOG_PAYLOAD_MAX];
+    uint16_t len;               // bytes of frame used, 0 if none is open
+    uint8_t count;
+    uint8_t counter;            // data frames sent, lets the decoder notice a lost one
+    uint8_t since_key;
+    bool key;                   // next frame is a keyframe
+} imu_log_stream_t;
+
+typedef struct {
+    imu_log_stream_t stream[IMU_LOG_STREAMS];
+    uint8_t *out;               // caller buffer, see imu_log_swap
+    uint32_t size;
+    uint32_t used;
+
+    /* totals, sent by imu_log_write_stats */
+    uint32_t samples;
+    uint64_t cycles;            // imu_clock ticks spent in imu_log_encode
+    uint32_t bytes;
+    uint32_t lost;              // frames that did not fit the output buffer
+} imu_log_encoder_t;
+
+void imu_log_encoder_init(imu_log_encoder_t *enc, uint8_t *buf, uint32_t size);
+
+/* configures a stream, again whenever the gain or scale changes. The header goes out with the next keyframe */
+imu_log_result_t imu_log_set_stream(imu_log_encoder_t *enc, imu_ring_sensor_t sensor, uint8_t bits, uint8_t gain, float scale);
+
+/* appends a ring record of a configured stream, a gap in the sequence starts a new frame */
+imu_log_result_t imu_log_encode(imu_log_encoder_t *enc, const imu_ring_record_t *rec);
+imu_log_result_t imu_log_flush(imu_log_encoder_t *enc);          // closes the open frames
+imu_log_result_t imu_log_write_stats(imu_log_encoder_t *enc);    // totals for the decoder, e.g. once a second
+
+/*
+ * hands the filled output to the caller and continues in buf, e.g. ping-pong buffers of a UART
+ * DMA transfer. Returns the number of bytes at *data.
+ */
+uint32_t imu_log_swap(imu_log_encoder_t *enc, uint8_t *buf, uint32_t size, uint8_t **data);
+
+/* decoded sample, timestamp in imu_clock ticks at the resolution of the stream */
+typedef struct {
+    imu_ring_sensor_t sensor;
+    uint32_t sequence;
+    uint32_t timestamp;
+    int16_t x;
+    int16_t y;
+    int16_t z;
+    const imu_log_header_t *header;
+} imu_log_sample_t;
+
+typedef struct {
+    uint32_t samples;
+    uint64_t cycles;
+    uint32_t bytes;
+    uint32_t lost;
+    uint32_t ticks_per_us;
+} imu_log_stats_t;
+
+typedef void (*imu_log_sample_callback_t)(void *ctx, const imu_log_sample_t *sample);
+
+typedef struct {
+    imu_log_header_t header[IMU_LOG_STREAMS];
+    bool configured[IMU_LOG_STREAMS];
+    bool synced[IMU_LOG_STREAMS];   // delta state valid, false until the next keyframe
+    int16_t x[IMU_LOG_STREAMS];
+    int16_t y[IMU_LOG_STREAMS];
+    int16_t z[IMU_LOG_STREAMS];
+    uint32_t timestamp[IMU_LOG_STREAMS];
+    uint32_t period[IMU_LOG_STREAMS];
+    uint8_t counter[IMU_LOG_STREAMS];
+
+    /* frame reassembly */
+    uint8_t frame[IMU_LOG_OVERHEAD + 255];
+    uint16_t len;
+
+    /* totals */
+    uint32_t frames;
+    uint32_t crc_errors;
+    uint32_t skipped;           // bytes discarded while hunting for the sync word
+    uint32_t unsynced;          // data frames dropped waiting for a keyframe
+    imu_log_stats_t stats;      // last stats frame of the encoder
+    bool stats_valid;
+} imu_log_decoder_t;
+
+void imu_log_decoder_init(imu_log_decoder_t *dec);
+void imu_log_decode(imu_log_decoder_t *dec, const uint8_t *data, uint32_t len, imu_log_sample_callback_t callback, void *ctx);
+
+/* C++ detection */
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,340 @@
+#include "imu_power.h"
+#include "imu_clock.h"
+
+/* private variables */
+static const uint16_t imu_power_gyro_odr_hz[4] = { 95, 190, 380, 760 };    // by the DR bits of CTRL_REG1
+
+/* private functions */
+static imu_power_result_t imu_power_enter_idle(imu_power_t *pm);
+static imu_power_result_t imu_power_enter_active(imu_power_t *pm);
+static void imu_power_save(imu_power_t *pm);
+static imu_power_result_t imu_power_reduce(imu_power_t *pm);
+static imu_power_result_t imu_power_arm(imu_power_t *pm, uint8_t cfg, uint16_t threshold_mg, uint16_t duration_ms);
+static uint32_t imu_power_settle_us(const imu_power_t *pm);
+static uint32_t imu_power_state_ua(const imu_power_t *pm, imu_power_state_t state);
+static void imu_power_account(imu_power_t *pm, imu_power_state_t next);
+static void imu_power_record(uint32_t us, uint32_t *last, uint32_t *max);
+
+imu_power_result_t imu_power_init(imu_power_t *pm, l3gd20_t *gyro, lsm303dlhc_t *lsm, const imu_power_config_t *config) {
+    if (lsm == NULL || config == NULL) {
+        return IMU_POWER_ERROR;
+    }
+
+    *pm = (imu_power_t) { 0 };
+    pm->gyro = gyro;
+    pm->lsm = lsm;
+    pm->config = *config;
+    pm->state = IMU_POWER_ACTIVE;
+    pm->since_ms = HAL_GetTick();
+    pm->settled = true;
+    imu_power_save(pm);
+
+    /* high-pass filter in normal mode on generator 1 only, the output registers stay unfiltered */
+    if (lsm303dlhc_dev_update_ctrl(lsm, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_CTRL_REG2_A, LSM303DLHC_ACR2A_HPM | LSM303DLHC_ACR2A_HPIS1,
+                                   LSM303DLHC_ACR2A_HPIS1) != LSM303DLHC_OK) {
+        return IMU_POWER_ERROR;
+    }
+
+    if (lsm303dlhc_dev_update_ctrl(lsm, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_CTRL_REG5_A, LSM303DLHC_ACR5A_LIR_INT1, LSM303DLHC_ACR5A_LIR_INT1) != LSM303DLHC_OK) {
+        return IMU_POWER_ERROR;
+    }
+
+    if (lsm303dlhc_dev_update_ctrl(lsm, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_CTRL_REG6_A, LSM303DLHC_ACR6A_I2_INT1, LSM303DLHC_ACR6A_I2_INT1) != LSM303DLHC_OK) {
+        return IMU_POWER_ERROR;
+    }
+
+    return imu_power_arm(pm, LSM303DLHC_AINT_AOI | LSM303DLHC_AINT_XLIE | LSM303DLHC_AINT_YLIE | LSM303DLHC_AINT_ZLIE, config->idle_mg, config->idle_ms);
+}
+
+void imu_power_on_int(imu_power_t *pm) {
+    if (!pm->pending) {
+        pm->int_tick = imu_clock_now();
+    }
+
+    pm->pending = true;
+}
+
+imu_power_result_t imu_power_poll(imu_power_t *pm) {
+    uint8_t src;
+
+    if (!pm->pending) {
+        return IMU_POWER_OK;
+    }
+
+    pm->pending = false;
+
+    /* reading the source releases the latched pin */
+    if (lsm303dlhc_dev_read_acc_int1_src(pm->lsm, &src) != LSM303DLHC_OK) {
+        pm->pending = true;
+        return IMU_POWER_ERROR;
+    }
+
+    if (!(src & LSM303DLHC_AINT_SRC_IA)) {
+        return IMU_POWER_OK;
+    }
+
+    if (pm->state == IMU_POWER_ACTIVE) {
+        return imu_power_enter_idle(pm);
+    }
+
+    if (imu_power_enter_active(pm) != IMU_POWER_OK) {
+        return IMU_POWER_ERROR;
+    }
+
+    imu_power_record(imu_clock_us(pm->wake_tick - pm->int_tick), &pm->stats.latency_us, &pm->stats.max_latency_us);
+
+    return IMU_POWER_OK;
+}
+
+imu_power_result_t imu_power_sleep(imu_power_t *pm) {
+    return (pm->state == IMU_POWER_IDLE) ? IMU_POWER_OK : imu_power_enter_idle(pm);
+}
+
+imu_power_result_t imu_power_wake(imu_power_t *pm) {
+    return (pm->state == IMU_POWER_ACTIVE) ? IMU_POWER_OK : imu_power_enter_active(pm);
+}
+
+imu_power_state_t imu_power_get_state(const imu_power_t *pm) {
+    return pm->state;
+}
+
+uint32_t imu_power_current_ua(const imu_power_t *pm) {
+    return imu_power_state_ua(pm, pm->state);
+}
+
+uint32_t imu_power_wake_bound_us(const imu_power_t *pm) {
+    uint32_t recovery_us = (pm->lsm->scl_port != NULL) ? LSM303DLHC_RECOVERY_US : 0;
+    uint32_t bound_us;
+
+    bound_us = imu_bus_worst_case_us(&pm->lsm->bus, IMU_POWER_WAKE_LSM_TRANSACTIONS, recovery_us);
+    if (pm->gyro != NULL) {
+        bound_us += imu_bus_worst_case_us(&pm->gyro->bus, IMU_POWER_WAKE_GYRO_TRANSACTIONS, 0);
+    }
+
+    /* settling starts with the first write, the bus bound already covers the ones after it */
+    return bound_us + imu_power_settle_us(pm);
+}
+
+bool imu_power_ready(imu_power_t *pm) {
+    /* latched, so that the cycle counter may wrap later */
+    if (!pm->settled && pm->state == IMU_POWER_ACTIVE && imu_clock_us(imu_clock_now() - pm->wake_tick) >= pm->settle_us) {
+        pm->settled = true;
+    }
+
+    return pm->settled && pm->state == IMU_POWER_ACTIVE;
+}
+
+void imu_power_get_stats(const imu_power_t *pm, imu_power_stats_t *stats) {
+    uint32_t elapsed = HAL_GetTick() - pm->since_ms;
+    uint64_t total;
+
+    *stats = pm->stats;
+
+    /* include the current stretch */
+    if (pm->state == IMU_POWER_ACTIVE) {
+        stats->active_ms += elapsed;
+    } else {
+        stats->idle_ms += elapsed;
+    }
+
+    total = (uint64_t) stats->active_ms + stats->idle_ms;
+    if (total == 0) {
+        stats->average_ua = imu_power_current_ua(pm);
+    } else {
+        stats->average_ua = (uint32_t) (((uint64_t) stats->active_ms * imu_power_state_ua(pm, IMU_POWER_ACTIVE)
+                                         + (uint64_t) stats->idle_ms * imu_power_state_ua(pm, IMU_POWER_IDLE) + total / 2) / total);
+    }
+}
+
+/* private functions */
+static imu_power_result_t imu_power_enter_idle(imu_power_t *pm) {
+    uint32_t start = imu_clock_now();
+
+    imu_power_save(pm);
+
+    if (imu_power_reduce(pm) != IMU_POWER_OK) {
+        /* back to the saved registers, a write that fails again stays pending in the shadows */
+        imu_power_enter_active(pm);
+        return IMU_POWER_ERROR;
+    }
+
+    imu_power_account(pm, IMU_POWER_IDLE);
+    pm->stats.idle_count++;
+    imu_power_record(imu_clock_us(imu_clock_now() - start), &pm->stats.enter_us, &pm->stats.max_enter_us);
+
+    return IMU_POWER_OK;
+}
+
+static imu_power_result_t imu_power_enter_active(imu_power_t *pm) {
+    lsm303dlhc_t *lsm = pm->lsm;
+    uint32_t start = imu_clock_now();
+
+    /* longest turn-on first */
+    if (pm->gyro != NULL && l3gd20_dev_update_ctrl(pm->gyro, L3GD20_REG_CTRL_REG1, 0xFF, pm->gyro_ctrl1) != L3GD20_OK) {
+        return IMU_POWER_ERROR;
+    }
+
+    if (lsm303dlhc_dev_update_ctrl(lsm, LSM303DLHC_ADDR_MAG, LSM303DLHC_REG_MAG_MR_REG_M, 0xFF, pm->mag_mr) != LSM303DLHC_OK) {
+        return IMU_POWER_ERROR;
+    }
+
+    if (lsm303dlhc_dev_set_acc_scale(lsm, pm->acc_ctrl4) != LSM303DLHC_OK) {
+        return IMU_POWER_ERROR;
+    }
+
+    if (lsm303dlhc_dev_update_ctrl(lsm, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_CTRL_REG1_A, 0xFF, pm->acc_ctrl1) != LSM303DLHC_OK) {
+        return IMU_POWER_ERROR;
+    }
+
+    /* the duration is counted at the restored rate */
+    if (imu_power_arm(pm, LSM303DLHC_AINT_AOI | LSM303DLHC_AINT_XLIE | LSM303DLHC_AINT_YLIE | LSM303DLHC_AINT_ZLIE, pm->config.idle_mg,
+                      pm->config.idle_ms) != IMU_POWER_OK) {
+        return IMU_POWER_ERROR;
+    }
+
+    pm->wake_tick = imu_clock_now();
+    pm->settle_us = imu_power_settle_us(pm);
+    pm->settled = false;
+
+    if (pm->state == IMU_POWER_IDLE) {
+        imu_power_account(pm, IMU_POWER_ACTIVE);
+        imu_power_record(imu_clock_us(pm->wake_tick - start), &pm->stats.exit_us, &pm->stats.max_exit_us);
+    }
+
+    return IMU_POWER_OK;
+}
+
+/* registers restored by imu_power_enter_active */
+static void imu_power_save(imu_power_t *pm) {
+    pm->acc_ctrl1 = lsm303dlhc_dev_get_ctrl(pm->lsm, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_CTRL_REG1_A);
+    pm->acc_ctrl4 = lsm303dlhc_dev_get_ctrl(pm->lsm, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_CTRL_REG4_A);
+    pm->mag_mr = lsm303dlhc_dev_get_ctrl(pm->lsm, LSM303DLHC_ADDR_MAG, LSM303DLHC_REG_MAG_MR_REG_M);
+    if (pm->gyro != NULL) {
+        pm->gyro_ctrl1 = l3gd20_dev_get_ctrl(pm->gyro, L3GD20_REG_CTRL_REG1);
+    }
+}
+
+/* idle configuration, in the order of imu_power_enter_active */
+static imu_power_result_t imu_power_reduce(imu_power_t *pm) {
+    /* sleep keeps the drive running with the axes off, power-down stops it */
+    if (pm->gyro != NULL) {
+        if (pm->config.gyro_sleep) {
+            if (l3gd20_dev_update_ctrl(pm->gyro, L3GD20_REG_CTRL_REG1, L3GD20_CR1_PD | L3GD20_CR1_XEN | L3GD20_CR1_YEN | L3GD20_CR1_ZEN,
+                                       L3GD20_CR1_PD) != L3GD20_OK) {
+                return IMU_POWER_ERROR;
+            }
+        } else if (l3gd20_dev_update_ctrl(pm->gyro, L3GD20_REG_CTRL_REG1, L3GD20_CR1_PD, 0) != L3GD20_OK) {
+            return IMU_POWER_ERROR;
+        }
+    }
+
+    if (lsm303dlhc_dev_update_ctrl(pm->lsm, LSM303DLHC_ADDR_MAG, LSM303DLHC_REG_MAG_MR_REG_M, 0x03, LSM303DLHC_MAGOP_SLEEP2) != LSM303DLHC_OK) {
+        return IMU_POWER_ERROR;
+    }
+
+    /* low-power mode excludes high resolution */
+    if ((pm->acc_ctrl4 & LSM303DLHC_ACR4A_HR) && lsm303dlhc_dev_set_acc_scale(pm->lsm, pm->acc_ctrl4 & ~LSM303DLHC_ACR4A_HR) != LSM303DLHC_OK) {
+        return IMU_POWER_ERROR;
+    }
+
+    if (lsm303dlhc_dev_update_ctrl(pm->lsm, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_CTRL_REG1_A, LSM303DLHC_ACR1A_ODR30 | LSM303DLHC_ACR1A_LPEN,
+                                   LSM303DLHC_ACR1A_ODR30_10_HZ | LSM303DLHC_ACR1A_LPEN) != LSM303DLHC_OK) {
+        return IMU_POWER_ERROR;
+    }
+
+    return imu_power_arm(pm, LSM303DLHC_AINT_XHIE | LSM303DLHC_AINT_YHIE | LSM303DLHC_AINT_ZHIE, pm->config.wake_mg, 0);
+}
+
+/* configures generator 1, then restarts the filter at the new rate and drops an event latched before */
+static imu_power_result_t imu_power_arm(imu_power_t *pm, uint8_t cfg, uint16_t threshold_mg, uint16_t duration_ms) {
+    uint8_t src;
+
+    if (lsm303dlhc_dev_set_acc_int1(pm->lsm, cfg, threshold_mg, duration_ms) != LSM303DLHC_OK) {
+        return IMU_POWER_ERROR;
+    }
+
+    if (lsm303dlhc_dev_reset_acc_hp(pm->lsm) != LSM303DLHC_OK) {
+        return IMU_POWER_ERROR;
+    }
+
+    /* cleared first, an edge after the read below is a new event */
+    pm->pending = false;
+
+    if (lsm303dlhc_dev_read_acc_int1_src(pm->lsm, &src) != LSM303DLHC_OK) {
+        return IMU_POWER_ERROR;
+    }
+
+    return IMU_POWER_OK;
+}
+
+/* time until every sensor delivers settled samples at the saved rates, nothing to wait for from one configured off */
+static uint32_t imu_power_settle_us(const imu_power_t *pm) {
+    uint32_t settle_us = 0, us, odr_mhz;
+    uint8_t cra_reg_m;
+
+    if (pm->gyro != NULL && (pm->gyro_ctrl1 & L3GD20_CR1_PD)) {
+        if (pm->config.gyro_sleep) {
+            settle_us = IMU_POWER_GYRO_SLEEP_SAMPLES * 1000000u / imu_power_gyro_odr_hz[pm->gyro_ctrl1 >> 6];
+        } else {
+            settle_us = IMU_POWER_GYRO_TURN_ON_US;
+        }
+    }
+
+    /* first conversion */
+    if (pm->mag_mr == LSM303DLHC_MAGOP_CONT) {
+        cra_reg_m = lsm303dlhc_dev_get_ctrl(pm->lsm, LSM303DLHC_ADDR_MAG, LSM303DLHC_REG_MAG_CRA_REG_M);
+        us = (uint32_t) (1000000000ull / lsm303dlhc_mag_odr_mhz(cra_reg_m));
+        settle_us = (us > settle_us) ? us : settle_us;
+    }
+
+    odr_mhz = lsm303dlhc_acc_odr_mhz(pm->acc_ctrl1);
+    if (odr_mhz != 0) {
+        if (pm->acc_ctrl1 & LSM303DLHC_ACR1A_LPEN) {
+            us = IMU_POWER_ACC_LP_TURN_ON_US;
+        } else {
+            us = (uint32_t) (IMU_POWER_ACC_TURN_ON_SAMPLES * 1000000000ull / odr_mhz);
+        }
+
+        settle_us = (us > settle_us) ? us : settle_us;
+    }
+
+    return settle_us;
+}
+
+static uint32_t imu_power_state_ua(const imu_power_t *pm, imu_power_state_t state) {
+    uint32_t ua;
+
+    if (state == IMU_POWER_ACTIVE) {
+        ua = IMU_POWER_LSM_ACTIVE_UA;
+        if (pm->gyro != NULL) {
+            ua += IMU_POWER_GYRO_NORMAL_UA;
+        }
+    } else {
+        ua = IMU_POWER_LSM_IDLE_UA;
+        if (pm->gyro != NULL) {
+            ua += pm->config.gyro_sleep ? IMU_POWER_GYRO_SLEEP_UA : IMU_POWER_GYRO_DOWN_UA;
+        }
+    }
+
+    return ua;
+}
+
+static void imu_power_account(imu_power_t *pm, imu_power_state_t next) {
+    uint32_t now = HAL_GetTick();
+
+    if (pm->state == IMU_POWER_ACTIVE) {
+        pm->stats.active_ms += now - pm->since_ms;
+    } else {
+        pm->stats.idle_ms += now - pm->since_ms;
+    }
+
+    pm->since_ms = now;
+    pm->state = next;
+}
+
+static void imu_power_record(uint32_t us, uint32_t *last, uint32_t *max) {
+    *last = us;
+    if (us > *max) {
+        *max = us;
+    }
+}
@@ -0,0 +1,124 @@
+#ifndef __IMU_POWER_H__
+#define __IMU_POWER_H__
+
+/* C++ detection */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "stm32f3xx_l3gd20.h"
+#include "stm32f3xx_lsm303dlhc.h"
+
+/*
+ * activity-aware power manager
+ * The accelerometer interrupt generator 1 watches for motion on the high-pass filtered signal.
+ * While active it reports inactivity, all axes below idle_mg for idle_ms; the manager then powers
+ * down the gyroscope (or puts it to sleep), puts the magnetometer to sleep and drops the
+ * accelerometer to low-power 10 Hz. While idle it reports activity, any axis above wake_mg, and
+ * the manager restores the saved control registers. The interrupt is latched and routed to the
+ * INT2 pin, INT1 stays free for data-ready. The EXTI callback only sets a flag, the bus work is
+ * done by imu_power_poll from the main loop.
+ * Samples read before imu_power_ready are not settled yet. Currents are nominal datasheet values,
+ * those marked as estimates are not specified there and can be overridden with measured ones.
+ */
+
+/* typical supply currents in uA */
+#define IMU_POWER_GYRO_NORMAL_UA    6100        // L3GD20 normal mode
+#define IMU_POWER_GYRO_SLEEP_UA     2000        // L3GD20 sleep mode
+#define IMU_POWER_GYRO_DOWN_UA      5           // L3GD20 power-down
+#ifndef IMU_POWER_LSM_ACTIVE_UA
+#define IMU_POWER_LSM_ACTIVE_UA     110         // LSM303DLHC, accelerometer 50 Hz and magnetometer 7.5 Hz
+#endif
+#ifndef IMU_POWER_LSM_IDLE_UA
+#define IMU_POWER_LSM_IDLE_UA       10          // estimate, accelerometer low-power 10 Hz and magnetometer asleep
+#endif
+
+/* settling after a wake-up */
+#ifndef IMU_POWER_GYRO_TURN_ON_US
+#define IMU_POWER_GYRO_TURN_ON_US   250000      // estimate, gyroscope out of power-down
+#endif
+#ifndef IMU_POWER_GYRO_SLEEP_SAMPLES
+#define IMU_POWER_GYRO_SLEEP_SAMPLES    5       // estimate, gyroscope out of sleep, periods of its output data rate
+#endif
+#define IMU_POWER_ACC_TURN_ON_SAMPLES   7       // accelerometer in normal mode, 1 ms in low-power mode
+#define IMU_POWER_ACC_LP_TURN_ON_US     1000
+
+/* blocking transactions of a wake-up, for imu_bus_worst_case_us */
+#define IMU_POWER_WAKE_GYRO_TRANSACTIONS    1   // CTRL_REG1
+#define IMU_POWER_WAKE_LSM_TRANSACTIONS     8   // INT1_SRC_A, MR_REG_M, CTRL_REG4_A, CTRL_REG1_A, INT1_THS_A, INT1_CFG_A, REFERENCE_A, INT1_SRC_A
+
+typedef enum {
+    IMU_POWER_OK,
+    IMU_POWER_ERROR
+} imu_power_result_t;
+
+typedef enum {
+    IMU_POWER_ACTIVE,   // configured rates
+    IMU_POWER_IDLE      // gyroscope down, magnetometer asleep, accelerometer low-power 10 Hz
+} imu_power_state_t;
+
+typedef struct {
+    uint16_t idle_mg;       // all axes stay below this ...
+    uint16_t idle_ms;       // ... this long for idle, at most 127 samples of the active accelerometer rate
+    uint16_t wake_mg;       // any axis above this wakes, also limited to 127 steps of the threshold
+    bool gyro_sleep;        // sleep instead of power-down, faster wake-up for 2 mA
+} imu_power_config_t;
+
+typedef struct {
+    uint32_t enter_us;      // last transition to idle
+    uint32_t exit_us;       // last transition to active
+    uint32_t latency_us;    // last interrupt to active, includes the wait for imu_power_poll
+    uint32_t max_enter_us;
+    uint32_t max_exit_us;
+    uint32_t max_latency_us;
+    uint32_t idle_count;    // transitions to idle
+    uint32_t active_ms;     // time spent in each state
+    uint32_t idle_ms;
+    uint32_t average_ua;    // nominal current averaged over both
+} imu_power_stats_t;
+
+typedef struct {
+    l3gd20_t *gyro;                 // NULL if not managed
+    lsm303dlhc_t *lsm;
+    imu_power_config_t config;
+    imu_power_state_t state;
+
+    /* registers restored on wake-up */
+    uint8_t gyro_ctrl1;
+    uint8_t acc_ctrl1;
+    uint8_t acc_ctrl4;
+    uint8_t mag_mr;
+
+    volatile bool pending;          // interrupt not yet handled by imu_power_poll
+    volatile uint32_t int_tick;     // imu_clock of the interrupt
+    uint32_t since_ms;              // HAL tick of the last transition
+    uint32_t wake_tick;             // imu_clock at the end of the last wake-up
+    uint32_t settle_us;             // of the last wake-up
+    bool settled;
+    imu_power_stats_t stats;
+} imu_power_t;
+
+/* sets up the high-pass filter, latching and INT2 routing of interrupt generator 1, starts active */
+imu_power_result_t imu_power_init(imu_power_t *pm, l3gd20_t *gyro, lsm303dlhc_t *lsm, const imu_power_config_t *config);
+
+void imu_power_on_int(imu_power_t *pm);                 // call from the EXTI callback of the accelerometer INT2 pin
+imu_power_result_t imu_power_poll(imu_power_t *pm);     // call from the main loop, changes state on a pending interrupt
+
+imu_power_result_t imu_power_sleep(imu_power_t *pm);    // forced transitions, nothing to do if already there
+imu_power_result_t imu_power_wake(imu_power_t *pm);
+
+imu_power_state_t imu_power_get_state(const imu_power_t *pm);
+uint32_t imu_power_current_ua(const imu_power_t *pm);    // nominal current of the state
+uint32_t imu_power_wake_bound_us(const imu_power_t *pm);  // worst case from imu_power_poll to settled samples
+bool imu_power_ready(imu_power_t *pm);                     // samples settled since the last wake-up
+void imu_power_get_stats(const imu_power_t *pm, imu_power_stats_t *stats);
+
+/* C++ detection */
+#ifdef __cplusplus
+}
+#endif
+
+#endif
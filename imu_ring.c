@@ -0,0 +1,89 @@
+#include "imu_ring.h"
+#include "imu_clock.h"
+
+#include <string.h>
+
+/* head and tail are free-running, the buffer index is taken with the mask */
+#define IMU_RING_LOAD(p)        __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define IMU_RING_STORE(p, v)    __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+imu_ring_result_t imu_ring_init(imu_ring_t *ring, imu_ring_record_t *buf, uint32_t capacity) {
+    if (ring == NULL || buf == NULL || capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        return IMU_RING_ERROR;
+    }
+
+    ring->buf = buf;
+    ring->mask = capacity - 1;
+    ring->head = 0;
+    ring->sequence = 0;
+    ring->drops = 0;
+    ring->tail = 0;
+
+    return IMU_RING_OK;
+}
+
+imu_ring_result_t imu_ring_push(imu_ring_t *ring, imu_ring_sensor_t sensor, uint8_t flags, int16_t x, int16_t y, int16_t z) {
+    uint32_t head = ring->head;
+    imu_ring_record_t *rec;
+
+    if (head - IMU_RING_LOAD(&ring->tail) > ring->mask) {
+        ring->sequence++;
+        IMU_RING_STORE(&ring->drops, ring->drops + 1);
+        return IMU_RING_FULL;
+    }
+
+    rec = &ring->buf[head & ring->mask];
+    rec->timestamp = imu_clock_now();
+    rec->sequence = ring->sequence++;
+    rec->x = x;
+    rec->y = y;
+    rec->z = z;
+    rec->sensor = (uint8_t) sensor;
+    rec->flags = flags;
+
+    /* publish the record after it is written */
+    IMU_RING_STORE(&ring->head, head + 1);
+
+    return IMU_RING_OK;
+}
+
+uint32_t imu_ring_count(const imu_ring_t *ring) {
+    return IMU_RING_LOAD(&ring->head) - ring->tail;
+}
+
+uint32_t imu_ring_pop(imu_ring_t *ring, imu_ring_record_t out[], uint32_t max) {
+    const imu_ring_record_t *span;
+    uint32_t n, total = 0;
+
+    /* at most two spans, before and after the wrap */
+    while (total < max && (n = imu_ring_peek(ring, &span)) > 0) {
+        if (n > max - total) {
+            n = max - total;
+        }
+
+        memcpy(&out[total], span, n * sizeof(imu_ring_record_t));
+        imu_ring_consume(ring, n);
+        total += n;
+    }
+
+    return total;
+}
+
+uint32_t imu_ring_peek(const imu_ring_t *ring, const imu_ring_record_t **span) {
+    uint32_t tail = ring->tail;
+    uint32_t count = IMU_RING_LOAD(&ring->head) - tail;
+    uint32_t to_end = ring->mask + 1 - (tail & ring->mask);
+
+    *span = &ring->buf[tail & ring->mask];
+
+    return (count < to_end) ? count : to_end;
+}
+
+void imu_ring_consume(imu_ring_t *ring, uint32_t count) {
+    /* the records are read before the producer may reuse them */
+    IMU_RING_STORE(&ring->tail, ring->tail + count);
+}
+
+uint32_t imu_ring_drops(const imu_ring_t *ring) {
+    return IMU_RING_LOAD(&ring->drops);
+}
@@ -0,0 +1,74 @@
+#ifndef __IMU_RING_H__
+#define __IMU_RING_H__
+
+/* C++ detection */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * lock-free single-producer/single-consumer ring of timestamped samples
+ * The producer (an interrupt or DMA completion) only writes head, the consumer only writes tail,
+ * so neither side needs to mask interrupts. A full ring drops the new sample.
+ */
+
+typedef enum {
+    IMU_RING_OK,
+    IMU_RING_ERROR,
+    IMU_RING_FULL     // sample dropped
+} imu_ring_result_t;
+
+typedef enum {
+    IMU_RING_GYRO,
+    IMU_RING_ACC,
+    IMU_RING_MAG
+} imu_ring_sensor_t;
+
+/* record flags */
+#define IMU_RING_FLAG_RAW    (1 << 0)    // x, y, z are raw counts, otherwise converted by the driver
+
+/* 16 bytes, four records per 64 byte cache line */
+typedef struct {
+    uint32_t timestamp;     // imu_clock ticks when the sample was received
+    uint32_t sequence;      // counts every sample offered to the ring, gaps are drops
+    int16_t x;
+    int16_t y;
+    int16_t z;
+    uint8_t sensor;         // imu_ring_sensor_t
+    uint8_t flags;
+} imu_ring_record_t;
+
+typedef struct {
+    imu_ring_record_t *buf;
+    uint32_t mask;          // capacity - 1
+
+    /* producer */
+    uint32_t head;
+    uint32_t sequence;
+    uint32_t drops;
+
+    /* consumer */
+    uint32_t tail;
+} imu_ring_t;
+
+imu_ring_result_t imu_ring_init(imu_ring_t *ring, imu_ring_record_t *buf, uint32_t capacity);    // capacity must be a power of two
+
+/* producer side */
+imu_ring_result_t imu_ring_push(imu_ring_t *ring, imu_ring_sensor_t sensor, uint8_t flags, int16_t x, int16_t y, int16_t z);
+
+/* consumer side */
+uint32_t imu_ring_count(const imu_ring_t *ring);
+uint32_t imu_ring_pop(imu_ring_t *ring, imu_ring_record_t out[], uint32_t max);
+uint32_t imu_ring_peek(const imu_ring_t *ring, const imu_ring_record_t **span);    // contiguous records up to the end of the buffer, no copy
+void imu_ring_consume(imu_ring_t *ring, uint32_t count);                            // releases records returned by imu_ring_peek
+uint32_t imu_ring_drops(const imu_ring_t *ring);
+
+/* C++ detection */
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,91 @@
+#include "imu_stats.h"
+
+#ifdef IMU_STATS
+
+#include <string.h>
+
+/* the counters are updated from interrupts as well */
+#if defined(__ARM_ARCH)
+#define IMU_STATS_LOCK      uint32_t primask = __get_PRIMASK(); __disable_irq()
+#define IMU_STATS_UNLOCK    __set_PRIMASK(primask)
+#else
+#define IMU_STATS_LOCK
+#define IMU_STATS_UNLOCK
+#endif
+
+/* private variables */
+static imu_stats_t imu_stats[IMU_STATS_SITES];
+
+static const char *const imu_stats_names[IMU_STATS_SITES] = {
+    "l3gd20_read_spi",
+    "l3gd20_write_spi",
+    "l3gd20_read",
+    "lsm303dlhc_read_i2c",
+    "lsm303dlhc_write_i2c",
+    "lsm303dlhc_read_acc",
+    "lsm303dlhc_read_mag"
+};
+
+void imu_stats_record(imu_stats_site_t site, uint32_t ticks, uint32_t bytes, HAL_StatusTypeDef status) {
+    imu_stats_t *s = &imu_stats[site];
+    uint8_t bucket;
+
+    /* floor(log2(ticks)) */
+    bucket = (uint8_t) (31 - __builtin_clz(ticks | 1));
+    if (bucket >= IMU_STATS_BUCKETS) {
+        bucket = IMU_STATS_BUCKETS - 1;
+    }
+
+    IMU_STATS_LOCK;
+
+    if (s->calls == 0 || ticks < s->ticks_min) {
+        s->ticks_min = ticks;
+    }
+
+    if (ticks > s->ticks_max) {
+        s->ticks_max = ticks;
+    }
+
+    s->calls++;
+    s->bytes += bytes;
+    s->ticks_total += ticks;
+    s->histogram[bucket]++;
+
+    if (status == HAL_TIMEOUT) {
+        s->timeouts++;
+    } else if (status != HAL_OK) {
+        s->errors++;
+    }
+
+    IMU_STATS_UNLOCK;
+}
+
+void imu_stats_retry(imu_stats_site_t site) {
+    IMU_STATS_LOCK;
+    imu_stats[site].retries++;
+    IMU_STATS_UNLOCK;
+}
+
+void imu_stats_snapshot(imu_stats_site_t site, imu_stats_t *stats) {
+    IMU_STATS_LOCK;
+    *stats = imu_stats[site];
+    IMU_STATS_UNLOCK;
+}
+
+void imu_stats_reset(void) {
+    imu_clock_init();
+
+    IMU_STATS_LOCK;
+    memset(imu_stats, 0, sizeof(imu_stats));
+    IMU_STATS_UNLOCK;
+}
+
+const char *imu_stats_name(imu_stats_site_t site) {
+    if (site >= IMU_STATS_SITES) {
+        return "";
+    }
+
+    return imu_stats_names[site];
+}
+
+#endif
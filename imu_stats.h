@@ -0,0 +1,77 @@
+#ifndef __IMU_STATS_H__
+#define __IMU_STATS_H__
+
+/* C++ detection */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "stm32f3xx_hal.h"
+
+/*
+ * bus transaction instrumentation
+ * Define IMU_STATS to count calls, bytes, errors, timeouts and retries of the driver bus
+ * helpers and read functions, with a latency histogram per call site. Without it the
+ * macros expand to nothing.
+ */
+
+#define IMU_STATS_BUCKETS    24    // bucket n counts latencies of 2^n .. 2^(n+1)-1 ticks, the last one everything above
+
+typedef enum {
+    IMU_STATS_L3GD20_READ_SPI,
+    IMU_STATS_L3GD20_WRITE_SPI,
+    IMU_STATS_L3GD20_READ,
+    IMU_STATS_LSM303DLHC_READ_I2C,
+    IMU_STATS_LSM303DLHC_WRITE_I2C,
+    IMU_STATS_LSM303DLHC_READ_ACC,
+    IMU_STATS_LSM303DLHC_READ_MAG,
+    IMU_STATS_SITES
+} imu_stats_site_t;
+
+typedef struct {
+    uint32_t calls;
+    uint32_t bytes;
+    uint32_t errors;
+    uint32_t timeouts;
+    uint32_t retries;
+    uint32_t ticks_min;     // imu_clock ticks, see imu_clock_us
+    uint32_t ticks_max;
+    uint64_t ticks_total;
+    uint32_t histogram[IMU_STATS_BUCKETS];
+} imu_stats_t;
+
+#ifdef IMU_STATS
+
+#include "imu_clock.h"
+
+#define IMU_STATS_BEGIN(start)                      uint32_t start = imu_clock_now()
+#define IMU_STATS_END(site, start, bytes, status)   imu_stats_record((site), imu_clock_now() - (start), (bytes), (status))
+#define IMU_STATS_RETRY(site)                       imu_stats_retry(site)
+
+/*
+ * status is a HAL_StatusTypeDef, HAL_TIMEOUT is counted as a timeout, anything else but HAL_OK as an
+ * error. The I2C HAL returns HAL_ERROR on a timeout, the driver passes it as HAL_TIMEOUT.
+ */
+void imu_stats_record(imu_stats_site_t site, uint32_t ticks, uint32_t bytes, HAL_StatusTypeDef status);
+void imu_stats_retry(imu_stats_site_t site);
+
+void imu_stats_snapshot(imu_stats_site_t site, imu_stats_t *stats);
+void imu_stats_reset(void);    // also starts the cycle counter
+const char *imu_stats_name(imu_stats_site_t site);
+
+#else
+
+#define IMU_STATS_BEGIN(start)
+#define IMU_STATS_END(site, start, bytes, status)   ((void) 0)
+#define IMU_STATS_RETRY(site)                       ((void) 0)
+
+#endif
+
+/* C++ detection */
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,225 @@
+#include "imu_sync.h"
+#include "imu_clock.h"
+
+#include <stddef.h>
+
+#define IMU_SYNC_MASK    (IMU_SYNC_DEPTH - 1)
+
+/* private functions */
+static void imu_sync_track(imu_sync_sensor_t *s, uint32_t timestamp);
+static bool imu_sync_ready(const imu_sync_t *sync, uint32_t t);
+static bool imu_sync_sample(imu_sync_t *sync, const imu_sync_sensor_t *s, uint32_t t, int16_t out[3]);
+
+imu_sync_result_t imu_sync_init(imu_sync_t *sync, uint32_t rate_hz, uint8_t gating) {
+    if (sync == NULL || rate_hz == 0 || (gating & (IMU_SYNC_GYRO | IMU_SYNC_ACC | IMU_SYNC_MAG)) == 0) {
+        return IMU_SYNC_ERROR;
+    }
+
+    *sync = (imu_sync_t) { 0 };
+    sync->gating = gating;
+    sync->period = (uint32_t) ((uint64_t) imu_clock_ticks_per_us() * 1000000 / rate_hz);
+
+    return IMU_SYNC_OK;
+}
+
+void imu_sync_push(imu_sync_t *sync, imu_ring_sensor_t sensor, uint32_t timestamp, int16_t x, int16_t y, int16_t z) {
+    imu_sync_sensor_t *s = &sync->sensor[sensor];
+    uint32_t i = s->count & IMU_SYNC_MASK;
+
+    imu_sync_track(s, timestamp);
+
+    s->t[i] = s->last;
+    s->v[i][0] = x;
+    s->v[i][1] = y;
+    s->v[i][2] = z;
+    s->count++;
+}
+
+void imu_sync_push_record(imu_sync_t *sync, const imu_ring_record_t *rec) {
+    if (rec->sensor <= IMU_RING_MAG) {
+        imu_sync_push(sync, (imu_ring_sensor_t) rec->sensor, rec->timestamp, rec->x, rec->y, rec->z);
+    }
+}
+
+bool imu_sync_next(imu_sync_t *sync, imu_sync_frame_t *frame) {
+    uint32_t start = 0;
+    bool first = true;
+    uint8_t i;
+
+    if (!sync->started) {
+        /* start at the latest oldest sample, every gating sensor can be interpolated from there */
+        for (i = 0; i < 3; i++) {
+            const imu_sync_sensor_t *s = &sync->sensor[i];
+            uint32_t oldest;
+
+            if (!(sync->gating & (1 << i))) {
+                continue;
+            }
+
+            if (s->count == 0) {
+                return false;
+            }
+
+            oldest = s->t[(s->count - ((s->count < IMU_SYNC_DEPTH) ? s->count : IMU_SYNC_DEPTH)) & IMU_SYNC_MASK];
+            if (first || (int32_t) (oldest - start) > 0) {
+                start = oldest;
+                first = false;
+            }
+        }
+
+        sync->next = start;
+        sync->started = true;
+    }
+
+    if (!imu_sync_ready(sync, sync->next)) {
+        return false;
+    }
+
+    frame->timestamp = sync->next;
+    frame->sequence = sync->sequence++;
+    frame->valid = 0;
+
+    if (imu_sync_sample(sync, &sync->sensor[IMU_RING_GYRO], sync->next, frame->gyro)) {
+        frame->valid |= IMU_SYNC_GYRO;
+    }
+    if (imu_sync_sample(sync, &sync->sensor[IMU_RING_ACC], sync->next, frame->acc)) {
+        frame->valid |= IMU_SYNC_ACC;
+    }
+    if (imu_sync_sample(sync, &sync->sensor[IMU_RING_MAG], sync->next, frame->mag)) {
+        frame->valid |= IMU_SYNC_MAG;
+    }
+
+    sync->next += sync->period;
+
+    return true;
+}
+
+uint32_t imu_sync_rate_mhz(const imu_sync_t *sync, imu_ring_sensor_t sensor) {
+    const imu_sync_sensor_t *s = &sync->sensor[sensor];
+    uint64_t ticks_per_s = (uint64_t) imu_clock_ticks_per_us() * 1000000;
+
+    if (s->period_q16 <= 0) {
+        return 0;
+    }
+
+    return (uint32_t) (((ticks_per_s * 1000) << 16) / (uint64_t) s->period_q16);
+}
+
+/* private functions */
+
+/*
+ * The period estimate follows the sensor clock, samples closer or further apart than a period
+ * (interrupt latency, dropped samples) only move the smoothed timestamps by a fraction of the error.
+ */
+static void imu_sync_track(imu_sync_sensor_t *s, uint32_t timestamp) {
+    uint32_t elapsed = timestamp - s->last;
+    int64_t expected, err;
+    uint32_t n, gain;
+
+    if (s->count == 0) {
+        s->last = timestamp;
+        return;
+    }
+
+    if (s->period_q16 == 0) {
+        s->period_q16 = (int64_t) elapsed << 16;
+        s->last = timestamp;
+        return;
+    }
+
+    /* periods since the last sample, more than one after drops */
+    n = (uint32_t) ((((uint64_t) elapsed << 16) + (uint64_t) s->period_q16 / 2) / (uint64_t) s->period_q16);
+    if (n == 0) {
+        n = 1;
+    }
+
+    if (n > IMU_SYNC_GAP_MAX) {
+        s->gaps++;
+        s->last = timestamp;
+        return;
+    }
+
+    expected = n * s->period_q16;
+    err = ((int64_t) elapsed << 16) - expected;
+
+    /* running mean of the first periods, then a fixed gain */
+    gain = (s->count < IMU_SYNC_PERIOD_GAIN) ? s->count : IMU_SYNC_PERIOD_GAIN;
+    s->period_q16 += err / (int64_t) (n * gain);
+
+    s->last += (uint32_t) ((expected + err / IMU_SYNC_PHASE_GAIN) >> 16);
+}
+
+static bool imu_sync_ready(const imu_sync_t *sync, uint32_t t) {
+    const imu_sync_sensor_t *s;
+    uint8_t i;
+
+    for (i = 0; i < 3; i++) {
+        s = &sync->sensor[i];
+
+        if (!(sync->gating & (1 << i))) {
+            continue;
+        }
+
+        if (s->count == 0 || (int32_t) (s->t[(s->count - 1) & IMU_SYNC_MASK] - t) < 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool imu_sync_sample(imu_sync_t *sync, const imu_sync_sensor_t *s, uint32_t t, int16_t out[3]) {
+    uint32_t held = (s->count < IMU_SYNC_DEPTH) ? s->count : IMU_SYNC_DEPTH;
+    uint32_t newer, older, k, span;
+    int32_t w;
+    uint8_t j;
+
+    if (s->count == 0) {
+        out[0] = out[1] = out[2] = 0;
+        return false;
+    }
+
+    /* newest sample at or before t */
+    newer = (s->count - 1) & IMU_SYNC_MASK;
+    older = newer;
+    for (k = 1; k < held; k++) {
+        older = (s->count - 1 - k) & IMU_SYNC_MASK;
+
+        if ((int32_t) (t - s->t[older]) >= 0) {
+            break;
+        }
+
+        newer = older;
+    }
+
+    if (k == 1 && (int32_t) (t - s->t[newer]) >= 0) {
+        /* not gating and nothing newer yet, hold */
+        out[0] = s->v[newer][0];
+        out[1] = s->v[newer][1];
+        out[2] = s->v[newer][2];
+        return true;
+    }
+
+    if (k == held) {
+        /* t is older than the history, or than the first sample */
+        if (s->count > IMU_SYNC_DEPTH) {
+            sync->late++;
+        }
+        out[0] = s->v[newer][0];
+        out[1] = s->v[newer][1];
+        out[2] = s->v[newer][2];
+        return true;
+    }
+
+    /* weight of the newer sample in Q16 */
+    span = s->t[newer] - s->t[older];
+    w = (span == 0) ? 65536 : (int32_t) (((uint64_t) (t - s->t[older]) << 16) / span);
+
+    for (j = 0; j < 3; j++) {
+        int32_t d = (int32_t) s->v[newer][j] - s->v[older][j];
+
+        out[j] = (int16_t) (s->v[older][j] + (int32_t) (((int64_t) d * w + 32768) >> 16));
+    }
+
+    return true;
+}
@@ -0,0 +1,85 @@
+#ifndef __IMU_SYNC_H__
+#define __IMU_SYNC_H__
+
+/* C++ detection */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "imu_ring.h"
+
+/*
+ * multi-sensor synchronizer
+ * Takes samples timestamped with imu_clock at acquisition (ring records are), tracks the true
+ * rate of every sensor and smooths the timestamp jitter, then emits frames of all three sensors
+ * at a fixed output rate, each sensor linearly interpolated to the frame time. A frame is ready
+ * once every gating sensor has a sample at or after its time, so frames lag by about one period
+ * of the slowest gating sensor. Other sensors are interpolated if they can be, held otherwise.
+ */
+
+/* samples kept per sensor, a power of two covering one period of the slowest gating sensor */
+#ifndef IMU_SYNC_DEPTH
+#define IMU_SYNC_DEPTH    16
+#endif
+
+#define IMU_SYNC_GAP_MAX         8     // periods without a sample before the rate tracking restarts
+#define IMU_SYNC_PERIOD_GAIN     64    // samples averaged by the period estimate
+#define IMU_SYNC_PHASE_GAIN      8     // samples averaged by the timestamp smoothing
+
+/* sensor bits */
+#define IMU_SYNC_GYRO    (1 << IMU_RING_GYRO)
+#define IMU_SYNC_ACC     (1 << IMU_RING_ACC)
+#define IMU_SYNC_MAG     (1 << IMU_RING_MAG)
+
+typedef enum {
+    IMU_SYNC_OK,
+    IMU_SYNC_ERROR
+} imu_sync_result_t;
+
+typedef struct {
+    uint32_t timestamp;     // imu_clock ticks
+    uint32_t sequence;
+    int16_t gyro[3];
+    int16_t acc[3];
+    int16_t mag[3];
+    uint8_t valid;          // sensors with samples, IMU_SYNC_* bits
+} imu_sync_frame_t;
+
+typedef struct {
+    uint32_t t[IMU_SYNC_DEPTH];         // smoothed timestamps
+    int16_t v[IMU_SYNC_DEPTH][3];
+    uint32_t count;                     // samples pushed
+
+    /* rate tracking */
+    uint32_t last;                      // smoothed timestamp of the newest sample
+    int64_t period_q16;                 // ticks, 0 until the second sample
+    uint32_t gaps;                      // restarts of the tracking
+} imu_sync_sensor_t;
+
+typedef struct {
+    imu_sync_sensor_t sensor[3];        // by imu_ring_sensor_t
+    uint8_t gating;
+    uint32_t period;                    // output period in ticks
+    uint32_t next;                      // time of the next frame
+    bool started;
+    uint32_t sequence;
+    uint32_t late;                      // interpolations that fell behind IMU_SYNC_DEPTH
+} imu_sync_t;
+
+imu_sync_result_t imu_sync_init(imu_sync_t *sync, uint32_t rate_hz, uint8_t gating);    // gating is a set of IMU_SYNC_* bits
+
+void imu_sync_push(imu_sync_t *sync, imu_ring_sensor_t sensor, uint32_t timestamp, int16_t x, int16_t y, int16_t z);
+void imu_sync_push_record(imu_sync_t *sync, const imu_ring_record_t *rec);
+
+bool imu_sync_next(imu_sync_t *sync, imu_sync_frame_t *frame);    // false until the next frame is ready
+uint32_t imu_sync_rate_mhz(const imu_sync_t *sync, imu_ring_sensor_t sensor);    // estimated output data rate, 0 if unknown
+
+/* C++ detection */
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,234 @@
+#include "imu_tempcomp.h"
+
+#include <math.h>
+#include <string.h>
+
+/* private functions */
+static void imu_tempcomp_locate(float t0, float step, uint8_t count, float temp, uint8_t *idx, float *frac);
+static bool imu_tempcomp_solve(const imu_tempcomp_sums_t *sums, uint32_t samples, uint8_t count, uint8_t axis, imu_tempcomp_t *table);
+
+imu_tempcomp_result_t imu_tempcomp_init(imu_tempcomp_t *table, float t0, float step, uint8_t count) {
+    uint8_t i, j;
+
+    if (count < 2 || count > IMU_TEMPCOMP_POINTS || !(step > 0.0f)) {
+        return IMU_TEMPCOMP_ERROR;
+    }
+
+    *table = (imu_tempcomp_t) { 0 };
+    table->t0 = t0;
+    table->step = step;
+    table->count = count;
+
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < 3; j++) {
+            table->scale[i][j] = 1.0f;
+        }
+    }
+
+    return IMU_TEMPCOMP_OK;
+}
+
+void imu_tempcomp_eval(const imu_tempcomp_t *table, float temp, float bias[3], float scale[3]) {
+    uint8_t idx, j;
+    float frac;
+
+    imu_tempcomp_locate(table->t0, table->step, table->count, temp, &idx, &frac);
+
+    for (j = 0; j < 3; j++) {
+        bias[j] = table->bias[idx][j] + frac * (table->bias[idx + 1][j] - table->bias[idx][j]);
+        scale[j] = table->scale[idx][j] + frac * (table->scale[idx + 1][j] - table->scale[idx][j]);
+    }
+}
+
+imu_tempcomp_result_t imu_tempcomp_builder_init(imu_tempcomp_builder_t *builder, float t0, float step, uint8_t count) {
+    if (count < 2 || count > IMU_TEMPCOMP_POINTS || !(step > 0.0f)) {
+        return IMU_TEMPCOMP_ERROR;
+    }
+
+    *builder = (imu_tempcomp_builder_t) { 0 };
+    builder->t0 = t0;
+    builder->step = step;
+    builder->count = count;
+
+    return IMU_TEMPCOMP_OK;
+}
+
+void imu_tempcomp_builder_add(imu_tempcomp_builder_t *builder, float temp, const float measured[3], const float reference[3]) {
+    imu_tempcomp_sums_t *sums;
+    double w0, w1, m, r;
+    uint8_t idx, j;
+    float frac;
+
+    /* samples past the ends count for the end point, as the table is clamped there */
+    imu_tempcomp_locate(builder->t0, builder->step, builder->count, temp, &idx, &frac);
+    w0 = 1.0 - frac;
+    w1 = frac;
+
+    for (j = 0; j < 3; j++) {
+        sums = &builder->axis[j];
+        m = measured[j];
+        r = reference[j];
+
+        sums->mm[idx][0] += w0 * w0 * m * m;
+        sums->mm[idx][1] += w0 * w1 * m * m;
+        sums->mm[idx + 1][0] += w1 * w1 * m * m;
+        sums->m[idx][0] += w0 * w0 * m;
+        sums->m[idx][1] += w0 * w1 * m;
+        sums->m[idx + 1][0] += w1 * w1 * m;
+        sums->w[idx][0] += w0 * w0;
+        sums->w[idx][1] += w0 * w1;
+        sums->w[idx + 1][0] += w1 * w1;
+        sums->mr[idx] += w0 * m * r;
+        sums->mr[idx + 1] += w1 * m * r;
+        sums->r[idx] += w0 * r;
+        sums->r[idx + 1] += w1 * r;
+        sums->wm[idx] += w0 * m;
+        sums->wm[idx + 1] += w1 * m;
+        sums->sum_r += r;
+        sums->sum_rr += r * r;
+    }
+
+    builder->samples++;
+}
+
+imu_tempcomp_result_t imu_tempcomp_builder_finish(const imu_tempcomp_builder_t *builder, imu_tempcomp_t *table) {
+    uint8_t j;
+
+    if (imu_tempcomp_init(table, builder->t0, builder->step, builder->count) != IMU_TEMPCOMP_OK || builder->samples == 0) {
+        return IMU_TEMPCOMP_ERROR;
+    }
+
+    for (j = 0; j < 3; j++) {
+        if (!imu_tempcomp_solve(&builder->axis[j], builder->samples, builder->count, j, table)) {
+            return IMU_TEMPCOMP_ERROR;
+        }
+    }
+
+    return IMU_TEMPCOMP_OK;
+}
+
+/* private functions */
+static void imu_tempcomp_locate(float t0, float step, uint8_t count, float temp, uint8_t *idx, float *frac) {
+    float x = (temp - t0) / step;
+
+    if (!(x > 0.0f)) {
+        *idx = 0;
+        *frac = 0.0f;
+    } else if (x >= (float) (count - 1)) {
+        *idx = count - 2;
+        *frac = 1.0f;
+    } else {
+        *idx = (uint8_t) x;
+        *frac = x - (float) *idx;
+    }
+}
+
+/*
+ * reference = s(T) * measured - c(T) with c = s * bias is linear in the points of s and c. The
+ * unknowns are s_0 .. s_n-1, c_0 .. c_n-1, or only the c if the scale is fixed at 1.
+ */
+static bool imu_tempcomp_solve(const imu_tempcomp_sums_t *sums, uint32_t samples, uint8_t count, uint8_t axis, imu_tempcomp_t *table) {
+    double a[2 * IMU_TEMPCOMP_POINTS][2 * IMU_TEMPCOMP_POINTS + 1];
+    double x[2 * IMU_TEMPCOMP_POINTS];
+    double mean_r, var_r, lambda, f;
+    uint8_t n, o, k, i, l, row, col, pivot;
+    bool fit_scale;
+
+    mean_r = sums->sum_r / samples;
+    var_r = sums->sum_rr / samples - mean_r * mean_r;
+
+    /* a constant reference, e.g. at rest, only tells the offset */
+    fit_scale = var_r > 1e-9 * (1.0 + mean_r * mean_r);
+    o = fit_scale ? count : 0;
+    n = o + count;
+
+    memset(a, 0, sizeof(a));
+
+    for (k = 0; k < count; k++) {
+        for (i = 0; i < 2 && k + i < count; i++) {
+            l = k + i;
+
+            a[o + k][o + l] = a[o + l][o + k] = sums->w[k][i];
+
+            if (fit_scale) {
+                a[k][l] = a[l][k] = sums->mm[k][i];
+                a[k][o + l] = a[o + l][k] = -sums->m[k][i];
+                a[l][o + k] = a[o + k][l] = -sums->m[k][i];
+            }
+        }
+
+        if (fit_scale) {
+            a[k][n] = sums->mr[k];
+            a[o + k][n] = -sums->r[k];
+        } else {
+            a[k][n] = sums->wm[k] - sums->r[k];
+        }
+    }
+
+    /* a small penalty on neighbour differences per block makes points without samples well defined */
+    for (l = 0; l < n; l += count) {
+        lambda = 0.0;
+        for (k = 0; k < count; k++) {
+            lambda = (a[l + k][l + k] > lambda) ? a[l + k][l + k] : lambda;
+        }
+
+        lambda *= IMU_TEMPCOMP_SMOOTH;
+
+        for (k = 0; k + 1 < count; k++) {
+            a[l + k][l + k] += lambda;
+            a[l + k + 1][l + k + 1] += lambda;
+            a[l + k][l + k + 1] -= lambda;
+            a[l + k + 1][l + k] -= lambda;
+        }
+    }
+
+    /* Gaussian elimination with partial pivoting */
+    for (col = 0; col < n; col++) {
+        pivot = col;
+        for (row = col + 1; row < n; row++) {
+            if (fabs(a[row][col]) > fabs(a[pivot][col])) {
+                pivot = row;
+            }
+        }
+
+        if (a[pivot][col] == 0.0) {
+            return false;
+        }
+
+        if (pivot != col) {
+            for (k = col; k <= n; k++) {
+                f = a[col][k];
+                a[col][k] = a[pivot][k];
+                a[pivot][k] = f;
+            }
+        }
+
+        for (row = col + 1; row < n; row++) {
+            f = a[row][col] / a[col][col];
+            for (k = col; k <= n; k++) {
+                a[row][k] -= f * a[col][k];
+            }
+        }
+    }
+
+    for (row = n; row-- > 0;) {
+        f = a[row][n];
+        for (k = row + 1; k < n; k++) {
+            f -= a[row][k] * x[k];
+        }
+
+        x[row] = f / a[row][row];
+    }
+
+    for (k = 0; k < count; k++) {
+        f = fit_scale ? x[k] : 1.0;
+        if (!(f > 0.0)) {
+            return false;
+        }
+
+        table->scale[k][axis] = (float) f;
+        table->bias[k][axis] = (float) (x[o + k] / f);
+    }
+
+    return true;
+}
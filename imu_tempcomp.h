@@ -0,0 +1,84 @@
+#ifndef __IMU_TEMPCOMP_H__
+#define __IMU_TEMPCOMP_H__
+
+/* C++ detection */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * temperature compensation
+ * A piecewise-linear table of bias and scale per axis over evenly spaced temperatures. A sample x in
+ * the nominal unit of the sensor is corrected to scale(T) * (x - bias(T)), the table is clamped at
+ * both ends. The drivers evaluate it when their temperature reading changes and fold the result into
+ * the conversion factors, so the conversions cost the same as without compensation.
+ * The builder fits a table from a thermal sweep: samples of the sensor with the die temperature and
+ * the expected value, e.g. zero at rest for a gyroscope, or a turntable rate. It solves the least
+ * squares problem of the interpolated table itself, so the table is exact for a drift that is
+ * piecewise linear on the grid. Neither side allocates; this file builds on host too, without the HAL.
+ */
+
+#define IMU_TEMPCOMP_POINTS         8           // points of a table
+#define IMU_TEMPCOMP_SMOOTH         1e-6        // penalty on differences between points relative to the data, fills points without samples
+
+typedef enum {
+    IMU_TEMPCOMP_OK,
+    IMU_TEMPCOMP_ERROR
+} imu_tempcomp_result_t;
+
+typedef struct {
+    float t0;                   // degC of the first point
+    float step;                 // degC between points
+    uint8_t count;              // points used, 2 .. IMU_TEMPCOMP_POINTS
+    float bias[IMU_TEMPCOMP_POINTS][3];     // nominal unit, subtracted first
+    float scale[IMU_TEMPCOMP_POINTS][3];
+} imu_tempcomp_t;
+
+/*
+ * normal equations of one axis, m measured, r reference and w_k the interpolation weight of point k.
+ * They are banded, a point only shares samples with its neighbours: index 0 is point k with itself,
+ * index 1 point k with k + 1.
+ */
+typedef struct {
+    double mm[IMU_TEMPCOMP_POINTS][2];      // sum of w_k * w_k+i * m^2
+    double m[IMU_TEMPCOMP_POINTS][2];       // sum of w_k * w_k+i * m
+    double w[IMU_TEMPCOMP_POINTS][2];       // sum of w_k * w_k+i
+    double mr[IMU_TEMPCOMP_POINTS];         // sum of w_k * m * r
+    double r[IMU_TEMPCOMP_POINTS];          // sum of w_k * r
+    double wm[IMU_TEMPCOMP_POINTS];         // sum of w_k * m
+    double sum_r;               // spread of the reference
+    double sum_rr;
+} imu_tempcomp_sums_t;
+
+typedef struct {
+    float t0;
+    float step;
+    uint8_t count;
+    imu_tempcomp_sums_t axis[3];
+    uint32_t samples;
+} imu_tempcomp_builder_t;
+
+/* identity table, zero bias and unit scale at every point */
+imu_tempcomp_result_t imu_tempcomp_init(imu_tempcomp_t *table, float t0, float step, uint8_t count);
+void imu_tempcomp_eval(const imu_tempcomp_t *table, float temp, float bias[3], float scale[3]);
+
+imu_tempcomp_result_t imu_tempcomp_builder_init(imu_tempcomp_builder_t *builder, float t0, float step, uint8_t count);
+void imu_tempcomp_builder_add(imu_tempcomp_builder_t *builder, float temp, const float measured[3], const float reference[3]);
+
+/*
+ * Solves for reference = scale(T) * (measured - bias(T)) over all samples. An axis whose reference
+ * does not vary, e.g. at rest, gets a unit scale. Points without samples are interpolated between
+ * their neighbours and continue the nearest one past the ends. Fails without samples or if a scale
+ * comes out negative. Not for the sample path, it solves a dense system of 2 * count unknowns.
+ */
+imu_tempcomp_result_t imu_tempcomp_builder_finish(const imu_tempcomp_builder_t *builder, imu_tempcomp_t *table);
+
+/* C++ detection */
+#ifdef __cplusplus
+}
+#endif
+
+#endif
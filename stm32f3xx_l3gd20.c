@@ -1,24 +1,73 @@
 #include "stm32f3xx_l3gd20.h"
+#include "imu_stats.h"
+
+/* shadow entry of a CTRL_REGx address */
+#define L3GD20_CTRL(dev, reg)    ((dev)->ctrl[(reg) - L3GD20_REG_CTRL_REG1])
 
 /* private variables */
-static l3gd20_scale_t l3gd20_scale;
-static SPI_HandleTypeDef *l3gd20_hspi = NULL;
+static l3gd20_t l3gd20_default;
+static l3gd20_t *l3gd20_devices = NULL;
 
-/* private functions */
-static l3gd20_result_t l3gd20_read_spi(uint8_t address, uint8_t *data);
-static l3gd20_result_t l3gd20_write_spi(uint8_t address, uint8_t data);
+/* high-pass cut-off in mHz, HPCF 0 at 760 Hz first */
+static const uint32_t l3gd20_hpf_cutoffs[13] = {
+    51400, 27000, 13500, 7200, 3500, 1800, 900, 450, 180, 90, 45, 18, 9
+};
 
-l3gd20_result_t l3gd20_init(SPI_HandleTypeDef *hspi, l3gd20_scale_t scale) {
-    l3gd20_hspi = hspi;
-    l3gd20_scale = scale;
+/* private functions */
+static l3gd20_result_t l3gd20_read_spi(l3gd20_t *dev, uint8_t address, uint8_t *data);
+static l3gd20_result_t l3gd20_write_spi(l3gd20_t *dev, uint8_t address, uint8_t data);
+static l3gd20_result_t l3gd20_read_spi_multi(l3gd20_t *dev, uint8_t address, uint8_t *data, uint16_t len);
+static l3gd20_result_t l3gd20_write_spi_multi(l3gd20_t *dev, uint8_t address, const uint8_t *data, uint16_t len);
+static l3gd20_result_t l3gd20_transfer(l3gd20_t *dev, uint8_t *tx, uint16_t tx_len, uint8_t *rx, uint16_t rx_len);
+static void l3gd20_ctrl_modify(l3gd20_t *dev, uint8_t reg, uint8_t mask, uint8_t value);
+static l3gd20_result_t l3gd20_ctrl_flush(l3gd20_t *dev);
+static void l3gd20_update_scale(l3gd20_t *dev, l3gd20_scale_t scale);
+static void l3gd20_update_factors(l3gd20_t *dev);
+static void l3gd20_update_temp(l3gd20_t *dev, uint8_t out_temp);
+static bool l3gd20_temp_due(l3gd20_t *dev);
+static int32_t l3gd20_round(double value);
+static void l3gd20_decode(l3gd20_data_t *data, const uint8_t *buf);
+static void l3gd20_convert(const l3gd20_t *dev, l3gd20_data_t *data, const uint8_t *buf);
+static l3gd20_result_t l3gd20_read_sample(l3gd20_t *dev, l3gd20_data_t *data, bool raw);
+static l3gd20_result_t l3gd20_read_output(l3gd20_t *dev, l3gd20_data_t *data, bool raw);
+static l3gd20_result_t l3gd20_stream_begin(l3gd20_t *dev);
+static void l3gd20_stream_resume(SPI_HandleTypeDef *hspi, l3gd20_t *after);
+static bool l3gd20_bus_busy(const SPI_HandleTypeDef *hspi);
+static bool l3gd20_drdy_routed(const l3gd20_t *dev);
+
+l3gd20_result_t l3gd20_dev_init(l3gd20_t *dev, SPI_HandleTypeDef *hspi, GPIO_TypeDef *cs_port, uint16_t cs_pin, l3gd20_scale_t scale) {
+    l3gd20_t *it;
     uint8_t who_am_i;
 
-    if (l3gd20_hspi == NULL) {
+    if (dev == NULL || hspi == NULL || cs_port == NULL) {
         return L3GD20_ERROR;
     }
 
+    /* register the device once, the HAL callbacks find it by its bus */
+    for (it = l3gd20_devices; it != NULL && it != dev; it = it->next) {
+    }
+
+    if (it == NULL) {
+        *dev = (l3gd20_t) { 0 };
+        dev->bus.timeout_us = L3GD20_SPI_TIMEOUT * 1000;
+        dev->next = l3gd20_devices;
+        l3gd20_devices = dev;
+    } else if (dev->stream_busy) {
+        return L3GD20_BUSY;
+    }
+
+    dev->hspi = hspi;
+    dev->cs_port = cs_port;
+    dev->cs_pin = cs_pin;
+    dev->raw = false;
+    dev->stream_on = false;
+    dev->stream_pending = false;
+    dev->drdy_pending = false;
+    dev->temp_valid = false;
+    dev->temp_new = false;
+
     /* check if sensor is L3GD20 */
-    if (l3gd20_read_spi(L3GD20_REG_WHO_AM_I, &who_am_i) != L3GD20_OK) {
+    if (l3gd20_read_spi(dev, L3GD20_REG_WHO_AM_I, &who_am_i) != L3GD20_OK) {
         return L3GD20_ERROR;
     }
 
@@ -28,123 +77,902 @@ l3gd20_result_t l3gd20_init(SPI_HandleTypeDef *hspi, l3gd20_scale_t scale) {
     }
 
     /* enable L3GD20 Power bit */
-    if (l3gd20_write_spi(L3GD20_REG_CTRL_REG1, 0xFF) != L3GD20_OK) {
-        return L3GD20_ERROR;
-    }
-
-    /* set L3GD20 scale */
-    if (l3gd20_scale == L3GD20_SCALE_250) {
-        if (l3gd20_write_spi(L3GD20_REG_CTRL_REG4, 0x00) != L3GD20_OK) {
-            return L3GD20_ERROR;
-        }
-    } else if (l3gd20_scale == L3GD20_SCALE_500) {
-        if (l3gd20_write_spi(L3GD20_REG_CTRL_REG4, 0x10) != L3GD20_OK) {
-            return L3GD20_ERROR;
-        }
-    } else if (l3gd20_scale == L3GD20_SCALE_2000) {
-        if (l3gd20_write_spi(L3GD20_REG_CTRL_REG4, 0x20) != L3GD20_OK) {
-            return L3GD20_ERROR;
-        }
-    }
+    L3GD20_CTRL(dev, L3GD20_REG_CTRL_REG1) = 0xFF;
 
     /* set high-pass filter settings */
-    if (l3gd20_write_spi(L3GD20_REG_CTRL_REG2, 0x00) != L3GD20_OK) {
+    L3GD20_CTRL(dev, L3GD20_REG_CTRL_REG2) = 0x00;
+
+    /* no interrupts */
+    L3GD20_CTRL(dev, L3GD20_REG_CTRL_REG3) = 0x00;
+
+    /* set L3GD20 scale and sensitivity scale correction */
+    L3GD20_CTRL(dev, L3GD20_REG_CTRL_REG4) = 0x00;
+    l3gd20_update_scale(dev, scale);
+
+    /* enable high-pass filter */
+    L3GD20_CTRL(dev, L3GD20_REG_CTRL_REG5) = L3GD20_CR5_OUT_SEL_HPF;
+    dev->fifo_ctrl = 0;
+    dev->fifo_status = (l3gd20_fifo_status_t) { 0 };
+
+    /* the state of the sensor is unknown, CTRL_REG1 .. CTRL_REG5 in one transaction */
+    dev->ctrl_dirty = (1 << L3GD20_CTRL_COUNT) - 1;
+    if (l3gd20_ctrl_flush(dev) != L3GD20_OK) {
         return L3GD20_ERROR;
     }
 
-    /* enable high-pass filter */
-    if (l3gd20_write_spi(L3GD20_REG_CTRL_REG5, 0x10) != L3GD20_OK) {
+    return L3GD20_OK;
+}
+
+l3gd20_result_t l3gd20_dev_set_bus_policy(l3gd20_t *dev, const imu_bus_policy_t *policy) {
+    if (policy == NULL || policy->retries > IMU_BUS_RETRIES_MAX) {
         return L3GD20_ERROR;
     }
 
+    dev->bus = *policy;
+
     return L3GD20_OK;
 }
 
-l3gd20_result_t l3gd20_read(l3gd20_data_t *data) {
-    float temp, s;
-    uint8_t byte_lo, byte_hi;
+uint32_t l3gd20_dev_read_bound_us(const l3gd20_t *dev) {
+    return imu_bus_worst_case_us(&dev->bus, L3GD20_READ_TRANSACTIONS, 0);
+}
+
+uint8_t l3gd20_dev_get_ctrl(const l3gd20_t *dev, uint8_t reg) {
+    if (reg < L3GD20_REG_CTRL_REG1 || reg > L3GD20_REG_CTRL_REG5) {
+        return 0;
+    }
 
-    /* read X axis */
-    if (l3gd20_read_spi(L3GD20_REG_OUT_X_L, &byte_lo) != L3GD20_OK) {
+    return L3GD20_CTRL(dev, reg);
+}
+
+l3gd20_result_t l3gd20_dev_update_ctrl(l3gd20_t *dev, uint8_t reg, uint8_t mask, uint8_t value) {
+    if (reg < L3GD20_REG_CTRL_REG1 || reg > L3GD20_REG_CTRL_REG5) {
         return L3GD20_ERROR;
     }
 
-    if (l3gd20_read_spi(L3GD20_REG_OUT_X_H, &byte_hi) != L3GD20_OK) {
+    l3gd20_ctrl_modify(dev, reg, mask, value);
+
+    return l3gd20_ctrl_flush(dev);
+}
+
+l3gd20_result_t l3gd20_dev_set_odr(l3gd20_t *dev, uint8_t dr_bw) {
+    return l3gd20_dev_update_ctrl(dev, L3GD20_REG_CTRL_REG1, L3GD20_CR1_DR | L3GD20_CR1_BW, dr_bw);
+}
+
+l3gd20_result_t l3gd20_dev_set_hpf(l3gd20_t *dev, const l3gd20_hpf_config_t *config) {
+    if (config == NULL || config->cutoff > L3GD20_HPCF_MAX || (config->mode & ~L3GD20_CR2_HPM) != 0 ||
+        (config->out_sel & ~L3GD20_CR5_OUT_SEL) != 0 || config->out_sel == L3GD20_CR5_OUT_SEL) {
         return L3GD20_ERROR;
     }
 
-    data->x = byte_hi << 8 | byte_lo;
+    l3gd20_ctrl_modify(dev, L3GD20_REG_CTRL_REG2, L3GD20_CR2_HPM | L3GD20_CR2_HPCF, config->mode | config->cutoff);
+    l3gd20_ctrl_modify(dev, L3GD20_REG_CTRL_REG5, L3GD20_CR5_OUT_SEL_HPF | L3GD20_CR5_OUT_SEL,
+                       (config->enable ? L3GD20_CR5_OUT_SEL_HPF : 0) | config->out_sel);
+
+    return l3gd20_ctrl_flush(dev);
+}
 
-    /* read Y axis */
-    if (l3gd20_read_spi(L3GD20_REG_OUT_Y_L, &byte_lo) != L3GD20_OK) {
+uint32_t l3gd20_hpf_cutoff_mhz(uint8_t ctrl_reg1, uint8_t cutoff) {
+    /* datasheet table 26: each doubling of the data rate shifts the column by one entry */
+    if (cutoff > L3GD20_HPCF_MAX) {
+        return 0;
+    }
+
+    return l3gd20_hpf_cutoffs[3 - ((ctrl_reg1 & L3GD20_CR1_DR) >> 6) + cutoff];
+}
+
+l3gd20_result_t l3gd20_dev_set_scale(l3gd20_t *dev, l3gd20_scale_t scale) {
+    if (scale != L3GD20_SCALE_250 && scale != L3GD20_SCALE_500 && scale != L3GD20_SCALE_2000) {
         return L3GD20_ERROR;
     }
 
-    if (l3gd20_read_spi(L3GD20_REG_OUT_Y_H, &byte_hi) != L3GD20_OK) {
+    /* samples read after this are converted with the new factors */
+    l3gd20_update_scale(dev, scale);
+
+    return l3gd20_ctrl_flush(dev);
+}
+
+l3gd20_result_t l3gd20_dev_read(l3gd20_t *dev, l3gd20_data_t *data) {
+    return l3gd20_read_sample(dev, data, dev->raw);
+}
+
+l3gd20_result_t l3gd20_dev_read_raw(l3gd20_t *dev, l3gd20_data_t *data) {
+    return l3gd20_read_sample(dev, data, true);
+}
+
+void l3gd20_dev_set_raw(l3gd20_t *dev, bool raw) {
+    dev->raw = raw;
+}
+
+void l3gd20_dev_convert_mdps(const l3gd20_t *dev, l3gd20_data_fixed_t *conv, const l3gd20_data_t *raw) {
+    const l3gd20_factors_t *f = &dev->factors[dev->factors_idx];
+
+    /* at most 32768 * 17920 times a scale near 1, fits in 32 bits */
+    conv->x = raw->x * f->mdps_k_q8[0] / 256 - f->offset_mdps[0];
+    conv->y = raw->y * f->mdps_k_q8[1] / 256 - f->offset_mdps[1];
+    conv->z = raw->z * f->mdps_k_q8[2] / 256 - f->offset_mdps[2];
+}
+
+void l3gd20_dev_convert_q16(const l3gd20_t *dev, l3gd20_data_fixed_t *conv, const l3gd20_data_t *raw) {
+    const l3gd20_factors_t *f = &dev->factors[dev->factors_idx];
+
+    conv->x = (int32_t) ((int64_t) raw->x * f->dps_k_q32[0] / 65536) - f->offset_q16[0];
+    conv->y = (int32_t) ((int64_t) raw->y * f->dps_k_q32[1] / 65536) - f->offset_q16[1];
+    conv->z = (int32_t) ((int64_t) raw->z * f->dps_k_q32[2] / 65536) - f->offset_q16[2];
+}
+
+void l3gd20_dev_convert_dps(const l3gd20_t *dev, l3gd20_data_dps_t *conv, const l3gd20_data_t *raw) {
+    const l3gd20_factors_t *f = &dev->factors[dev->factors_idx];
+
+    conv->x = (float) raw->x * f->dps_k[0] - f->offset_dps[0];
+    conv->y = (float) raw->y * f->dps_k[1] - f->offset_dps[1];
+    conv->z = (float) raw->z * f->dps_k[2] - f->offset_dps[2];
+}
+
+void l3gd20_dev_set_bias(l3gd20_t *dev, const float bias_dps[3]) {
+    uint8_t i;
+
+    for (i = 0; i < 3; i++) {
+        dev->bias_dps[i] = (bias_dps != NULL) ? bias_dps[i] : 0.0f;
+    }
+
+    l3gd20_update_factors(dev);
+}
+
+void l3gd20_dev_set_temp_rate(l3gd20_t *dev, uint16_t every) {
+    dev->temp_every = every;
+    dev->temp_count = 1;
+}
+
+void l3gd20_dev_apply_temp(l3gd20_t *dev) {
+    if (!dev->temp_new) {
+        return;
+    }
+
+    /* cleared first, a reading latched meanwhile sets it again and is applied next time */
+    dev->temp_new = false;
+    l3gd20_update_temp(dev, dev->temp_out);
+}
+
+l3gd20_result_t l3gd20_dev_get_temp(const l3gd20_t *dev, int8_t *temp) {
+    if (!dev->temp_valid) {
+        return L3GD20_NO_DATA;
+    }
+
+    *temp = dev->temp;
+
+    return L3GD20_OK;
+}
+
+void l3gd20_dev_set_temp_comp(l3gd20_t *dev, const imu_tempcomp_t *table) {
+    dev->temp_table = table;
+
+    l3gd20_update_factors(dev);
+}
+
+static l3gd20_result_t l3gd20_read_sample(l3gd20_t *dev, l3gd20_data_t *data, bool raw) {
+    l3gd20_result_t result;
+
+    IMU_STATS_BEGIN(start);
+
+    result = l3gd20_read_output(dev, data, raw);
+
+    IMU_STATS_END(IMU_STATS_L3GD20_READ, start, 0, (result == L3GD20_ERROR) ? HAL_ERROR : HAL_OK);
+
+    return result;
+}
+
+static l3gd20_result_t l3gd20_read_output(l3gd20_t *dev, l3gd20_data_t *data, bool raw) {
+    uint8_t buf[2 + L3GD20_SAMPLE_LEN];
+    uint8_t *out = buf;
+    l3gd20_result_t result;
+    bool drdy = l3gd20_drdy_routed(dev);
+    bool temp;
+
+    /* nothing to read until the data-ready interrupt fires */
+    if (drdy) {
+        if (!dev->drdy_pending) {
+            return L3GD20_NO_DATA;
+        }
+
+        dev->drdy_pending = false;
+    }
+
+    /* STATUS_REG and all axes in one transaction, so the high and low bytes belong to the same sample */
+    temp = l3gd20_temp_due(dev);
+    if (temp) {
+        result = l3gd20_read_spi_multi(dev, L3GD20_REG_OUT_TEMP, buf, sizeof(buf));
+    } else {
+        result = l3gd20_read_spi_multi(dev, L3GD20_REG_STATUS_REG, buf, sizeof(buf) - 1);
+    }
+
+    /* the output was not read, DRDY stays high and raises no new edge */
+    if (result != L3GD20_OK) {
+        if (drdy) {
+            dev->drdy_pending = true;
+        }
+
+        return result;
+    }
+
+    if (temp) {
+        l3gd20_update_temp(dev, buf[0]);
+        out = &buf[1];
+    }
+
+    dev->status = out[0];
+
+    if (!(dev->status & L3GD20_SR_ZYXDA)) {
+        return L3GD20_NO_DATA;
+    }
+
+    if (raw) {
+        l3gd20_decode(data, &out[1]);
+    } else {
+        l3gd20_convert(dev, data, &out[1]);
+    }
+
+    return L3GD20_OK;
+}
+
+uint8_t l3gd20_dev_get_status(const l3gd20_t *dev) {
+    return dev->status;
+}
+
+l3gd20_result_t l3gd20_dev_set_fifo(l3gd20_t *dev, l3gd20_fifo_mode_t mode, uint8_t watermark) {
+    if (watermark >= L3GD20_FIFO_SIZE) {
         return L3GD20_ERROR;
     }
 
-    data->y = byte_hi << 8 | byte_lo;
+    /* FIFO_EN must be set for any mode but bypass */
+    l3gd20_ctrl_modify(dev, L3GD20_REG_CTRL_REG5, L3GD20_CR5_FIFO_EN, (mode == L3GD20_FIFO_BYPASS) ? 0 : L3GD20_CR5_FIFO_EN);
 
-    /* read Z axis */
-    if (l3gd20_read_spi(L3GD20_REG_OUT_Z_L, &byte_lo) != L3GD20_OK) {
+    if (l3gd20_ctrl_flush(dev) != L3GD20_OK) {
         return L3GD20_ERROR;
     }
 
-    if (l3gd20_read_spi(L3GD20_REG_OUT_Z_H, &byte_hi) != L3GD20_OK) {
+    if (l3gd20_write_spi(dev, L3GD20_REG_FIFO_CTRL_REG, (uint8_t) mode | watermark) != L3GD20_OK) {
         return L3GD20_ERROR;
     }
 
-    data->z = byte_hi << 8 | byte_lo;
+    dev->fifo_ctrl = (uint8_t) mode | watermark;
+
+    return L3GD20_OK;
+}
+
+l3gd20_result_t l3gd20_dev_read_fifo(l3gd20_t *dev, l3gd20_data_t data[], uint8_t max, uint8_t *count) {
+    uint8_t fifo_src, level, i;
+    uint8_t buf[2 + L3GD20_FIFO_SIZE * L3GD20_SAMPLE_LEN];
+    uint8_t *out = buf;
+
+    *count = 0;
+
+    if (l3gd20_read_spi(dev, L3GD20_REG_FIFO_SRC_REG, &fifo_src) != L3GD20_OK) {
+        return L3GD20_ERROR;
+    }
 
-    /* set sensitivity scale correction */
-    if (l3gd20_scale == L3GD20_SCALE_250) {
-        s = L3GD20_SENSITIVITY_250 * 0.001;
-    } else if (l3gd20_scale == L3GD20_SCALE_500) {
-        s = L3GD20_SENSITIVITY_500 * 0.001;
+    /* FSS saturates at 31, a full FIFO is reported as overrun */
+    if (fifo_src & L3GD20_FIFO_SRC_EMPTY) {
+        level = 0;
+    } else if (fifo_src & L3GD20_FIFO_SRC_OVRN) {
+        level = L3GD20_FIFO_SIZE;
     } else {
-        s = L3GD20_SENSITIVITY_2000 * 0.001;
+        level = fifo_src & L3GD20_FIFO_SRC_FSS;
     }
 
-    /* convert results */
-    temp = (float) data->x * s;
-    data->x = (int16_t) temp;
-    temp = (float) data->y * s;
-    data->y = (int16_t) temp;
-    temp = (float) data->z * s;
-    data->z = (int16_t) temp;
+    dev->fifo_status.level = level;
+    dev->fifo_status.watermark = (fifo_src & L3GD20_FIFO_SRC_WTM) != 0;
+    dev->fifo_status.overrun = (fifo_src & L3GD20_FIFO_SRC_OVRN) != 0;
+
+    if (level > max) {
+        level = max;
+    }
+
+    /*
+     * the address wraps from OUT_Z_H back to OUT_X_L while the FIFO is enabled, so one burst drains
+     * every sample. A burst starting at OUT_TEMP passes STATUS_REG before the first sample.
+     */
+    if (level > 0 && l3gd20_temp_due(dev)) {
+        if (l3gd20_read_spi_multi(dev, L3GD20_REG_OUT_TEMP, buf, 2 + level * L3GD20_SAMPLE_LEN) != L3GD20_OK) {
+            return L3GD20_ERROR;
+        }
+
+        l3gd20_update_temp(dev, buf[0]);
+        out = &buf[2];
+    } else if (level > 0) {
+        if (l3gd20_read_spi_multi(dev, L3GD20_REG_OUT_X_L, buf, level * L3GD20_SAMPLE_LEN) != L3GD20_OK) {
+            return L3GD20_ERROR;
+        }
+    }
+
+    for (i = 0; i < level; i++) {
+        l3gd20_convert(dev, &data[i], &out[i * L3GD20_SAMPLE_LEN]);
+    }
+
+    *count = level;
+
+    if (dev->fifo_status.overrun) {
+        dev->fifo_status.overruns++;
+
+        /* FIFO mode stops collecting once full, pass through bypass to restart it */
+        if ((dev->fifo_ctrl & L3GD20_FIFO_CTRL_FM) == L3GD20_FIFO_FIFO) {
+            if (l3gd20_write_spi(dev, L3GD20_REG_FIFO_CTRL_REG, (uint8_t) L3GD20_FIFO_BYPASS) != L3GD20_OK) {
+                return L3GD20_ERROR;
+            }
+
+            if (l3gd20_write_spi(dev, L3GD20_REG_FIFO_CTRL_REG, dev->fifo_ctrl) != L3GD20_OK) {
+                return L3GD20_ERROR;
+            }
+        }
+
+        return L3GD20_OVERRUN;
+    }
 
     return L3GD20_OK;
 }
 
-l3gd20_result_t l3gd20_read_spi(uint8_t address, uint8_t *data) {
-    uint8_t address_out = address | 0x80;
+void l3gd20_dev_get_fifo_status(const l3gd20_t *dev, l3gd20_fifo_status_t *status) {
+    *status = dev->fifo_status;
+}
+
+l3gd20_result_t l3gd20_dev_stream_start(l3gd20_t *dev, l3gd20_callback_t callback) {
+    if (dev->hspi == NULL) {
+        return L3GD20_ERROR;
+    }
+
+    dev->stream_callback = callback;
+    dev->stream_on = true;
 
-    L3GD20_CS_LOW;
+    return l3gd20_dev_stream_trigger(dev);
+}
+
+l3gd20_result_t l3gd20_dev_stream_trigger(l3gd20_t *dev) {
+    l3gd20_result_t result;
+    uint32_t primask;
 
-    if (HAL_SPI_Transmit(l3gd20_hspi, &address_out, 1, 50) != HAL_OK) {
+    if (!dev->stream_on) {
         return L3GD20_ERROR;
     }
-    if (HAL_SPI_Receive(l3gd20_hspi, data, 1, 50) != HAL_OK) {
+
+    /* the bus check and the claim of the bus are one step for the thread and the interrupts */
+    primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (l3gd20_bus_busy(dev->hspi)) {
+        dev->stream_pending = true;
+        result = L3GD20_OK;
+    } else {
+        result = l3gd20_stream_begin(dev);
+    }
+
+    __set_PRIMASK(primask);
+
+    return result;
+}
+
+void l3gd20_dev_stream_stop(l3gd20_t *dev) {
+    dev->stream_on = false;
+    dev->stream_pending = false;
+}
+
+void l3gd20_dev_set_ring(l3gd20_t *dev, imu_ring_t *ring) {
+    dev->ring = ring;
+}
+
+void l3gd20_spi_txrx_cplt(SPI_HandleTypeDef *hspi) {
+    l3gd20_t *dev;
+    uint8_t idx;
+    uint8_t *rx;
+
+    for (dev = l3gd20_devices; dev != NULL; dev = dev->next) {
+        if (dev->hspi == hspi && dev->stream_busy) {
+            break;
+        }
+    }
+
+    if (dev == NULL) {
+        return;
+    }
+
+    idx = dev->stream_idx;
+    rx = dev->stream_rx[idx];
+
+    HAL_GPIO_WritePin(dev->cs_port, dev->cs_pin, GPIO_PIN_SET);
+
+    dev->stream_idx ^= 1;
+    dev->stream_busy = false;
+
+    /* start the next transfer on this bus before decoding this one */
+    l3gd20_stream_resume(hspi, dev);
+
+    if (!dev->stream_on) {
+        return;
+    }
+
+    /* OUT_TEMP follows the address byte, step over it so rx[1] is STATUS_REG either way */
+    if (dev->stream_temp[idx]) {
+        dev->temp_out = rx[1];
+        dev->temp_new = true;
+        rx++;
+    }
+
+    if (rx[1] & L3GD20_SR_ZYXDA) {
+        dev->status = rx[1];
+        l3gd20_convert(dev, &dev->stream_data[idx], &rx[2]);
+
+        if (dev->ring != NULL) {
+            imu_ring_push(dev->ring, IMU_RING_GYRO, dev->raw ? IMU_RING_FLAG_RAW : 0, dev->stream_data[idx].x, dev->stream_data[idx].y, dev->stream_data[idx].z);
+        }
+
+        if (dev->stream_callback != NULL) {
+            dev->stream_callback(dev, L3GD20_OK, &dev->stream_data[idx]);
+        }
+    }
+}
+
+void l3gd20_spi_error(SPI_HandleTypeDef *hspi) {
+    l3gd20_t *dev;
+
+    for (dev = l3gd20_devices; dev != NULL; dev = dev->next) {
+        if (dev->hspi == hspi && dev->stream_busy) {
+            break;
+        }
+    }
+
+    if (dev == NULL) {
+        return;
+    }
+
+    HAL_GPIO_WritePin(dev->cs_port, dev->cs_pin, GPIO_PIN_SET);
+
+    dev->stream_busy = false;
+
+    /* the sample was not read and DRDY stays high, read it again instead of waiting for an edge */
+    if (dev->stream_on && l3gd20_drdy_routed(dev)) {
+        dev->stream_pending = true;
+    }
+
+    if (dev->stream_on && dev->stream_callback != NULL) {
+        dev->stream_callback(dev, L3GD20_ERROR, NULL);
+    }
+
+    l3gd20_stream_resume(hspi, dev);
+}
+
+l3gd20_result_t l3gd20_dev_set_int(l3gd20_t *dev, uint8_t ctrl_reg3) {
+    l3gd20_ctrl_modify(dev, L3GD20_REG_CTRL_REG3, 0xFF, ctrl_reg3);
+
+    if (l3gd20_ctrl_flush(dev) != L3GD20_OK) {
         return L3GD20_ERROR;
     }
 
-    L3GD20_CS_HIGH;
+    /* DRDY is a level signal, a sample may already be waiting and its edge is gone */
+    if (ctrl_reg3 & L3GD20_CR3_I2_DRDY) {
+        l3gd20_dev_on_drdy(dev);
+    }
 
     return L3GD20_OK;
 }
 
-l3gd20_result_t l3gd20_write_spi(uint8_t address, uint8_t data) {
-    uint8_t buf[2] = { address, data };
+void l3gd20_dev_on_drdy(l3gd20_t *dev) {
+    if (!l3gd20_drdy_routed(dev)) {
+        return;
+    }
+
+    if (!dev->stream_on) {
+        dev->drdy_pending = true;
+        return;
+    }
+
+    /* a transfer that could not start is retried at the end of the next one on the bus */
+    if (l3gd20_dev_stream_trigger(dev) != L3GD20_OK) {
+        dev->stream_pending = true;
+
+        if (dev->stream_callback != NULL) {
+            dev->stream_callback(dev, L3GD20_ERROR, NULL);
+        }
+    }
+}
+
+/* single sensor API */
+l3gd20_t *l3gd20_get_default(void) {
+    return &l3gd20_default;
+}
+
+l3gd20_result_t l3gd20_init(SPI_HandleTypeDef *hspi, l3gd20_scale_t scale) {
+    return l3gd20_dev_init(&l3gd20_default, hspi, L3GD20_CS_PORT, L3GD20_CS_PIN, scale);
+}
+
+l3gd20_result_t l3gd20_read(l3gd20_data_t *data) {
+    return l3gd20_dev_read(&l3gd20_default, data);
+}
+
+uint8_t l3gd20_get_status(void) {
+    return l3gd20_dev_get_status(&l3gd20_default);
+}
+
+l3gd20_result_t l3gd20_set_bus_policy(const imu_bus_policy_t *policy) {
+    return l3gd20_dev_set_bus_policy(&l3gd20_default, policy);
+}
+
+l3gd20_result_t l3gd20_set_odr(uint8_t dr_bw) {
+    return l3gd20_dev_set_odr(&l3gd20_default, dr_bw);
+}
+
+l3gd20_result_t l3gd20_set_scale(l3gd20_scale_t scale) {
+    return l3gd20_dev_set_scale(&l3gd20_default, scale);
+}
+
+l3gd20_result_t l3gd20_set_hpf(const l3gd20_hpf_config_t *config) {
+    return l3gd20_dev_set_hpf(&l3gd20_default, config);
+}
+
+void l3gd20_set_bias(const float bias_dps[3]) {
+    l3gd20_dev_set_bias(&l3gd20_default, bias_dps);
+}
+
+void l3gd20_set_temp_rate(uint16_t every) {
+    l3gd20_dev_set_temp_rate(&l3gd20_default, every);
+}
+
+void l3gd20_apply_temp(void) {
+    l3gd20_dev_apply_temp(&l3gd20_default);
+}
+
+l3gd20_result_t l3gd20_get_temp(int8_t *temp) {
+    return l3gd20_dev_get_temp(&l3gd20_default, temp);
+}
+
+void l3gd20_set_temp_comp(const imu_tempcomp_t *table) {
+    l3gd20_dev_set_temp_comp(&l3gd20_default, table);
+}
+
+l3gd20_result_t l3gd20_read_raw(l3gd20_data_t *data) {
+    return l3gd20_dev_read_raw(&l3gd20_default, data);
+}
+
+void l3gd20_convert_mdps(l3gd20_data_fixed_t *conv, const l3gd20_data_t *raw) {
+    l3gd20_dev_convert_mdps(&l3gd20_default, conv, raw);
+}
+
+void l3gd20_convert_q16(l3gd20_data_fixed_t *conv, const l3gd20_data_t *raw) {
+    l3gd20_dev_convert_q16(&l3gd20_default, conv, raw);
+}
+
+void l3gd20_convert_dps(l3gd20_data_dps_t *conv, const l3gd20_data_t *raw) {
+    l3gd20_dev_convert_dps(&l3gd20_default, conv, raw);
+}
+
+l3gd20_result_t l3gd20_set_fifo(l3gd20_fifo_mode_t mode, uint8_t watermark) {
+    return l3gd20_dev_set_fifo(&l3gd20_default, mode, watermark);
+}
+
+l3gd20_result_t l3gd20_read_fifo(l3gd20_data_t data[], uint8_t max, uint8_t *count) {
+    return l3gd20_dev_read_fifo(&l3gd20_default, data, max, count);
+}
+
+void l3gd20_get_fifo_status(l3gd20_fifo_status_t *status) {
+    l3gd20_dev_get_fifo_status(&l3gd20_default, status);
+}
+
+l3gd20_result_t l3gd20_stream_start(l3gd20_callback_t callback) {
+    return l3gd20_dev_stream_start(&l3gd20_default, callback);
+}
+
+l3gd20_result_t l3gd20_stream_trigger(void) {
+    return l3gd20_dev_stream_trigger(&l3gd20_default);
+}
+
+void l3gd20_stream_stop(void) {
+    l3gd20_dev_stream_stop(&l3gd20_default);
+}
+
+l3gd20_result_t l3gd20_set_int(uint8_t ctrl_reg3) {
+    return l3gd20_dev_set_int(&l3gd20_default, ctrl_reg3);
+}
 
-    L3GD20_CS_LOW;
+void l3gd20_on_drdy(void) {
+    l3gd20_dev_on_drdy(&l3gd20_default);
+}
+
+/* private functions */
+static bool l3gd20_bus_busy(const SPI_HandleTypeDef *hspi) {
+    const l3gd20_t *it;
+
+    for (it = l3gd20_devices; it != NULL; it = it->next) {
+        if (it->hspi == hspi && (it->stream_busy || it->blocking)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool l3gd20_drdy_routed(const l3gd20_t *dev) {
+    return (L3GD20_CTRL(dev, L3GD20_REG_CTRL_REG3) & L3GD20_CR3_I2_DRDY) != 0;
+}
+
+static void l3gd20_stream_resume(SPI_HandleTypeDef *hspi, l3gd20_t *after) {
+    l3gd20_t *it = after;
+
+    /* round robin over the devices sharing the bus, starting after the one that just finished */
+    do {
+        it = it->next != NULL ? it->next : l3gd20_devices;
 
-    if (HAL_SPI_Transmit(l3gd20_hspi, buf, 2, 100) != HAL_OK) {
+        if (it->hspi == hspi && it->stream_on && it->stream_pending) {
+            it->stream_pending = false;
+
+            if (l3gd20_stream_begin(it) != L3GD20_OK) {
+                /* a sample behind DRDY raises no new edge, it stays pending for the next resume */
+                it->stream_pending = l3gd20_drdy_routed(it);
+
+                if (it->stream_callback != NULL) {
+                    it->stream_callback(it, L3GD20_ERROR, NULL);
+                }
+            }
+
+            return;
+        }
+    } while (it != after);
+}
+
+static l3gd20_result_t l3gd20_stream_begin(l3gd20_t *dev) {
+    bool temp = l3gd20_temp_due(dev);
+
+    dev->stream_busy = true;
+    dev->stream_temp[dev->stream_idx] = temp;
+    dev->stream_tx[0] = (temp ? L3GD20_REG_OUT_TEMP : L3GD20_REG_STATUS_REG) | L3GD20_SPI_READ | L3GD20_SPI_MS;
+
+    HAL_GPIO_WritePin(dev->cs_port, dev->cs_pin, GPIO_PIN_RESET);
+
+    if (HAL_SPI_TransmitReceive_DMA(dev->hspi, dev->stream_tx, dev->stream_rx[dev->stream_idx], temp ? L3GD20_STREAM_TEMP_LEN : L3GD20_STREAM_LEN) != HAL_OK) {
+        HAL_GPIO_WritePin(dev->cs_port, dev->cs_pin, GPIO_PIN_SET);
+        dev->stream_busy = false;
         return L3GD20_ERROR;
     }
 
-    L3GD20_CS_HIGH;
+    return L3GD20_OK;
+}
+
+static void l3gd20_ctrl_modify(l3gd20_t *dev, uint8_t reg, uint8_t mask, uint8_t value) {
+    uint8_t old = L3GD20_CTRL(dev, reg);
+    uint8_t updated = (old & ~mask) | (value & mask);
+
+    /* an unchanged register is not written again */
+    if (updated != old) {
+        L3GD20_CTRL(dev, reg) = updated;
+        dev->ctrl_dirty |= 1 << (reg - L3GD20_REG_CTRL_REG1);
+    }
+}
+
+static l3gd20_result_t l3gd20_ctrl_flush(l3gd20_t *dev) {
+    l3gd20_result_t result;
+    uint8_t first, last;
+
+    /* one auto-increment burst per run of dirty registers */
+    for (first = 0; first < L3GD20_CTRL_COUNT; first = last) {
+        last = first + 1;
+
+        if (!(dev->ctrl_dirty & (1 << first))) {
+            continue;
+        }
+
+        while (last < L3GD20_CTRL_COUNT && (dev->ctrl_dirty & (1 << last))) {
+            last++;
+        }
+
+        result = l3gd20_write_spi_multi(dev, L3GD20_REG_CTRL_REG1 + first, &dev->ctrl[first], last - first);
+        if (result != L3GD20_OK) {
+            return result;
+        }
+
+        dev->ctrl_dirty &= ~(((1 << last) - 1) & ~((1 << first) - 1));
+    }
 
     return L3GD20_OK;
 }
 
+static void l3gd20_update_scale(l3gd20_t *dev, l3gd20_scale_t scale) {
+    uint8_t fs;
+
+    if (scale == L3GD20_SCALE_250) {
+        fs = 0x00;
+        dev->mdps_lsb_q8 = L3GD20_SENSITIVITY_250_Q8;
+    } else if (scale == L3GD20_SCALE_500) {
+        fs = 0x10;
+        dev->mdps_lsb_q8 = L3GD20_SENSITIVITY_500_Q8;
+    } else {
+        fs = 0x20;
+        dev->mdps_lsb_q8 = L3GD20_SENSITIVITY_2000_Q8;
+    }
+
+    dev->scale = scale;
+    l3gd20_ctrl_modify(dev, L3GD20_REG_CTRL_REG4, L3GD20_CR4_FS, fs);
+
+    /* dps per digit in Q0.32: mdps * 2^32 / 1000 = mdps_q8 * 2^24 / 1000, rounded */
+    dev->dps_lsb_q32 = (int32_t) (((int64_t) dev->mdps_lsb_q8 * (1 << 24) + 500) / 1000);
+    dev->dps_lsb = (float) dev->mdps_lsb_q8 / 256000.0f;
+
+    l3gd20_update_factors(dev);
+}
+
+static void l3gd20_update_factors(l3gd20_t *dev) {
+    l3gd20_factors_t *f = &dev->factors[dev->factors_idx ^ 1];
+    float bias[3] = { 0.0f, 0.0f, 0.0f };
+    float scale[3] = { 1.0f, 1.0f, 1.0f };
+    uint8_t i;
+
+    if (dev->temp_table != NULL && dev->temp_valid) {
+        imu_tempcomp_eval(dev->temp_table, (float) dev->temp, bias, scale);
+    }
+
+    /* scale * (dps_lsb * raw - bias(T)) - bias = k * raw - offset, the fixed-point ones are taken here once */
+    for (i = 0; i < 3; i++) {
+        f->dps_k[i] = scale[i] * dev->dps_lsb;
+        f->offset_dps[i] = scale[i] * bias[i] + dev->bias_dps[i];
+        f->mdps_k_q8[i] = l3gd20_round((double) scale[i] * dev->mdps_lsb_q8);
+        f->dps_k_q32[i] = l3gd20_round((double) scale[i] * dev->dps_lsb_q32);
+        f->offset_mdps[i] = l3gd20_round((double) f->offset_dps[i] * 1000.0);
+        f->offset_q16[i] = l3gd20_round((double) f->offset_dps[i] * 65536.0);
+    }
+
+    /* the conversions in the SPI interrupt switch over with this one store */
+    dev->factors_idx ^= 1;
+}
+
+static void l3gd20_update_temp(l3gd20_t *dev, uint8_t out_temp) {
+    int8_t temp = (int8_t) (L3GD20_TEMP_OFFSET - (int8_t) out_temp);
+
+    /* the table is only evaluated when the reading changes */
+    if (dev->temp_valid && temp == dev->temp) {
+        return;
+    }
+
+    dev->temp = temp;
+    dev->temp_valid = true;
+
+    if (dev->temp_table != NULL) {
+        l3gd20_update_factors(dev);
+    }
+}
+
+static bool l3gd20_temp_due(l3gd20_t *dev) {
+    if (dev->temp_every == 0 || --dev->temp_count > 0) {
+        return false;
+    }
+
+    dev->temp_count = dev->temp_every;
+
+    return true;
+}
+
+static int32_t l3gd20_round(double value) {
+    return (int32_t) ((value < 0.0) ? value - 0.5 : value + 0.5);
+}
+
+static void l3gd20_decode(l3gd20_data_t *data, const uint8_t *buf) {
+    data->x = buf[L3GD20_XHI] << 8 | buf[L3GD20_XLO];
+    data->y = buf[L3GD20_YHI] << 8 | buf[L3GD20_YLO];
+    data->z = buf[L3GD20_ZHI] << 8 | buf[L3GD20_ZLO];
+}
+
+static void l3gd20_convert(const l3gd20_t *dev, l3gd20_data_t *data, const uint8_t *buf) {
+    const l3gd20_factors_t *f = &dev->factors[dev->factors_idx];
+
+    l3gd20_decode(data, buf);
+
+    if (dev->raw) {
+        return;
+    }
+
+    /* whole dps, integer only since this also runs in the SPI interrupt */
+    data->x = (int16_t) ((data->x * f->mdps_k_q8[0] / 256 - f->offset_mdps[0]) / 1000);
+    data->y = (int16_t) ((data->y * f->mdps_k_q8[1] / 256 - f->offset_mdps[1]) / 1000);
+    data->z = (int16_t) ((data->z * f->mdps_k_q8[2] / 256 - f->offset_mdps[2]) / 1000);
+}
+
+static l3gd20_result_t l3gd20_read_spi(l3gd20_t *dev, uint8_t address, uint8_t *data) {
+    return l3gd20_read_spi_multi(dev, address, data, 1);
+}
+
+static l3gd20_result_t l3gd20_write_spi(l3gd20_t *dev, uint8_t address, uint8_t data) {
+    return l3gd20_write_spi_multi(dev, address, &data, 1);
+}
+
+static l3gd20_result_t l3gd20_read_spi_multi(l3gd20_t *dev, uint8_t address, uint8_t *data, uint16_t len) {
+    uint8_t address_out = address | L3GD20_SPI_READ;
+
+    if (len > 1) {
+        address_out |= L3GD20_SPI_MS;
+    }
+
+    return l3gd20_transfer(dev, &address_out, 1, data, len);
+}
+
+static l3gd20_result_t l3gd20_write_spi_multi(l3gd20_t *dev, uint8_t address, const uint8_t *data, uint16_t len) {
+    uint8_t buf[8];
+    uint16_t i;
+
+    if (len > sizeof(buf) - 1) {
+        return L3GD20_ERROR;
+    }
+
+    buf[0] = address;
+    if (len > 1) {
+        buf[0] |= L3GD20_SPI_MS;
+    }
+
+    for (i = 0; i < len; i++) {
+        buf[i + 1] = data[i];
+    }
+
+    return l3gd20_transfer(dev, buf, len + 1, NULL, 0);
+}
+
+/* one blocking transaction with the retries of the bus policy, rx may be NULL */
+static l3gd20_result_t l3gd20_transfer(l3gd20_t *dev, uint8_t *tx, uint16_t tx_len, uint8_t *rx, uint16_t rx_len) {
+    l3gd20_result_t result;
+    HAL_StatusTypeDef status;
+    uint32_t start_tick;
+    uint32_t primask;
+    uint8_t attempt;
+
+    /* hold the bus, a stream trigger from an interrupt only marks itself pending until the end */
+    primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (l3gd20_bus_busy(dev->hspi)) {
+        __set_PRIMASK(primask);
+        return L3GD20_BUSY;
+    }
+
+    dev->blocking = true;
+    __set_PRIMASK(primask);
+
+    for (attempt = 0;; attempt++) {
+        IMU_STATS_BEGIN(start);
+
+        start_tick = HAL_GetTick();
+
+        HAL_GPIO_WritePin(dev->cs_port, dev->cs_pin, GPIO_PIN_RESET);
+
+        status = HAL_SPI_Transmit(dev->hspi, tx, tx_len, imu_bus_timeout_ms(&dev->bus));
+        if (status == HAL_OK && rx != NULL) {
+            uint32_t remaining = imu_bus_remaining_ms(&dev->bus, start_tick);
+
+            status = (remaining == 0) ? HAL_TIMEOUT : HAL_SPI_Receive(dev->hspi, rx, rx_len, remaining);
+        }
+
+        /* chip select is released on every path, a held CS would wedge the next transaction */
+        HAL_GPIO_WritePin(dev->cs_port, dev->cs_pin, GPIO_PIN_SET);
+
+        IMU_STATS_END((rx != NULL) ? IMU_STATS_L3GD20_READ_SPI : IMU_STATS_L3GD20_WRITE_SPI, start, tx_len + rx_len, status);
+
+        if (status == HAL_OK) {
+            result = L3GD20_OK;
+            break;
+        }
+
+        /* drop what an aborted transfer left in the FIFOs */
+        HAL_SPI_Abort(dev->hspi);
+
+        if (attempt >= dev->bus.retries) {
+            result = L3GD20_ERROR;
+            break;
+        }
+
+        IMU_STATS_RETRY((rx != NULL) ? IMU_STATS_L3GD20_READ_SPI : IMU_STATS_L3GD20_WRITE_SPI);
+        imu_bus_backoff(&dev->bus, attempt + 1);
+    }
+
+    /* release the bus and start a stream transfer deferred meanwhile */
+    primask = __get_PRIMASK();
+    __disable_irq();
+
+    dev->blocking = false;
+    l3gd20_stream_resume(dev->hspi, dev);
+
+    __set_PRIMASK(primask);
+
+    return result;
+}
@@ -6,12 +6,26 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
+#include <stdbool.h>
+
 #include "stm32f3xx_hal.h"
+#include "imu_ring.h"
+#include "imu_bus.h"
+#include "imu_tempcomp.h"
 
-/* default CS pin on STM32F3 Discovery board */
+/* default CS pin on STM32F3 Discovery board, used by l3gd20_init */
 #define L3GD20_CS_PORT    GPIOE
 #define L3GD20_CS_PIN     GPIO_PIN_3
 
+/* default deadline of a blocking SPI transaction in ms, see l3gd20_dev_set_bus_policy */
+#ifndef L3GD20_SPI_TIMEOUT
+#define L3GD20_SPI_TIMEOUT    100
+#endif
+
+/* blocking transactions issued by l3gd20_dev_read and l3gd20_dev_read_raw, for imu_bus_worst_case_us */
+#define L3GD20_READ_TRANSACTIONS    1
+
 /* pin macros */
 #define L3GD20_CS_LOW     HAL_GPIO_WritePin(L3GD20_CS_PORT, L3GD20_CS_PIN, GPIO_PIN_RESET)
 #define L3GD20_CS_HIGH    HAL_GPIO_WritePin(L3GD20_CS_PORT, L3GD20_CS_PIN, GPIO_PIN_SET)
@@ -26,6 +40,7 @@ extern "C" {
 #define L3GD20_REG_CTRL_REG3        0x22
 #define L3GD20_REG_CTRL_REG4        0x23
 #define L3GD20_REG_CTRL_REG5        0x24
+#define L3GD20_CTRL_COUNT           5       // CTRL_REG1 .. CTRL_REG5 are shadowed by the device
 #define L3GD20_REG_REFERENCE        0x25
 #define L3GD20_REG_OUT_TEMP         0x26
 #define L3GD20_REG_STATUS_REG       0x27
@@ -47,31 +62,335 @@ extern "C" {
 #define L3GD20_REG_INT1_TSH_ZL      0x37
 #define L3GD20_REG_INT1_DURATION    0x38
 
+/* SPI address byte */
+#define L3GD20_SPI_READ    0x80    // RW bit: read access
+#define L3GD20_SPI_MS      0x40    // MS bit: auto-increment address in multiple read/write
+
+/* STATUS_REG */
+#define L3GD20_SR_XDA      (1 << 0)    // X axis new data available
+#define L3GD20_SR_YDA      (1 << 1)    // Y axis new data available
+#define L3GD20_SR_ZDA      (1 << 2)    // Z axis new data available
+#define L3GD20_SR_ZYXDA    (1 << 3)    // X, Y, Z axis new data available
+#define L3GD20_SR_XOR      (1 << 4)    // X axis data overrun
+#define L3GD20_SR_YOR      (1 << 5)    // Y axis data overrun
+#define L3GD20_SR_ZOR      (1 << 6)    // Z axis data overrun
+#define L3GD20_SR_ZYXOR    (1 << 7)    // X, Y, Z axis data overrun
+
+/* CTRL_REG1 */
+#define L3GD20_CR1_XEN            (1 << 0)    // X axis enable
+#define L3GD20_CR1_YEN            (1 << 1)    // Y axis enable
+#define L3GD20_CR1_ZEN            (1 << 2)    // Z axis enable
+#define L3GD20_CR1_PD             (1 << 3)    // normal mode, power-down when cleared
+#define L3GD20_CR1_BW             (0b11 << 4) // bandwidth selection, datasheet pg. 31
+#define L3GD20_CR1_DR             (0b11 << 6) // output data rate selection
+#define L3GD20_CR1_DR_95          (0b00 << 6) // 95 Hz
+#define L3GD20_CR1_DR_190         (0b01 << 6) // 190 Hz
+#define L3GD20_CR1_DR_380         (0b10 << 6) // 380 Hz
+#define L3GD20_CR1_DR_760         (0b11 << 6) // 760 Hz
+
+/* CTRL_REG2 */
+#define L3GD20_CR2_HPCF           (0b1111 << 0)   // high-pass cut-off, see l3gd20_hpf_cutoff_mhz
+#define L3GD20_HPCF_MAX           9               // highest valid HPCF
+#define L3GD20_CR2_HPM            (0b11 << 4)     // high-pass filter mode
+#define L3GD20_CR2_HPM_NORMAL_RESET   (0b00 << 4) // normal, reset by reading REFERENCE
+#define L3GD20_CR2_HPM_REFERENCE      (0b01 << 4) // output relative to REFERENCE
+#define L3GD20_CR2_HPM_NORMAL         (0b10 << 4) // normal
+#define L3GD20_CR2_HPM_AUTORESET      (0b11 << 4) // reset on an interrupt event
+
+/* CTRL_REG3 */
+#define L3GD20_CR3_I2_EMPTY       (1 << 0)    // FIFO empty interrupt on DRDY/INT2
+#define L3GD20_CR3_I2_ORUN        (1 << 1)    // FIFO overrun interrupt on DRDY/INT2
+#define L3GD20_CR3_I2_WTM         (1 << 2)    // FIFO watermark interrupt on DRDY/INT2
+#define L3GD20_CR3_I2_DRDY        (1 << 3)    // data ready on DRDY/INT2
+#define L3GD20_CR3_PP_OD          (1 << 4)    // open drain outputs
+#define L3GD20_CR3_H_LACTIVE      (1 << 5)    // INT1 active low
+#define L3GD20_CR3_I1_BOOT        (1 << 6)    // boot status on INT1
+#define L3GD20_CR3_I1_INT1        (1 << 7)    // interrupt generator on INT1
+
+/* CTRL_REG4 */
+#define L3GD20_CR4_FS             (0b11 << 4) // full scale selection
+
+/* CTRL_REG5 */
+#define L3GD20_CR5_OUT_SEL        (0b11 << 0) // output registers and FIFO data selection
+#define L3GD20_CR5_OUT_LPF1       (0b00 << 0) // LPF1 only, the high-pass filter is bypassed
+#define L3GD20_CR5_OUT_HPF        (0b01 << 0) // LPF1 and the high-pass filter
+#define L3GD20_CR5_OUT_LPF2       (0b10 << 0) // LPF1, the high-pass filter and LPF2
+#define L3GD20_CR5_OUT_SEL_HPF    (1 << 4)    // HPen: high-pass filter enable
+#define L3GD20_CR5_FIFO_EN        (1 << 6)    // FIFO enable
+
+/* FIFO_CTRL_REG */
+#define L3GD20_FIFO_CTRL_FM       0xE0        // FIFO mode, see l3gd20_fifo_mode_t
+#define L3GD20_FIFO_CTRL_WTM      0x1F        // FIFO watermark level
+
+/* FIFO_SRC_REG */
+#define L3GD20_FIFO_SRC_FSS       0x1F        // FIFO stored data level
+#define L3GD20_FIFO_SRC_EMPTY     (1 << 5)    // FIFO empty
+#define L3GD20_FIFO_SRC_OVRN      (1 << 6)    // FIFO overrun, oldest samples overwritten
+#define L3GD20_FIFO_SRC_WTM       (1 << 7)    // FIFO level reached the watermark
+
+#define L3GD20_FIFO_SIZE          32          // samples
+
+/* output byte order, OUT_X_L first */
+#define L3GD20_XLO         0
+#define L3GD20_XHI         1
+#define L3GD20_YLO         2
+#define L3GD20_YHI         3
+#define L3GD20_ZLO         4
+#define L3GD20_ZHI         5
+#define L3GD20_SAMPLE_LEN  6
+
+/* full-duplex DMA frame: address byte, STATUS_REG, OUT_X_L .. OUT_Z_H */
+#define L3GD20_STREAM_LEN  (2 + L3GD20_SAMPLE_LEN)
+
+/* the same frame starting at OUT_TEMP, see l3gd20_dev_set_temp_rate */
+#define L3GD20_STREAM_TEMP_LEN    (1 + L3GD20_STREAM_LEN)
+
+/* OUT_TEMP is -1 digit per degC around an uncalibrated point, this many degC reads as 0 */
+#ifndef L3GD20_TEMP_OFFSET
+#define L3GD20_TEMP_OFFSET    25
+#endif
+
 /* sensitivity factors, datasheet pg. 9 */
 #define L3GD20_SENSITIVITY_250     8.75	// 8.75 mdps/digit
 #define L3GD20_SENSITIVITY_500     17.5	// 17.5 mdps/digit
 #define L3GD20_SENSITIVITY_2000    70   // 70 mdps/digit
 
+/* sensitivity factors in 1/256 mdps/digit, exact for every scale */
+#define L3GD20_SENSITIVITY_250_Q8     2240
+#define L3GD20_SENSITIVITY_500_Q8     4480
+#define L3GD20_SENSITIVITY_2000_Q8    17920
+
 typedef struct {
     int16_t x;
     int16_t y;
     int16_t z;
 } l3gd20_data_t;
 
+/* fixed-point angular rate, milli-dps or Q16.16 dps */
+typedef struct {
+    int32_t x;
+    int32_t y;
+    int32_t z;
+} l3gd20_data_fixed_t;
+
+typedef struct {
+    float x;
+    float y;
+    float z;
+} l3gd20_data_dps_t;
+
 typedef enum {
     L3GD20_OK,
-    L3GD20_ERROR
+    L3GD20_ERROR,
+    L3GD20_OVERRUN,   // data is valid, but the FIFO has overrun and samples were lost
+    L3GD20_BUSY,      // a DMA transfer is in progress on the bus
+    L3GD20_NO_DATA    // no new sample since the last read
 } l3gd20_result_t;
 
+/* on-chip high-pass filter, CTRL_REG2 and the filter bits of CTRL_REG5 */
+typedef struct {
+    bool enable;        // HPen
+    uint8_t mode;       // L3GD20_CR2_HPM_*
+    uint8_t cutoff;     // HPCF 0 .. 9, lower cut-off for higher values
+    uint8_t out_sel;    // L3GD20_CR5_OUT_*, LPF1 keeps the output unfiltered even when enabled
+} l3gd20_hpf_config_t;
+
 typedef enum {
     L3GD20_SCALE_250, // full scale to 250 mdps
     L3GD20_SCALE_500, // full scale to 500 mdps
     L3GD20_SCALE_2000 // full scale to 2000 mdps
 } l3gd20_scale_t;
 
+/* FIFO_CTRL_REG FM2-0 */
+typedef enum {
+    L3GD20_FIFO_BYPASS = 0x00,            // FIFO disabled, output registers only
+    L3GD20_FIFO_FIFO = 0x20,              // fill up to 32 samples, then stop until re-armed
+    L3GD20_FIFO_STREAM = 0x40,            // keep the newest 32 samples
+    L3GD20_FIFO_STREAM_TO_FIFO = 0x60,    // stream until INT1 event, then FIFO
+    L3GD20_FIFO_BYPASS_TO_STREAM = 0x80   // bypass until INT1 event, then stream
+} l3gd20_fifo_mode_t;
+
+typedef struct {
+    uint8_t level;      // samples stored in the FIFO when it was last drained
+    bool watermark;     // level had reached the watermark
+    bool overrun;       // samples were lost before the last drain
+    uint32_t overruns;  // number of drains that found the FIFO overrun
+} l3gd20_fifo_status_t;
+
+typedef struct l3gd20 l3gd20_t;
+
+/*
+ * Streaming callback, called from the SPI interrupt for every transfer that carried a new sample.
+ * data points into one of two buffers of the device, it stays valid until the transfer after
+ * the next one completes. On error data is NULL.
+ */
+typedef void (*l3gd20_callback_t)(l3gd20_t *dev, l3gd20_result_t result, const l3gd20_data_t *data);
+
+/* per axis factors and offsets of the conversions, bias and temperature folded in */
+typedef struct {
+    float dps_k[3];
+    float offset_dps[3];
+    int32_t mdps_k_q8[3];
+    int32_t offset_mdps[3];
+    int32_t dps_k_q32[3];
+    int32_t offset_q16[3];
+} l3gd20_factors_t;
+
+/* device handle, one per sensor. Treat as opaque, set up by l3gd20_dev_init */
+struct l3gd20 {
+    SPI_HandleTypeDef *hspi;
+    GPIO_TypeDef *cs_port;
+    uint16_t cs_pin;
+    imu_bus_policy_t bus;
+    l3gd20_scale_t scale;
+    bool raw;                   // deliver raw samples instead of whole dps
+    int32_t mdps_lsb_q8;        // conversion factors of scale, computed when the scale is set
+    int32_t dps_lsb_q32;
+    float dps_lsb;
+    float bias_dps[3];          // zero-rate offset, see l3gd20_dev_set_bias
+    l3gd20_factors_t factors[2];    // conversions use factors[factors_idx], updates fill the other one
+    volatile uint8_t factors_idx;
+
+    /* temperature */
+    const imu_tempcomp_t *temp_table;   // NULL if not compensated
+    uint16_t temp_every;        // reads between temperature reads, 0 if disabled
+    uint16_t temp_count;        // reads until the next one
+    int8_t temp;                // degC of the last reading
+    bool temp_valid;
+    volatile uint8_t temp_out;  // OUT_TEMP latched by the stream
+    volatile bool temp_new;     // temp_out is not applied yet
+
+    uint8_t status;             // STATUS_REG of the last sample
+    uint8_t ctrl[L3GD20_CTRL_COUNT];    // shadow of CTRL_REG1 .. CTRL_REG5
+    uint8_t ctrl_dirty;         // one bit per shadowed register not yet written
+    uint8_t fifo_ctrl;
+    l3gd20_fifo_status_t fifo_status;
+    volatile bool drdy_pending;
+
+    /* DMA streaming */
+    volatile bool blocking;     // a blocking transaction holds the bus, stream triggers are deferred
+    volatile bool stream_on;
+    volatile bool stream_busy;
+    volatile bool stream_pending;
+    l3gd20_callback_t stream_callback;
+    uint8_t stream_tx[L3GD20_STREAM_TEMP_LEN];
+    uint8_t stream_rx[2][L3GD20_STREAM_TEMP_LEN];    // ping-pong, one is decoded while the other is transferred
+    bool stream_temp[2];        // the buffer starts with OUT_TEMP
+    l3gd20_data_t stream_data[2];
+    uint8_t stream_idx;
+    imu_ring_t *ring;           // receives every streamed sample, may be NULL
+
+    l3gd20_t *next;             // devices are looked up by bus in the HAL callbacks
+};
+
+l3gd20_result_t l3gd20_dev_init(l3gd20_t *dev, SPI_HandleTypeDef *hspi, GPIO_TypeDef *cs_port, uint16_t cs_pin, l3gd20_scale_t scale);
+l3gd20_result_t l3gd20_dev_read(l3gd20_t *dev, l3gd20_data_t *data);
+uint8_t l3gd20_dev_get_status(const l3gd20_t *dev);    // STATUS_REG captured by the last read
+
+/*
+ * register shadow
+ * CTRL_REG1 .. CTRL_REG5 are cached by the device, reading them costs no bus traffic. Updates change
+ * the shadow and write only the registers that changed, contiguous ones in one burst. A failed
+ * write stays pending and is retried by the next update.
+ */
+uint8_t l3gd20_dev_get_ctrl(const l3gd20_t *dev, uint8_t reg);    // reg is L3GD20_REG_CTRL_REG1 .. L3GD20_REG_CTRL_REG5
+l3gd20_result_t l3gd20_dev_update_ctrl(l3gd20_t *dev, uint8_t reg, uint8_t mask, uint8_t value);    // only the bits of mask change
+l3gd20_result_t l3gd20_dev_set_odr(l3gd20_t *dev, uint8_t dr_bw);    // L3GD20_CR1_DR_* with the L3GD20_CR1_BW bits
+l3gd20_result_t l3gd20_dev_set_scale(l3gd20_t *dev, l3gd20_scale_t scale);
+l3gd20_result_t l3gd20_dev_set_hpf(l3gd20_t *dev, const l3gd20_hpf_config_t *config);
+uint32_t l3gd20_hpf_cutoff_mhz(uint8_t ctrl_reg1, uint8_t cutoff);    // cut-off at the data rate of ctrl_reg1, 0 for an invalid HPCF
+
+/*
+ * full-resolution conversion
+ * l3gd20_dev_read truncates to whole dps, read raw samples instead and convert them with the
+ * precomputed factor of the device. The fixed-point functions need no FPU.
+ */
+l3gd20_result_t l3gd20_dev_read_raw(l3gd20_t *dev, l3gd20_data_t *data);
+void l3gd20_dev_set_raw(l3gd20_t *dev, bool raw);    // FIFO reads and the stream deliver raw samples too
+void l3gd20_dev_convert_mdps(const l3gd20_t *dev, l3gd20_data_fixed_t *conv, const l3gd20_data_t *raw);
+void l3gd20_dev_convert_q16(const l3gd20_t *dev, l3gd20_data_fixed_t *conv, const l3gd20_data_t *raw);
+void l3gd20_dev_convert_dps(const l3gd20_t *dev, l3gd20_data_dps_t *conv, const l3gd20_data_t *raw);
+
+/*
+ * zero-rate bias in dps, e.g. estimated by imu_calib.c. Every conversion subtracts it, including the
+ * whole dps samples of the reads and the stream. NULL clears it. It does not depend on the scale.
+ * With a temperature table it is what remains after the table, estimate it on compensated samples.
+ */
+void l3gd20_dev_set_bias(l3gd20_t *dev, const float bias_dps[3]);
+
+/*
+ * temperature
+ * Every nth blocking read, FIFO drain and stream transfer starts its burst at OUT_TEMP instead of
+ * STATUS_REG, one byte more on the bus and no extra transaction. With a table the conversions
+ * correct the samples to scale(T) * (dps - bias(T)); the table is evaluated and folded into the
+ * conversion factors only when the reading changes, which at 1 degC per digit is rare.
+ * The stream only latches OUT_TEMP in the SPI interrupt; call l3gd20_dev_apply_temp from the main
+ * loop to take it over. New factors are filled in beside the ones in use and switched to at once,
+ * a conversion in the interrupt never sees half of them.
+ */
+void l3gd20_dev_set_temp_rate(l3gd20_t *dev, uint16_t every);    // 0 disables, the next read carries the temperature
+void l3gd20_dev_apply_temp(l3gd20_t *dev);    // thread context, the reading of the stream if there is a new one
+l3gd20_result_t l3gd20_dev_get_temp(const l3gd20_t *dev, int8_t *temp);    // degC, L3GD20_NO_DATA before the first reading
+void l3gd20_dev_set_temp_comp(l3gd20_t *dev, const imu_tempcomp_t *table);    // in dps, kept by reference, NULL disables
+
+l3gd20_result_t l3gd20_dev_set_fifo(l3gd20_t *dev, l3gd20_fifo_mode_t mode, uint8_t watermark);
+l3gd20_result_t l3gd20_dev_read_fifo(l3gd20_t *dev, l3gd20_data_t data[], uint8_t max, uint8_t *count);
+void l3gd20_dev_get_fifo_status(const l3gd20_t *dev, l3gd20_fifo_status_t *status);
+
+/*
+ * bus policy
+ * Every blocking transaction is bounded by the deadline of the device and retried as the policy
+ * says. Chip select is released after every attempt. The default is L3GD20_SPI_TIMEOUT and no
+ * retries, set the policy after l3gd20_dev_init.
+ */
+l3gd20_result_t l3gd20_dev_set_bus_policy(l3gd20_t *dev, const imu_bus_policy_t *policy);
+uint32_t l3gd20_dev_read_bound_us(const l3gd20_t *dev);    // worst case of a blocking read in us
+
+/*
+ * DMA streaming, a trigger issued while the bus is busy is started from the completion of the
+ * running transfer, or from the end of a blocking transaction of any device on the bus
+ */
+l3gd20_result_t l3gd20_dev_stream_start(l3gd20_t *dev, l3gd20_callback_t callback);
+l3gd20_result_t l3gd20_dev_stream_trigger(l3gd20_t *dev);    // call at the sample rate from a timer, or let l3gd20_dev_on_drdy do it
+void l3gd20_dev_stream_stop(l3gd20_t *dev);
+void l3gd20_dev_set_ring(l3gd20_t *dev, imu_ring_t *ring);    // streamed samples are pushed to ring, NULL to disable
+void l3gd20_spi_txrx_cplt(SPI_HandleTypeDef *hspi);    // call from HAL_SPI_TxRxCpltCallback
+void l3gd20_spi_error(SPI_HandleTypeDef *hspi);        // call from HAL_SPI_ErrorCallback
+
+/*
+ * interrupt routing, with L3GD20_CR3_I2_DRDY set reads are scheduled by l3gd20_dev_on_drdy
+ * DRDY stays high until the output is read, so a failed read keeps its interrupt pending: the next
+ * blocking read tries again, a failed stream transfer is started again when the bus is free.
+ */
+l3gd20_result_t l3gd20_dev_set_int(l3gd20_t *dev, uint8_t ctrl_reg3);
+void l3gd20_dev_on_drdy(l3gd20_t *dev);    // call from the EXTI callback of the DRDY/INT2 pin
 
+/* single sensor API, operates on a default device with the CS pin L3GD20_CS_PORT/L3GD20_CS_PIN */
+l3gd20_t *l3gd20_get_default(void);
 l3gd20_result_t l3gd20_init(SPI_HandleTypeDef *hspi, l3gd20_scale_t scale);
 l3gd20_result_t l3gd20_read(l3gd20_data_t *data);
+uint8_t l3gd20_get_status(void);
+l3gd20_result_t l3gd20_read_raw(l3gd20_data_t *data);
+l3gd20_result_t l3gd20_set_bus_policy(const imu_bus_policy_t *policy);
+l3gd20_result_t l3gd20_set_odr(uint8_t dr_bw);
+l3gd20_result_t l3gd20_set_scale(l3gd20_scale_t scale);
+l3gd20_result_t l3gd20_set_hpf(const l3gd20_hpf_config_t *config);
+void l3gd20_set_bias(const float bias_dps[3]);
+void l3gd20_set_temp_rate(uint16_t every);
+void l3gd20_apply_temp(void);
+l3gd20_result_t l3gd20_get_temp(int8_t *temp);
+void l3gd20_set_temp_comp(const imu_tempcomp_t *table);
+void l3gd20_convert_mdps(l3gd20_data_fixed_t *conv, const l3gd20_data_t *raw);
+void l3gd20_convert_q16(l3gd20_data_fixed_t *conv, const l3gd20_data_t *raw);
+void l3gd20_convert_dps(l3gd20_data_dps_t *conv, const l3gd20_data_t *raw);
+l3gd20_result_t l3gd20_set_fifo(l3gd20_fifo_mode_t mode, uint8_t watermark);
+l3gd20_result_t l3gd20_read_fifo(l3gd20_data_t data[], uint8_t max, uint8_t *count);
+void l3gd20_get_fifo_status(l3gd20_fifo_status_t *status);
+l3gd20_result_t l3gd20_stream_start(l3gd20_callback_t callback);
+l3gd20_result_t l3gd20_stream_trigger(void);
+void l3gd20_stream_stop(void);
+l3gd20_result_t l3gd20_set_int(uint8_t ctrl_reg3);
+void l3gd20_on_drdy(void);
 
 /* C++ detection */
 #ifdef __cplusplus
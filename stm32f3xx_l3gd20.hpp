@@ -0,0 +1,74 @@
+#ifndef __L3GD20_HPP__
+#define __L3GD20_HPP__
+
+#include <cstdint>
+
+#include "stm32f3xx_l3gd20.h"
+
+/*
+ * C++17 front-end
+ * The bus, the chip select and the scale are template parameters, the register values and the
+ * nominal conversion factors are constants of the type. Every member is static and calls the C
+ * driver on a device of its own, there is no object and no virtual call. Bus and CsPin are types
+ * with static members, e.g.
+ *
+ *   struct Spi1 { static SPI_HandleTypeDef *handle() { return &hspi1; } };
+ *   struct CsPE3 { static GPIO_TypeDef *port() { return GPIOE; } static constexpr uint16_t pin = GPIO_PIN_3; };
+ *   using Gyro = L3gd20<Spi1, CsPE3, L3GD20_SCALE_500>;
+ *
+ * The nominal conversions ignore the bias and the temperature table, convert_* apply them.
+ */
+
+template <typename Bus, typename CsPin, l3gd20_scale_t Scale, uint8_t DrBw = L3GD20_CR1_DR | L3GD20_CR1_BW>
+class L3gd20 {
+    static_assert(Scale == L3GD20_SCALE_250 || Scale == L3GD20_SCALE_500 || Scale == L3GD20_SCALE_2000, "invalid scale");
+    static_assert((DrBw & ~(L3GD20_CR1_DR | L3GD20_CR1_BW)) == 0, "DrBw takes only L3GD20_CR1_DR_* and L3GD20_CR1_BW bits");
+    static_assert(CsPin::pin != 0, "no chip select pin");
+
+public:
+    /* CTRL_REG1 and CTRL_REG4 as written by init, DrBw defaults to what l3gd20_dev_init sets */
+    static constexpr uint8_t ctrl_reg1 = DrBw | L3GD20_CR1_PD | L3GD20_CR1_XEN | L3GD20_CR1_YEN | L3GD20_CR1_ZEN;
+    static constexpr uint8_t ctrl_reg4 = Scale == L3GD20_SCALE_250 ? 0x00 : Scale == L3GD20_SCALE_500 ? 0x10 : 0x20;
+
+    /* same values and expressions as l3gd20_update_scale, the results match the C conversions bit for bit */
+    static constexpr int32_t mdps_lsb_q8 = Scale == L3GD20_SCALE_250 ? L3GD20_SENSITIVITY_250_Q8 :
+                                           Scale == L3GD20_SCALE_500 ? L3GD20_SENSITIVITY_500_Q8 : L3GD20_SENSITIVITY_2000_Q8;
+    static constexpr float dps_lsb = (float) mdps_lsb_q8 / 256000.0f;
+
+    static l3gd20_result_t init() {
+        if (l3gd20_dev_init(&dev, Bus::handle(), CsPin::port(), CsPin::pin, Scale) != L3GD20_OK) {
+            return L3GD20_ERROR;
+        }
+
+        if constexpr (DrBw != (L3GD20_CR1_DR | L3GD20_CR1_BW)) {
+            return l3gd20_dev_set_odr(&dev, DrBw);
+        }
+
+        return L3GD20_OK;
+    }
+
+    static l3gd20_result_t read(l3gd20_data_t &data) { return l3gd20_dev_read(&dev, &data); }
+    static l3gd20_result_t read_raw(l3gd20_data_t &data) { return l3gd20_dev_read_raw(&dev, &data); }
+
+    /* nominal conversions, inlined with the factor as an immediate */
+    static constexpr l3gd20_data_fixed_t to_mdps(const l3gd20_data_t &raw) {
+        return { raw.x * mdps_lsb_q8 / 256, raw.y * mdps_lsb_q8 / 256, raw.z * mdps_lsb_q8 / 256 };
+    }
+
+    static constexpr l3gd20_data_dps_t to_dps(const l3gd20_data_t &raw) {
+        return { (float) raw.x * dps_lsb, (float) raw.y * dps_lsb, (float) raw.z * dps_lsb };
+    }
+
+    /* calibrated conversions of the driver */
+    static void convert_mdps(l3gd20_data_fixed_t &conv, const l3gd20_data_t &raw) { l3gd20_dev_convert_mdps(&dev, &conv, &raw); }
+    static void convert_q16(l3gd20_data_fixed_t &conv, const l3gd20_data_t &raw) { l3gd20_dev_convert_q16(&dev, &conv, &raw); }
+    static void convert_dps(l3gd20_data_dps_t &conv, const l3gd20_data_t &raw) { l3gd20_dev_convert_dps(&dev, &conv, &raw); }
+
+    /* for the rest of the C API, a scale changed there is not seen by the nominal conversions */
+    static l3gd20_t *device() { return &dev; }
+
+private:
+    static inline l3gd20_t dev {};
+};
+
+#endif
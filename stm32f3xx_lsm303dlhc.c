@@ -1,313 +1,1664 @@
 #include "stm32f3xx_lsm303dlhc.h"
+#include "imu_stats.h"
+#include "imu_clock.h"
+
+#ifdef ARM_MATH_CM4
+#include "arm_math.h"
+#endif
 
 /* private variables */
-static I2C_HandleTypeDef *lsm303dlhc_i2c = NULL;
-static lsm303dlhc_mag_gain_t lsm303dlhc_mag_magin = LSM303DLHC_MAGGAIN_1_3;
-static bool lsm303dlhc_mag_auto_range = false;
-static float lsm303dlhc_acc_mg_lsb = 0.001f;   // 1, 2, 4 or 12 mg per lsb
-static float lsm303dlhc_mag_gauss_lsb_xy = 1100.0f;  // Varies with gain
-static float lsm303dlhc_mag_gauss_lsb_z = 980.0f;   // Varies with gain
+static lsm303dlhc_t lsm303dlhc_default;
+
+/* magnetometer lsb/gauss of x/y and z, indexed by gain >> 5 */
+static const uint16_t lsm303dlhc_mag_lsb[8][2] = {
+    { 0, 0 },
+    { 1100, 980 },  // 1.3
+    { 855, 760 },   // 1.9
+    { 670, 600 },   // 2.5
+    { 450, 400 },   // 4.0
+    { 400, 355 },   // 4.7
+    { 330, 295 },   // 5.6
+    { 230, 205 }    // 8.1
+};
+
+/* mg per lsb of INT1_THS_A/INT2_THS_A, indexed by the FS bits of CTRL_REG4_A */
+static const uint8_t lsm303dlhc_ths_mg[4] = { 16, 32, 62, 186 };
+
+/* output data rates in mHz, indexed by ODR3..0 of CTRL_REG1_A and DO2..0 of CRA_REG_M */
+static const uint32_t lsm303dlhc_acc_rates[10] = { 0, 1000, 10000, 25000, 50000, 100000, 200000, 400000, 1620000, 1344000 };
+static const uint32_t lsm303dlhc_mag_rates[8] = { 750, 1500, 3000, 7500, 15000, 30000, 75000, 220000 };
+
+static lsm303dlhc_t *lsm303dlhc_devices = NULL;
 
 /* private functions */
-static lsm303dlhc_result_t lsm303dlhc_read_i2c(uint8_t address, uint8_t reg, uint8_t *data);
-static lsm303dlhc_result_t lsm303dlhc_write_i2c(uint8_t address, uint8_t reg, uint8_t data);
+static lsm303dlhc_result_t lsm303dlhc_read_i2c(lsm303dlhc_t *dev, uint8_t address, uint8_t reg, uint8_t *data);
+static lsm303dlhc_result_t lsm303dlhc_write_i2c(lsm303dlhc_t *dev, uint8_t address, uint8_t reg, uint8_t data);
+static lsm303dlhc_result_t lsm303dlhc_write_i2c_multi(lsm303dlhc_t *dev, uint8_t address, uint8_t reg, const uint8_t *data, uint16_t len);
+static lsm303dlhc_result_t lsm303dlhc_transfer(lsm303dlhc_t *dev, uint8_t address, uint8_t *tx, uint16_t tx_len, uint8_t *rx, uint16_t rx_len);
+static HAL_StatusTypeDef lsm303dlhc_wait_idle(lsm303dlhc_t *dev, uint32_t start_tick);
+static void lsm303dlhc_recovery_pin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state);
+static bool lsm303dlhc_ctrl_index(uint8_t address, uint8_t reg, uint8_t *idx);
+static void lsm303dlhc_ctrl_modify(lsm303dlhc_t *dev, uint8_t address, uint8_t reg, uint8_t mask, uint8_t value);
+static lsm303dlhc_result_t lsm303dlhc_ctrl_flush(lsm303dlhc_t *dev, uint8_t address);
+static float lsm303dlhc_acc_mg_lsb(uint8_t ctrl_reg4_a);
+static uint32_t lsm303dlhc_steps(uint32_t value, uint32_t step);
+static bool lsm303dlhc_mag_gain_valid(lsm303dlhc_mag_gain_t gain);
+static void lsm303dlhc_update_mag_gain(lsm303dlhc_t *dev, lsm303dlhc_mag_gain_t gain);
+static lsm303dlhc_result_t lsm303dlhc_read_i2c_multi(lsm303dlhc_t *dev, uint8_t address, uint8_t reg, uint8_t *data, uint16_t len);
+static void lsm303dlhc_decode_acc(lsm303dlhc_data_raw_t *data, const uint8_t *buf);
+static void lsm303dlhc_decode_mag(lsm303dlhc_data_raw_t *data, const uint8_t *buf);
+static lsm303dlhc_result_t lsm303dlhc_read_async(lsm303dlhc_t *dev, lsm303dlhc_xfer_t xfer, uint8_t address, uint8_t reg, lsm303dlhc_callback_t callback);
+static void lsm303dlhc_drdy_resume(lsm303dlhc_t *dev);
+static lsm303dlhc_result_t lsm303dlhc_attach(lsm303dlhc_t *dev, I2C_HandleTypeDef *i2c);
+static lsm303dlhc_t *lsm303dlhc_find(const I2C_HandleTypeDef *i2c);
+static lsm303dlhc_result_t lsm303dlhc_read_acc_output(lsm303dlhc_t *dev, lsm303dlhc_data_raw_t *data);
+static lsm303dlhc_result_t lsm303dlhc_read_mag_output(lsm303dlhc_t *dev, lsm303dlhc_mag_sample_t *sample);
+static lsm303dlhc_result_t lsm303dlhc_mag_ready(lsm303dlhc_t *dev);
+static lsm303dlhc_result_t lsm303dlhc_read_mag_data(lsm303dlhc_t *dev, lsm303dlhc_mag_sample_t *sample);
+static lsm303dlhc_result_t lsm303dlhc_mag_auto_range(lsm303dlhc_t *dev, const lsm303dlhc_data_raw_t *raw);
+static void lsm303dlhc_update_scale(lsm303dlhc_t *dev);
+static void lsm303dlhc_read_temp(lsm303dlhc_t *dev);
+static void lsm303dlhc_scale_batch(lsm303dlhc_data_t *conv, const lsm303dlhc_data_raw_t *raw, uint16_t count, const float *k, const float *b);
+static void lsm303dlhc_scale_soa(float *x, float *y, float *z, const lsm303dlhc_data_raw_t *raw, uint16_t count, const float *k, const float *b);
+static void lsm303dlhc_convert_soft(const lsm303dlhc_t *dev, lsm303dlhc_data_t *conv, const lsm303dlhc_data_raw_t *raw);
 
-lsm303dlhc_result_t lsm303dlhc_init_acc(I2C_HandleTypeDef *i2c, const lsm303dlhc_acc_init_t *init) {
-    uint8_t reg1_a;
-    lsm303dlhc_i2c = i2c;
+lsm303dlhc_result_t lsm303dlhc_dev_init_acc(lsm303dlhc_t *dev, I2C_HandleTypeDef *i2c, const lsm303dlhc_acc_init_t *init) {
+    uint8_t reg1_a, reg5_a;
 
-    if (lsm303dlhc_i2c == NULL || init == NULL) {
+    if (init == NULL || init->fifo_watermark > LSM303DLHC_ACCFIFO_CTRL_FTH) {
         return LSM303DLHC_ERROR;
     }
 
-    /* set control registers */
-    if (lsm303dlhc_write_i2c(LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_CTRL_REG1_A, init->ctrl_reg1_a) != LSM303DLHC_OK) {
+    if (lsm303dlhc_attach(dev, i2c) != LSM303DLHC_OK) {
         return LSM303DLHC_ERROR;
     }
 
-    if (lsm303dlhc_write_i2c(LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_CTRL_REG2_A, init->ctrl_reg2_a) != LSM303DLHC_OK) {
+    dev->acc_drdy = false;
+    dev->acc_drdy_pending = false;
+
+    /* FIFO_EN must be set for any mode but bypass */
+    if (init->fifo_mode == LSM303DLHC_ACCFIFO_BYPASS) {
+        reg5_a = init->ctrl_reg5_a & ~LSM303DLHC_ACR5A_FIFO_EN;
+    } else {
+        reg5_a = init->ctrl_reg5_a | LSM303DLHC_ACR5A_FIFO_EN;
+    }
+
+    /* set control registers, the state of the sensor is unknown so all of them in one burst */
+    dev->acc_ctrl.reg[0] = init->ctrl_reg1_a;
+    dev->acc_ctrl.reg[1] = init->ctrl_reg2_a;
+    dev->acc_ctrl.reg[2] = init->ctrl_reg3_a;
+    dev->acc_ctrl.reg[3] = init->ctrl_reg4_a;
+    dev->acc_ctrl.reg[4] = reg5_a;
+    dev->acc_ctrl.reg[5] = init->ctrl_reg6_a;
+    dev->acc_ctrl.dirty = (1 << LSM303DLHC_ACC_CTRL_COUNT) - 1;
+
+    dev->acc_mg_lsb = lsm303dlhc_acc_mg_lsb(init->ctrl_reg4_a);
+    lsm303dlhc_update_scale(dev);
+
+    if (lsm303dlhc_ctrl_flush(dev, LSM303DLHC_ADDR_ACC) != LSM303DLHC_OK) {
         return LSM303DLHC_ERROR;
     }
 
-    if (lsm303dlhc_write_i2c(LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_CTRL_REG3_A, init->ctrl_reg3_a) != LSM303DLHC_OK) {
+    dev->acc_fifo_ctrl = (uint8_t) init->fifo_mode | init->fifo_watermark;
+    dev->acc_fifo_status = (lsm303dlhc_fifo_status_t) { 0 };
+
+    if (lsm303dlhc_write_i2c(dev, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_FIFO_CTRL_REG_A, dev->acc_fifo_ctrl) != LSM303DLHC_OK) {
         return LSM303DLHC_ERROR;
     }
 
-    if (lsm303dlhc_set_acc_scale(init->ctrl_reg4_a) != LSM303DLHC_OK) {
+    /* LSM303DLHC has no WHOAMI register so read CTRL_REG1_A back to check if we are connected or not */
+    if (lsm303dlhc_read_i2c(dev, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_CTRL_REG1_A, &reg1_a) != LSM303DLHC_OK) {
+        return LSM303DLHC_ERROR;
+    }
+    if (reg1_a != init->ctrl_reg1_a) {
         return LSM303DLHC_ERROR;
     }
 
-    if (lsm303dlhc_write_i2c(LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_CTRL_REG5_A, init->ctrl_reg5_a) != LSM303DLHC_OK) {
+    return LSM303DLHC_OK;
+}
+
+uint8_t lsm303dlhc_dev_get_ctrl(const lsm303dlhc_t *dev, uint8_t address, uint8_t reg) {
+    uint8_t idx;
+
+    if (!lsm303dlhc_ctrl_index(address, reg, &idx)) {
+        return 0;
+    }
+
+    return (address == LSM303DLHC_ADDR_ACC) ? dev->acc_ctrl.reg[idx] : dev->mag_ctrl.reg[idx];
+}
+
+lsm303dlhc_result_t lsm303dlhc_dev_update_ctrl(lsm303dlhc_t *dev, uint8_t address, uint8_t reg, uint8_t mask, uint8_t value) {
+    uint8_t idx, updated;
+
+    if (!lsm303dlhc_ctrl_index(address, reg, &idx)) {
         return LSM303DLHC_ERROR;
     }
 
-    if (lsm303dlhc_write_i2c(LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_CTRL_REG6_A, init->ctrl_reg6_a) != LSM303DLHC_OK) {
+    updated = (lsm303dlhc_dev_get_ctrl(dev, address, reg) & ~mask) | (value & mask);
+
+    /* the conversion factors follow these two */
+    if (address == LSM303DLHC_ADDR_ACC && reg == LSM303DLHC_REG_ACC_CTRL_REG4_A) {
+        return lsm303dlhc_dev_set_acc_scale(dev, updated);
+    } else if (address == LSM303DLHC_ADDR_MAG && reg == LSM303DLHC_REG_MAG_CRB_REG_M) {
+        return lsm303dlhc_dev_set_mag_gain(dev, (lsm303dlhc_mag_gain_t) updated);
+    }
+
+    lsm303dlhc_ctrl_modify(dev, address, reg, 0xFF, updated);
+
+    return lsm303dlhc_ctrl_flush(dev, address);
+}
+
+lsm303dlhc_result_t lsm303dlhc_dev_set_bus_policy(lsm303dlhc_t *dev, const imu_bus_policy_t *policy) {
+    if (policy == NULL || policy->retries > IMU_BUS_RETRIES_MAX) {
         return LSM303DLHC_ERROR;
     }
 
-    /* LSM303DLHC has no WHOAMI register so read CTRL_REG1_A back to check if we are connected or not */
-    if (lsm303dlhc_read_i2c(LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_CTRL_REG1_A, &reg1_a) != LSM303DLHC_OK) {
+    dev->bus = *policy;
+
+    return LSM303DLHC_OK;
+}
+
+void lsm303dlhc_dev_set_recovery(lsm303dlhc_t *dev, GPIO_TypeDef *scl_port, uint16_t scl_pin, GPIO_TypeDef *sda_port, uint16_t sda_pin) {
+    dev->scl_port = scl_port;
+    dev->scl_pin = scl_pin;
+    dev->sda_port = sda_port;
+    dev->sda_pin = sda_pin;
+}
+
+lsm303dlhc_result_t lsm303dlhc_dev_recover(lsm303dlhc_t *dev) {
+    GPIO_InitTypeDef gpio = { 0 };
+    bool released;
+    uint8_t i;
+
+    if (dev->scl_port == NULL || dev->sda_port == NULL) {
         return LSM303DLHC_ERROR;
     }
-    if (reg1_a != init->ctrl_reg1_a) {
+
+    /* never take the pins from under a transfer, ours or one of another context on the same handle */
+    if (lsm303dlhc_find(dev->i2c) != NULL || HAL_I2C_GetState(dev->i2c) != HAL_I2C_STATE_READY) {
+        return LSM303DLHC_BUSY;
+    }
+
+    /* take the pins from the peripheral and drive them as open-drain outputs, released */
+    HAL_I2C_DeInit(dev->i2c);
+
+    HAL_GPIO_WritePin(dev->scl_port, dev->scl_pin, GPIO_PIN_SET);
+    HAL_GPIO_WritePin(dev->sda_port, dev->sda_pin, GPIO_PIN_SET);
+
+    gpio.Mode = GPIO_MODE_OUTPUT_OD;
+    gpio.Pull = GPIO_PULLUP;
+    gpio.Speed = GPIO_SPEED_FREQ_HIGH;
+    gpio.Pin = dev->scl_pin;
+    HAL_GPIO_Init(dev->scl_port, &gpio);
+    gpio.Pin = dev->sda_pin;
+    HAL_GPIO_Init(dev->sda_port, &gpio);
+
+    imu_clock_delay_us(LSM303DLHC_RECOVERY_HALF_US);
+
+    /* a slave stuck in a read lets go of SDA within nine clocks */
+    for (i = 0; i < 9 && HAL_GPIO_ReadPin(dev->sda_port, dev->sda_pin) == GPIO_PIN_RESET; i++) {
+        lsm303dlhc_recovery_pin(dev->scl_port, dev->scl_pin, GPIO_PIN_RESET);
+        lsm303dlhc_recovery_pin(dev->scl_port, dev->scl_pin, GPIO_PIN_SET);
+    }
+
+    /* STOP: SDA rises while SCL is high */
+    lsm303dlhc_recovery_pin(dev->scl_port, dev->scl_pin, GPIO_PIN_RESET);
+    lsm303dlhc_recovery_pin(dev->sda_port, dev->sda_pin, GPIO_PIN_RESET);
+    lsm303dlhc_recovery_pin(dev->scl_port, dev->scl_pin, GPIO_PIN_SET);
+    lsm303dlhc_recovery_pin(dev->sda_port, dev->sda_pin, GPIO_PIN_SET);
+
+    released = (HAL_GPIO_ReadPin(dev->sda_port, dev->sda_pin) == GPIO_PIN_SET);
+
+    HAL_GPIO_DeInit(dev->scl_port, dev->scl_pin);
+    HAL_GPIO_DeInit(dev->sda_port, dev->sda_pin);
+
+    /* HAL_I2C_MspInit gives the pins back to the peripheral */
+    if (HAL_I2C_Init(dev->i2c) != HAL_OK || !released) {
         return LSM303DLHC_ERROR;
     }
 
     return LSM303DLHC_OK;
 }
 
-lsm303dlhc_result_t lsm303dlhc_set_acc_scale(uint8_t ctrl_reg4_a) {
-    if (lsm303dlhc_write_i2c(LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_CTRL_REG4_A, ctrl_reg4_a) != LSM303DLHC_OK) {
+uint32_t lsm303dlhc_dev_read_acc_bound_us(const lsm303dlhc_t *dev) {
+    return imu_bus_worst_case_us(&dev->bus, LSM303DLHC_READ_ACC_TRANSACTIONS, (dev->scl_port != NULL) ? LSM303DLHC_RECOVERY_US : 0);
+}
+
+uint32_t lsm303dlhc_dev_read_mag_bound_us(const lsm303dlhc_t *dev) {
+    return imu_bus_worst_case_us(&dev->bus, LSM303DLHC_READ_MAG_TRANSACTIONS, (dev->scl_port != NULL) ? LSM303DLHC_RECOVERY_US : 0);
+}
+
+lsm303dlhc_result_t lsm303dlhc_dev_set_acc_scale(lsm303dlhc_t *dev, uint8_t ctrl_reg4_a) {
+    /* samples read after this are converted with the new scale */
+    dev->acc_mg_lsb = lsm303dlhc_acc_mg_lsb(ctrl_reg4_a);
+    lsm303dlhc_update_scale(dev);
+
+    lsm303dlhc_ctrl_modify(dev, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_CTRL_REG4_A, 0xFF, ctrl_reg4_a);
+
+    if (lsm303dlhc_ctrl_flush(dev, LSM303DLHC_ADDR_ACC) != LSM303DLHC_OK) {
         return LSM303DLHC_ERROR;
     }
 
-    if ((ctrl_reg4_a & 0b110000) == LSM303DLHC_ACR4A_FS10_1MG) {
-        lsm303dlhc_acc_mg_lsb = 0.001f;
-    } else if ((ctrl_reg4_a & 0b110000) == LSM303DLHC_ACR4A_FS10_2MG) {
-        lsm303dlhc_acc_mg_lsb = 0.002f;
-    } else if ((ctrl_reg4_a & 0b110000) == LSM303DLHC_ACR4A_FS10_4MG) {
-        lsm303dlhc_acc_mg_lsb = 0.004f;
-    } else if ((ctrl_reg4_a & 0b110000) == LSM303DLHC_ACR4A_FS10_12MG) {
-        lsm303dlhc_acc_mg_lsb = 0.012f;
+    return LSM303DLHC_OK;
+}
+
+lsm303dlhc_result_t lsm303dlhc_dev_set_acc_odr(lsm303dlhc_t *dev, uint8_t odr) {
+    lsm303dlhc_ctrl_modify(dev, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_CTRL_REG1_A, LSM303DLHC_ACR1A_ODR30, odr);
+
+    return lsm303dlhc_ctrl_flush(dev, LSM303DLHC_ADDR_ACC);
+}
+
+lsm303dlhc_result_t lsm303dlhc_dev_read_acc_raw(lsm303dlhc_t *dev, lsm303dlhc_data_raw_t *data) {
+    lsm303dlhc_result_t result;
+
+    IMU_STATS_BEGIN(start);
+
+    result = lsm303dlhc_read_acc_output(dev, data);
+
+    IMU_STATS_END(IMU_STATS_LSM303DLHC_READ_ACC, start, 0, (result == LSM303DLHC_ERROR) ? HAL_ERROR : HAL_OK);
+
+    return result;
+}
+
+static lsm303dlhc_result_t lsm303dlhc_read_acc_output(lsm303dlhc_t *dev, lsm303dlhc_data_raw_t *data) {
+    uint8_t buf[LSM303DLHC_ACC_LEN] = { 0 };
+
+    /* nothing to read until the data-ready interrupt fires */
+    if (dev->acc_drdy) {
+        if (!dev->acc_drdy_pending) {
+            return LSM303DLHC_NO_DATA;
+        }
+
+        dev->acc_drdy_pending = false;
+    }
+
+    /* the output was not read, DRDY stays high and raises no new edge */
+    if (lsm303dlhc_read_i2c_multi(dev, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_OUT_X_L_A, buf, LSM303DLHC_ACC_LEN) != LSM303DLHC_OK) {
+        dev->acc_drdy_pending = dev->acc_drdy;
+        return LSM303DLHC_ERROR;
     }
 
+    lsm303dlhc_decode_acc(data, buf);
+
     return LSM303DLHC_OK;
 }
 
-lsm303dlhc_result_t lsm303dlhc_read_acc_raw(lsm303dlhc_data_raw_t *data) {
-    uint8_t reg = LSM303DLHC_REG_ACC_OUT_X_L_A | 0x80;
-    uint8_t buf[6] = { 0 };
+void lsm303dlhc_dev_convert_acc(lsm303dlhc_t *dev, lsm303dlhc_data_t *conv, const lsm303dlhc_data_raw_t *raw) {
+    conv->x = (float) raw->x * dev->acc_k[0] + dev->acc_b[0];
+    conv->y = (float) raw->y * dev->acc_k[1] + dev->acc_b[1];
+    conv->z = (float) raw->z * dev->acc_k[2] + dev->acc_b[2];
+}
+
+void lsm303dlhc_dev_convert_acc_batch(const lsm303dlhc_t *dev, lsm303dlhc_data_t conv[], const lsm303dlhc_data_raw_t raw[], uint16_t count) {
+    lsm303dlhc_scale_batch(conv, raw, count, dev->acc_k, dev->acc_b);
+}
+
+void lsm303dlhc_dev_convert_acc_soa(const lsm303dlhc_t *dev, float x[], float y[], float z[], const lsm303dlhc_data_raw_t raw[], uint16_t count) {
+    lsm303dlhc_scale_soa(x, y, z, raw, count, dev->acc_k, dev->acc_b);
+}
 
-    if (HAL_I2C_Master_Transmit(lsm303dlhc_i2c, LSM303DLHC_ADDR_ACC, &reg, 1, 1000) != HAL_OK) {
+void lsm303dlhc_dev_set_acc_calib(lsm303dlhc_t *dev, const float offset[3], const float scale[3]) {
+    uint8_t i;
+
+    for (i = 0; i < 3; i++) {
+        dev->acc_cal_offset[i] = (offset != NULL) ? offset[i] : 0.0f;
+        dev->acc_cal_scale[i] = (scale != NULL) ? scale[i] : 1.0f;
+    }
+
+    lsm303dlhc_update_scale(dev);
+}
+
+lsm303dlhc_result_t lsm303dlhc_dev_set_acc_fifo(lsm303dlhc_t *dev, lsm303dlhc_acc_fifo_mode_t mode, uint8_t watermark) {
+    if (watermark > LSM303DLHC_ACCFIFO_CTRL_FTH) {
         return LSM303DLHC_ERROR;
     }
 
-    if (HAL_I2C_Master_Receive(lsm303dlhc_i2c, LSM303DLHC_ADDR_ACC, buf, 6, 1000) != HAL_OK) {
+    lsm303dlhc_ctrl_modify(dev, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_CTRL_REG5_A, LSM303DLHC_ACR5A_FIFO_EN,
+                           (mode == LSM303DLHC_ACCFIFO_BYPASS) ? 0 : LSM303DLHC_ACR5A_FIFO_EN);
+
+    if (lsm303dlhc_ctrl_flush(dev, LSM303DLHC_ADDR_ACC) != LSM303DLHC_OK) {
         return LSM303DLHC_ERROR;
     }
 
-    /* raw data (low byte first) */
-    data->x = (int16_t) (buf[LSM303DLHC_ACC_XLO] | (buf[LSM303DLHC_ACC_XHI] << 8)) >> 4;
-    data->y = (int16_t) (buf[LSM303DLHC_ACC_YLO] | (buf[LSM303DLHC_ACC_YHI] << 8)) >> 4;
-    data->z = (int16_t) (buf[LSM303DLHC_ACC_ZLO] | (buf[LSM303DLHC_ACC_ZHI] << 8)) >> 4;
+    if (lsm303dlhc_write_i2c(dev, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_FIFO_CTRL_REG_A, (uint8_t) mode | watermark) != LSM303DLHC_OK) {
+        return LSM303DLHC_ERROR;
+    }
+
+    dev->acc_fifo_ctrl = (uint8_t) mode | watermark;
 
     return LSM303DLHC_OK;
 }
 
-void lsm303dlhc_convert_acc(lsm303dlhc_data_t *conv, const lsm303dlhc_data_raw_t *raw) {
-    conv->x = (float) raw->x * lsm303dlhc_acc_mg_lsb * LSM303DLHC_ACC_SENSORS_GRAVITY_STANDARD;
-    conv->y = (float) raw->y * lsm303dlhc_acc_mg_lsb * LSM303DLHC_ACC_SENSORS_GRAVITY_STANDARD;
-    conv->z = (float) raw->z * lsm303dlhc_acc_mg_lsb * LSM303DLHC_ACC_SENSORS_GRAVITY_STANDARD;
-}
+lsm303dlhc_result_t lsm303dlhc_dev_read_acc_fifo(lsm303dlhc_t *dev, lsm303dlhc_data_raw_t data[], uint8_t max, uint8_t *count) {
+    uint8_t fifo_src, level, i;
+    uint8_t buf[LSM303DLHC_ACC_FIFO_SIZE * LSM303DLHC_ACC_LEN];
 
-lsm303dlhc_result_t lsm303dlhc_init_mag(I2C_HandleTypeDef *i2c, const lsm303dlhc_mag_init_t *init) {
-    uint8_t cra_reg_m;
-    lsm303dlhc_i2c = i2c;
-    lsm303dlhc_mag_auto_range = init->auto_range;
+    *count = 0;
 
-    if (lsm303dlhc_i2c == NULL || init == NULL) {
+    if (lsm303dlhc_read_i2c(dev, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_FIFO_SRC_REG_A, &fifo_src) != LSM303DLHC_OK) {
         return LSM303DLHC_ERROR;
     }
 
-    if (lsm303dlhc_write_i2c(LSM303DLHC_ADDR_MAG, LSM303DLHC_REG_MAG_MR_REG_M, (uint8_t) init->op) != LSM303DLHC_OK) {
+    /* FSS saturates at 31, a full FIFO is reported as overrun */
+    if (fifo_src & LSM303DLHC_ACCFIFO_SRC_EMPTY) {
+        level = 0;
+    } else if (fifo_src & LSM303DLHC_ACCFIFO_SRC_OVRN) {
+        level = LSM303DLHC_ACC_FIFO_SIZE;
+    } else {
+        level = fifo_src & LSM303DLHC_ACCFIFO_SRC_FSS;
+    }
+
+    dev->acc_fifo_status.level = level;
+    dev->acc_fifo_status.watermark = (fifo_src & LSM303DLHC_ACCFIFO_SRC_WTM) != 0;
+    dev->acc_fifo_status.overrun = (fifo_src & LSM303DLHC_ACCFIFO_SRC_OVRN) != 0;
+
+    if (level > max) {
+        level = max;
+    }
+
+    /* the address wraps from OUT_Z_H_A back to OUT_X_L_A while the FIFO is enabled, so one read drains every sample */
+    if (level > 0) {
+        if (lsm303dlhc_read_i2c_multi(dev, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_OUT_X_L_A, buf, level * LSM303DLHC_ACC_LEN) != LSM303DLHC_OK) {
+            return LSM303DLHC_ERROR;
+        }
+    }
+
+    for (i = 0; i < level; i++) {
+        lsm303dlhc_decode_acc(&data[i], &buf[i * LSM303DLHC_ACC_LEN]);
+    }
+
+    *count = level;
+
+    if (dev->acc_fifo_status.overrun) {
+        dev->acc_fifo_status.overruns++;
+
+        /* FIFO mode stops collecting once full, pass through bypass to restart it */
+        if ((dev->acc_fifo_ctrl & LSM303DLHC_ACCFIFO_CTRL_FM) == LSM303DLHC_ACCFIFO_FIFO) {
+            if (lsm303dlhc_write_i2c(dev, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_FIFO_CTRL_REG_A, (uint8_t) LSM303DLHC_ACCFIFO_BYPASS) != LSM303DLHC_OK) {
+                return LSM303DLHC_ERROR;
+            }
+
+            if (lsm303dlhc_write_i2c(dev, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_FIFO_CTRL_REG_A, dev->acc_fifo_ctrl) != LSM303DLHC_OK) {
+                return LSM303DLHC_ERROR;
+            }
+        }
+
+        return LSM303DLHC_OVERRUN;
+    }
+
+    return LSM303DLHC_OK;
+}
+
+void lsm303dlhc_dev_get_acc_fifo_status(lsm303dlhc_t *dev, lsm303dlhc_fifo_status_t *status) {
+    *status = dev->acc_fifo_status;
+}
+
+lsm303dlhc_result_t lsm303dlhc_dev_init_mag(lsm303dlhc_t *dev, I2C_HandleTypeDef *i2c, const lsm303dlhc_mag_init_t *init) {
+    uint8_t cra_reg_m;
+
+    if (init == NULL || !lsm303dlhc_mag_gain_valid(init->gain)) {
         return LSM303DLHC_ERROR;
     }
 
-    if (lsm303dlhc_set_mag_rate(init->rate) != LSM303DLHC_OK) {
+    if (lsm303dlhc_attach(dev, i2c) != LSM303DLHC_OK) {
         return LSM303DLHC_ERROR;
     }
 
-    if (lsm303dlhc_set_mag_gain(init->gain) != LSM303DLHC_OK) {
+    dev->mag_auto_range = init->auto_range;
+    dev->mag_drdy = false;
+    dev->mag_drdy_pending = false;
+    dev->mag_single = false;
+
+    /* CRA_REG_M, CRB_REG_M and MR_REG_M in one burst, the mode is set last */
+    dev->mag_ctrl.reg[0] = (((uint8_t) init->rate & 0x07) << 2) | ((dev->temp_every != 0) ? LSM303DLHC_CRAM_TEMP_EN : 0);
+    dev->mag_ctrl.reg[1] = (uint8_t) init->gain;
+    dev->mag_ctrl.reg[2] = (uint8_t) init->op;
+    dev->mag_ctrl.dirty = (1 << LSM303DLHC_MAG_CTRL_COUNT) - 1;
+
+    lsm303dlhc_update_mag_gain(dev, init->gain);
+
+    if (lsm303dlhc_ctrl_flush(dev, LSM303DLHC_ADDR_MAG) != LSM303DLHC_OK) {
         return LSM303DLHC_ERROR;
     }
 
     /* LSM303DLHC has no WHOAMI register so read CRA_REG_M to check the set value */
-    if (lsm303dlhc_read_i2c(LSM303DLHC_ADDR_MAG, LSM303DLHC_REG_MAG_CRA_REG_M, &cra_reg_m) != LSM303DLHC_OK) {
+    if (lsm303dlhc_read_i2c(dev, LSM303DLHC_ADDR_MAG, LSM303DLHC_REG_MAG_CRA_REG_M, &cra_reg_m) != LSM303DLHC_OK) {
         return LSM303DLHC_ERROR;
     }
 
-    if (((cra_reg_m >> 2) & 0x07) != (uint8_t) init->rate) {
+    if (cra_reg_m != dev->mag_ctrl.reg[0]) {
         return LSM303DLHC_ERROR;
     }
 
     return LSM303DLHC_OK;
 }
 
-lsm303dlhc_result_t lsm303dlhc_set_mag_rate(lsm303dlhc_mag_rate_t rate) {
-    uint8_t reg_m = ((uint8_t) rate & 0x07) << 2;
+lsm303dlhc_result_t lsm303dlhc_dev_set_mag_rate(lsm303dlhc_t *dev, lsm303dlhc_mag_rate_t rate) {
+    lsm303dlhc_ctrl_modify(dev, LSM303DLHC_ADDR_MAG, LSM303DLHC_REG_MAG_CRA_REG_M, 0x07 << 2, (uint8_t) rate << 2);
 
-    if (lsm303dlhc_write_i2c(LSM303DLHC_ADDR_MAG, LSM303DLHC_REG_MAG_CRA_REG_M, reg_m) != LSM303DLHC_OK) {
+    if (lsm303dlhc_ctrl_flush(dev, LSM303DLHC_ADDR_MAG) != LSM303DLHC_OK) {
         return LSM303DLHC_ERROR;
     } else {
         return LSM303DLHC_OK;
     }
 }
 
-lsm303dlhc_result_t lsm303dlhc_set_mag_gain(lsm303dlhc_mag_gain_t gain) {
-    if (lsm303dlhc_write_i2c(LSM303DLHC_ADDR_MAG, LSM303DLHC_REG_MAG_CRB_REG_M, (uint8_t) gain) != LSM303DLHC_OK) {
-        return LSM303DLHC_ERROR;
-    }
-
-    lsm303dlhc_mag_magin = gain;
-
-    switch (lsm303dlhc_mag_magin) {
-    case LSM303DLHC_MAGGAIN_1_3:
-        lsm303dlhc_mag_gauss_lsb_xy = 1100;
-        lsm303dlhc_mag_gauss_lsb_z = 980;
-        break;
-    case LSM303DLHC_MAGGAIN_1_9:
-        lsm303dlhc_mag_gauss_lsb_xy = 855;
-        lsm303dlhc_mag_gauss_lsb_z = 760;
-        break;
-    case LSM303DLHC_MAGGAIN_2_5:
-        lsm303dlhc_mag_gauss_lsb_xy = 670;
-        lsm303dlhc_mag_gauss_lsb_z = 600;
-        break;
-    case LSM303DLHC_MAGGAIN_4_0:
-        lsm303dlhc_mag_gauss_lsb_xy = 450;
-        lsm303dlhc_mag_gauss_lsb_z = 400;
-        break;
-    case LSM303DLHC_MAGGAIN_4_7:
-        lsm303dlhc_mag_gauss_lsb_xy = 400;
-        lsm303dlhc_mag_gauss_lsb_z = 355;
-        break;
-    case LSM303DLHC_MAGGAIN_5_6:
-        lsm303dlhc_mag_gauss_lsb_xy = 330;
-        lsm303dlhc_mag_gauss_lsb_z = 295;
-        break;
-    case LSM303DLHC_MAGGAIN_8_1:
-        lsm303dlhc_mag_gauss_lsb_xy = 230;
-        lsm303dlhc_mag_gauss_lsb_z = 205;
-        break;
+lsm303dlhc_result_t lsm303dlhc_dev_set_mag_gain(lsm303dlhc_t *dev, lsm303dlhc_mag_gain_t gain) {
+    if (!lsm303dlhc_mag_gain_valid(gain)) {
+        return LSM303DLHC_ERROR;
+    }
+
+    /* an unchanged gain keeps its samples */
+    if (gain != dev->mag_gain) {
+        lsm303dlhc_update_mag_gain(dev, gain);
+    }
+
+    lsm303dlhc_ctrl_modify(dev, LSM303DLHC_ADDR_MAG, LSM303DLHC_REG_MAG_CRB_REG_M, 0xFF, (uint8_t) gain);
+
+    if (lsm303dlhc_ctrl_flush(dev, LSM303DLHC_ADDR_MAG) != LSM303DLHC_OK) {
+        return LSM303DLHC_ERROR;
     }
 
     return LSM303DLHC_OK;
 }
 
-lsm303dlhc_result_t lsm303dlhc_read_mag_raw(lsm303dlhc_data_raw_t *data) {
-    bool reading_valid = false;
-    uint8_t reg_mg = 0;
-    uint8_t reg_mag_out = LSM303DLHC_REG_MAG_OUT_X_H_M;
-    uint8_t buf[6] = { 0 };
+lsm303dlhc_result_t lsm303dlhc_dev_read_mag_raw(lsm303dlhc_t *dev, lsm303dlhc_data_raw_t *data) {
+    lsm303dlhc_mag_sample_t sample;
+    lsm303dlhc_result_t result;
 
-    while (reading_valid == false) {
-        if (lsm303dlhc_read_i2c(LSM303DLHC_ADDR_MAG, LSM303DLHC_REG_MAG_SR_REG_Mg, &reg_mg) != LSM303DLHC_OK) {
-            return LSM303DLHC_ERROR;
+    result = lsm303dlhc_dev_read_mag_sample(dev, &sample);
+    if (result != LSM303DLHC_OK) {
+        return result;
+    }
+
+    /* the conversion factors already follow the new gain, untagged this sample would be converted with it */
+    if (sample.gain != dev->mag_gain) {
+        return LSM303DLHC_NO_DATA;
+    }
+
+    *data = sample.raw;
+
+    return LSM303DLHC_OK;
+}
+
+lsm303dlhc_result_t lsm303dlhc_dev_read_mag_sample(lsm303dlhc_t *dev, lsm303dlhc_mag_sample_t *sample) {
+    lsm303dlhc_result_t result;
+
+    IMU_STATS_BEGIN(start);
+
+    result = lsm303dlhc_read_mag_output(dev, sample);
+
+    IMU_STATS_END(IMU_STATS_LSM303DLHC_READ_MAG, start, 0, (result == LSM303DLHC_ERROR) ? HAL_ERROR : HAL_OK);
+
+    return result;
+}
+
+lsm303dlhc_result_t lsm303dlhc_dev_mag_trigger(lsm303dlhc_t *dev) {
+    if (dev->mag_single) {
+        return LSM303DLHC_BUSY;
+    }
+
+    /* written even if the shadow already says single, the sensor left that mode after the last conversion */
+    if (lsm303dlhc_write_i2c(dev, LSM303DLHC_ADDR_MAG, LSM303DLHC_REG_MAG_MR_REG_M, LSM303DLHC_MAGOP_SINGLE) != LSM303DLHC_OK) {
+        return LSM303DLHC_ERROR;
+    }
+
+    dev->mag_ctrl.reg[2] = LSM303DLHC_MAGOP_SINGLE;
+    dev->mag_ctrl.dirty &= ~(1 << LSM303DLHC_REG_MAG_MR_REG_M);
+
+    /* the conversion starts after any gain change, its sample is good */
+    dev->mag_discard = false;
+    dev->mag_single = true;
+    dev->mag_single_ms = HAL_GetTick();
+
+    return LSM303DLHC_OK;
+}
+
+lsm303dlhc_result_t lsm303dlhc_dev_mag_collect(lsm303dlhc_t *dev, lsm303dlhc_mag_sample_t *sample) {
+    lsm303dlhc_result_t result;
+    uint32_t expected_ms;
+
+    if (!dev->mag_single) {
+        return LSM303DLHC_ERROR;
+    }
+
+    if (lsm303dlhc_dev_mag_remaining_ms(dev) > 0) {
+        return LSM303DLHC_NO_DATA;
+    }
+
+    IMU_STATS_BEGIN(start);
+
+    result = lsm303dlhc_mag_ready(dev);
+
+    if (result == LSM303DLHC_OK) {
+        dev->mag_single = false;
+        result = lsm303dlhc_read_mag_data(dev, sample);
+
+        if (result == LSM303DLHC_NO_DATA && lsm303dlhc_dev_mag_trigger(dev) != LSM303DLHC_OK) {
+            result = LSM303DLHC_ERROR;
         }
+    } else if (result == LSM303DLHC_NO_DATA) {
+        expected_ms = lsm303dlhc_mag_conversion_us(dev->mag_ctrl.reg[0]) / 1000 + 1;
 
-        if (!(reg_mg & 0x1)) {
-            return LSM303DLHC_ERROR;
+        if (HAL_GetTick() - dev->mag_single_ms > LSM303DLHC_MAG_SINGLE_PERIODS * expected_ms) {
+            dev->mag_single = false;
+            result = LSM303DLHC_ERROR;
         }
+    }
 
-        if (HAL_I2C_Master_Transmit(lsm303dlhc_i2c, LSM303DLHC_ADDR_MAG, &reg_mag_out, 1, 1000) != HAL_OK) {
-            return LSM303DLHC_ERROR;
+    IMU_STATS_END(IMU_STATS_LSM303DLHC_READ_MAG, start, 0, (result == LSM303DLHC_ERROR) ? HAL_ERROR : HAL_OK);
+
+    return result;
+}
+
+uint32_t lsm303dlhc_dev_mag_remaining_ms(const lsm303dlhc_t *dev) {
+    /* a whole tick more, the trigger may have come late in its tick */
+    uint32_t expected_ms = lsm303dlhc_mag_conversion_us(dev->mag_ctrl.reg[0]) / 1000 + 1;
+    uint32_t elapsed_ms = HAL_GetTick() - dev->mag_single_ms;
+
+    if (!dev->mag_single || elapsed_ms >= expected_ms) {
+        return 0;
+    }
+
+    return expected_ms - elapsed_ms;
+}
+
+uint32_t lsm303dlhc_mag_conversion_us(uint8_t cra_reg_m) {
+    uint32_t odr_mhz = lsm303dlhc_mag_odr_mhz(cra_reg_m);
+
+    return (uint32_t) ((1000000000ull + odr_mhz - 1) / odr_mhz);
+}
+
+static lsm303dlhc_result_t lsm303dlhc_read_mag_output(lsm303dlhc_t *dev, lsm303dlhc_mag_sample_t *sample) {
+    lsm303dlhc_result_t result = lsm303dlhc_mag_ready(dev);
+
+    if (result != LSM303DLHC_OK) {
+        return result;
+    }
+
+    return lsm303dlhc_read_mag_data(dev, sample);
+}
+
+static lsm303dlhc_result_t lsm303dlhc_mag_ready(lsm303dlhc_t *dev) {
+    uint8_t reg_mg = 0;
+
+    /* the data-ready interrupt replaces the status poll */
+    if (dev->mag_drdy) {
+        if (!dev->mag_drdy_pending) {
+            return LSM303DLHC_NO_DATA;
         }
 
-        if (HAL_I2C_Master_Receive(lsm303dlhc_i2c, LSM303DLHC_ADDR_MAG, buf, 6, 1000) != HAL_OK) {
+        dev->mag_drdy_pending = false;
+    } else {
+        if (lsm303dlhc_read_i2c(dev, LSM303DLHC_ADDR_MAG, LSM303DLHC_REG_MAG_SR_REG_Mg, &reg_mg) != LSM303DLHC_OK) {
             return LSM303DLHC_ERROR;
         }
 
-        /* raw data (low byte first) */
-        data->x = (int16_t) (buf[LSM303DLHC_MAG_XLO] | (buf[LSM303DLHC_MAG_XHI] << 8));
-        data->y = (int16_t) (buf[LSM303DLHC_MAG_YLO] | (buf[LSM303DLHC_MAG_YHI] << 8));
-        data->z = (int16_t) (buf[LSM303DLHC_MAG_ZLO] | (buf[LSM303DLHC_MAG_ZHI] << 8));
-
-        /* make sure the sensor isn't saturating if auto-ranging is enabled */
-        if (lsm303dlhc_mag_auto_range == false) {
-            reading_valid = true;
-        } else {
-            /* check if the sensor is saturating or not */
-            if ((data->x >= 2040) | (data->x <= -2040) | (data->y >= 2040) | (data->y <= -2040) | (data->z >= 2040) | (data->z <= -2040)) {
-                /* saturating .... increase the range if we can */
-                switch (lsm303dlhc_mag_magin) {
-                case LSM303DLHC_MAGGAIN_5_6:
-                    if (lsm303dlhc_set_mag_gain(LSM303DLHC_MAGGAIN_8_1) != LSM303DLHC_OK) {
-                        return LSM303DLHC_ERROR;
-                    } else {
-                        reading_valid = false;
-                    }
-                    break;
-
-                case LSM303DLHC_MAGGAIN_4_7:
-                    if (lsm303dlhc_set_mag_gain(LSM303DLHC_MAGGAIN_5_6) != LSM303DLHC_OK) {
-                        return LSM303DLHC_ERROR;
-                    } else {
-                        reading_valid = false;
-                    }
-                    break;
-
-                case LSM303DLHC_MAGGAIN_4_0:
-                    if (lsm303dlhc_set_mag_gain(LSM303DLHC_MAGGAIN_4_7) != LSM303DLHC_OK) {
-                        return LSM303DLHC_ERROR;
-                    } else {
-                        reading_valid = false;
-                    }
-                    break;
-
-                case LSM303DLHC_MAGGAIN_2_5:
-                    if (lsm303dlhc_set_mag_gain(LSM303DLHC_MAGGAIN_4_0) != LSM303DLHC_OK) {
-                        return LSM303DLHC_ERROR;
-                    } else {
-                        reading_valid = false;
-                    }
-                    break;
-
-                case LSM303DLHC_MAGGAIN_1_9:
-                    if (lsm303dlhc_set_mag_gain(LSM303DLHC_MAGGAIN_2_5) != LSM303DLHC_OK) {
-                        return LSM303DLHC_ERROR;
-                    } else {
-                        reading_valid = false;
-                    }
-                    break;
-
-                case LSM303DLHC_MAGGAIN_1_3:
-                    if (lsm303dlhc_set_mag_gain(LSM303DLHC_MAGGAIN_1_9) != LSM303DLHC_OK) {
-                        return LSM303DLHC_ERROR;
-                    } else {
-                        reading_valid = false;
-                    }
-                    break;
-
-                    /* cannot change the range */
-                default:
-                    reading_valid = true;
-                    break;
-                }
-            } else {
-                /* all values are withing range */
-                reading_valid = true;
-            }
+        if (!(reg_mg & 0x1)) {
+            return LSM303DLHC_NO_DATA;
         }
     }
 
     return LSM303DLHC_OK;
 }
 
-void lsm303dlhc_convert_mag(lsm303dlhc_data_t *conv, const lsm303dlhc_data_raw_t *raw) {
-    conv->x = ((float) raw->x / lsm303dlhc_mag_gauss_lsb_xy) * LSM303DLHC_MAG_SENSORS_GAUSS_TO_MICROTESLA;
-    conv->y = ((float) raw->y / lsm303dlhc_mag_gauss_lsb_xy) * LSM303DLHC_MAG_SENSORS_GAUSS_TO_MICROTESLA;
-    conv->z = ((float) raw->z / lsm303dlhc_mag_gauss_lsb_z) * LSM303DLHC_MAG_SENSORS_GAUSS_TO_MICROTESLA;
-}
+/* output registers, then the temperature and auto-ranging */
+static lsm303dlhc_result_t lsm303dlhc_read_mag_data(lsm303dlhc_t *dev, lsm303dlhc_mag_sample_t *sample) {
+    uint8_t buf[LSM303DLHC_MAG_LEN] = { 0 };
 
-/* private functions */
-static lsm303dlhc_result_t lsm303dlhc_read_i2c(uint8_t address, uint8_t reg, uint8_t *data) {
-    if (HAL_I2C_Master_Transmit(lsm303dlhc_i2c, address, &reg, 1, 1000) != HAL_OK) {
+    /* the output was not read, DRDY stays high and raises no new edge */
+    if (lsm303dlhc_read_i2c_multi(dev, LSM303DLHC_ADDR_MAG, LSM303DLHC_REG_MAG_OUT_X_H_M, buf, LSM303DLHC_MAG_LEN) != LSM303DLHC_OK) {
+        dev->mag_drdy_pending = dev->mag_drdy;
         return LSM303DLHC_ERROR;
     }
 
-    if (HAL_I2C_Master_Receive(lsm303dlhc_i2c, address, data, 1, 1000) != HAL_OK) {
-        return LSM303DLHC_ERROR;
+    lsm303dlhc_decode_mag(&sample->raw, buf);
+    sample->gain = dev->mag_gain;
+
+    lsm303dlhc_read_temp(dev);
+
+    if (dev->mag_auto_range == false) {
+        return LSM303DLHC_OK;
     }
 
-    return LSM303DLHC_OK;
+    return lsm303dlhc_mag_auto_range(dev, &sample->raw);
+}
+
+void lsm303dlhc_dev_convert_mag(lsm303dlhc_t *dev, lsm303dlhc_data_t *conv, const lsm303dlhc_data_raw_t *raw) {
+    if (dev->mag_cross) {
+        lsm303dlhc_convert_soft(dev, conv, raw);
+        return;
+    }
+
+    conv->x = (float) raw->x * dev->mag_k[0][0] + dev->mag_b[0];
+    conv->y = (float) raw->y * dev->mag_k[1][1] + dev->mag_b[1];
+    conv->z = (float) raw->z * dev->mag_k[2][2] + dev->mag_b[2];
 }
 
-static lsm303dlhc_result_t lsm303dlhc_write_i2c(uint8_t address, uint8_t reg, uint8_t data) {
-    uint8_t buf[2] = { reg, data };
+void lsm303dlhc_convert_mag_sample(lsm303dlhc_data_t *conv, const lsm303dlhc_mag_sample_t *sample) {
+    const uint16_t *lsb = lsm303dlhc_mag_lsb[(uint8_t) sample->gain >> 5];
 
-    if (HAL_I2C_Master_Transmit(lsm303dlhc_i2c, address, buf, 2, 1000) != HAL_OK) {
-        return LSM303DLHC_ERROR;
-    } else {
-        return LSM303DLHC_OK;
+    conv->x = (float) sample->raw.x * LSM303DLHC_MAG_SENSORS_GAUSS_TO_MICROTESLA / lsb[0];
+    conv->y = (float) sample->raw.y * LSM303DLHC_MAG_SENSORS_GAUSS_TO_MICROTESLA / lsb[0];
+    conv->z = (float) sample->raw.z * LSM303DLHC_MAG_SENSORS_GAUSS_TO_MICROTESLA / lsb[1];
+}
+
+void lsm303dlhc_dev_convert_mag_batch(const lsm303dlhc_t *dev, lsm303dlhc_data_t conv[], const lsm303dlhc_data_raw_t raw[], uint16_t count) {
+    const float k[3] = { dev->mag_k[0][0], dev->mag_k[1][1], dev->mag_k[2][2] };
+    uint16_t i;
+
+    if (!dev->mag_cross) {
+        lsm303dlhc_scale_batch(conv, raw, count, k, dev->mag_b);
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        lsm303dlhc_convert_soft(dev, &conv[i], &raw[i]);
+    }
+}
+
+void lsm303dlhc_dev_convert_mag_soa(const lsm303dlhc_t *dev, float x[], float y[], float z[], const lsm303dlhc_data_raw_t raw[], uint16_t count) {
+    const float k[3] = { dev->mag_k[0][0], dev->mag_k[1][1], dev->mag_k[2][2] };
+    lsm303dlhc_data_t conv;
+    uint16_t i;
+
+    if (!dev->mag_cross) {
+        lsm303dlhc_scale_soa(x, y, z, raw, count, k, dev->mag_b);
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        lsm303dlhc_convert_soft(dev, &conv, &raw[i]);
+        x[i] = conv.x;
+        y[i] = conv.y;
+        z[i] = conv.z;
+    }
+}
+
+void lsm303dlhc_dev_set_mag_calib(lsm303dlhc_t *dev, const float offset[3], const float soft[3][3]) {
+    uint8_t i, j;
+
+    for (i = 0; i < 3; i++) {
+        dev->mag_cal_offset[i] = (offset != NULL) ? offset[i] : 0.0f;
+
+        for (j = 0; j < 3; j++) {
+            if (soft != NULL) {
+                dev->mag_cal_soft[i][j] = soft[i][j];
+            } else {
+                dev->mag_cal_soft[i][j] = (i == j) ? 1.0f : 0.0f;
+            }
+        }
+    }
+
+    lsm303dlhc_update_scale(dev);
+}
+
+lsm303dlhc_result_t lsm303dlhc_dev_set_temp_rate(lsm303dlhc_t *dev, uint16_t every) {
+    dev->temp_every = every;
+    dev->temp_count = 1;
+
+    lsm303dlhc_ctrl_modify(dev, LSM303DLHC_ADDR_MAG, LSM303DLHC_REG_MAG_CRA_REG_M, LSM303DLHC_CRAM_TEMP_EN, (every != 0) ? LSM303DLHC_CRAM_TEMP_EN : 0);
+
+    return lsm303dlhc_ctrl_flush(dev, LSM303DLHC_ADDR_MAG);
+}
+
+lsm303dlhc_result_t lsm303dlhc_dev_get_temp(const lsm303dlhc_t *dev, float *temp) {
+    if (!dev->temp_valid) {
+        return LSM303DLHC_NO_DATA;
     }
+
+    *temp = (float) dev->temp / LSM303DLHC_TEMP_LSB + LSM303DLHC_TEMP_OFFSET;
+
+    return LSM303DLHC_OK;
+}
+
+void lsm303dlhc_dev_set_temp_comp(lsm303dlhc_t *dev, const imu_tempcomp_t *acc, const imu_tempcomp_t *mag) {
+    dev->acc_temp_table = acc;
+    dev->mag_temp_table = mag;
+
+    lsm303dlhc_update_scale(dev);
+}
+
+lsm303dlhc_result_t lsm303dlhc_dev_read_acc_raw_async(lsm303dlhc_t *dev, lsm303dlhc_callback_t callback) {
+    return lsm303dlhc_read_async(dev, LSM303DLHC_XFER_ACC, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_OUT_X_L_A | 0x80, callback);
+}
+
+lsm303dlhc_result_t lsm303dlhc_dev_read_mag_raw_async(lsm303dlhc_t *dev, lsm303dlhc_callback_t callback) {
+    return lsm303dlhc_read_async(dev, LSM303DLHC_XFER_MAG, LSM303DLHC_ADDR_MAG, LSM303DLHC_REG_MAG_OUT_X_H_M, callback);
+}
+
+void lsm303dlhc_i2c_rx_cplt(I2C_HandleTypeDef *i2c) {
+    lsm303dlhc_t *dev = lsm303dlhc_find(i2c);
+    lsm303dlhc_xfer_t xfer;
+    lsm303dlhc_callback_t callback;
+    imu_ring_t *ring;
+    uint8_t idx;
+
+    if (dev == NULL) {
+        return;
+    }
+
+    xfer = dev->xfer;
+    callback = dev->xfer_callback;
+    idx = dev->xfer_idx;
+
+    /* hand the filled buffer to the callback, the next transfer goes to the other one */
+    dev->xfer_idx ^= 1;
+    dev->xfer = LSM303DLHC_XFER_NONE;
+
+    /* a data-ready interrupt that found the bus busy is served first, into the other buffer */
+    lsm303dlhc_drdy_resume(dev);
+
+    if (xfer == LSM303DLHC_XFER_ACC) {
+        lsm303dlhc_decode_acc(&dev->xfer_data[idx], dev->xfer_buf[idx]);
+        ring = dev->acc_ring;
+    } else {
+        lsm303dlhc_decode_mag(&dev->xfer_data[idx], dev->xfer_buf[idx]);
+        ring = dev->mag_ring;
+    }
+
+    if (ring != NULL) {
+        imu_ring_push(ring, (xfer == LSM303DLHC_XFER_ACC) ? IMU_RING_ACC : IMU_RING_MAG, IMU_RING_FLAG_RAW, dev->xfer_data[idx].x, dev->xfer_data[idx].y, dev->xfer_data[idx].z);
+    }
+
+    if (callback != NULL) {
+        callback(dev, LSM303DLHC_OK, &dev->xfer_data[idx]);
+    }
+}
+
+void lsm303dlhc_dev_set_ring(lsm303dlhc_t *dev, imu_ring_t *acc_ring, imu_ring_t *mag_ring) {
+    dev->acc_ring = acc_ring;
+    dev->mag_ring = mag_ring;
+}
+
+void lsm303dlhc_i2c_error(I2C_HandleTypeDef *i2c) {
+    lsm303dlhc_t *dev = lsm303dlhc_find(i2c);
+    lsm303dlhc_callback_t callback;
+
+    if (dev == NULL) {
+        return;
+    }
+
+    callback = dev->xfer_callback;
+
+    /* the sample was not read and DRDY stays high, read it again instead of waiting for an edge */
+    if (dev->xfer == LSM303DLHC_XFER_ACC && dev->acc_drdy && dev->acc_drdy_callback != NULL) {
+        dev->acc_drdy_pending = true;
+    } else if (dev->xfer == LSM303DLHC_XFER_MAG && dev->mag_drdy && dev->mag_drdy_callback != NULL) {
+        dev->mag_drdy_pending = true;
+    }
+
+    dev->xfer = LSM303DLHC_XFER_NONE;
+
+    if (callback != NULL) {
+        callback(dev, LSM303DLHC_ERROR, NULL);
+    }
+
+    lsm303dlhc_drdy_resume(dev);
+}
+
+lsm303dlhc_result_t lsm303dlhc_dev_set_drdy_acc(lsm303dlhc_t *dev, bool enable, lsm303dlhc_callback_t callback) {
+    lsm303dlhc_ctrl_modify(dev, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_CTRL_REG3_A, LSM303DLHC_ACR3A_I1_DRDY1,
+                           enable ? LSM303DLHC_ACR3A_I1_DRDY1 : 0);
+
+    if (lsm303dlhc_ctrl_flush(dev, LSM303DLHC_ADDR_ACC) != LSM303DLHC_OK) {
+        return LSM303DLHC_ERROR;
+    }
+    dev->acc_drdy_callback = callback;
+    dev->acc_drdy_pending = false;
+    dev->acc_drdy = enable;
+
+    /* DRDY is a level signal, a sample may already be waiting and its edge is gone */
+    lsm303dlhc_dev_on_drdy_acc(dev);
+
+    return LSM303DLHC_OK;
+}
+
+lsm303dlhc_result_t lsm303dlhc_dev_set_acc_int1(lsm303dlhc_t *dev, uint8_t cfg, uint16_t threshold_mg, uint16_t duration_ms) {
+    uint32_t odr_mhz = lsm303dlhc_acc_odr_mhz(dev->acc_ctrl.reg[0]);
+    uint8_t buf[LSM303DLHC_AINT_LEN];
+    uint32_t ths, duration;
+
+    if (odr_mhz == 0) {
+        return LSM303DLHC_ERROR;
+    }
+
+    /* rounded up, an event is never reported below the requested threshold or duration */
+    ths = lsm303dlhc_steps(threshold_mg, lsm303dlhc_ths_mg[(dev->acc_ctrl.reg[3] >> 4) & 0x03]);
+    duration = lsm303dlhc_steps((uint32_t) duration_ms * (odr_mhz / 1000), 1000);
+
+    if (ths > LSM303DLHC_AINT_MAX || duration > LSM303DLHC_AINT_MAX) {
+        return LSM303DLHC_ERROR;
+    }
+
+    buf[0] = (uint8_t) ths;
+    buf[1] = (uint8_t) duration;
+
+    if (lsm303dlhc_write_i2c_multi(dev, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_INT1_THS_A, buf, LSM303DLHC_AINT_LEN) != LSM303DLHC_OK) {
+        return LSM303DLHC_ERROR;
+    }
+
+    return lsm303dlhc_write_i2c(dev, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_INT1_CFG_A, cfg);
+}
+
+lsm303dlhc_result_t lsm303dlhc_dev_read_acc_int1_src(lsm303dlhc_t *dev, uint8_t *src) {
+    return lsm303dlhc_read_i2c(dev, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_INT1_SOURCE_A, src);
+}
+
+lsm303dlhc_result_t lsm303dlhc_dev_reset_acc_hp(lsm303dlhc_t *dev) {
+    uint8_t reference;
+
+    return lsm303dlhc_read_i2c(dev, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_REFERENCE_A, &reference);
+}
+
+lsm303dlhc_result_t lsm303dlhc_dev_set_acc_hpf(lsm303dlhc_t *dev, const lsm303dlhc_acc_hpf_config_t *config) {
+    if (config == NULL || (config->mode & ~LSM303DLHC_ACR2A_HPM) != 0 || config->cutoff > 3) {
+        return LSM303DLHC_ERROR;
+    }
+
+    lsm303dlhc_ctrl_modify(dev, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_CTRL_REG2_A, LSM303DLHC_ACR2A_HPM | LSM303DLHC_ACR2A_HPCF | LSM303DLHC_ACR2A_FDS,
+                           config->mode | (config->cutoff << 4) | (config->output ? LSM303DLHC_ACR2A_FDS : 0));
+
+    return lsm303dlhc_ctrl_flush(dev, LSM303DLHC_ADDR_ACC);
+}
+
+uint32_t lsm303dlhc_acc_odr_mhz(uint8_t ctrl_reg1_a) {
+    uint8_t odr = ctrl_reg1_a >> 4;
+
+    if (odr >= sizeof(lsm303dlhc_acc_rates) / sizeof(lsm303dlhc_acc_rates[0])) {
+        return 0;
+    }
+
+    /* the fastest code runs four times faster in low-power mode */
+    if ((ctrl_reg1_a & LSM303DLHC_ACR1A_LPEN) && (ctrl_reg1_a & LSM303DLHC_ACR1A_ODR30) == LSM303DLHC_ACR1A_ODR30_5376_HZ) {
+        return 5376000;
+    }
+
+    return lsm303dlhc_acc_rates[odr];
+}
+
+uint32_t lsm303dlhc_mag_odr_mhz(uint8_t cra_reg_m) {
+    return lsm303dlhc_mag_rates[(cra_reg_m >> 2) & 0x07];
+}
+
+lsm303dlhc_result_t lsm303dlhc_dev_set_click(lsm303dlhc_t *dev, const lsm303dlhc_click_config_t *config) {
+    uint32_t odr_hz = lsm303dlhc_acc_odr_mhz(dev->acc_ctrl.reg[0]) / 1000;
+    uint32_t fs_mg = 2000u << ((dev->acc_ctrl.reg[3] >> 4) & 0x03);
+    uint32_t ths, limit, latency, window;
+    uint8_t buf[LSM303DLHC_CLICK_LEN];
+
+    if (config == NULL || odr_hz == 0) {
+        return LSM303DLHC_ERROR;
+    }
+
+    ths = lsm303dlhc_steps((uint32_t) config->threshold_mg * 128, fs_mg);
+    limit = lsm303dlhc_steps((uint32_t) config->limit_ms * odr_hz, 1000);
+    latency = lsm303dlhc_steps((uint32_t) config->latency_ms * odr_hz, 1000);
+    window = lsm303dlhc_steps((uint32_t) config->window_ms * odr_hz, 1000);
+
+    if (ths > LSM303DLHC_CLICK_THS_MAX || limit > LSM303DLHC_CLICK_LIMIT_MAX || latency > LSM303DLHC_CLICK_TIME_MAX || window > LSM303DLHC_CLICK_TIME_MAX) {
+        return LSM303DLHC_ERROR;
+    }
+
+    /* detection off while the timing changes */
+    if (lsm303dlhc_write_i2c(dev, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_CLICK_CFG_A, 0) != LSM303DLHC_OK) {
+        return LSM303DLHC_ERROR;
+    }
+
+    buf[0] = (uint8_t) ths;
+    buf[1] = (uint8_t) limit;
+    buf[2] = (uint8_t) latency;
+    buf[3] = (uint8_t) window;
+
+    if (lsm303dlhc_write_i2c_multi(dev, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_CLICK_THS_A, buf, LSM303DLHC_CLICK_LEN) != LSM303DLHC_OK) {
+        return LSM303DLHC_ERROR;
+    }
+
+    lsm303dlhc_ctrl_modify(dev, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_CTRL_REG2_A, LSM303DLHC_ACR2A_HPCLICK,
+                           config->high_pass ? LSM303DLHC_ACR2A_HPCLICK : 0);
+    lsm303dlhc_ctrl_modify(dev, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_CTRL_REG3_A, LSM303DLHC_ACR3A_I1_CLICK,
+                           (config->axes != 0 && config->pin == LSM303DLHC_CLICK_PIN_INT1) ? LSM303DLHC_ACR3A_I1_CLICK : 0);
+    lsm303dlhc_ctrl_modify(dev, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_CTRL_REG6_A, LSM303DLHC_ACR6A_I2_CLICK,
+                           (config->axes != 0 && config->pin == LSM303DLHC_CLICK_PIN_INT2) ? LSM303DLHC_ACR6A_I2_CLICK : 0);
+
+    if (lsm303dlhc_ctrl_flush(dev, LSM303DLHC_ADDR_ACC) != LSM303DLHC_OK) {
+        return LSM303DLHC_ERROR;
+    }
+
+    return lsm303dlhc_write_i2c(dev, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_CLICK_CFG_A, config->axes & 0x3F);
+}
+
+lsm303dlhc_result_t lsm303dlhc_dev_read_click(lsm303dlhc_t *dev, lsm303dlhc_click_event_t *event) {
+    uint8_t click_src_a;
+
+    if (lsm303dlhc_read_i2c(dev, LSM303DLHC_ADDR_ACC, LSM303DLHC_REG_ACC_CLICK_SRC_A, &click_src_a) != LSM303DLHC_OK) {
+        return LSM303DLHC_ERROR;
+    }
+
+    lsm303dlhc_decode_click(event, click_src_a);
+
+    return (event->type == LSM303DLHC_CLICK_NONE) ? LSM303DLHC_NO_DATA : LSM303DLHC_OK;
+}
+
+void lsm303dlhc_decode_click(lsm303dlhc_click_event_t *event, uint8_t click_src_a) {
+    /* a double click also reports the single click it started with */
+    if (!(click_src_a & LSM303DLHC_CLICKSRC_IA)) {
+        event->type = LSM303DLHC_CLICK_NONE;
+    } else if (click_src_a & LSM303DLHC_CLICKSRC_DCLICK) {
+        event->type = LSM303DLHC_CLICK_DOUBLE;
+    } else if (click_src_a & LSM303DLHC_CLICKSRC_SCLICK) {
+        event->type = LSM303DLHC_CLICK_SINGLE;
+    } else {
+        event->type = LSM303DLHC_CLICK_NONE;
+    }
+
+    event->axes = click_src_a & (LSM303DLHC_CLICKSRC_X | LSM303DLHC_CLICKSRC_Y | LSM303DLHC_CLICKSRC_Z);
+    event->negative = (click_src_a & LSM303DLHC_CLICKSRC_SIGN) != 0;
+}
+
+lsm303dlhc_result_t lsm303dlhc_dev_set_drdy_mag(lsm303dlhc_t *dev, bool enable, lsm303dlhc_callback_t callback) {
+    dev->mag_drdy_callback = callback;
+    dev->mag_drdy_pending = false;
+    dev->mag_drdy = enable;
+
+    lsm303dlhc_dev_on_drdy_mag(dev);
+
+    return LSM303DLHC_OK;
+}
+
+void lsm303dlhc_dev_on_drdy_acc(lsm303dlhc_t *dev) {
+    lsm303dlhc_result_t result;
+
+    if (!dev->acc_drdy) {
+        return;
+    }
+
+    if (dev->acc_drdy_callback == NULL) {
+        dev->acc_drdy_pending = true;
+        return;
+    }
+
+    /* a read that could not start is retried at the end of the next transfer */
+    result = lsm303dlhc_dev_read_acc_raw_async(dev, dev->acc_drdy_callback);
+    if (result != LSM303DLHC_OK) {
+        dev->acc_drdy_pending = true;
+    }
+
+    if (result == LSM303DLHC_ERROR) {
+        dev->acc_drdy_callback(dev, LSM303DLHC_ERROR, NULL);
+    }
+}
+
+void lsm303dlhc_dev_on_drdy_mag(lsm303dlhc_t *dev) {
+    lsm303dlhc_result_t result;
+
+    if (!dev->mag_drdy) {
+        return;
+    }
+
+    if (dev->mag_drdy_callback == NULL) {
+        dev->mag_drdy_pending = true;
+        return;
+    }
+
+    /* a read that could not start is retried at the end of the next transfer */
+    result = lsm303dlhc_dev_read_mag_raw_async(dev, dev->mag_drdy_callback);
+    if (result != LSM303DLHC_OK) {
+        dev->mag_drdy_pending = true;
+    }
+
+    if (result == LSM303DLHC_ERROR) {
+        dev->mag_drdy_callback(dev, LSM303DLHC_ERROR, NULL);
+    }
+}
+
+/* single sensor API */
+lsm303dlhc_t *lsm303dlhc_get_default(void) {
+    return &lsm303dlhc_default;
+}
+
+lsm303dlhc_result_t lsm303dlhc_init_acc(I2C_HandleTypeDef *i2c, const lsm303dlhc_acc_init_t *init) {
+    return lsm303dlhc_dev_init_acc(&lsm303dlhc_default, i2c, init);
+}
+
+lsm303dlhc_result_t lsm303dlhc_set_acc_scale(uint8_t ctrl_reg4_a) {
+    return lsm303dlhc_dev_set_acc_scale(&lsm303dlhc_default, ctrl_reg4_a);
+}
+
+lsm303dlhc_result_t lsm303dlhc_set_acc_odr(uint8_t odr) {
+    return lsm303dlhc_dev_set_acc_odr(&lsm303dlhc_default, odr);
+}
+
+lsm303dlhc_result_t lsm303dlhc_read_acc_raw(lsm303dlhc_data_raw_t *data) {
+    return lsm303dlhc_dev_read_acc_raw(&lsm303dlhc_default, data);
+}
+
+void lsm303dlhc_set_acc_calib(const float offset[3], const float scale[3]) {
+    lsm303dlhc_dev_set_acc_calib(&lsm303dlhc_default, offset, scale);
+}
+
+void lsm303dlhc_set_mag_calib(const float offset[3], const float soft[3][3]) {
+    lsm303dlhc_dev_set_mag_calib(&lsm303dlhc_default, offset, soft);
+}
+
+lsm303dlhc_result_t lsm303dlhc_set_temp_rate(uint16_t every) {
+    return lsm303dlhc_dev_set_temp_rate(&lsm303dlhc_default, every);
+}
+
+lsm303dlhc_result_t lsm303dlhc_get_temp(float *temp) {
+    return lsm303dlhc_dev_get_temp(&lsm303dlhc_default, temp);
+}
+
+void lsm303dlhc_set_temp_comp(const imu_tempcomp_t *acc, const imu_tempcomp_t *mag) {
+    lsm303dlhc_dev_set_temp_comp(&lsm303dlhc_default, acc, mag);
+}
+
+void lsm303dlhc_convert_acc(lsm303dlhc_data_t *conv, const lsm303dlhc_data_raw_t *raw) {
+    lsm303dlhc_dev_convert_acc(&lsm303dlhc_default, conv, raw);
+}
+
+lsm303dlhc_result_t lsm303dlhc_set_acc_fifo(lsm303dlhc_acc_fifo_mode_t mode, uint8_t watermark) {
+    return lsm303dlhc_dev_set_acc_fifo(&lsm303dlhc_default, mode, watermark);
+}
+
+lsm303dlhc_result_t lsm303dlhc_read_acc_fifo(lsm303dlhc_data_raw_t data[], uint8_t max, uint8_t *count) {
+    return lsm303dlhc_dev_read_acc_fifo(&lsm303dlhc_default, data, max, count);
+}
+
+void lsm303dlhc_get_acc_fifo_status(lsm303dlhc_fifo_status_t *status) {
+    lsm303dlhc_dev_get_acc_fifo_status(&lsm303dlhc_default, status);
+}
+
+lsm303dlhc_result_t lsm303dlhc_init_mag(I2C_HandleTypeDef *i2c, const lsm303dlhc_mag_init_t *init) {
+    return lsm303dlhc_dev_init_mag(&lsm303dlhc_default, i2c, init);
+}
+
+lsm303dlhc_result_t lsm303dlhc_set_mag_gain(lsm303dlhc_mag_gain_t gain) {
+    return lsm303dlhc_dev_set_mag_gain(&lsm303dlhc_default, gain);
+}
+
+lsm303dlhc_result_t lsm303dlhc_set_mag_rate(lsm303dlhc_mag_rate_t rate) {
+    return lsm303dlhc_dev_set_mag_rate(&lsm303dlhc_default, rate);
+}
+
+lsm303dlhc_result_t lsm303dlhc_set_bus_policy(const imu_bus_policy_t *policy) {
+    return lsm303dlhc_dev_set_bus_policy(&lsm303dlhc_default, policy);
+}
+
+void lsm303dlhc_set_recovery(GPIO_TypeDef *scl_port, uint16_t scl_pin, GPIO_TypeDef *sda_port, uint16_t sda_pin) {
+    lsm303dlhc_dev_set_recovery(&lsm303dlhc_default, scl_port, scl_pin, sda_port, sda_pin);
+}
+
+lsm303dlhc_result_t lsm303dlhc_recover(void) {
+    return lsm303dlhc_dev_recover(&lsm303dlhc_default);
+}
+
+lsm303dlhc_result_t lsm303dlhc_read_mag_raw(lsm303dlhc_data_raw_t *data) {
+    return lsm303dlhc_dev_read_mag_raw(&lsm303dlhc_default, data);
+}
+
+lsm303dlhc_result_t lsm303dlhc_read_mag_sample(lsm303dlhc_mag_sample_t *sample) {
+    return lsm303dlhc_dev_read_mag_sample(&lsm303dlhc_default, sample);
+}
+
+lsm303dlhc_result_t lsm303dlhc_mag_trigger(void) {
+    return lsm303dlhc_dev_mag_trigger(&lsm303dlhc_default);
+}
+
+lsm303dlhc_result_t lsm303dlhc_mag_collect(lsm303dlhc_mag_sample_t *sample) {
+    return lsm303dlhc_dev_mag_collect(&lsm303dlhc_default, sample);
+}
+
+uint32_t lsm303dlhc_mag_remaining_ms(void) {
+    return lsm303dlhc_dev_mag_remaining_ms(&lsm303dlhc_default);
+}
+
+void lsm303dlhc_convert_mag(lsm303dlhc_data_t *conv, const lsm303dlhc_data_raw_t *raw) {
+    lsm303dlhc_dev_convert_mag(&lsm303dlhc_default, conv, raw);
+}
+
+void lsm303dlhc_convert_acc_batch(lsm303dlhc_data_t conv[], const lsm303dlhc_data_raw_t raw[], uint16_t count) {
+    lsm303dlhc_dev_convert_acc_batch(&lsm303dlhc_default, conv, raw, count);
+}
+
+void lsm303dlhc_convert_mag_batch(lsm303dlhc_data_t conv[], const lsm303dlhc_data_raw_t raw[], uint16_t count) {
+    lsm303dlhc_dev_convert_mag_batch(&lsm303dlhc_default, conv, raw, count);
+}
+
+lsm303dlhc_result_t lsm303dlhc_read_acc_raw_async(lsm303dlhc_callback_t callback) {
+    return lsm303dlhc_dev_read_acc_raw_async(&lsm303dlhc_default, callback);
+}
+
+lsm303dlhc_result_t lsm303dlhc_read_mag_raw_async(lsm303dlhc_callback_t callback) {
+    return lsm303dlhc_dev_read_mag_raw_async(&lsm303dlhc_default, callback);
+}
+
+lsm303dlhc_result_t lsm303dlhc_set_drdy_acc(bool enable, lsm303dlhc_callback_t callback) {
+    return lsm303dlhc_dev_set_drdy_acc(&lsm303dlhc_default, enable, callback);
+}
+
+lsm303dlhc_result_t lsm303dlhc_set_drdy_mag(bool enable, lsm303dlhc_callback_t callback) {
+    return lsm303dlhc_dev_set_drdy_mag(&lsm303dlhc_default, enable, callback);
+}
+
+void lsm303dlhc_on_drdy_acc(void) {
+    lsm303dlhc_dev_on_drdy_acc(&lsm303dlhc_default);
+}
+
+void lsm303dlhc_on_drdy_mag(void) {
+    lsm303dlhc_dev_on_drdy_mag(&lsm303dlhc_default);
+}
+
+lsm303dlhc_result_t lsm303dlhc_set_acc_int1(uint8_t cfg, uint16_t threshold_mg, uint16_t duration_ms) {
+    return lsm303dlhc_dev_set_acc_int1(&lsm303dlhc_default, cfg, threshold_mg, duration_ms);
+}
+
+lsm303dlhc_result_t lsm303dlhc_read_acc_int1_src(uint8_t *src) {
+    return lsm303dlhc_dev_read_acc_int1_src(&lsm303dlhc_default, src);
+}
+
+lsm303dlhc_result_t lsm303dlhc_reset_acc_hp(void) {
+    return lsm303dlhc_dev_reset_acc_hp(&lsm303dlhc_default);
+}
+
+lsm303dlhc_result_t lsm303dlhc_set_acc_hpf(const lsm303dlhc_acc_hpf_config_t *config) {
+    return lsm303dlhc_dev_set_acc_hpf(&lsm303dlhc_default, config);
+}
+
+lsm303dlhc_result_t lsm303dlhc_set_click(const lsm303dlhc_click_config_t *config) {
+    return lsm303dlhc_dev_set_click(&lsm303dlhc_default, config);
+}
+
+lsm303dlhc_result_t lsm303dlhc_read_click(lsm303dlhc_click_event_t *event) {
+    return lsm303dlhc_dev_read_click(&lsm303dlhc_default, event);
+}
+
+/* private functions */
+static lsm303dlhc_result_t lsm303dlhc_attach(lsm303dlhc_t *dev, I2C_HandleTypeDef *i2c) {
+    lsm303dlhc_t *it;
+
+    if (dev == NULL || i2c == NULL) {
+        return LSM303DLHC_ERROR;
+    }
+
+    /* register the device once, the HAL callbacks find it by its bus */
+    for (it = lsm303dlhc_devices; it != NULL && it != dev; it = it->next) {
+    }
+
+    if (it == NULL) {
+        *dev = (lsm303dlhc_t) { 0 };
+        dev->bus.timeout_us = LSM303DLHC_I2C_TIMEOUT * 1000;
+        dev->acc_mg_lsb = 0.001f;
+        dev->mag_gain = LSM303DLHC_MAGGAIN_1_3;
+        dev->mag_gauss_lsb_xy = 1100.0f;
+        dev->mag_gauss_lsb_z = 980.0f;
+        lsm303dlhc_dev_set_acc_calib(dev, NULL, NULL);
+        lsm303dlhc_dev_set_mag_calib(dev, NULL, NULL);
+        dev->next = lsm303dlhc_devices;
+        lsm303dlhc_devices = dev;
+    } else if (dev->xfer != LSM303DLHC_XFER_NONE) {
+        return LSM303DLHC_ERROR;
+    }
+
+    dev->i2c = i2c;
+
+    return LSM303DLHC_OK;
+}
+
+/* at most one gain change per sample, so a read costs at most one extra register write */
+static lsm303dlhc_result_t lsm303dlhc_mag_auto_range(lsm303dlhc_t *dev, const lsm303dlhc_data_raw_t *raw) {
+    uint8_t idx = (uint8_t) dev->mag_gain >> 5;
+    uint8_t next = idx;
+    uint16_t peak = 0;
+    int16_t v[3] = { raw->x, raw->y, raw->z };
+    uint8_t i;
+
+    /* the first sample after a change may have been converted with the old gain */
+    if (dev->mag_discard) {
+        dev->mag_discard = false;
+        return LSM303DLHC_NO_DATA;
+    }
+
+    for (i = 0; i < 3; i++) {
+        uint16_t a = (v[i] < 0) ? (uint16_t) -v[i] : (uint16_t) v[i];    // -4096 reports an overflow
+
+        if (a > peak) {
+            peak = a;
+        }
+    }
+
+    /* widen before the output clips, narrow only if the sample would stay well below that */
+    if (peak >= LSM303DLHC_MAG_RANGE_HIGH) {
+        if (idx < 7) {
+            next = idx + 1;
+        }
+    } else if (idx > 1 && (uint32_t) peak * lsm303dlhc_mag_lsb[idx - 1][0] < (uint32_t) LSM303DLHC_MAG_RANGE_LOW * lsm303dlhc_mag_lsb[idx][0]) {
+        next = idx - 1;
+    }
+
+    if (next != idx) {
+        IMU_STATS_RETRY(IMU_STATS_LSM303DLHC_READ_MAG);
+
+        if (lsm303dlhc_dev_set_mag_gain(dev, (lsm303dlhc_mag_gain_t) (next << 5)) != LSM303DLHC_OK) {
+            return LSM303DLHC_ERROR;
+        }
+    }
+
+    if (peak >= LSM303DLHC_MAG_SATURATION) {
+        return LSM303DLHC_NO_DATA;
+    }
+
+    return LSM303DLHC_OK;
+}
+
+static lsm303dlhc_t *lsm303dlhc_find(const I2C_HandleTypeDef *i2c) {
+    lsm303dlhc_t *it;
+
+    /* one LSM303DLHC per bus, its addresses are fixed */
+    for (it = lsm303dlhc_devices; it != NULL; it = it->next) {
+        if (it->i2c == i2c && it->xfer != LSM303DLHC_XFER_NONE) {
+            return it;
+        }
+    }
+
+    return NULL;
+}
+
+static bool lsm303dlhc_ctrl_index(uint8_t address, uint8_t reg, uint8_t *idx) {
+    if (address == LSM303DLHC_ADDR_ACC && reg >= LSM303DLHC_REG_ACC_CTRL_REG1_A && reg < LSM303DLHC_REG_ACC_CTRL_REG1_A + LSM303DLHC_ACC_CTRL_COUNT) {
+        *idx = reg - LSM303DLHC_REG_ACC_CTRL_REG1_A;
+        return true;
+    }
+
+    if (address == LSM303DLHC_ADDR_MAG && reg < LSM303DLHC_REG_MAG_CRA_REG_M + LSM303DLHC_MAG_CTRL_COUNT) {
+        *idx = reg - LSM303DLHC_REG_MAG_CRA_REG_M;
+        return true;
+    }
+
+    return false;
+}
+
+static void lsm303dlhc_ctrl_modify(lsm303dlhc_t *dev, uint8_t address, uint8_t reg, uint8_t mask, uint8_t value) {
+    lsm303dlhc_shadow_t *shadow = (address == LSM303DLHC_ADDR_ACC) ? &dev->acc_ctrl : &dev->mag_ctrl;
+    uint8_t idx, updated;
+
+    if (!lsm303dlhc_ctrl_index(address, reg, &idx)) {
+        return;
+    }
+
+    /* an unchanged register is not written again */
+    updated = (shadow->reg[idx] & ~mask) | (value & mask);
+    if (updated != shadow->reg[idx]) {
+        shadow->reg[idx] = updated;
+        shadow->dirty |= 1 << idx;
+    }
+}
+
+static lsm303dlhc_result_t lsm303dlhc_ctrl_flush(lsm303dlhc_t *dev, uint8_t address) {
+    lsm303dlhc_shadow_t *shadow;
+    uint8_t base, count, first, last;
+
+    if (address == LSM303DLHC_ADDR_ACC) {
+        shadow = &dev->acc_ctrl;
+        base = LSM303DLHC_REG_ACC_CTRL_REG1_A;
+        count = LSM303DLHC_ACC_CTRL_COUNT;
+    } else {
+        shadow = &dev->mag_ctrl;
+        base = LSM303DLHC_REG_MAG_CRA_REG_M;
+        count = LSM303DLHC_MAG_CTRL_COUNT;
+    }
+
+    /* one auto-increment burst per run of dirty registers */
+    for (first = 0; first < count; first = last) {
+        last = first + 1;
+
+        if (!(shadow->dirty & (1 << first))) {
+            continue;
+        }
+
+        while (last < count && (shadow->dirty & (1 << last))) {
+            last++;
+        }
+
+        if (lsm303dlhc_write_i2c_multi(dev, address, base + first, &shadow->reg[first], last - first) != LSM303DLHC_OK) {
+            return LSM303DLHC_ERROR;
+        }
+
+        shadow->dirty &= ~(((1 << last) - 1) & ~((1 << first) - 1));
+    }
+
+    return LSM303DLHC_OK;
+}
+
+static float lsm303dlhc_acc_mg_lsb(uint8_t ctrl_reg4_a) {
+    if ((ctrl_reg4_a & 0b110000) == LSM303DLHC_ACR4A_FS10_1MG) {
+        return 0.001f;
+    } else if ((ctrl_reg4_a & 0b110000) == LSM303DLHC_ACR4A_FS10_2MG) {
+        return 0.002f;
+    } else if ((ctrl_reg4_a & 0b110000) == LSM303DLHC_ACR4A_FS10_4MG) {
+        return 0.004f;
+    } else {
+        return 0.012f;
+    }
+}
+
+/* steps of size step covering value */
+static uint32_t lsm303dlhc_steps(uint32_t value, uint32_t step) {
+    return (value + step - 1) / step;
+}
+
+static bool lsm303dlhc_mag_gain_valid(lsm303dlhc_mag_gain_t gain) {
+    return ((uint8_t) gain >> 5) != 0 && ((uint8_t) gain & 0x1F) == 0;
+}
+
+static void lsm303dlhc_update_mag_gain(lsm303dlhc_t *dev, lsm303dlhc_mag_gain_t gain) {
+    uint8_t idx = (uint8_t) gain >> 5;
+
+    dev->mag_gain = gain;
+    dev->mag_discard = true;
+    dev->mag_gauss_lsb_xy = lsm303dlhc_mag_lsb[idx][0];
+    dev->mag_gauss_lsb_z = lsm303dlhc_mag_lsb[idx][1];
+
+    lsm303dlhc_update_scale(dev);
+}
+
+static void lsm303dlhc_update_scale(lsm303dlhc_t *dev) {
+    float acc_bias[3] = { 0.0f, 0.0f, 0.0f }, acc_t[3] = { 1.0f, 1.0f, 1.0f };
+    float mag_bias[3] = { 0.0f, 0.0f, 0.0f }, mag_t[3] = { 1.0f, 1.0f, 1.0f };
+    float temp = (float) dev->temp / LSM303DLHC_TEMP_LSB + LSM303DLHC_TEMP_OFFSET;
+    uint8_t i, j;
+    float lsb[3];
+
+    /* reciprocals are taken here once, the conversions only multiply */
+    dev->acc_scale = dev->acc_mg_lsb * LSM303DLHC_ACC_SENSORS_GRAVITY_STANDARD;
+    dev->mag_scale_xy = LSM303DLHC_MAG_SENSORS_GAUSS_TO_MICROTESLA / dev->mag_gauss_lsb_xy;
+    dev->mag_scale_z = LSM303DLHC_MAG_SENSORS_GAUSS_TO_MICROTESLA / dev->mag_gauss_lsb_z;
+
+    if (dev->temp_valid && dev->acc_temp_table != NULL) {
+        imu_tempcomp_eval(dev->acc_temp_table, temp, acc_bias, acc_t);
+    }
+
+    if (dev->temp_valid && dev->mag_temp_table != NULL) {
+        imu_tempcomp_eval(dev->mag_temp_table, temp, mag_bias, mag_t);
+    }
+
+    /* scale * (t * (acc_scale * raw - bias) - offset) = k * raw + b */
+    for (i = 0; i < 3; i++) {
+        dev->acc_k[i] = dev->acc_cal_scale[i] * acc_t[i] * dev->acc_scale;
+        dev->acc_b[i] = -dev->acc_cal_scale[i] * (acc_t[i] * acc_bias[i] + dev->acc_cal_offset[i]);
+    }
+
+    /* soft * (t * (diag(lsb) * raw - bias) - offset) = k * raw + b */
+    lsb[0] = dev->mag_scale_xy;
+    lsb[1] = dev->mag_scale_xy;
+    lsb[2] = dev->mag_scale_z;
+    dev->mag_cross = false;
+
+    for (i = 0; i < 3; i++) {
+        dev->mag_b[i] = 0.0f;
+
+        for (j = 0; j < 3; j++) {
+            dev->mag_k[i][j] = dev->mag_cal_soft[i][j] * mag_t[j] * lsb[j];
+            dev->mag_b[i] -= dev->mag_cal_soft[i][j] * (mag_t[j] * mag_bias[j] + dev->mag_cal_offset[j]);
+
+            if (i != j && dev->mag_k[i][j] != 0.0f) {
+                dev->mag_cross = true;
+            }
+        }
+    }
+}
+
+static void lsm303dlhc_read_temp(lsm303dlhc_t *dev) {
+    uint8_t buf[2];
+    int16_t temp;
+
+    if (dev->temp_every == 0 || --dev->temp_count > 0) {
+        return;
+    }
+
+    dev->temp_count = dev->temp_every;
+
+    /* a failed read keeps the last temperature, the sample is still good */
+    if (lsm303dlhc_read_i2c_multi(dev, LSM303DLHC_ADDR_MAG, LSM303DLHC_REG_MAG_TEMP_OUT_H_M, buf, sizeof(buf)) != LSM303DLHC_OK) {
+        return;
+    }
+
+    temp = (int16_t) (buf[0] << 8 | buf[1]) >> 4;
+
+    /* the tables are only evaluated when the reading changes */
+    if (dev->temp_valid && temp == dev->temp) {
+        return;
+    }
+
+    dev->temp = temp;
+    dev->temp_valid = true;
+
+    if (dev->acc_temp_table != NULL || dev->mag_temp_table != NULL) {
+        lsm303dlhc_update_scale(dev);
+    }
+}
+
+static void lsm303dlhc_scale_batch(lsm303dlhc_data_t *conv, const lsm303dlhc_data_raw_t *raw, uint16_t count, const float *k, const float *b) {
+    uint16_t i;
+
+#ifdef ARM_MATH_CM4
+    /* both arrays are flat x, y, z sequences, convert them as one vector */
+    float32_t *out = (float32_t *) conv;
+
+    arm_q15_to_float((q15_t *) raw, out, 3 * count);
+
+    if (k[0] == k[1] && k[1] == k[2] && b[0] == 0.0f && b[1] == 0.0f && b[2] == 0.0f) {
+        arm_scale_f32(out, k[0] * 32768.0f, out, 3 * count);
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        conv[i].x = conv[i].x * (k[0] * 32768.0f) + b[0];
+        conv[i].y = conv[i].y * (k[1] * 32768.0f) + b[1];
+        conv[i].z = conv[i].z * (k[2] * 32768.0f) + b[2];
+    }
+#else
+    for (i = 0; i < count; i++) {
+        conv[i].x = (float) raw[i].x * k[0] + b[0];
+        conv[i].y = (float) raw[i].y * k[1] + b[1];
+        conv[i].z = (float) raw[i].z * k[2] + b[2];
+    }
+#endif
+}
+
+static void lsm303dlhc_scale_soa(float *x, float *y, float *z, const lsm303dlhc_data_raw_t *raw, uint16_t count, const float *k, const float *b) {
+    uint16_t i;
+
+    /* one pass per axis keeps every store stream contiguous */
+    for (i = 0; i < count; i++) {
+        x[i] = (float) raw[i].x * k[0] + b[0];
+    }
+
+    for (i = 0; i < count; i++) {
+        y[i] = (float) raw[i].y * k[1] + b[1];
+    }
+
+    for (i = 0; i < count; i++) {
+        z[i] = (float) raw[i].z * k[2] + b[2];
+    }
+}
+
+static void lsm303dlhc_convert_soft(const lsm303dlhc_t *dev, lsm303dlhc_data_t *conv, const lsm303dlhc_data_raw_t *raw) {
+    const float (*k)[3] = dev->mag_k;
+
+    conv->x = (float) raw->x * k[0][0] + (float) raw->y * k[0][1] + (float) raw->z * k[0][2] + dev->mag_b[0];
+    conv->y = (float) raw->x * k[1][0] + (float) raw->y * k[1][1] + (float) raw->z * k[1][2] + dev->mag_b[1];
+    conv->z = (float) raw->x * k[2][0] + (float) raw->y * k[2][1] + (float) raw->z * k[2][2] + dev->mag_b[2];
+}
+
+static void lsm303dlhc_decode_acc(lsm303dlhc_data_raw_t *data, const uint8_t *buf) {
+    /* raw data (low byte first) */
+    data->x = (int16_t) (buf[LSM303DLHC_ACC_XLO] | (buf[LSM303DLHC_ACC_XHI] << 8)) >> 4;
+    data->y = (int16_t) (buf[LSM303DLHC_ACC_YLO] | (buf[LSM303DLHC_ACC_YHI] << 8)) >> 4;
+    data->z = (int16_t) (buf[LSM303DLHC_ACC_ZLO] | (buf[LSM303DLHC_ACC_ZHI] << 8)) >> 4;
+}
+
+static void lsm303dlhc_decode_mag(lsm303dlhc_data_raw_t *data, const uint8_t *buf) {
+    /* raw data (high byte first) */
+    data->x = (int16_t) (buf[LSM303DLHC_MAG_XLO] | (buf[LSM303DLHC_MAG_XHI] << 8));
+    data->y = (int16_t) (buf[LSM303DLHC_MAG_YLO] | (buf[LSM303DLHC_MAG_YHI] << 8));
+    data->z = (int16_t) (buf[LSM303DLHC_MAG_ZLO] | (buf[LSM303DLHC_MAG_ZHI] << 8));
+}
+
+static lsm303dlhc_result_t lsm303dlhc_read_async(lsm303dlhc_t *dev, lsm303dlhc_xfer_t xfer, uint8_t address, uint8_t reg, lsm303dlhc_callback_t callback) {
+    HAL_StatusTypeDef status;
+    uint8_t *buf = dev->xfer_buf[dev->xfer_idx];
+
+    if (dev->i2c == NULL) {
+        return LSM303DLHC_ERROR;
+    }
+
+    if (dev->xfer != LSM303DLHC_XFER_NONE) {
+        return LSM303DLHC_BUSY;
+    }
+
+    dev->xfer = xfer;
+    dev->xfer_callback = callback;
+
+#ifdef LSM303DLHC_ASYNC_IT
+    status = HAL_I2C_Mem_Read_IT(dev->i2c, address, reg, I2C_MEMADD_SIZE_8BIT, buf, LSM303DLHC_ACC_LEN);
+#else
+    status = HAL_I2C_Mem_Read_DMA(dev->i2c, address, reg, I2C_MEMADD_SIZE_8BIT, buf, LSM303DLHC_ACC_LEN);
+#endif
+
+    if (status != HAL_OK) {
+        dev->xfer = LSM303DLHC_XFER_NONE;
+
+        /* the HAL handle is locked by a transfer this driver didn't start */
+        return status == HAL_BUSY ? LSM303DLHC_BUSY : LSM303DLHC_ERROR;
+    }
+
+    return LSM303DLHC_OK;
+}
+
+static void lsm303dlhc_drdy_resume(lsm303dlhc_t *dev) {
+    if (dev->acc_drdy && dev->acc_drdy_callback != NULL && dev->acc_drdy_pending) {
+        dev->acc_drdy_pending = false;
+        lsm303dlhc_dev_on_drdy_acc(dev);
+    } else if (dev->mag_drdy && dev->mag_drdy_callback != NULL && dev->mag_drdy_pending) {
+        dev->mag_drdy_pending = false;
+        lsm303dlhc_dev_on_drdy_mag(dev);
+    }
+}
+
+static lsm303dlhc_result_t lsm303dlhc_read_i2c(lsm303dlhc_t *dev, uint8_t address, uint8_t reg, uint8_t *data) {
+    return lsm303dlhc_read_i2c_multi(dev, address, reg, data, 1);
+}
+
+static lsm303dlhc_result_t lsm303dlhc_write_i2c(lsm303dlhc_t *dev, uint8_t address, uint8_t reg, uint8_t data) {
+    return lsm303dlhc_write_i2c_multi(dev, address, reg, &data, 1);
+}
+
+static lsm303dlhc_result_t lsm303dlhc_write_i2c_multi(lsm303dlhc_t *dev, uint8_t address, uint8_t reg, const uint8_t *data, uint16_t len) {
+    uint8_t buf[1 + LSM303DLHC_ACC_CTRL_COUNT];
+    uint16_t i;
+
+    if (len > sizeof(buf) - 1) {
+        return LSM303DLHC_ERROR;
+    }
+
+    /* same sub-address rule as lsm303dlhc_read_i2c_multi */
+    buf[0] = reg;
+    if (address == LSM303DLHC_ADDR_ACC && len > 1) {
+        buf[0] |= 0x80;
+    }
+
+    for (i = 0; i < len; i++) {
+        buf[i + 1] = data[i];
+    }
+
+    return lsm303dlhc_transfer(dev, address, buf, len + 1, NULL, 0);
+}
+
+static lsm303dlhc_result_t lsm303dlhc_read_i2c_multi(lsm303dlhc_t *dev, uint8_t address, uint8_t reg, uint8_t *data, uint16_t len) {
+    /* the accelerometer only auto-increments the sub-address if its MSB is set, the magnetometer always does */
+    if (address == LSM303DLHC_ADDR_ACC && len > 1) {
+        reg |= 0x80;
+    }
+
+    return lsm303dlhc_transfer(dev, address, &reg, 1, data, len);
+}
+
+/* one blocking transaction with the retries of the bus policy, rx may be NULL */
+static lsm303dlhc_result_t lsm303dlhc_transfer(lsm303dlhc_t *dev, uint8_t address, uint8_t *tx, uint16_t tx_len, uint8_t *rx, uint16_t rx_len) {
+    HAL_StatusTypeDef status;
+    uint32_t start_tick;
+    uint8_t attempt;
+
+    for (attempt = 0;; attempt++) {
+        IMU_STATS_BEGIN(start);
+
+        start_tick = HAL_GetTick();
+
+        status = lsm303dlhc_wait_idle(dev, start_tick);
+        if (status == HAL_OK) {
+            uint32_t remaining = imu_bus_remaining_ms(&dev->bus, start_tick);
+
+            status = (remaining == 0) ? HAL_TIMEOUT : HAL_I2C_Master_Transmit(dev->i2c, address, tx, tx_len, remaining);
+        }
+
+        if (status == HAL_OK && rx != NULL) {
+            uint32_t remaining = imu_bus_remaining_ms(&dev->bus, start_tick);
+
+            status = (remaining == 0) ? HAL_TIMEOUT : HAL_I2C_Master_Receive(dev->i2c, address, rx, rx_len, remaining);
+        }
+
+        /* the I2C HAL reports an expired deadline as HAL_ERROR with the cause in ErrorCode */
+        if (status == HAL_ERROR && (HAL_I2C_GetError(dev->i2c) & HAL_I2C_ERROR_TIMEOUT)) {
+            status = HAL_TIMEOUT;
+        }
+
+        IMU_STATS_END((rx != NULL) ? IMU_STATS_LSM303DLHC_READ_I2C : IMU_STATS_LSM303DLHC_WRITE_I2C, start, tx_len + rx_len, status);
+
+        if (status == HAL_OK) {
+            return LSM303DLHC_OK;
+        }
+
+        /*
+         * a slave holding SDA shows as a timeout with SDA low. A NACK leaves the bus idle and
+         * HAL_BUSY is a transfer of another context on the handle, neither is recovered.
+         */
+        if (status == HAL_TIMEOUT && dev->scl_port != NULL && HAL_GPIO_ReadPin(dev->sda_port, dev->sda_pin) == GPIO_PIN_RESET) {
+            lsm303dlhc_dev_recover(dev);
+        }
+
+        if (attempt >= dev->bus.retries) {
+            return LSM303DLHC_ERROR;
+        }
+
+        IMU_STATS_RETRY((rx != NULL) ? IMU_STATS_LSM303DLHC_READ_I2C : IMU_STATS_LSM303DLHC_WRITE_I2C);
+        imu_bus_backoff(&dev->bus, attempt + 1);
+    }
+}
+
+/*
+ * The HAL waits I2C_TIMEOUT_BUSY (25 ms) for a busy bus before it looks at its own timeout, so the
+ * bus is polled here under the deadline of the transaction instead. A handle that is not ready is
+ * left to the HAL, which returns HAL_BUSY at once.
+ */
+static HAL_StatusTypeDef lsm303dlhc_wait_idle(lsm303dlhc_t *dev, uint32_t start_tick) {
+    if (HAL_I2C_GetState(dev->i2c) != HAL_I2C_STATE_READY) {
+        return HAL_OK;
+    }
+
+    while (__HAL_I2C_GET_FLAG(dev->i2c, I2C_FLAG_BUSY) == SET) {
+        if (imu_bus_remaining_ms(&dev->bus, start_tick) == 0) {
+            return HAL_TIMEOUT;
+        }
+
+        imu_clock_delay_us(LSM303DLHC_BUSY_POLL_US);
+    }
+
+    return HAL_OK;
+}
+
+/* drives one recovery pin and holds it for half a clock period */
+static void lsm303dlhc_recovery_pin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state) {
+    HAL_GPIO_WritePin(port, pin, state);
+    imu_clock_delay_us(LSM303DLHC_RECOVERY_HALF_US);
 }
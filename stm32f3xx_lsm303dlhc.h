@@ -5,12 +5,30 @@
 #include <stdbool.h>
 
 #include "stm32f3xx_hal.h"
+#include "imu_ring.h"
+#include "imu_bus.h"
+#include "imu_tempcomp.h"
 
 /* C++ detection */
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* default deadline of a blocking I2C transaction in ms, see lsm303dlhc_dev_set_bus_policy */
+#ifndef LSM303DLHC_I2C_TIMEOUT
+#define LSM303DLHC_I2C_TIMEOUT    1000
+#endif
+
+/* bus recovery, half period of the SCL pulses */
+#define LSM303DLHC_RECOVERY_HALF_US    5                                       // 100 kHz
+#define LSM303DLHC_RECOVERY_US         (24 * LSM303DLHC_RECOVERY_HALF_US + 50)  // bound of lsm303dlhc_dev_recover, 50 us for the I2C re-init
+#define LSM303DLHC_BUSY_POLL_US        10                                      // a busy bus is polled this often before a transaction
+
+/* blocking transactions issued by the read functions, for imu_bus_worst_case_us */
+#define LSM303DLHC_READ_ACC_TRANSACTIONS    1
+#define LSM303DLHC_READ_MAG_TRANSACTIONS    4    // status, data, temperature and an auto-range gain change
+#define LSM303DLHC_COLLECT_MAG_TRANSACTIONS 5    // the same and the trigger after a dropped sample
+
 /* i2c addresses */
 #define LSM303DLHC_ADDR_ACC    0x32
 #define LSM303DLHC_ADDR_MAG    0x3C
@@ -52,6 +70,7 @@ extern "C" {
 #define LSM303DLHC_ACR1A_YEN                 (1 << 1)   // Y axis enable. Default value: 1
 #define LSM303DLHC_ACR1A_ZEN                 (1 << 2)   // Z axis enable. Default value: 1
 #define LSM303DLHC_ACR1A_LPEN                (1 << 3)   // Low-power mode enable. Default value: 0
+#define LSM303DLHC_ACR1A_ODR30               (0b1111 << 4)   // Output data rate selection
 #define LSM303DLHC_ACR1A_ODR30_POWER_DOWN    (0b0000 << 4)   // Power-down mode
 #define LSM303DLHC_ACR1A_ODR30_1_HZ          (0b0001 << 4)   // Normal / low-power mode (1 Hz)
 #define LSM303DLHC_ACR1A_ODR30_10_HZ         (0b0010 << 4)
@@ -63,6 +82,27 @@ extern "C" {
 #define LSM303DLHC_ACR1A_ODR30_1620_HZ       (0b1000 << 4)
 #define LSM303DLHC_ACR1A_ODR30_5376_HZ       (0b1001 << 4)   // Normal (1.344 kHz) / low-power mode (5.376 KHz)
 
+/* accelerometer CTRL_REG2_A, high-pass filter */
+#define LSM303DLHC_ACR2A_HPIS1               (1 << 0)       // filtered data to interrupt generator 1
+#define LSM303DLHC_ACR2A_HPIS2               (1 << 1)       // filtered data to interrupt generator 2
+#define LSM303DLHC_ACR2A_HPCLICK             (1 << 2)       // filtered data to the click function
+#define LSM303DLHC_ACR2A_FDS                 (1 << 3)       // filtered data to the output registers and FIFO
+#define LSM303DLHC_ACR2A_HPCF                (0b11 << 4)    // cut-off frequency
+#define LSM303DLHC_ACR2A_HPM                 (0b11 << 6)    // mode, 00 = normal, reset by reading REFERENCE_A
+#define LSM303DLHC_ACR2A_HPM_NORMAL_RESET    (0b00 << 6)    // normal, reset by reading REFERENCE_A
+#define LSM303DLHC_ACR2A_HPM_REFERENCE       (0b01 << 6)    // output relative to REFERENCE_A
+#define LSM303DLHC_ACR2A_HPM_NORMAL          (0b10 << 6)    // normal
+#define LSM303DLHC_ACR2A_HPM_AUTORESET       (0b11 << 6)    // reset on an interrupt event
+
+/* accelerometer CTRL_REG3_A, INT1 routing */
+#define LSM303DLHC_ACR3A_I1_OVERRUN          (1 << 1)       // FIFO overrun interrupt on INT1
+#define LSM303DLHC_ACR3A_I1_WTM              (1 << 2)       // FIFO watermark interrupt on INT1
+#define LSM303DLHC_ACR3A_I1_DRDY2            (1 << 3)       // DRDY2 interrupt on INT1
+#define LSM303DLHC_ACR3A_I1_DRDY1            (1 << 4)       // DRDY1 (data ready) interrupt on INT1
+#define LSM303DLHC_ACR3A_I1_AOI2             (1 << 5)       // AOI2 interrupt on INT1
+#define LSM303DLHC_ACR3A_I1_AOI1             (1 << 6)       // AOI1 interrupt on INT1
+#define LSM303DLHC_ACR3A_I1_CLICK            (1 << 7)       // CLICK interrupt on INT1
+
 /* accelerometer CTRL_REG4_A */
 #define LSM303DLHC_ACR4A_SIM                 (1 << 0)       // SPI serial interface mode selection. Default value: 0
 #define LSM303DLHC_ACR4A_HR                  (1 << 3)       // High resolution output mode: Default value: 0
@@ -73,6 +113,80 @@ extern "C" {
 #define LSM303DLHC_ACR4A_BLE                 (1 << 6)       // Big/little endian data selection. Default value 0
 #define LSM303DLHC_ACR4A_BLU                 (1 << 7)       // Block data update. Default value: 0
 
+/* accelerometer CTRL_REG5_A */
+#define LSM303DLHC_ACR5A_D4D_INT2            (1 << 0)       // 4D enable on INT2
+#define LSM303DLHC_ACR5A_LIR_INT2            (1 << 1)       // Latch interrupt request on INT2_SRC
+#define LSM303DLHC_ACR5A_D4D_INT1            (1 << 2)       // 4D enable on INT1
+#define LSM303DLHC_ACR5A_LIR_INT1            (1 << 3)       // Latch interrupt request on INT1_SRC
+#define LSM303DLHC_ACR5A_FIFO_EN             (1 << 6)       // FIFO enable. Default value: 0
+#define LSM303DLHC_ACR5A_BOOT                (1 << 7)       // Reboot memory content. Default value: 0
+
+/* accelerometer CTRL_REG6_A, INT2 routing */
+#define LSM303DLHC_ACR6A_H_LACTIVE           (1 << 1)       // interrupts active low
+#define LSM303DLHC_ACR6A_P2_ACT              (1 << 3)       // activity interrupt on INT2
+#define LSM303DLHC_ACR6A_BOOT_I1             (1 << 4)       // boot status on INT2
+#define LSM303DLHC_ACR6A_I2_INT2             (1 << 5)       // interrupt generator 2 on INT2
+#define LSM303DLHC_ACR6A_I2_INT1             (1 << 6)       // interrupt generator 1 on INT2
+#define LSM303DLHC_ACR6A_I2_CLICK            (1 << 7)       // CLICK interrupt on INT2
+
+/* accelerometer INT1_CFG_A/INT2_CFG_A, an axis event compares the magnitude with the threshold */
+#define LSM303DLHC_AINT_XLIE                 (1 << 0)       // X below the threshold
+#define LSM303DLHC_AINT_XHIE                 (1 << 1)       // X above the threshold
+#define LSM303DLHC_AINT_YLIE                 (1 << 2)
+#define LSM303DLHC_AINT_YHIE                 (1 << 3)
+#define LSM303DLHC_AINT_ZLIE                 (1 << 4)
+#define LSM303DLHC_AINT_ZHIE                 (1 << 5)
+#define LSM303DLHC_AINT_6D                   (1 << 6)       // 6 direction detection
+#define LSM303DLHC_AINT_AOI                  (1 << 7)       // AND of the enabled events, OR when cleared
+
+/* accelerometer INT1_SRC_A/INT2_SRC_A, the axis bits as in the CFG, reading clears a latched interrupt */
+#define LSM303DLHC_AINT_SRC_IA               (1 << 6)       // interrupt active
+#define LSM303DLHC_AINT_LEN                  2              // THS and DURATION, written in one burst
+#define LSM303DLHC_AINT_MAX                  127            // steps of THS and DURATION
+
+/* accelerometer CLICK_CFG_A */
+#define LSM303DLHC_CLICK_XS                  (1 << 0)       // single click on X
+#define LSM303DLHC_CLICK_XD                  (1 << 1)       // double click on X
+#define LSM303DLHC_CLICK_YS                  (1 << 2)
+#define LSM303DLHC_CLICK_YD                  (1 << 3)
+#define LSM303DLHC_CLICK_ZS                  (1 << 4)
+#define LSM303DLHC_CLICK_ZD                  (1 << 5)
+
+/* accelerometer CLICK_SRC_A */
+#define LSM303DLHC_CLICKSRC_X                (1 << 0)       // click on X
+#define LSM303DLHC_CLICKSRC_Y                (1 << 1)
+#define LSM303DLHC_CLICKSRC_Z                (1 << 2)
+#define LSM303DLHC_CLICKSRC_SIGN             (1 << 3)       // negative
+#define LSM303DLHC_CLICKSRC_SCLICK           (1 << 4)       // single click
+#define LSM303DLHC_CLICKSRC_DCLICK           (1 << 5)       // double click
+#define LSM303DLHC_CLICKSRC_IA               (1 << 6)       // interrupt active
+
+/* CLICK_THS_A .. TIME_WINDOW_A, written in one burst */
+#define LSM303DLHC_CLICK_LEN                 4
+#define LSM303DLHC_CLICK_THS_MAX             127            // full scale / 128 per step
+#define LSM303DLHC_CLICK_LIMIT_MAX           127            // 1 / ODR per step, as the latency and the window
+#define LSM303DLHC_CLICK_TIME_MAX            255
+
+/* accelerometer FIFO_CTRL_REG_A */
+typedef enum {
+    LSM303DLHC_ACCFIFO_BYPASS = 0x00,   // FIFO disabled, output registers only
+    LSM303DLHC_ACCFIFO_FIFO = 0x40,     // fill up to 32 samples, then stop until re-armed
+    LSM303DLHC_ACCFIFO_STREAM = 0x80,   // keep the newest 32 samples
+    LSM303DLHC_ACCFIFO_TRIGGER = 0xC0   // stream until trigger event, then FIFO
+} lsm303dlhc_acc_fifo_mode_t;
+
+#define LSM303DLHC_ACCFIFO_CTRL_FM           0xC0           // FIFO mode, see lsm303dlhc_acc_fifo_mode_t
+#define LSM303DLHC_ACCFIFO_CTRL_TR           (1 << 5)       // Trigger selection: 0 = INT1, 1 = INT2
+#define LSM303DLHC_ACCFIFO_CTRL_FTH          0x1F           // FIFO watermark level
+
+/* accelerometer FIFO_SRC_REG_A */
+#define LSM303DLHC_ACCFIFO_SRC_FSS           0x1F           // FIFO stored data level
+#define LSM303DLHC_ACCFIFO_SRC_EMPTY         (1 << 5)       // FIFO empty
+#define LSM303DLHC_ACCFIFO_SRC_OVRN          (1 << 6)       // FIFO overrun, oldest samples overwritten
+#define LSM303DLHC_ACCFIFO_SRC_WTM           (1 << 7)       // FIFO level reached the watermark
+
+#define LSM303DLHC_ACC_FIFO_SIZE             32             // samples
+
 /* accelerometer read byte order if LSM303DLHC_ACR4A_BLE = 0  */
 #define LSM303DLHC_ACC_XLO   0
 #define LSM303DLHC_ACC_XHI   1
@@ -80,6 +194,11 @@ extern "C" {
 #define LSM303DLHC_ACC_YHI   3
 #define LSM303DLHC_ACC_ZLO   4
 #define LSM303DLHC_ACC_ZHI   5
+#define LSM303DLHC_ACC_LEN   6
+
+/* shadowed control registers, CTRL_REG1_A .. CTRL_REG6_A and CRA_REG_M .. MR_REG_M */
+#define LSM303DLHC_ACC_CTRL_COUNT    6
+#define LSM303DLHC_MAG_CTRL_COUNT    3
 
 #define LSM303DLHC_ACC_SENSORS_GRAVITY_STANDARD    (9.80665f)  // Earth's gravity in m/s^2
 
@@ -120,6 +239,14 @@ typedef enum {
     LSM303DLHC_MAGRATE_220 = 0x07   // 200 Hz
 } lsm303dlhc_mag_rate_t;
 
+#define LSM303DLHC_CRAM_TEMP_EN    (1 << 7)    // temperature sensor enable
+
+/* TEMP_OUT_H_M/L_M, 12 bits left-justified at 8 lsb per degC around an uncalibrated point, this many degC read as 0 */
+#define LSM303DLHC_TEMP_LSB        8
+#ifndef LSM303DLHC_TEMP_OFFSET
+#define LSM303DLHC_TEMP_OFFSET     25
+#endif
+
 /* CRB_REG_M */
 typedef enum {
     LSM303DLHC_MAGGAIN_1_3 = 0x20,  // +/- 1.3
@@ -138,11 +265,25 @@ typedef enum {
 #define LSM303DLHC_MAG_ZLO   3
 #define LSM303DLHC_MAG_YHI   4
 #define LSM303DLHC_MAG_YLO   5
+#define LSM303DLHC_MAG_LEN   6
 
 #define LSM303DLHC_MAG_SENSORS_GAUSS_TO_MICROTESLA    (100.0f)  // Gauss to micro-Tesla multiplier
 
+/* a single conversion not done within this many output periods of CRA_REG_M fails */
+#ifndef LSM303DLHC_MAG_SINGLE_PERIODS
+#define LSM303DLHC_MAG_SINGLE_PERIODS    2
+#endif
+
+/* magnetometer auto-ranging, raw counts of the largest axis */
+#define LSM303DLHC_MAG_SATURATION    2040    // output clips here, the sample is dropped
+#define LSM303DLHC_MAG_RANGE_HIGH    1800    // step to the next wider range
+#define LSM303DLHC_MAG_RANGE_LOW     1400    // step to the next narrower range if the sample would stay below this there
+
 typedef enum {
-    LSM303DLHC_OK, LSM303DLHC_ERROR
+    LSM303DLHC_OK, LSM303DLHC_ERROR,
+    LSM303DLHC_OVERRUN,   // data is valid, but the FIFO has overrun and samples were lost
+    LSM303DLHC_BUSY,      // an asynchronous transfer is already in progress on the bus
+    LSM303DLHC_NO_DATA    // no new sample since the last read
 } lsm303dlhc_result_t;
 
 typedef struct {
@@ -151,6 +292,12 @@ typedef struct {
     int16_t z;
 } lsm303dlhc_data_raw_t;
 
+/* magnetometer sample tagged with the gain that produced it */
+typedef struct {
+    lsm303dlhc_data_raw_t raw;
+    lsm303dlhc_mag_gain_t gain;
+} lsm303dlhc_mag_sample_t;
+
 typedef struct {
     float x;
     float y;
@@ -164,8 +311,17 @@ typedef struct {
     uint8_t ctrl_reg4_a;
     uint8_t ctrl_reg5_a;
     uint8_t ctrl_reg6_a;
+    lsm303dlhc_acc_fifo_mode_t fifo_mode;   // FIFO_EN in ctrl_reg5_a is set to match
+    uint8_t fifo_watermark;                 // 0 .. 31
 } lsm303dlhc_acc_init_t;
 
+typedef struct {
+    uint8_t level;      // samples stored in the FIFO when it was last drained
+    bool watermark;     // level had reached the watermark
+    bool overrun;       // samples were lost before the last drain
+    uint32_t overruns;  // number of drains that found the FIFO overrun
+} lsm303dlhc_fifo_status_t;
+
 typedef struct {
     lsm303dlhc_mag_op_t op;
     lsm303dlhc_mag_rate_t rate;
@@ -173,16 +329,307 @@ typedef struct {
     bool auto_range;
 } lsm303dlhc_mag_init_t;
 
+/* on-chip high-pass filter of the output, CTRL_REG2_A without the interrupt and click routing bits */
+typedef struct {
+    uint8_t mode;       // LSM303DLHC_ACR2A_HPM_*
+    uint8_t cutoff;     // HPCF 0 .. 3, lower cut-off for higher values, scales with the output data rate
+    bool output;        // FDS, filtered data to the output registers and FIFO
+} lsm303dlhc_acc_hpf_config_t;
+
+typedef enum {
+    LSM303DLHC_CLICK_PIN_NONE,      // CLICK_SRC_A is polled
+    LSM303DLHC_CLICK_PIN_INT1,
+    LSM303DLHC_CLICK_PIN_INT2
+} lsm303dlhc_click_pin_t;
+
+typedef struct {
+    uint8_t axes;               // LSM303DLHC_CLICK_* single and double click bits, 0 disables
+    uint16_t threshold_mg;      // a click starts above this ...
+    uint16_t limit_ms;          // ... and ends below it within this
+    uint16_t latency_ms;        // detection is off this long after the first click of a double click ...
+    uint16_t window_ms;         // ... and the second click starts within this after that
+    lsm303dlhc_click_pin_t pin;
+    bool high_pass;             // detect on the high-pass filtered signal, ignores slow changes such as tilt
+} lsm303dlhc_click_config_t;
+
+typedef enum {
+    LSM303DLHC_CLICK_NONE, LSM303DLHC_CLICK_SINGLE, LSM303DLHC_CLICK_DOUBLE
+} lsm303dlhc_click_type_t;
+
+/* decoded CLICK_SRC_A */
+typedef struct {
+    lsm303dlhc_click_type_t type;
+    uint8_t axes;               // LSM303DLHC_CLICKSRC_X/Y/Z
+    bool negative;              // direction of the click
+} lsm303dlhc_click_event_t;
+
+typedef enum {
+    LSM303DLHC_XFER_NONE, LSM303DLHC_XFER_ACC, LSM303DLHC_XFER_MAG
+} lsm303dlhc_xfer_t;
+
+typedef struct lsm303dlhc lsm303dlhc_t;
+
+/*
+ * Completion callback of the asynchronous reads, called from the I2C interrupt.
+ * data points into one of two buffers of the device, it stays valid until the transfer after
+ * the next one completes, so a new read can be started from the callback.
+ * On error data is NULL.
+ */
+typedef void (*lsm303dlhc_callback_t)(lsm303dlhc_t *dev, lsm303dlhc_result_t result, const lsm303dlhc_data_raw_t *data);
+
+/* cached control registers of one address, see lsm303dlhc_dev_get_ctrl */
+typedef struct {
+    uint8_t reg[LSM303DLHC_ACC_CTRL_COUNT];    // the magnetometer uses the first LSM303DLHC_MAG_CTRL_COUNT
+    uint8_t dirty;              // one bit per register not yet written
+} lsm303dlhc_shadow_t;
+
+/* device handle, one per sensor (accelerometer and magnetometer). Treat as opaque, set up by the init functions */
+struct lsm303dlhc {
+    I2C_HandleTypeDef *i2c;
+    imu_bus_policy_t bus;
+    GPIO_TypeDef *scl_port;     // bus recovery, NULL if disabled
+    uint16_t scl_pin;
+    GPIO_TypeDef *sda_port;
+    uint16_t sda_pin;
+
+    /* accelerometer */
+    float acc_mg_lsb;           // 1, 2, 4 or 12 mg per lsb
+    float acc_scale;            // m/s^2 per lsb, updated with the scale
+    float acc_cal_offset[3];    // m/s^2, see lsm303dlhc_dev_set_acc_calib
+    float acc_cal_scale[3];
+    float acc_k[3];             // m/s^2 per lsb, calibration folded into the scale
+    float acc_b[3];             // m/s^2
+    lsm303dlhc_shadow_t acc_ctrl;
+    uint8_t acc_fifo_ctrl;
+    lsm303dlhc_fifo_status_t acc_fifo_status;
+    bool acc_drdy;
+    lsm303dlhc_callback_t acc_drdy_callback;
+    volatile bool acc_drdy_pending;     // sample ready (blocking) or read deferred (callback)
+
+    /* magnetometer */
+    lsm303dlhc_shadow_t mag_ctrl;
+    lsm303dlhc_mag_gain_t mag_gain;
+    bool mag_auto_range;
+    bool mag_discard;           // next sample was converted around a gain change
+    float mag_gauss_lsb_xy;     // Varies with gain
+    float mag_gauss_lsb_z;      // Varies with gain
+    float mag_scale_xy;         // uT per lsb, updated with the gain
+    float mag_scale_z;
+    float mag_cal_offset[3];    // uT, see lsm303dlhc_dev_set_mag_calib
+    float mag_cal_soft[3][3];
+    float mag_k[3][3];          // uT per lsb, calibration folded into the gain
+    float mag_b[3];             // uT
+    bool mag_cross;             // mag_k has off-diagonal terms
+    bool mag_drdy;
+    lsm303dlhc_callback_t mag_drdy_callback;
+    volatile bool mag_drdy_pending;
+    bool mag_single;            // single conversion triggered and not collected yet
+    uint32_t mag_single_ms;     // HAL tick of the trigger
+
+    /* temperature of the die, read by the magnetometer */
+    const imu_tempcomp_t *acc_temp_table;   // NULL if not compensated
+    const imu_tempcomp_t *mag_temp_table;
+    uint16_t temp_every;        // magnetometer reads between temperature reads, 0 if disabled
+    uint16_t temp_count;        // reads until the next one
+    int16_t temp;               // 1/LSM303DLHC_TEMP_LSB degC of the last reading, without the offset
+    bool temp_valid;
+
+    /* asynchronous transfer */
+    volatile lsm303dlhc_xfer_t xfer;
+    lsm303dlhc_callback_t xfer_callback;
+    uint8_t xfer_buf[2][LSM303DLHC_ACC_LEN];    // ping-pong, the next transfer never overwrites the last sample
+    lsm303dlhc_data_raw_t xfer_data[2];
+    uint8_t xfer_idx;
+    imu_ring_t *acc_ring;       // receive every asynchronous sample, may be NULL
+    imu_ring_t *mag_ring;
+
+    lsm303dlhc_t *next;         // devices are looked up by bus in the HAL callbacks
+};
+
+lsm303dlhc_result_t lsm303dlhc_dev_init_acc(lsm303dlhc_t *dev, I2C_HandleTypeDef *i2c, const lsm303dlhc_acc_init_t *init);
+lsm303dlhc_result_t lsm303dlhc_dev_set_acc_scale(lsm303dlhc_t *dev, uint8_t ctrl_reg4_a);
+lsm303dlhc_result_t lsm303dlhc_dev_set_acc_odr(lsm303dlhc_t *dev, uint8_t odr);    // LSM303DLHC_ACR1A_ODR30_*
+lsm303dlhc_result_t lsm303dlhc_dev_read_acc_raw(lsm303dlhc_t *dev, lsm303dlhc_data_raw_t *data);
+void lsm303dlhc_dev_convert_acc(lsm303dlhc_t *dev, lsm303dlhc_data_t *conv, const lsm303dlhc_data_raw_t *raw);
+lsm303dlhc_result_t lsm303dlhc_dev_set_acc_fifo(lsm303dlhc_t *dev, lsm303dlhc_acc_fifo_mode_t mode, uint8_t watermark);
+lsm303dlhc_result_t lsm303dlhc_dev_read_acc_fifo(lsm303dlhc_t *dev, lsm303dlhc_data_raw_t data[], uint8_t max, uint8_t *count);
+void lsm303dlhc_dev_get_acc_fifo_status(lsm303dlhc_t *dev, lsm303dlhc_fifo_status_t *status);
+
+lsm303dlhc_result_t lsm303dlhc_dev_init_mag(lsm303dlhc_t *dev, I2C_HandleTypeDef *i2c, const lsm303dlhc_mag_init_t *init);
+lsm303dlhc_result_t lsm303dlhc_dev_set_mag_gain(lsm303dlhc_t *dev, lsm303dlhc_mag_gain_t gain);
+lsm303dlhc_result_t lsm303dlhc_dev_set_mag_rate(lsm303dlhc_t *dev, lsm303dlhc_mag_rate_t rate);
+lsm303dlhc_result_t lsm303dlhc_dev_read_mag_raw(lsm303dlhc_t *dev, lsm303dlhc_data_raw_t *data);
+void lsm303dlhc_dev_convert_mag(lsm303dlhc_t *dev, lsm303dlhc_data_t *conv, const lsm303dlhc_data_raw_t *raw);
+
+/*
+ * bus policy and recovery
+ * Every blocking transaction is bounded by the deadline of the device and retried as the policy
+ * says; a busy bus is waited for within the deadline too. A slave holding SDA low keeps the bus
+ * busy until the transaction times out; with the SCL and SDA pins set, a timeout with SDA low
+ * clocks SCL up to nine times, issues a STOP and re-initializes the I2C peripheral through
+ * HAL_I2C_DeInit/HAL_I2C_Init before the next attempt. HAL_BUSY, a handle held by another
+ * context, is never recovered. The default is LSM303DLHC_I2C_TIMEOUT, no retries and no recovery,
+ * set them after the init functions.
+ */
+lsm303dlhc_result_t lsm303dlhc_dev_set_bus_policy(lsm303dlhc_t *dev, const imu_bus_policy_t *policy);
+void lsm303dlhc_dev_set_recovery(lsm303dlhc_t *dev, GPIO_TypeDef *scl_port, uint16_t scl_pin, GPIO_TypeDef *sda_port, uint16_t sda_pin);
+lsm303dlhc_result_t lsm303dlhc_dev_recover(lsm303dlhc_t *dev);    // LSM303DLHC_ERROR if SDA stays low, LSM303DLHC_BUSY while a transfer holds the handle
+uint32_t lsm303dlhc_dev_read_acc_bound_us(const lsm303dlhc_t *dev);    // worst case of a blocking read in us
+uint32_t lsm303dlhc_dev_read_mag_bound_us(const lsm303dlhc_t *dev);
+
+/*
+ * register shadow
+ * The control registers of both addresses are cached by the device, reading them costs no bus
+ * traffic. Updates change the shadow and write only the registers that changed, contiguous ones in
+ * one auto-increment burst. A failed write stays pending and is retried by the next update.
+ * CTRL_REG4_A and CRB_REG_M are passed to lsm303dlhc_dev_set_acc_scale and lsm303dlhc_dev_set_mag_gain.
+ */
+uint8_t lsm303dlhc_dev_get_ctrl(const lsm303dlhc_t *dev, uint8_t address, uint8_t reg);
+lsm303dlhc_result_t lsm303dlhc_dev_update_ctrl(lsm303dlhc_t *dev, uint8_t address, uint8_t reg, uint8_t mask, uint8_t value);    // only the bits of mask change
+
+/*
+ * With auto_range a read changes the gain at most once: one status read, one data read and one
+ * gain write. The sample that triggered the change is still returned unless it clipped, the first
+ * one after the change is dropped (LSM303DLHC_NO_DATA). lsm303dlhc_dev_read_mag_raw drops the
+ * triggering sample too, its conversion factors already follow the new gain. Asynchronous reads
+ * do not auto-range.
+ */
+lsm303dlhc_result_t lsm303dlhc_dev_read_mag_sample(lsm303dlhc_t *dev, lsm303dlhc_mag_sample_t *sample);
+void lsm303dlhc_convert_mag_sample(lsm303dlhc_data_t *conv, const lsm303dlhc_mag_sample_t *sample);    // uses the gain of the sample
+
+/*
+ * single conversion
+ * lsm303dlhc_dev_mag_trigger writes MR_REG_M to single mode, the magnetometer converts once and
+ * sleeps again. lsm303dlhc_dev_mag_collect returns LSM303DLHC_NO_DATA without bus traffic until one
+ * output period at the rate of CRA_REG_M has passed, then reads like lsm303dlhc_dev_read_mag_sample.
+ * Do other work in between, lsm303dlhc_dev_mag_remaining_ms tells how long. A sample dropped by
+ * auto-ranging triggers the next conversion at the new gain, collect again. A conversion not done
+ * after LSM303DLHC_MAG_SINGLE_PERIODS periods fails and has to be triggered again.
+ */
+lsm303dlhc_result_t lsm303dlhc_dev_mag_trigger(lsm303dlhc_t *dev);    // LSM303DLHC_BUSY while a conversion is pending
+lsm303dlhc_result_t lsm303dlhc_dev_mag_collect(lsm303dlhc_t *dev, lsm303dlhc_mag_sample_t *sample);    // LSM303DLHC_ERROR without a trigger
+uint32_t lsm303dlhc_dev_mag_remaining_ms(const lsm303dlhc_t *dev);    // until collect reads the bus, 0 if nothing is pending
+uint32_t lsm303dlhc_mag_conversion_us(uint8_t cra_reg_m);    // one output period
+
+/*
+ * calibration
+ * Corrected samples are scale * (sample - offset) for the accelerometer and soft * (sample - offset)
+ * for the magnetometer, in m/s^2 and uT, e.g. as estimated by imu_calib.c. Both are folded into the
+ * conversion factors whenever the scale or gain changes, so the conversions cost one multiply-add
+ * per axis, or three for a magnetometer matrix with off-diagonal terms. NULL restores the nominal
+ * conversion. lsm303dlhc_convert_mag_sample stays nominal.
+ */
+void lsm303dlhc_dev_set_acc_calib(lsm303dlhc_t *dev, const float offset[3], const float scale[3]);
+void lsm303dlhc_dev_set_mag_calib(lsm303dlhc_t *dev, const float offset[3], const float soft[3][3]);
+
+/*
+ * temperature
+ * Sets TEMP_EN and reads TEMP_OUT_H_M/L_M after every nth blocking magnetometer sample, one extra
+ * transaction. Both sensors share the die, so the reading serves the tables of both: a sample is
+ * corrected to scale(T) * (sample - bias(T)) in m/s^2 or uT before the calibration above. The
+ * tables are evaluated and folded into the conversion factors only when the reading changes, the
+ * conversions cost the same as without. Asynchronous reads use the last reading.
+ */
+lsm303dlhc_result_t lsm303dlhc_dev_set_temp_rate(lsm303dlhc_t *dev, uint16_t every);    // 0 disables, the next read carries the temperature
+lsm303dlhc_result_t lsm303dlhc_dev_get_temp(const lsm303dlhc_t *dev, float *temp);    // degC, LSM303DLHC_NO_DATA before the first reading
+void lsm303dlhc_dev_set_temp_comp(lsm303dlhc_t *dev, const imu_tempcomp_t *acc, const imu_tempcomp_t *mag);    // kept by reference, NULL disables
+
+/*
+ * batch conversion, e.g. of a drained FIFO
+ * The _soa variants write every axis to its own array of count floats. With ARM_MATH_CM4
+ * defined CMSIS-DSP is used, otherwise the loops are left to the compiler to vectorize.
+ */
+void lsm303dlhc_dev_convert_acc_batch(const lsm303dlhc_t *dev, lsm303dlhc_data_t conv[], const lsm303dlhc_data_raw_t raw[], uint16_t count);
+void lsm303dlhc_dev_convert_acc_soa(const lsm303dlhc_t *dev, float x[], float y[], float z[], const lsm303dlhc_data_raw_t raw[], uint16_t count);
+void lsm303dlhc_dev_convert_mag_batch(const lsm303dlhc_t *dev, lsm303dlhc_data_t conv[], const lsm303dlhc_data_raw_t raw[], uint16_t count);
+void lsm303dlhc_dev_convert_mag_soa(const lsm303dlhc_t *dev, float x[], float y[], float z[], const lsm303dlhc_data_raw_t raw[], uint16_t count);
+
+/* asynchronous reads use DMA, define LSM303DLHC_ASYNC_IT to use interrupt transfers instead */
+lsm303dlhc_result_t lsm303dlhc_dev_read_acc_raw_async(lsm303dlhc_t *dev, lsm303dlhc_callback_t callback);
+lsm303dlhc_result_t lsm303dlhc_dev_read_mag_raw_async(lsm303dlhc_t *dev, lsm303dlhc_callback_t callback);
+void lsm303dlhc_i2c_rx_cplt(I2C_HandleTypeDef *i2c);   // call from HAL_I2C_MemRxCpltCallback
+void lsm303dlhc_i2c_error(I2C_HandleTypeDef *i2c);     // call from HAL_I2C_ErrorCallback
+void lsm303dlhc_dev_set_ring(lsm303dlhc_t *dev, imu_ring_t *acc_ring, imu_ring_t *mag_ring);    // asynchronous samples are pushed as raw counts, NULL to disable
+
+/*
+ * data-ready interrupt driven acquisition
+ * With a callback every interrupt starts exactly one asynchronous read, without one the
+ * blocking read functions return LSM303DLHC_NO_DATA until the next interrupt, without bus traffic.
+ * DRDY stays high until the output is read, so a failed read keeps its interrupt pending: the next
+ * blocking read tries again, a failed asynchronous read is started again when its transfer ends.
+ */
+lsm303dlhc_result_t lsm303dlhc_dev_set_drdy_acc(lsm303dlhc_t *dev, bool enable, lsm303dlhc_callback_t callback);   // routes DRDY1 to INT1
+lsm303dlhc_result_t lsm303dlhc_dev_set_drdy_mag(lsm303dlhc_t *dev, bool enable, lsm303dlhc_callback_t callback);   // DRDY pin is always active
+void lsm303dlhc_dev_on_drdy_acc(lsm303dlhc_t *dev);   // call from the EXTI callback of the INT1 pin
+void lsm303dlhc_dev_on_drdy_mag(lsm303dlhc_t *dev);   // call from the EXTI callback of the DRDY pin
+
+/*
+ * accelerometer interrupt generator 1
+ * cfg is a set of LSM303DLHC_AINT_* bits. The threshold and duration are converted at the current
+ * scale and output data rate, so set them again after changing either; both are limited to
+ * LSM303DLHC_AINT_MAX steps and fail past that or in power-down. Routing (CTRL_REG3_A/CTRL_REG6_A),
+ * latching (CTRL_REG5_A) and the high-pass filter (CTRL_REG2_A) go through lsm303dlhc_dev_update_ctrl.
+ */
+lsm303dlhc_result_t lsm303dlhc_dev_set_acc_int1(lsm303dlhc_t *dev, uint8_t cfg, uint16_t threshold_mg, uint16_t duration_ms);
+lsm303dlhc_result_t lsm303dlhc_dev_read_acc_int1_src(lsm303dlhc_t *dev, uint8_t *src);    // INT1_SRC_A, clears a latched interrupt
+lsm303dlhc_result_t lsm303dlhc_dev_reset_acc_hp(lsm303dlhc_t *dev);    // reads REFERENCE_A, the filter restarts from the current sample
+lsm303dlhc_result_t lsm303dlhc_dev_set_acc_hpf(lsm303dlhc_t *dev, const lsm303dlhc_acc_hpf_config_t *config);
+uint32_t lsm303dlhc_acc_odr_mhz(uint8_t ctrl_reg1_a);    // nominal output data rate, 0 in power-down
+uint32_t lsm303dlhc_mag_odr_mhz(uint8_t cra_reg_m);
+
+/*
+ * click detection
+ * The threshold and the times are converted at the current scale and output data rate like those of
+ * lsm303dlhc_dev_set_acc_int1, rounded up, and fail past their register range or in power-down. The
+ * routed pin signals a click; flag it in the EXTI callback and read the event from the main loop, or
+ * poll at the rate of the expected clicks. Either costs one transaction per event instead of a
+ * stream of samples for a software detector.
+ */
+lsm303dlhc_result_t lsm303dlhc_dev_set_click(lsm303dlhc_t *dev, const lsm303dlhc_click_config_t *config);
+lsm303dlhc_result_t lsm303dlhc_dev_read_click(lsm303dlhc_t *dev, lsm303dlhc_click_event_t *event);    // LSM303DLHC_NO_DATA without a click
+void lsm303dlhc_decode_click(lsm303dlhc_click_event_t *event, uint8_t click_src_a);
+
+/* single sensor API, operates on a default device */
+lsm303dlhc_t *lsm303dlhc_get_default(void);
+lsm303dlhc_result_t lsm303dlhc_set_bus_policy(const imu_bus_policy_t *policy);
+void lsm303dlhc_set_recovery(GPIO_TypeDef *scl_port, uint16_t scl_pin, GPIO_TypeDef *sda_port, uint16_t sda_pin);
+lsm303dlhc_result_t lsm303dlhc_recover(void);
 lsm303dlhc_result_t lsm303dlhc_init_acc(I2C_HandleTypeDef *i2c, const lsm303dlhc_acc_init_t *init);
 lsm303dlhc_result_t lsm303dlhc_set_acc_scale(uint8_t ctrl_reg4_a);
+lsm303dlhc_result_t lsm303dlhc_set_acc_odr(uint8_t odr);
+void lsm303dlhc_set_acc_calib(const float offset[3], const float scale[3]);
+void lsm303dlhc_set_mag_calib(const float offset[3], const float soft[3][3]);
+lsm303dlhc_result_t lsm303dlhc_set_temp_rate(uint16_t every);
+lsm303dlhc_result_t lsm303dlhc_get_temp(float *temp);
+void lsm303dlhc_set_temp_comp(const imu_tempcomp_t *acc, const imu_tempcomp_t *mag);
 lsm303dlhc_result_t lsm303dlhc_read_acc_raw(lsm303dlhc_data_raw_t *data);
 void lsm303dlhc_convert_acc(lsm303dlhc_data_t *conv, const lsm303dlhc_data_raw_t *raw);
-
+lsm303dlhc_result_t lsm303dlhc_set_acc_fifo(lsm303dlhc_acc_fifo_mode_t mode, uint8_t watermark);
+lsm303dlhc_result_t lsm303dlhc_read_acc_fifo(lsm303dlhc_data_raw_t data[], uint8_t max, uint8_t *count);
+void lsm303dlhc_get_acc_fifo_status(lsm303dlhc_fifo_status_t *status);
 lsm303dlhc_result_t lsm303dlhc_init_mag(I2C_HandleTypeDef *i2c, const lsm303dlhc_mag_init_t *init);
 lsm303dlhc_result_t lsm303dlhc_set_mag_gain(lsm303dlhc_mag_gain_t gain);
 lsm303dlhc_result_t lsm303dlhc_set_mag_rate(lsm303dlhc_mag_rate_t rate);
 lsm303dlhc_result_t lsm303dlhc_read_mag_raw(lsm303dlhc_data_raw_t *data);
+lsm303dlhc_result_t lsm303dlhc_read_mag_sample(lsm303dlhc_mag_sample_t *sample);
+lsm303dlhc_result_t lsm303dlhc_mag_trigger(void);
+lsm303dlhc_result_t lsm303dlhc_mag_collect(lsm303dlhc_mag_sample_t *sample);
+uint32_t lsm303dlhc_mag_remaining_ms(void);
 void lsm303dlhc_convert_mag(lsm303dlhc_data_t *conv, const lsm303dlhc_data_raw_t *raw);
+void lsm303dlhc_convert_acc_batch(lsm303dlhc_data_t conv[], const lsm303dlhc_data_raw_t raw[], uint16_t count);
+void lsm303dlhc_convert_mag_batch(lsm303dlhc_data_t conv[], const lsm303dlhc_data_raw_t raw[], uint16_t count);
+lsm303dlhc_result_t lsm303dlhc_read_acc_raw_async(lsm303dlhc_callback_t callback);
+lsm303dlhc_result_t lsm303dlhc_read_mag_raw_async(lsm303dlhc_callback_t callback);
+lsm303dlhc_result_t lsm303dlhc_set_drdy_acc(bool enable, lsm303dlhc_callback_t callback);
+lsm303dlhc_result_t lsm303dlhc_set_drdy_mag(bool enable, lsm303dlhc_callback_t callback);
+void lsm303dlhc_on_drdy_acc(void);
+void lsm303dlhc_on_drdy_mag(void);
+lsm303dlhc_result_t lsm303dlhc_set_acc_int1(uint8_t cfg, uint16_t threshold_mg, uint16_t duration_ms);
+lsm303dlhc_result_t lsm303dlhc_read_acc_int1_src(uint8_t *src);
+lsm303dlhc_result_t lsm303dlhc_reset_acc_hp(void);
+lsm303dlhc_result_t lsm303dlhc_set_acc_hpf(const lsm303dlhc_acc_hpf_config_t *config);
+lsm303dlhc_result_t lsm303dlhc_set_click(const lsm303dlhc_click_config_t *config);
+lsm303dlhc_result_t lsm303dlhc_read_click(lsm303dlhc_click_event_t *event);
 
 /* C++ detection */
 #ifdef __cplusplus
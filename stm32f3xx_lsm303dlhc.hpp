@@ -0,0 +1,88 @@
+#ifndef __LSM303DLHC_HPP__
+#define __LSM303DLHC_HPP__
+
+#include <cstdint>
+
+#include "stm32f3xx_lsm303dlhc.h"
+
+/*
+ * C++17 front-end of the accelerometer
+ * The configuration is a type, its control registers and the nominal conversion factor are
+ * computed and checked at compile time. Every member is static and calls the C driver on a device
+ * of its own, there is no object and no virtual call. Bus is a type with a static handle(), e.g.
+ *
+ *   struct I2c1 { static I2C_HandleTypeDef *handle() { return &hi2c1; } };
+ *   using Acc = Lsm303dlhcAcc<I2c1, Lsm303dlhcAccConfig<LSM303DLHC_ACR1A_ODR30_100_HZ, LSM303DLHC_ACR4A_FS10_2MG>>;
+ *
+ * The magnetometer of the same package is set up on Acc::device() with the C API.
+ */
+
+enum class Lsm303dlhcAccMode {
+    Normal,             // 10 bits
+    HighResolution,     // 12 bits, CTRL_REG4_A HR
+    LowPower            // 8 bits, CTRL_REG1_A LPEN
+};
+
+/* any type with these members works as a configuration, CtrlReg3 routes interrupts to INT1 */
+template <uint8_t Odr, uint8_t Scale, Lsm303dlhcAccMode Mode = Lsm303dlhcAccMode::HighResolution, bool BlockUpdate = true,
+          lsm303dlhc_acc_fifo_mode_t FifoMode = LSM303DLHC_ACCFIFO_BYPASS, uint8_t Watermark = 0, uint8_t CtrlReg3 = 0>
+struct Lsm303dlhcAccConfig {
+    static constexpr uint8_t odr = Odr;                         // LSM303DLHC_ACR1A_ODR30_*
+    static constexpr uint8_t scale = Scale;                     // LSM303DLHC_ACR4A_FS10_*
+    static constexpr Lsm303dlhcAccMode mode = Mode;
+    static constexpr bool block_update = BlockUpdate;
+    static constexpr lsm303dlhc_acc_fifo_mode_t fifo_mode = FifoMode;
+    static constexpr uint8_t fifo_watermark = Watermark;
+    static constexpr uint8_t ctrl_reg3_a = CtrlReg3;
+};
+
+template <typename Bus, typename Config>
+class Lsm303dlhcAcc {
+    static_assert((Config::odr & ~LSM303DLHC_ACR1A_ODR30) == 0 && Config::odr <= LSM303DLHC_ACR1A_ODR30_5376_HZ, "invalid output data rate");
+    static_assert(Config::odr != LSM303DLHC_ACR1A_ODR30_POWER_DOWN, "power-down, nothing to read");
+    static_assert(Config::odr != LSM303DLHC_ACR1A_ODR30_1620_HZ || Config::mode == Lsm303dlhcAccMode::LowPower, "1.62 kHz exists in low-power mode only");
+    static_assert((Config::scale & ~0b110000) == 0, "scale takes only LSM303DLHC_ACR4A_FS10_* bits");
+    static_assert(Config::fifo_watermark <= LSM303DLHC_ACCFIFO_CTRL_FTH, "FIFO watermark is 0 .. 31");
+    static_assert(Config::fifo_mode != LSM303DLHC_ACCFIFO_BYPASS || (Config::ctrl_reg3_a & (LSM303DLHC_ACR3A_I1_WTM | LSM303DLHC_ACR3A_I1_OVERRUN)) == 0,
+                  "FIFO interrupts need a FIFO mode");
+
+public:
+    static constexpr uint8_t ctrl_reg1_a = Config::odr | LSM303DLHC_ACR1A_XEN | LSM303DLHC_ACR1A_YEN | LSM303DLHC_ACR1A_ZEN |
+                                           (Config::mode == Lsm303dlhcAccMode::LowPower ? LSM303DLHC_ACR1A_LPEN : 0);
+    static constexpr uint8_t ctrl_reg4_a = Config::scale | (Config::block_update ? LSM303DLHC_ACR4A_BLU : 0) |
+                                           (Config::mode == Lsm303dlhcAccMode::HighResolution ? LSM303DLHC_ACR4A_HR : 0);
+
+    /* m/s^2 per lsb of the 12-bit samples, as lsm303dlhc_update_scale takes it */
+    static constexpr float ms2_lsb = (Config::scale == LSM303DLHC_ACR4A_FS10_1MG ? 0.001f :
+                                      Config::scale == LSM303DLHC_ACR4A_FS10_2MG ? 0.002f :
+                                      Config::scale == LSM303DLHC_ACR4A_FS10_4MG ? 0.004f : 0.012f) * LSM303DLHC_ACC_SENSORS_GRAVITY_STANDARD;
+
+    static lsm303dlhc_result_t init() {
+        static constexpr lsm303dlhc_acc_init_t acc_init = {
+            ctrl_reg1_a, 0, Config::ctrl_reg3_a, ctrl_reg4_a, 0, 0, Config::fifo_mode, Config::fifo_watermark
+        };
+
+        return lsm303dlhc_dev_init_acc(&dev, Bus::handle(), &acc_init);
+    }
+
+    static lsm303dlhc_result_t read_raw(lsm303dlhc_data_raw_t &data) { return lsm303dlhc_dev_read_acc_raw(&dev, &data); }
+    static lsm303dlhc_result_t read_fifo(lsm303dlhc_data_raw_t data[], uint8_t max, uint8_t *count) {
+        return lsm303dlhc_dev_read_acc_fifo(&dev, data, max, count);
+    }
+
+    /* nominal conversion, inlined with the factor as an immediate */
+    static constexpr lsm303dlhc_data_t to_ms2(const lsm303dlhc_data_raw_t &raw) {
+        return { (float) raw.x * ms2_lsb, (float) raw.y * ms2_lsb, (float) raw.z * ms2_lsb };
+    }
+
+    /* calibrated conversion of the driver */
+    static void convert(lsm303dlhc_data_t &conv, const lsm303dlhc_data_raw_t &raw) { lsm303dlhc_dev_convert_acc(&dev, &conv, &raw); }
+
+    /* for the rest of the C API, a scale changed there is not seen by the nominal conversion */
+    static lsm303dlhc_t *device() { return &dev; }
+
+private:
+    static inline lsm303dlhc_t dev {};
+};
+
+#endif
@@ -0,0 +1,104 @@
+/*
+ * imu_log2csv - converts an imu_log stream to CSV
+ *
+ * build: cc -O2 -I.. -o imu_log2csv imu_log2csv.c ../imu_log.c
+ * usage: imu_log2csv [capture.bin] > samples.csv
+ *
+ * Reads the file, or stdin, writes one line per sample and a summary with the compression ratio
+ * and, if the stream carries a stats frame, the encode cost per sample to stderr.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "imu_log.h"
+
+#define IMU_LOG2CSV_CHUNK    4096
+#define IMU_LOG2CSV_RECORD   16        // bytes of an imu_ring_record_t
+#define IMU_LOG2CSV_FIXED    10        // bytes of three int16_t and a 32 bit timestamp
+
+typedef struct {
+    FILE *out;
+    uint64_t samples[IMU_LOG_STREAMS];
+    uint64_t time;              // ticks, unwrapped
+    uint32_t last;
+    int started;
+} imu_log2csv_t;
+
+static const char *const imu_log2csv_names[IMU_LOG_STREAMS] = { "gyro", "acc", "mag" };
+
+static void imu_log2csv_sample(void *ctx, const imu_log_sample_t *sample) {
+    imu_log2csv_t *csv = ctx;
+    const imu_log_header_t *h = sample->header;
+    double s = h->scale;
+
+    /* the counter wraps within a minute on target, streams interleave closely enough to unwrap */
+    if (!csv->started) {
+        csv->time = sample->timestamp;
+        csv->started = 1;
+    } else {
+        csv->time += (int64_t) (int32_t) (sample->timestamp - csv->last);
+    }
+
+    csv->last = sample->timestamp;
+    csv->samples[sample->sensor]++;
+
+    fprintf(csv->out, "%s,%u,%.6f,%d,%d,%d,%g,%g,%g\n", imu_log2csv_names[sample->sensor], (unsigned) sample->sequence,
+            (double) csv->time / (h->ticks_per_us * 1e6), sample->x, sample->y, sample->z, sample->x * s, sample->y * s, sample->z * s);
+}
+
+int main(int argc, char **argv) {
+    static imu_log_decoder_t dec;
+    imu_log2csv_t csv = { 0 };
+    uint8_t buf[IMU_LOG2CSV_CHUNK];
+    uint64_t bytes = 0, total = 0;
+    FILE *in = stdin;
+    size_t n;
+    int i;
+
+    if (argc > 2) {
+        fprintf(stderr, "usage: %s [capture.bin]\n", argv[0]);
+        return 2;
+    }
+
+    if (argc == 2 && (in = fopen(argv[1], "rb")) == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    csv.out = stdout;
+    imu_log_decoder_init(&dec);
+    fprintf(csv.out, "sensor,sequence,time_s,x,y,z,x_scaled,y_scaled,z_scaled\n");
+
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        imu_log_decode(&dec, buf, (uint32_t) n, imu_log2csv_sample, &csv);
+        bytes += n;
+    }
+
+    if (in != stdin) {
+        fclose(in);
+    }
+
+    for (i = 0; i < IMU_LOG_STREAMS; i++) {
+        total += csv.samples[i];
+    }
+
+    fprintf(stderr, "samples: %llu (gyro %llu, acc %llu, mag %llu)\n", (unsigned long long) total,
+            (unsigned long long) csv.samples[0], (unsigned long long) csv.samples[1], (unsigned long long) csv.samples[2]);
+    fprintf(stderr, "frames: %u, crc errors: %u, skipped bytes: %u, frames waiting for a keyframe: %u\n",
+            (unsigned) dec.frames, (unsigned) dec.crc_errors, (unsigned) dec.skipped, (unsigned) dec.unsynced);
+
+    if (total > 0) {
+        fprintf(stderr, "size: %llu bytes, %.2f bytes per sample, ratio %.2f against ring records, %.2f against fixed binary\n",
+                (unsigned long long) bytes, (double) bytes / total, (double) total * IMU_LOG2CSV_RECORD / bytes,
+                (double) total * IMU_LOG2CSV_FIXED / bytes);
+    }
+
+    if (dec.stats_valid && dec.stats.samples > 0 && dec.stats.ticks_per_us > 0) {
+        fprintf(stderr, "encode: %.1f ticks (%.3f us) per sample over %u samples, %u frames lost\n",
+                (double) dec.stats.cycles / dec.stats.samples, (double) dec.stats.cycles / dec.stats.samples / dec.stats.ticks_per_us,
+                (unsigned) dec.stats.samples, (unsigned) dec.stats.lost);
+    }
+
+    return 0;
+}
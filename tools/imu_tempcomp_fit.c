@@ -0,0 +1,112 @@
+/*
+ * imu_tempcomp_fit - fits an imu_tempcomp_t table to a thermal sweep log
+ *
+ * build: cc -O2 -I.. -o imu_tempcomp_fit imu_tempcomp_fit.c ../imu_tempcomp.c
+ * usage: imu_tempcomp_fit t0 step count [sweep.csv] > table.c
+ *
+ * Reads lines of temp,mx,my,mz,rx,ry,rz: the die temperature in degC, the sample in the nominal
+ * unit of the sensor and the expected value, e.g. 0,0,0 for a gyroscope at rest. Lines that do not
+ * parse, like a header, are skipped. Writes the table as a C initializer and the residual of the
+ * samples before and after compensation to stderr.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "imu_tempcomp.h"
+
+#define IMU_TEMPCOMP_FIT_LINE    256
+
+typedef struct {
+    float temp;
+    float m[3];
+    float r[3];
+} imu_tempcomp_fit_sample_t;
+
+static int imu_tempcomp_fit_parse(const char *line, imu_tempcomp_fit_sample_t *s) {
+    return sscanf(line, "%f,%f,%f,%f,%f,%f,%f", &s->temp, &s->m[0], &s->m[1], &s->m[2], &s->r[0], &s->r[1], &s->r[2]) == 7;
+}
+
+int main(int argc, char **argv) {
+    static imu_tempcomp_builder_t builder;
+    imu_tempcomp_fit_sample_t s;
+    imu_tempcomp_t table;
+    char line[IMU_TEMPCOMP_FIT_LINE];
+    double before = 0.0, after = 0.0;
+    float bias[3], scale[3], e;
+    FILE *in = stdin;
+    uint32_t n = 0;
+    int i, j;
+
+    if (argc < 4 || argc > 5) {
+        fprintf(stderr, "usage: %s t0 step count [sweep.csv]\n", argv[0]);
+        return 2;
+    }
+
+    if (imu_tempcomp_builder_init(&builder, strtof(argv[1], NULL), strtof(argv[2], NULL), (uint8_t) atoi(argv[3])) != IMU_TEMPCOMP_OK) {
+        fprintf(stderr, "count must be 2 .. %d and step positive\n", IMU_TEMPCOMP_POINTS);
+        return 2;
+    }
+
+    if (argc == 5 && (in = fopen(argv[4], "r")) == NULL) {
+        perror(argv[4]);
+        return 1;
+    }
+
+    while (fgets(line, sizeof(line), in) != NULL) {
+        if (imu_tempcomp_fit_parse(line, &s)) {
+            imu_tempcomp_builder_add(&builder, s.temp, s.m, s.r);
+        }
+    }
+
+    if (imu_tempcomp_builder_finish(&builder, &table) != IMU_TEMPCOMP_OK) {
+        fprintf(stderr, "no samples, or a scale came out negative\n");
+        return 1;
+    }
+
+    /* second pass for the residuals, only possible on a file */
+    if (in != stdin) {
+        rewind(in);
+
+        while (fgets(line, sizeof(line), in) != NULL) {
+            if (!imu_tempcomp_fit_parse(line, &s)) {
+                continue;
+            }
+
+            imu_tempcomp_eval(&table, s.temp, bias, scale);
+
+            for (j = 0; j < 3; j++) {
+                e = s.m[j] - s.r[j];
+                before += (double) e * e;
+                e = scale[j] * (s.m[j] - bias[j]) - s.r[j];
+                after += (double) e * e;
+            }
+
+            n++;
+        }
+
+        fclose(in);
+    }
+
+    printf("const imu_tempcomp_t table = {\n    .t0 = %gf,\n    .step = %gf,\n    .count = %u,\n", table.t0, table.step, table.count);
+
+    printf("    .bias = {\n");
+    for (i = 0; i < table.count; i++) {
+        printf("        { %.6ff, %.6ff, %.6ff },\n", table.bias[i][0], table.bias[i][1], table.bias[i][2]);
+    }
+
+    printf("    },\n    .scale = {\n");
+    for (i = 0; i < table.count; i++) {
+        printf("        { %.6ff, %.6ff, %.6ff },\n", table.scale[i][0], table.scale[i][1], table.scale[i][2]);
+    }
+
+    printf("    },\n};\n");
+
+    fprintf(stderr, "samples: %u\n", (unsigned) builder.samples);
+    if (n > 0) {
+        fprintf(stderr, "rms error per axis: %g before, %g after\n", sqrt(before / (3.0 * n)), sqrt(after / (3.0 * n)));
+    }
+
+    return 0;
+}